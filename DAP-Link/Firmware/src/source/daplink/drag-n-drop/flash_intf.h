@@ -46,6 +46,9 @@ typedef uint32_t (*flash_program_page_min_size_cb_t)(uint32_t addr);
 typedef uint32_t (*flash_erase_sector_size_cb_t)(uint32_t addr);
 typedef uint8_t (*flash_busy_cb_t)(void);
 typedef error_t (*flash_algo_set_cb_t)(uint32_t addr);
+typedef error_t (*flash_verify_crc_cb_t)(uint32_t addr, uint32_t size, uint32_t crc);
+typedef uint32_t (*flash_keep_size_cb_t)(void);
+typedef error_t (*flash_erase_sector_keep_cb_t)(uint32_t sector, uint32_t keep_addr, uint32_t keep_size);
 
 typedef struct {
     flash_intf_init_cb_t init;
@@ -57,6 +60,9 @@ typedef struct {
     flash_erase_sector_size_cb_t erase_sector_size;
     flash_busy_cb_t flash_busy;
     flash_algo_set_cb_t flash_algo_set;
+    flash_verify_crc_cb_t verify_crc;   // ERROR_SUCCESS if the CRC-32 of the flash at addr is crc, optional
+    flash_keep_size_cb_t keep_size;     // Most bytes erase_sector_keep can keep with the current algo, optional
+    flash_erase_sector_keep_cb_t erase_sector_keep; // erase_sector, then what keep_addr held programmed back, optional
 } flash_intf_t;
 
 // All flash interfaces.  Unsupported interfaces are NULL.
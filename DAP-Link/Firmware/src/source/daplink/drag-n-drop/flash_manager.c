@@ -25,6 +25,7 @@
 #include "util.h"
 #include "error.h"
 #include "settings.h"
+#include "crc.h"
 
 // Set to 1 to enable debugging
 #define DEBUG_FLASH_MANAGER     0
@@ -49,6 +50,10 @@ static uint8_t buf[1024];
 static bool buf_empty;
 static bool current_sector_valid;
 static bool page_erase_enabled = false;
+static bool smart_update_enabled;
+static bool sector_erase_pending;
+static uint32_t keep_addr;
+static uint32_t keep_end;
 static uint32_t current_write_block_addr;
 static uint32_t current_write_block_size;
 static uint32_t current_sector_addr;
@@ -88,6 +93,11 @@ error_t flash_manager_init(const flash_intf_t *flash_intf)
     current_sector_size = 0;
     last_addr = 0;
     intf = flash_intf;
+    // Sectors are compared with the image and erased one by one, if the interface can take CRCs
+    smart_update_enabled = config_ram_get_smart_update() && (0 != intf->verify_crc);
+    sector_erase_pending = false;
+    keep_addr = 0;
+    keep_end = 0;
     // Initialize flash
     status = intf->init();
     flash_manager_printf("    intf->init ret=%i\r\n", status);
@@ -96,7 +106,7 @@ error_t flash_manager_init(const flash_intf_t *flash_intf)
         return status;
     }
 
-    if (!page_erase_enabled) {
+    if (!page_erase_enabled && !smart_update_enabled) {
         // Erase flash and unint if there are errors
         status = intf->erase_chip();
         flash_manager_printf("    intf->erase_chip ret=%i\r\n", status);
@@ -222,6 +232,9 @@ error_t flash_manager_uninit(void)
     current_sector_addr = 0;
     current_sector_size = 0;
     last_addr = 0;
+    sector_erase_pending = false;
+    keep_addr = 0;
+    keep_end = 0;
     state = STATE_CLOSED;
 
     // Make sure an error from a page write or from an
@@ -284,11 +297,39 @@ static bool flash_intf_valid(const flash_intf_t *flash_intf)
 static error_t flush_current_block(uint32_t addr){
     // Write out current buffer if there is data in it
     error_t status = ERROR_SUCCESS;
-    if (!buf_empty) {
+    if (!buf_empty && sector_erase_pending) {
+        // Leave the block alone if the target holds it already
+        if (ERROR_SUCCESS == intf->verify_crc(current_write_block_addr, current_write_block_size,
+                                              crc32(buf, current_write_block_size))) {
+            flash_manager_printf("    unchanged block(addr=0x%x) skipped\r\n", current_write_block_addr);
+            if (keep_end == keep_addr || current_write_block_addr < keep_addr) {
+                keep_addr = current_write_block_addr;
+            }
+            keep_end = MAX(keep_end, current_write_block_addr + current_write_block_size);
+            buf_empty = true;
+        } else {
+            // The first changed one erases the sector, the unchanged blocks before it are programmed back.
+            // Blocks come in address order: one out of it loses what follows it, as with page erase.
+            sector_erase_pending = false;
+            if (current_write_block_addr >= keep_addr && current_write_block_addr < keep_end) {
+                keep_end = current_write_block_addr;
+            }
+            if (keep_end != keep_addr) {
+                status = intf->erase_sector_keep(current_sector_addr, keep_addr, keep_end - keep_addr);
+                flash_manager_printf("    intf->erase_sector_keep(addr=0x%x, keep=0x%x, size=0x%x) ret=%i\r\n",
+                                     current_sector_addr, keep_addr, keep_end - keep_addr, status);
+            } else {
+                status = intf->erase_sector(current_sector_addr);
+                flash_manager_printf("    intf->erase_sector(addr=0x%x) ret=%i\r\n", current_sector_addr, status);
+            }
+        }
+    }
+
+    if (!buf_empty && ERROR_SUCCESS == status) {
         status = intf->program_page(current_write_block_addr, buf, current_write_block_size);
         flash_manager_printf("    intf->program_page(addr=0x%x, size=0x%x) ret=%i\r\n", current_write_block_addr, current_write_block_size, status);
-        buf_empty = true;
     }
+    buf_empty = true;
 
     // Setup for next block
     memset(buf, 0xFF, current_write_block_size);
@@ -330,7 +371,17 @@ static error_t setup_next_sector(uint32_t addr)
         }
     }
 
-    if (page_erase_enabled) {
+    // With smart update the sector is compared block by block as the data comes in and only erased
+    // at the first change, see flush_current_block(). The blocks before it must fit what the
+    // interface can keep through the erase, else the sector is erased here as with page erase.
+    sector_erase_pending = smart_update_enabled &&
+                           (current_write_block_size == sector_size ||
+                            (intf->keep_size && intf->erase_sector_keep &&
+                             intf->keep_size() >= sector_size - current_write_block_size));
+    keep_addr = 0;
+    keep_end = 0;
+
+    if ((page_erase_enabled || smart_update_enabled) && !sector_erase_pending) {
         // Erase the current sector
         status = intf->erase_sector(current_sector_addr);
         flash_manager_printf("    intf->erase_sector(addr=0x%x) ret=%i\r\n", current_sector_addr);
@@ -68,6 +68,8 @@ typedef enum _magic_file {
     kMSDOffConfigFile,          //!< Disable USB MSC.
     kPageEraseActionFile,       //!< Enable page programming and sector erase for drag and drop.
     kChipEraseActionFile,       //!< Enable page programming and chip erase for drag and drop.
+    kSmartUpdateOnActionFile,   //!< Skip sectors that already hold the image data for drag and drop.
+    kSmartUpdateOffActionFile,  //!< Erase and program every sector for drag and drop.
 } magic_file_t;
 
 //! @brief Mapping from filename string to magic file enum.
@@ -112,6 +114,8 @@ static const magic_file_info_t s_magic_file_info[] = {
         { "MSD_OFF CFG", kMSDOffConfigFile          },
         { "PAGE_ON ACT", kPageEraseActionFile       },
         { "PAGE_OFFACT", kChipEraseActionFile       },
+        { "SKIP_ON ACT", kSmartUpdateOnActionFile   },
+        { "SKIP_OFFACT", kSmartUpdateOffActionFile  },
     };
 
 static uint8_t file_buffer[VFS_SECTOR_SIZE];
@@ -274,6 +278,12 @@ void vfs_user_file_change_handler(const vfs_filename_t filename, vfs_file_change
                     case kChipEraseActionFile:
                         config_ram_set_page_erase(false);
                         break;
+                    case kSmartUpdateOnActionFile:
+                        config_ram_set_smart_update(true);
+                        break;
+                    case kSmartUpdateOffActionFile:
+                        config_ram_set_smart_update(false);
+                        break;
                     default:
                         util_assert(false);
                 }
@@ -495,6 +505,9 @@ static uint32_t update_details_txt_file(uint8_t *data, uint32_t datasize)
     pos += util_write_string(buf + pos, "Page erasing: ");
     pos += util_write_string(buf + pos, config_ram_get_page_erase() ? "1" : "0");
     pos += util_write_string(buf + pos, "\r\n");
+    pos += util_write_string(buf + pos, "Smart update: ");
+    pos += util_write_string(buf + pos, config_ram_get_smart_update() ? "1" : "0");
+    pos += util_write_string(buf + pos, "\r\n");
     // Current mode
     mode_str = daplink_is_bootloader() ? "Bootloader" : "Interface";
     pos += util_write_string(buf + pos, "Daplink Mode: ");
@@ -33,6 +33,7 @@
 #include "settings.h"
 #include "target_family.h"
 #include "target_board.h"
+#include "crc.h"
 
 #define DEFAULT_PROGRAM_PAGE_MIN_SIZE   (256u)
 
@@ -51,6 +52,9 @@ static uint32_t target_flash_program_page_min_size(uint32_t addr);
 static uint32_t target_flash_erase_sector_size(uint32_t addr);
 static uint8_t target_flash_busy(void);
 static error_t target_flash_set(uint32_t addr);
+static error_t target_flash_verify_crc(uint32_t addr, uint32_t size, uint32_t crc);
+static uint32_t target_flash_keep_size(void);
+static error_t target_flash_erase_sector_keep(uint32_t sector, uint32_t keep_addr, uint32_t keep_size);
 
 static const flash_intf_t flash_intf = {
     target_flash_init,
@@ -62,6 +66,9 @@ static const flash_intf_t flash_intf = {
     target_flash_erase_sector_size,
     target_flash_busy,
     target_flash_set,
+    target_flash_verify_crc,
+    target_flash_keep_size,
+    target_flash_erase_sector_keep,
 };
 
 static state_t state = STATE_CLOSED;
@@ -79,6 +86,47 @@ static region_info_t * default_region = NULL;
 //saved flash start from flash algo
 static uint32_t flash_start = 0;
 
+//program page call left running on the target by the pipelined path
+static uint8_t program_busy = 0;
+
+//the next page goes to program_buffer_alt
+static uint8_t program_alt = 0;
+
+// Thumb code for any Cortex-M, run by target_flash_verify_crc().
+// Returns the CRC-32 of R1 bytes at R0 xored with R2: 0 if R2 is their CRC.
+static const uint32_t crc32_blob[] = {
+    0x2300B430, 0x4C0943DB, 0xD00A2900, 0x30017805,
+    0x2508406B, 0xD300085B, 0x3D014063, 0x3901D1FA,
+    0x43D8D1F4, 0xBC304050, 0x46C04770, 0xEDB88320,
+};
+
+//where crc32_blob was loaded for the current algo, 0 if it was not.
+//Past the algo in target RAM, or in program_buffer until a page is written over it.
+static uint32_t crc32_addr = 0;
+
+// Target RAM past the algo, its buffers and its stack, which nothing else uses.
+// crc32_blob goes there, then what target_flash_erase_sector_keep() keeps.
+static uint32_t target_ram_free(program_target_t * flash, uint32_t *free_start)
+{
+    region_info_t * ram_region = g_board_info.target_cfg->ram_regions;
+    uint32_t start = MAX(flash->sys_call_s.stack_pointer, flash->algo_start + flash->algo_size);
+
+    start = MAX(start, flash->program_buffer + flash->program_buffer_size);
+    if (flash->program_buffer_alt != 0) {
+        start = MAX(start, flash->program_buffer_alt + flash->program_buffer_size);
+    }
+    start = ROUND_UP(start, 4);
+    *free_start = start;
+
+    for (; ram_region->start != 0 || ram_region->end != 0; ++ram_region) {
+        if (start >= ram_region->start && start <= ram_region->end) {
+            return ram_region->end - start;
+        }
+    }
+
+    return 0;
+}
+
 static program_target_t * get_flash_algo(uint32_t addr)
 {
     region_info_t * flash_region = g_board_info.target_cfg->flash_regions;
@@ -103,12 +151,33 @@ static program_target_t * get_flash_algo(uint32_t addr)
     }
 }
 
+// Wait for the program page call left running, if any, and check its result
+static error_t program_wait(void)
+{
+    if (!program_busy) {
+        return ERROR_SUCCESS;
+    }
+
+    program_busy = 0;
+    if (!swd_flash_syscall_result(0, 0, FLASHALGO_RETURN_BOOL)) {
+        return ERROR_WRITE;
+    }
+
+    return ERROR_SUCCESS;
+}
+
 static error_t flash_func_start(flash_func_t func)
 {
     program_target_t * flash = current_flash_algo;
 
     if (last_flash_func != func)
     {
+        // Finish the page still programming before the algo is called for anything else.
+        error_t status = program_wait();
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
         // Finish the currently active function.
         if (FLASH_FUNC_NOP != last_flash_func &&
             ((flash->algo_flags & kAlgoSingleInitType) == 0 || FLASH_FUNC_NOP == func ) &&
@@ -147,6 +216,7 @@ static error_t target_flash_set(uint32_t addr)
         }
 
         current_flash_algo = new_flash_algo;
+        crc32_addr = 0;
 
     }
     return ERROR_SUCCESS;
@@ -159,6 +229,10 @@ static error_t target_flash_init()
 
         current_flash_algo = NULL;
 
+        program_busy = 0;
+        program_alt = 0;
+        crc32_addr = 0;
+
         if (0 == target_set_state(RESET_PROGRAM)) {
             return ERROR_RESET;
         }
@@ -183,6 +257,8 @@ static error_t target_flash_init()
 static error_t target_flash_uninit(void)
 {
     if (g_board_info.target_cfg) {
+        // The last page may still be programming, its error is reported once the target is closed
+        error_t program_status = program_wait();
         error_t status = flash_func_start(FLASH_FUNC_NOP);
         if (status != ERROR_SUCCESS) {
             return status;
@@ -200,12 +276,51 @@ static error_t target_flash_uninit(void)
 
         state = STATE_CLOSED;
         swd_off();
-        return ERROR_SUCCESS;
+        return program_status;
     } else {
         return ERROR_FAILURE;
     }
 }
 
+// Program with two buffers on the target: each page is written to one while the
+// page before it programs from the other. The last page is left running, see program_wait().
+static error_t program_page_pipelined(program_target_t * flash, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+    while (size > 0) {
+        uint32_t write_size = MIN(size, flash->program_buffer_size);
+        uint32_t buffer = program_alt ? flash->program_buffer_alt : flash->program_buffer;
+        error_t status;
+
+        // Write page to the free buffer
+        if (!swd_write_memory(buffer, (uint8_t *)buf, write_size)) {
+            return ERROR_ALGO_DATA_SEQ;
+        }
+
+        status = program_wait();
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
+        // Start flash programming and go on with the next page
+        if (!swd_flash_syscall_start(&flash->sys_call_s,
+                                     flash->program_page,
+                                     addr,
+                                     write_size,
+                                     buffer,
+                                     0)) {
+            return ERROR_WRITE;
+        }
+        program_busy = 1;
+        program_alt = !program_alt;
+
+        addr += write_size;
+        buf += write_size;
+        size -= write_size;
+    }
+
+    return ERROR_SUCCESS;
+}
+
 static error_t target_flash_program_page(uint32_t addr, const uint8_t *buf, uint32_t size)
 {
     if (g_board_info.target_cfg) {
@@ -229,6 +344,15 @@ static error_t target_flash_program_page(uint32_t addr, const uint8_t *buf, uint
             return status;
         }
 
+        if (crc32_addr == flash->program_buffer) {
+            crc32_addr = 0;
+        }
+
+        // Verifying in automation mode needs each page done before the next one
+        if (flash->program_buffer_alt != 0 && !config_get_automation_allowed()) {
+            return program_page_pipelined(flash, addr, buf, size);
+        }
+
         while (size > 0) {
             uint32_t write_size = MIN(size, flash->program_buffer_size);
 
@@ -271,21 +395,11 @@ static error_t target_flash_program_page(uint32_t addr, const uint8_t *buf, uint
                         return ERROR_WRITE_VERIFY;
                     }
                 } else {
-                    while (write_size > 0) {
-                        uint8_t rb_buf[16];
-                        uint32_t verify_size = MIN(write_size, sizeof(rb_buf));
-                        if (!swd_read_memory(addr, rb_buf, verify_size)) {
-                            return ERROR_ALGO_DATA_SEQ;
-                        }
-                        if (memcmp(buf, rb_buf, verify_size) != 0) {
-                            return ERROR_WRITE_VERIFY;
-                        }
-                        addr += verify_size;
-                        buf += verify_size;
-                        size -= verify_size;
-                        write_size -= verify_size;
+                    // Have the target take a CRC of the page rather than read it back
+                    status = target_flash_verify_crc(addr, write_size, crc32(buf, write_size));
+                    if (status != ERROR_SUCCESS) {
+                        return status;
                     }
-                    continue;
                 }
             }
             addr += write_size;
@@ -301,6 +415,123 @@ static error_t target_flash_program_page(uint32_t addr, const uint8_t *buf, uint
     }
 }
 
+static error_t target_flash_verify_crc(uint32_t addr, uint32_t size, uint32_t crc)
+{
+    if (g_board_info.target_cfg) {
+        error_t status = ERROR_SUCCESS;
+        program_target_t * flash = current_flash_algo;
+
+        if (!flash) {
+            return ERROR_INTERNAL;
+        }
+
+        // The CRC code goes over the data of a page still programming
+        status = program_wait();
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
+        // Loaded once per algo, unless it has to share program_buffer with the pages
+        if (0 == crc32_addr) {
+            uint32_t load_addr;
+
+            if (target_ram_free(flash, &load_addr) < sizeof(crc32_blob)) {
+                if (flash->program_buffer_size < sizeof(crc32_blob)) {
+                    return ERROR_INTERNAL;
+                }
+                load_addr = flash->program_buffer;
+            }
+
+            if (!swd_write_memory(load_addr, (uint8_t *)crc32_blob, sizeof(crc32_blob))) {
+                return ERROR_ALGO_DATA_SEQ;
+            }
+            crc32_addr = load_addr;
+        }
+
+        // Returns through the algo's breakpoint like an algo function
+        if (!swd_flash_syscall_exec(&flash->sys_call_s, crc32_addr + 1, addr, size, crc, 0, FLASHALGO_RETURN_BOOL)) {
+            return ERROR_WRITE_VERIFY;
+        }
+
+        return ERROR_SUCCESS;
+    } else {
+        return ERROR_FAILURE;
+    }
+}
+
+static uint32_t target_flash_keep_size(void)
+{
+    if (g_board_info.target_cfg && current_flash_algo) {
+        uint32_t free_start;
+        uint32_t ram_free = target_ram_free(current_flash_algo, &free_start);
+
+        return ram_free > sizeof(crc32_blob) ? ram_free - sizeof(crc32_blob) : 0;
+    } else {
+        return 0;
+    }
+}
+
+// Copies what keep_addr holds into target RAM past crc32_blob, erases the sector and programs the copy back
+static error_t target_flash_erase_sector_keep(uint32_t sector, uint32_t keep_addr, uint32_t keep_size)
+{
+    if (g_board_info.target_cfg) {
+        error_t status = ERROR_SUCCESS;
+        program_target_t * flash = current_flash_algo;
+        uint8_t chunk[64];
+        uint32_t keep_ram;
+        uint32_t offset;
+        uint32_t size;
+
+        if (!flash || keep_size > target_flash_keep_size()) {
+            return ERROR_INTERNAL;
+        }
+        target_ram_free(flash, &keep_ram);
+        keep_ram += sizeof(crc32_blob);
+
+        // The page still programming may be part of what is kept
+        status = program_wait();
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
+        for (offset = 0; offset < keep_size; offset += size) {
+            size = MIN(keep_size - offset, sizeof(chunk));
+            if (!swd_read_memory(keep_addr + offset, chunk, size) ||
+                !swd_write_memory(keep_ram + offset, chunk, size)) {
+                return ERROR_ALGO_DATA_SEQ;
+            }
+        }
+
+        status = target_flash_erase_sector(sector);
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
+        status = flash_func_start(FLASH_FUNC_PROGRAM);
+        if (status != ERROR_SUCCESS) {
+            return status;
+        }
+
+        // Straight from the copy, the algo takes its data from any target RAM
+        for (offset = 0; offset < keep_size; offset += size) {
+            size = MIN(keep_size - offset, flash->program_buffer_size);
+            if (!swd_flash_syscall_exec(&flash->sys_call_s,
+                                        flash->program_page,
+                                        keep_addr + offset,
+                                        size,
+                                        keep_ram + offset,
+                                        0,
+                                        FLASHALGO_RETURN_BOOL)) {
+                return ERROR_WRITE;
+            }
+        }
+
+        return ERROR_SUCCESS;
+    } else {
+        return ERROR_FAILURE;
+    }
+}
+
 static error_t target_flash_erase_sector(uint32_t addr)
 {
     if (g_board_info.target_cfg) {
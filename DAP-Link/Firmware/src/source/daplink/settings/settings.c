@@ -60,6 +60,7 @@ typedef struct __attribute__((__packed__)) cfg_ram {
 
     //Add new entries from here
     uint8_t page_erase_enable;
+    uint8_t smart_update_enable;
 } cfg_ram_t;
 
 // Configuration RAM
@@ -96,6 +97,7 @@ void config_init()
     memcpy(config_ram.hexdump, config_ram_copy.hexdump, sizeof(config_ram_copy.hexdump[0]) * config_ram_copy.valid_dumps);
     config_ram.disable_msd = config_ram_copy.disable_msd;
     config_ram.page_erase_enable = config_ram_copy.page_erase_enable;
+    config_ram.smart_update_enable = config_ram_copy.smart_update_enable;
     config_rom_init();
 }
 
@@ -242,3 +244,13 @@ bool config_ram_get_page_erase(void)
 {
     return config_ram.page_erase_enable;
 }
+
+void config_ram_set_smart_update(bool smart_update_enable)
+{
+    config_ram.smart_update_enable = smart_update_enable;
+}
+
+bool config_ram_get_smart_update(void)
+{
+    return config_ram.smart_update_enable;
+}
@@ -71,7 +71,8 @@ static const program_target_t flash = {  // Default is nrf51
     .algo_start = 0x20000000,
     .algo_size = 0x00000150,
     .algo_blob = nRF51822AA_FLM,
-    .program_buffer_size = 512 // should be USBD_MSC_BlockSize
+    .program_buffer_size = 512, // should be USBD_MSC_BlockSize
+    .program_buffer_alt = 0x20000400
 };
 
 static const sector_info_t sectors_info_nrf52[] = {
@@ -94,5 +95,6 @@ static const program_target_t flash_nrf52 = {
     .algo_start = 0x20000000,
     .algo_size = 0x00000150,
     .algo_blob = nRF52832AA_FLM,
-    .program_buffer_size = 512 // should be USBD_MSC_BlockSize
+    .program_buffer_size = 512, // should be USBD_MSC_BlockSize
+    .program_buffer_alt = 0x20000400
 };
@@ -48,6 +48,8 @@ static const sector_info_t sectors_info[] = {
     {0x08000000, 0x00000080},
 };
 
+// No second program buffer: each 128-byte page is erased just before it is programmed,
+// and the erase waits for the page before it, so nothing would overlap (test/flash_model)
 static const program_target_t flash = {
     0x20000021, // Init
     0x20000063, // UnInit
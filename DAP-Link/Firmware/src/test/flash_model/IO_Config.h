@@ -0,0 +1,12 @@
+/**
+ * @file    IO_Config.h
+ * @brief   No HIC pins for target_flash_model.c, gpio.h only includes it
+ *
+ * DAPLink Interface Firmware
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __IO_CONFIG_H__
+#define __IO_CONFIG_H__
+
+#endif
@@ -0,0 +1,449 @@
+/**
+ * @file    target_flash_model.c
+ * @brief   Host timing model of target_flash.c page programming
+ *
+ * DAPLink Interface Firmware
+ * Copyright (c) 2009-2019, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the real target_flash.c on the host, against a model of the SWD
+ * link and of a target running its flash algo, and prints the time a
+ * drag-n-drop image takes with one program buffer and with two.
+ *
+ * The link costs a fixed time per SWD transfer. The target programs and
+ * erases in the time its datasheet gives, and only stops at the algo's
+ * breakpoint once that time is up. Page data goes through a model of the
+ * target RAM into a model of its flash, so the run also fails if a buffer
+ * is written while a page programs from it, or if the flash does not end
+ * up holding the image. A last run per profile checks that
+ * erase_sector_keep() brings back what it was asked to keep.
+ *
+ * Build and run with any host compiler and make, in this directory:
+ *
+ *   make
+ *
+ * The exit status is 0 when every run programmed its image correctly and,
+ * for a profile with a second program buffer, the pipelined run took less
+ * time than the serial one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "daplink/interface/target_flash.c"
+
+#include "target_family.h"
+#include "target_board.h"
+
+//! SWD clock and the cost of one transfer: request, acks, 32 data bits and parity
+#define SWD_CLOCK_HZ            4000000u
+#define SWD_TRANSFER_BITS       46u
+#define SWD_TRANSFER_NS         (SWD_TRANSFER_BITS * 1000000000ull / SWD_CLOCK_HZ)
+
+//! swd_write_debug_state(): DCRDR, DCRSR and DHCSR for each of 9 registers, then run
+#define SYSCALL_START_TRANSFERS 30u
+//! R0 read back once halted
+#define SYSCALL_RESULT_TRANSFERS 4u
+//! CSW and TAR written again at every auto increment page
+#define WRITE_SETUP_TRANSFERS   2u
+
+//! Time init and uninit take on the target
+#define ALGO_CALL_NS            100000ull
+
+#define RAM_START               0x20000000u
+#define RAM_SIZE                0x5000u
+
+typedef struct {
+    const char *name;
+    const program_target_t *algo;
+    const sector_info_t *sectors;
+    uint32_t sector_count;
+    uint32_t image_start;
+    uint32_t image_size;
+    uint32_t write_unit;    // bytes the flash programs at once
+    uint64_t write_ns;      // time it takes for them
+    uint64_t erase_ns;      // time a sector erase takes
+} profile_t;
+
+// The blobs use the same names as target_flash.c and each other
+#define flash_start     nrf5x_flash_start
+#define sectors_info    nrf5x_sectors_info
+#define flash           nrf51_flash
+#include "family/nordic/nrf5x/flash_blob.c"
+#undef flash_start
+#undef sectors_info
+#undef flash
+
+#define flash_start     stm32l0_flash_start
+#define flash_size      stm32l0_flash_size
+#define sectors_info    stm32l0_sectors_info
+#define flash           stm32l0_flash
+#include "family/st/stm32l082cz/flash_blob.c"
+#undef flash_start
+#undef flash_size
+#undef sectors_info
+#undef flash
+
+static const profile_t profiles[] = {
+    // nRF52832 PS: t_WRITE 41 us a word, t_ERASEPAGE 85 ms
+    {"nrf52832", &flash_nrf52, sectors_info_nrf52, 1, 0x00000000, 0x40000, 4, 41000, 85000000},
+    // STM32L082CZ DS: t_prog 3.2 ms a half page, the same for a page erase
+    {"stm32l082cz", &stm32l0_flash, stm32l0_sectors_info, 1, 0x08000000, 0x10000, 64, 3200000, 3200000},
+};
+
+static uint64_t now;
+static uint32_t transfers;
+static uint32_t polls;
+static uint32_t errors;
+
+static uint8_t ram[RAM_SIZE];
+static uint8_t *flash_mem;
+static const profile_t *profile;
+static const program_target_t *algo;
+
+// The algo function running on the target, if any
+static struct {
+    uint8_t running;
+    uint32_t entry;
+    uint32_t args[3];
+    uint64_t done;
+} call;
+
+static void fail(const char *what, uint32_t addr)
+{
+    printf("  error: %s at 0x%08x\n", what, (unsigned)addr);
+    errors++;
+}
+
+static void swd_transfers(uint32_t count)
+{
+    transfers += count;
+    now += count * SWD_TRANSFER_NS;
+}
+
+static uint8_t *ram_at(uint32_t addr, uint32_t size)
+{
+    if (addr < RAM_START || addr + size > RAM_START + RAM_SIZE) {
+        return NULL;
+    }
+    return &ram[addr - RAM_START];
+}
+
+// What the algo function does to the flash, seen the moment it halts
+static uint32_t call_finish(void)
+{
+    uint32_t offset = call.args[0] - profile->image_start;
+
+    call.running = 0;
+    if (call.entry == algo->erase_sector) {
+        memset(&flash_mem[offset], 0xFF, profile->sectors[0].size);
+    } else if (call.entry == algo->program_page) {
+        uint8_t *data = ram_at(call.args[2], call.args[1]);
+        uint32_t i;
+
+        for (i = 0; i < call.args[1]; i++) {
+            if (flash_mem[offset + i] != 0xFF) {
+                fail("program over data not erased", call.args[0] + i);
+                return 1;
+            }
+        }
+        memcpy(&flash_mem[offset], data, call.args[1]);
+    }
+    return 0;
+}
+
+uint8_t swd_write_memory(uint32_t address, uint8_t *data, uint32_t size)
+{
+    uint8_t *dest = ram_at(address, size);
+
+    if (!dest) {
+        fail("write outside target RAM", address);
+        return 0;
+    }
+    if (call.running && call.entry == algo->program_page &&
+        address < call.args[2] + call.args[1] && call.args[2] < address + size) {
+        fail("buffer written while a page programs from it", address);
+    }
+    swd_transfers((size + 3) / 4 + WRITE_SETUP_TRANSFERS * (1 + size / TARGET_AUTO_INCREMENT_PAGE_SIZE));
+    memcpy(dest, data, size);
+    return 1;
+}
+
+uint8_t swd_read_memory(uint32_t address, uint8_t *data, uint32_t size)
+{
+    const uint8_t *src = ram_at(address, size);
+
+    if (address >= profile->image_start && address + size <= profile->image_start + profile->image_size) {
+        src = &flash_mem[address - profile->image_start];
+    }
+    if (!src) {
+        fail("read outside target RAM and flash", address);
+        return 0;
+    }
+    swd_transfers((size + 3) / 4 + WRITE_SETUP_TRANSFERS * (1 + size / TARGET_AUTO_INCREMENT_PAGE_SIZE));
+    memcpy(data, src, size);
+    return 1;
+}
+
+uint8_t swd_flash_syscall_start(const program_syscall_t *sysCallParam, uint32_t entry, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4)
+{
+    (void)sysCallParam;
+    (void)arg4;
+
+    if (call.running) {
+        fail("algo called while the target runs", entry);
+        return 0;
+    }
+    swd_transfers(SYSCALL_START_TRANSFERS);
+
+    call.running = 1;
+    call.entry = entry;
+    call.args[0] = arg1;
+    call.args[1] = arg2;
+    call.args[2] = arg3;
+    if (entry == algo->erase_sector) {
+        call.done = now + profile->erase_ns;
+    } else if (entry == algo->program_page) {
+        call.done = now + (arg2 + profile->write_unit - 1) / profile->write_unit * profile->write_ns;
+    } else {
+        call.done = now + ALGO_CALL_NS;
+    }
+    return 1;
+}
+
+uint8_t swd_flash_syscall_result(uint32_t arg1, uint32_t arg2, flash_algo_return_t return_type)
+{
+    (void)arg1;
+    (void)arg2;
+    (void)return_type;
+
+    if (!call.running) {
+        fail("result taken with nothing running", 0);
+        return 0;
+    }
+    // swd_wait_until_halted(): one DHCSR read at a time until S_HALT
+    do {
+        swd_transfers(1);
+        polls++;
+    } while (now < call.done);
+    swd_transfers(SYSCALL_RESULT_TRANSFERS);
+    return call_finish() == 0;
+}
+
+uint8_t swd_flash_syscall_exec(const program_syscall_t *sysCallParam, uint32_t entry, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, flash_algo_return_t return_type)
+{
+    if (!swd_flash_syscall_start(sysCallParam, entry, arg1, arg2, arg3, arg4)) {
+        return 0;
+    }
+    return swd_flash_syscall_result(arg1, arg2, return_type);
+}
+
+uint8_t swd_off(void)
+{
+    return 1;
+}
+
+uint8_t target_set_state(target_state_t state)
+{
+    (void)state;
+    return 1;
+}
+
+bool config_get_auto_rst(void)
+{
+    return false;
+}
+
+bool config_get_automation_allowed(void)
+{
+    return false;
+}
+
+uint32_t crc32(const void *data, int nBytes)
+{
+    (void)data;
+    (void)nBytes;
+    return 0;
+}
+
+void _util_assert(bool expression, const char *filename, uint16_t line)
+{
+    if (!expression) {
+        printf("  assert: %s:%u\n", filename, line);
+        errors++;
+    }
+}
+
+static target_cfg_t target_model;
+
+const board_info_t g_board_info = {
+    .target_cfg = &target_model,
+};
+
+const target_family_descriptor_t *g_target_family = NULL;
+
+// The profile's algo with the second buffer it has, or none
+static program_target_t *algo_with(const program_target_t *from, uint32_t buffer_alt)
+{
+    program_target_t *copy = malloc(sizeof(*copy));
+
+    memcpy(copy, from, sizeof(*copy));
+    memcpy((uint8_t *)copy + offsetof(program_target_t, program_buffer_alt), &buffer_alt, sizeof(buffer_alt));
+    return copy;
+}
+
+static void model_start(program_target_t *run_algo)
+{
+    memset(&target_model, 0, sizeof(target_model));
+    target_model.sectors_info = profile->sectors;
+    target_model.sector_info_length = profile->sector_count;
+    target_model.flash_regions[0].start = profile->image_start;
+    target_model.flash_regions[0].end = profile->image_start + profile->image_size;
+    target_model.flash_regions[0].flags = kRegionIsDefault;
+    target_model.flash_regions[0].flash_algo = run_algo;
+    target_model.ram_regions[0].start = RAM_START;
+    target_model.ram_regions[0].end = RAM_START + RAM_SIZE;
+
+    algo = run_algo;
+    now = 0;
+    transfers = 0;
+    polls = 0;
+    memset(&call, 0, sizeof(call));
+}
+
+// The first sector changed in its second half only, over the image programmed by model_run():
+// the first half kept through the erase, the second one programmed after it
+static void model_keep(program_target_t *run_algo, const uint8_t *image)
+{
+    const flash_intf_t *intf = flash_intf_target;
+    uint32_t half = profile->sectors[0].size / 2;
+    error_t status;
+
+    model_start(run_algo);
+    memset(&flash_mem[half], 0x5A, half);
+
+    status = intf->init();
+    if (status == ERROR_SUCCESS) {
+        status = intf->flash_algo_set(profile->image_start);
+    }
+    if (status == ERROR_SUCCESS && intf->keep_size() < half) {
+        fail("no target RAM to keep half a sector in", profile->image_start);
+        status = ERROR_INTERNAL;
+    }
+    if (status == ERROR_SUCCESS) {
+        status = intf->erase_sector_keep(profile->image_start, profile->image_start, half);
+    }
+    if (status == ERROR_SUCCESS) {
+        status = intf->program_page(profile->image_start + half, &image[half], half);
+    }
+    if (status == ERROR_SUCCESS) {
+        status = intf->uninit();
+    } else {
+        intf->uninit();
+    }
+
+    if (status != ERROR_SUCCESS) {
+        fail("keeping stopped", profile->image_start);
+    } else if (memcmp(flash_mem, image, profile->sectors[0].size) != 0) {
+        fail("sector kept through the erase does not hold the image", profile->image_start);
+    }
+    printf("%s: half a sector kept through its erase, %u transfers\n", profile->name, (unsigned)transfers);
+}
+
+// An image programmed in the order flash_manager.c calls the interface in
+static uint64_t model_run(program_target_t *run_algo, const uint8_t *image)
+{
+    const flash_intf_t *intf = flash_intf_target;
+    uint32_t sector_size = profile->sectors[0].size;
+    uint32_t addr;
+    error_t status;
+
+    model_start(run_algo);
+    memset(flash_mem, 0, profile->image_size);
+
+    status = intf->init();
+    for (addr = profile->image_start; status == ERROR_SUCCESS && addr < profile->image_start + profile->image_size; addr += sector_size) {
+        uint32_t offset = addr - profile->image_start;
+        uint32_t page = intf->program_page_min_size(addr);
+        uint32_t done;
+
+        status = intf->flash_algo_set(addr);
+        if (status == ERROR_SUCCESS) {
+            status = intf->erase_sector(addr);
+        }
+        for (done = 0; status == ERROR_SUCCESS && done < sector_size; done += page) {
+            status = intf->program_page(addr + done, &image[offset + done], page);
+        }
+    }
+    if (status == ERROR_SUCCESS) {
+        status = intf->uninit();
+    } else {
+        intf->uninit();
+    }
+
+    if (status != ERROR_SUCCESS) {
+        fail("programming stopped", addr);
+    } else if (call.running) {
+        fail("algo left running after uninit", call.entry);
+    } else if (memcmp(flash_mem, image, profile->image_size) != 0) {
+        fail("flash does not hold the image", profile->image_start);
+    }
+    return now;
+}
+
+int main(void)
+{
+    uint32_t i, j;
+
+    printf("SWD %u kHz, %u ns a transfer\n", SWD_CLOCK_HZ / 1000, (unsigned)SWD_TRANSFER_NS);
+    for (i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        uint8_t *image;
+        uint64_t serial, pipelined;
+        uint32_t buffer_alt;
+
+        profile = &profiles[i];
+        buffer_alt = profile->algo->program_buffer_alt;
+        image = malloc(profile->image_size);
+        flash_mem = malloc(profile->image_size);
+        srand(i + 1);
+        for (j = 0; j < profile->image_size; j++) {
+            image[j] = (uint8_t)rand();
+        }
+
+        serial = model_run(algo_with(profile->algo, 0), image);
+        printf("%s: %u KB, serial %.3f s (%u transfers, %u polls)\n", profile->name,
+               (unsigned)(profile->image_size / 1024), serial / 1e9, (unsigned)transfers, (unsigned)polls);
+        if (buffer_alt == 0) {
+            printf("%s: no second program buffer, serial only\n", profile->name);
+        } else {
+            pipelined = model_run(algo_with(profile->algo, buffer_alt), image);
+            printf("%s: %u KB, pipelined %.3f s (%u transfers, %u polls), %.1f%% faster\n", profile->name,
+                   (unsigned)(profile->image_size / 1024), pipelined / 1e9, (unsigned)transfers, (unsigned)polls,
+                   100.0 * (double)(serial - pipelined) / (double)serial);
+            if (pipelined >= serial) {
+                fail("pipelined no faster than serial", profile->image_start);
+            }
+        }
+        model_keep(algo_with(profile->algo, buffer_alt), image);
+        free(image);
+        free(flash_mem);
+    }
+
+    printf("%u errors\n", (unsigned)errors);
+    return errors != 0;
+}
@@ -0,0 +1,251 @@
+#include "main.h"
+#include "boot.h"
+#include "fw_flash.h"
+#include "nvm.h"
+#include "st25dv.h"
+
+/*
+ * Bootloader, in the first FW_BOOT_SIZE of flash (fw_flash.h). Starts the
+ * application unless an update is due, then takes it over the ST25DV
+ * mailbox (boot_receive.c) and writes it over the application region.
+ * Flashed once over SWD with Boot.hex next to the application's
+ * L-ink_Card.hex, each one carries its own address; from then on the
+ * application is updated over NFC.
+ *
+ * Registers only, on the MSI the chip resets to: I2C1 polled at 100 kHz,
+ * the flash and data EEPROM written directly. The region is only
+ * started again once an image checked out in it, a transfer cut short
+ * by the field going away comes back here at the next power-up.
+ */
+
+#define BOOT_WORD(Address)      (*(__IO uint32_t *) (Address))
+#define BOOT_NVM(Word)          BOOT_WORD(DATA_EEPROM_BASE + (Word) * 4)
+#define BOOT_RAM_END            (SRAM_BASE + 0x2000U)
+#define BOOT_HALF_WORDS         (UPDATE_HALF_PAGE_SIZE / 4)
+#define BOOT_SR_ERRORS          (FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_SIZERR | FLASH_SR_NOTZEROERR | FLASH_SR_FWWERR)
+#define BOOT_MSI_HZ             2097000U
+#define BOOT_I2C_TIMING         0x00000809U     // 100 kHz from the MSI
+#define BOOT_I2C_CHUNK          128             // mailbox bytes per read, under the 255 NBYTES holds
+
+static UPDATE_Flash_t BootFlash;
+static uint32_t BootSaved[UPDATE_SAVED_SIZE / 4];
+
+/* The reset clock does, the application sets up its own */
+void SystemInit(void)
+{
+}
+
+/* Ends on the errors the operation left, cleared for the next one */
+static __RAM_FUNC uint8_t BootWait(void)
+{
+    uint32_t errors;
+
+    while (FLASH->SR & FLASH_SR_BSY);
+    errors = FLASH->SR & BOOT_SR_ERRORS;
+    FLASH->SR = errors;
+    return errors == 0;
+}
+
+static void BootUnlock(void)
+{
+    FLASH->PEKEYR = FLASH_PEKEY1;
+    FLASH->PEKEYR = FLASH_PEKEY2;
+    FLASH->PRGKEYR = FLASH_PRGKEY1;
+    FLASH->PRGKEYR = FLASH_PRGKEY2;
+}
+
+uint32_t NvmRead(uint8_t Word)
+{
+    return BOOT_NVM(Word);
+}
+
+HAL_StatusTypeDef NvmWrite(uint8_t Word, uint32_t Value)
+{
+    if (BOOT_NVM(Word) == Value)
+        return HAL_OK;
+    BOOT_NVM(Word) = Value;
+    return BootWait() ? HAL_OK : HAL_ERROR;
+}
+
+static int32_t BootErase(uint32_t Offset)
+{
+    uint8_t ok;
+
+    FLASH->PECR |= FLASH_PECR_ERASE | FLASH_PECR_PROG;
+    BOOT_WORD(FW_APP_ADDRESS + Offset) = 0;
+    ok = BootWait();
+    FLASH->PECR &= ~(FLASH_PECR_ERASE | FLASH_PECR_PROG);
+    return ok ? 0 : -1;
+}
+
+/* Nothing may be read from flash meanwhile: run from RAM, with pWords in RAM */
+static __RAM_FUNC int32_t BootHalfPage(uint32_t Offset, const uint32_t *pWords)
+{
+    uint8_t ok, i;
+
+    FLASH->PECR |= FLASH_PECR_PROG | FLASH_PECR_FPRG;
+    for (i = 0; i < BOOT_HALF_WORDS; i++)
+        BOOT_WORD(FW_APP_ADDRESS + Offset + i * 4) = pWords[i];
+    ok = BootWait();
+    FLASH->PECR &= ~(FLASH_PECR_PROG | FLASH_PECR_FPRG);
+    return ok ? 0 : -1;
+}
+
+/* Something the application's reset handler can take */
+static uint8_t BootRunnable(void)
+{
+    const uint32_t *vectors = (const uint32_t *) FW_APP_ADDRESS;
+
+    return vectors[0] > SRAM_BASE && vectors[0] <= BOOT_RAM_END;
+}
+
+const UPDATE_Flash_t *BootFlashGet(void)
+{
+    uint32_t size = NvmRead(NVM_FW_SIZE);
+
+    BootFlash.pRunning = (const uint8_t *) FW_APP_ADDRESS;
+    BootFlash.RunningSize = 0;
+    if (NvmRead(NVM_FW_STATE) == FW_STATE_RECEIVE && BootRunnable() && size <= FW_APP_SIZE)
+        BootFlash.RunningSize = size;
+    BootFlash.RegionSize = FW_APP_SIZE;
+    BootFlash.pSaved = BootSaved;
+    BootFlash.Erase = BootErase;
+    BootFlash.Program = BootHalfPage;
+    return &BootFlash;
+}
+
+/* PB6 SCL, PB7 SDA, AF1 open drain with pull-ups like the application's; the tag out of low power on PA4 */
+static void BootI2cInit(void)
+{
+    RCC->IOPENR |= RCC_IOPENR_GPIOAEN | RCC_IOPENR_GPIOBEN;
+    RCC->APB1ENR |= RCC_APB1ENR_I2C1EN;
+
+    GPIOA->BSRR = GPIO_BSRR_BR_4;
+    GPIOA->MODER = (GPIOA->MODER & ~GPIO_MODER_MODE4) | GPIO_MODER_MODE4_0;
+
+    GPIOB->OTYPER |= GPIO_OTYPER_OT_6 | GPIO_OTYPER_OT_7;
+    GPIOB->PUPDR = (GPIOB->PUPDR & ~(GPIO_PUPDR_PUPD6 | GPIO_PUPDR_PUPD7)) | GPIO_PUPDR_PUPD6_0 | GPIO_PUPDR_PUPD7_0;
+    GPIOB->AFR[0] = (GPIOB->AFR[0] & ~0xFF000000U) | 0x11000000U;
+    GPIOB->MODER = (GPIOB->MODER & ~(GPIO_MODER_MODE6 | GPIO_MODER_MODE7)) | GPIO_MODER_MODE6_1 | GPIO_MODER_MODE7_1;
+
+    I2C1->TIMINGR = BOOT_I2C_TIMING;
+    I2C1->CR1 = I2C_CR1_PE;
+}
+
+/* 0 on a NACK, the tag busy with the RF side: the STOP is sent by then */
+static uint8_t BootI2cWait(uint32_t Flag)
+{
+    uint32_t isr;
+
+    do
+    {
+        isr = I2C1->ISR;
+        if (isr & I2C_ISR_NACKF)
+        {
+            while (!(I2C1->ISR & I2C_ISR_STOPF));
+            I2C1->ICR = I2C_ICR_NACKCF | I2C_ICR_STOPCF;
+            return 0;
+        }
+    } while (!(isr & Flag));
+    return 1;
+}
+
+/* Length bytes at the tag's Register, in or out. 0 if the tag did not answer */
+static uint8_t BootTag(uint16_t Register, uint8_t *pData, uint16_t Length, uint8_t Read)
+{
+    uint16_t i;
+
+    I2C1->CR2 = ST25DV_ADDR_DATA_I2C | ((Read ? 2U : 2U + Length) << I2C_CR2_NBYTES_Pos) |
+                (Read ? 0 : I2C_CR2_AUTOEND) | I2C_CR2_START;
+    if (!BootI2cWait(I2C_ISR_TXIS))
+        return 0;
+    I2C1->TXDR = Register >> 8;
+    if (!BootI2cWait(I2C_ISR_TXIS))
+        return 0;
+    I2C1->TXDR = Register & 0xFF;
+
+    if (Read)
+    {
+        if (!BootI2cWait(I2C_ISR_TC))
+            return 0;
+        I2C1->CR2 = ST25DV_ADDR_DATA_I2C | I2C_CR2_RD_WRN | ((uint32_t) Length << I2C_CR2_NBYTES_Pos) |
+                    I2C_CR2_AUTOEND | I2C_CR2_START;
+        for (i = 0; i < Length; i++)
+        {
+            if (!BootI2cWait(I2C_ISR_RXNE))
+                return 0;
+            pData[i] = I2C1->RXDR;
+        }
+    } else
+        for (i = 0; i < Length; i++)
+        {
+            if (!BootI2cWait(I2C_ISR_TXIS))
+                return 0;
+            I2C1->TXDR = pData[i];
+        }
+
+    BootI2cWait(I2C_ISR_STOPF);
+    I2C1->ICR = I2C_ICR_STOPCF;
+    return 1;
+}
+
+uint16_t BootMailboxRead(uint8_t *pData)
+{
+    uint8_t ctrl, last;
+    uint16_t length, at, chunk;
+
+    if (!BootTag(ST25DV_MB_CTRL_DYN_REG, &ctrl, 1, 1))
+        return 0;
+    /* Off after a power cycle of the tag: on, without emptying a mailbox that is on already */
+    if (!(ctrl & ST25DV_MB_CTRL_DYN_MBEN_MASK))
+    {
+        ctrl = ST25DV_MB_CTRL_DYN_MBEN_MASK;
+        BootTag(ST25DV_MB_CTRL_DYN_REG, &ctrl, 1, 0);
+        return 0;
+    }
+    if (!(ctrl & ST25DV_MB_CTRL_DYN_RFPUTMSG_MASK) || !BootTag(ST25DV_MBLEN_DYN_REG, &last, 1, 1))
+        return 0;
+
+    length = last + 1;
+    for (at = 0; at < length; at += chunk)
+    {
+        chunk = length - at < BOOT_I2C_CHUNK ? length - at : BOOT_I2C_CHUNK;
+        if (!BootTag(ST25DV_MAILBOX_RAM_REG + at, pData + at, chunk, 1))
+            return 0;
+    }
+    return length;
+}
+
+void BootMailboxWrite(const uint8_t *pData, uint16_t Length)
+{
+    BootTag(ST25DV_MAILBOX_RAM_REG, (uint8_t *) pData, Length, 0);
+}
+
+uint8_t BootPause(void)
+{
+    SysTick->LOAD = BOOT_MSI_HZ / 1000 * BOOT_POLL_MS - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+    while (!(SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk));
+    SysTick->CTRL = 0;
+    return 1;
+}
+
+int main(void)
+{
+    const uint32_t *vectors = (const uint32_t *) FW_APP_ADDRESS;
+
+    if (NvmRead(NVM_FW_STATE) != FW_STATE_NONE || !BootRunnable())
+    {
+        BootUnlock();
+        BootI2cInit();
+        BootReceive();
+        /* The application, or this again, from a clean reset */
+        NVIC_SystemReset();
+    }
+
+    SCB->VTOR = FW_APP_ADDRESS;
+    __set_MSP(vectors[0]);
+    ((void (*)(void)) vectors[1])();
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef __BOOT_H
+#define __BOOT_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "fw_update.h"
+
+/*
+ * The bootloader's update loop (boot_receive.c) and what it takes from
+ * the part it runs on: boot.c on the registers, the host simulator on
+ * its tag and flash models. NVM words go through nvm.h.
+ */
+
+#define BOOT_MESSAGE_MAX    256         // the ST25DV mailbox
+#define BOOT_POLL_MS        2           // between looks at the mailbox
+#define BOOT_IDLE_MS        10000       // nothing written yet and no message for that long: back to the application
+
+/* The message waiting in the mailbox into pData, BOOT_MESSAGE_MAX. Its length, 0 if there is none */
+uint16_t BootMailboxRead(uint8_t *pData);
+
+void BootMailboxWrite(const uint8_t *pData, uint16_t Length);
+
+/* BOOT_POLL_MS of nothing. 0 ends the loop, where the reader can never come back */
+uint8_t BootPause(void);
+
+/* The application region; RunningSize 0 when it holds nothing runnable */
+const UPDATE_Flash_t *BootFlashGet(void);
+
+/*
+ * Takes the update NVM_FW_START holds, and any other one the reader
+ * starts, until an image is installed or the reader went away before
+ * anything was written. Returns 1 when an image was installed: either
+ * way the application is to be started if FW_STATE_NONE is set.
+ */
+uint8_t BootReceive(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,94 @@
+#include "boot.h"
+#include "fw_flash.h"
+#include "nvm.h"
+
+/*
+ * The update protocol of fw_update.h, on the bootloader's side: data
+ * messages, status queries and the install, plus a start that replaces
+ * the update the application handed over. The application region is
+ * marked FW_STATE_WRITING before its first page goes, and only back to
+ * FW_STATE_NONE by an install, which UpdateData() only allows once the
+ * image in the region matches its CRC.
+ */
+
+static UPDATE_Transfer_t BootUpdate;
+static uint8_t BootMessage[BOOT_MESSAGE_MAX];
+
+static void BootLoadStart(uint8_t *pStart)
+{
+    uint32_t word;
+    uint8_t i;
+
+    for (i = 0; i < UPDATE_START_SIZE / 4; i++)
+    {
+        word = NvmRead(NVM_FW_START + i);
+        pStart[i * 4] = word & 0xFF;
+        pStart[i * 4 + 1] = (word >> 8) & 0xFF;
+        pStart[i * 4 + 2] = (word >> 16) & 0xFF;
+        pStart[i * 4 + 3] = word >> 24;
+    }
+}
+
+/* A power loss from here on resumes this update rather than the one before */
+static void BootSaveStart(const uint8_t *pStart)
+{
+    uint8_t i;
+
+    for (i = 0; i < UPDATE_START_SIZE / 4; i++)
+        NvmWrite(NVM_FW_START + i, pStart[i * 4] | (pStart[i * 4 + 1] << 8) | ((uint32_t) pStart[i * 4 + 2] << 16) |
+                                   ((uint32_t) pStart[i * 4 + 3] << 24));
+}
+
+uint8_t BootReceive(void)
+{
+    uint32_t state = NvmRead(NVM_FW_STATE);
+    uint32_t idle = 0;
+    uint16_t length;
+
+    /* Half written, the update goes on from the start if it was whole; a patch has nothing left to apply to */
+    UpdateInit(&BootUpdate, BootFlashGet());
+    if (state == FW_STATE_RECEIVE || state == FW_STATE_WRITING)
+    {
+        BootLoadStart(BootMessage);
+        UpdateStart(&BootUpdate, BootMessage, UPDATE_START_SIZE);
+    }
+
+    for (;;)
+    {
+        length = BootMailboxRead(BootMessage);
+        if (length == 0)
+        {
+            /* The application is whole still as long as nothing was written */
+            if (BootUpdate.pFlash->RunningSize && NvmRead(NVM_FW_STATE) != FW_STATE_WRITING &&
+                ++idle >= BOOT_IDLE_MS / BOOT_POLL_MS)
+                break;
+            if (!BootPause())
+                return 0;
+            continue;
+        }
+        idle = 0;
+
+        if (BootMessage[0] == 'U' && length == UPDATE_START_SIZE)
+        {
+            if (UpdateStart(&BootUpdate, BootMessage, length) == FRAME_OK)
+                BootSaveStart(BootMessage);
+        } else if (BootMessage[0] == 'W' && BootUpdate.Status == UPDATE_STATUS_RECEIVING)
+        {
+            if (NvmWrite(NVM_FW_STATE, FW_STATE_WRITING) == HAL_OK)
+                UpdateData(&BootUpdate, BootMessage, length);
+        } else if (BootMessage[0] == 'V' && length == UPDATE_QUERY_SIZE)
+        {
+            if (BootMessage[1] != UPDATE_QUERY_INSTALL)
+                BootMailboxWrite(BootMessage, UpdateBuildReply(&BootUpdate, BootMessage));
+            else if (BootUpdate.Status == UPDATE_STATUS_DONE &&
+                     NvmWrite(NVM_FW_SIZE, BootUpdate.Size) == HAL_OK)
+            {
+                NvmWrite(NVM_FW_STATE, FW_STATE_NONE);
+                return 1;
+            }
+        }
+    }
+
+    NvmWrite(NVM_FW_STATE, FW_STATE_NONE);
+    return 0;
+}
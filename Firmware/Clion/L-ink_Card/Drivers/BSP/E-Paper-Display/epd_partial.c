@@ -0,0 +1,294 @@
+#include "epd_partial.h"
+#include "stm32l0xx_hal.h"
+
+/*
+ * Dirty tracking for the partial refresh path. Incoming frame data is
+ * compared with the frame buffer while it is copied in, so the previous
+ * image never needs a second 5000-byte buffer: each row only keeps the
+ * first and last changed byte column, each region the pixels that flipped.
+ * EpdPartShow() picks the refresh from those and the ghosting left by the
+ * partial refreshes before it.
+ */
+
+#define EPD_ROW_CLEAN 0xFF
+#define EPD_REGION_ROWS (yDot / EPD_PART_REGIONS)
+#define EPD_REGION_PIXELS ((uint32_t) EPD_REGION_ROWS * xDot)
+#define EPD_PIXELS ((uint32_t) xDot * yDot)
+
+typedef struct
+{
+    uint8_t Last;
+    uint8_t Reason;
+    uint8_t Changed;
+    int8_t Temperature;
+    uint16_t Counts[EPD_REFRESH_FULL + 1];
+    uint16_t Reasons[EPD_REASON_COUNT];
+} EPD_PartStats_t;
+
+static uint8_t RowXMin[yDot];
+static uint8_t RowXMax[yDot];
+static uint16_t Changed[EPD_PART_REGIONS];  // pixels flipped since the last refresh
+static uint16_t Ghost[EPD_PART_REGIONS];    // pixels flipped by partial refreshes since the last full one
+static uint8_t Runs[EPD_PART_REGIONS];      // partial refreshes since the last full one
+static uint8_t Forced = 1;
+static uint8_t Tracking = 0;
+static uint8_t PartInFlight = 0;
+static EPD_PartStats_t Stats = {EPD_REFRESH_NONE, EPD_REASON_NONE, 0, EPD_TEMP_UNKNOWN, {0}, {0}};
+
+/* Set bits per nibble */
+static const uint8_t NibbleBits[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+/* Board code overrides this when it can read a temperature */
+__weak int8_t EpdPartTemperature(void)
+{
+    return EPD_TEMP_UNKNOWN;
+}
+
+static void EpdPartClear(void)
+{
+    uint8_t row;
+
+    for (row = 0; row < yDot; row++)
+    {
+        RowXMin[row] = EPD_ROW_CLEAN;
+        RowXMax[row] = 0;
+    }
+    for (row = 0; row < EPD_PART_REGIONS; row++)
+        Changed[row] = 0;
+    Tracking = 1;
+}
+
+/* Flips a region may take, partial refreshes ghost more in the cold */
+static uint16_t EpdPartBudget(int8_t Temperature)
+{
+    uint32_t budget = EPD_REGION_PIXELS * EPD_PART_GHOST_BUDGET / 100;
+
+    if (Temperature != EPD_TEMP_UNKNOWN && Temperature < EPD_PART_COOL_C)
+        budget /= 2;
+    return budget > 0xFFFF ? 0xFFFF : (uint16_t) budget;
+}
+
+static void EpdPartRecord(uint8_t Refresh, uint8_t Reason)
+{
+    Stats.Last = Refresh;
+    Stats.Reason = Reason;
+    Stats.Counts[Refresh]++;
+    if (Refresh == EPD_REFRESH_FULL)
+        Stats.Reasons[Reason]++;
+}
+
+static void EpdPartForget(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < EPD_PART_REGIONS; i++)
+    {
+        Ghost[i] = 0;
+        Runs[i] = 0;
+    }
+}
+
+static uint8_t EpdPartFull(unsigned char *Frame, uint8_t Reason)
+{
+    EpdDisFull(Frame, 1);
+    EpdPartForget();
+    Forced = 0;
+    PartInFlight = 0;
+    EpdPartClear();
+    EpdPartRecord(EPD_REFRESH_FULL, Reason);
+    return EPD_REFRESH_FULL;
+}
+
+/* The panel was redrawn behind our back, the frame buffer is not what it shows */
+void EpdPartInvalidate(void)
+{
+    EpdPartForget();
+    Forced = 1;
+}
+
+void EpdPartUpdate(unsigned char *Frame, uint16_t Offset, const uint8_t *pData, uint16_t Length)
+{
+    uint8_t row = Offset / EPD_ROW_BYTES;
+    uint8_t col = Offset % EPD_ROW_BYTES;
+    uint8_t flipped;
+
+    if (!Tracking)
+        EpdPartClear();
+
+    Frame += Offset;
+    while (Length-- && row < yDot)
+    {
+        if (*Frame != *pData)
+        {
+            /*
+             * The buffer is rewritten into the panel's previous-frame RAM
+             * when the partial refresh in flight ends, so newer data would
+             * be taken as already shown. Fall back to a full refresh.
+             */
+            if (PartInFlight && EpdIsBusy())
+                Forced = 1;
+            flipped = *Frame ^ *pData;
+            Changed[row / EPD_REGION_ROWS] += NibbleBits[flipped >> 4] + NibbleBits[flipped & 0x0F];
+            if (col < RowXMin[row])
+                RowXMin[row] = col;
+            if (col > RowXMax[row])
+                RowXMax[row] = col;
+            *Frame = *pData;
+        }
+        Frame++;
+        pData++;
+
+        if (++col == EPD_ROW_BYTES)
+        {
+            col = 0;
+            row++;
+        }
+    }
+}
+
+uint8_t EpdPartGetRects(EPD_Rect_t *pRects)
+{
+    uint8_t count = 0;
+    uint8_t row;
+    EPD_Rect_t *rect = pRects;
+
+    if (!Tracking)
+        return 0;
+
+    for (row = 0; row < yDot; row++)
+    {
+        if (RowXMin[row] == EPD_ROW_CLEAN)
+            continue;
+
+        if (count == 0 || (row - rect->Y1 > EPD_PART_MERGE_ROWS + 1 && count < EPD_PART_MAX_RECTS))
+        {
+            rect = &pRects[count++];
+            rect->X0 = RowXMin[row];
+            rect->X1 = RowXMax[row];
+            rect->Y0 = row;
+        } else
+        {
+            // close enough to the previous run, or out of rectangles
+            if (RowXMin[row] < rect->X0)
+                rect->X0 = RowXMin[row];
+            if (RowXMax[row] > rect->X1)
+                rect->X1 = RowXMax[row];
+        }
+        rect->Y1 = row;
+    }
+
+    return count;
+}
+
+uint8_t EpdPartShow(unsigned char *Frame)
+{
+    EPD_Rect_t rects[EPD_PART_MAX_RECTS];
+    uint8_t count;
+    uint8_t i;
+    uint16_t area = 0;
+    uint16_t budget;
+    uint32_t changed = 0;
+
+    count = EpdPartGetRects(rects);
+    for (i = 0; i < count; i++)
+    {
+        area += (rects[i].X1 - rects[i].X0 + 1) * (rects[i].Y1 - rects[i].Y0 + 1);
+    }
+    for (i = 0; i < EPD_PART_REGIONS; i++)
+        changed += Changed[i];
+
+    Stats.Changed = changed * 100 / EPD_PIXELS;
+    Stats.Temperature = EpdPartTemperature();
+    budget = EpdPartBudget(Stats.Temperature);
+
+    if (Forced)
+        return EpdPartFull(Frame, EPD_REASON_FORCED);
+
+    if (count == 0)
+    {
+        EpdPartRecord(EPD_REFRESH_NONE, EPD_REASON_NONE);
+        return EPD_REFRESH_NONE;
+    }
+
+    if (Stats.Temperature != EPD_TEMP_UNKNOWN && Stats.Temperature < EPD_PART_COLD_C)
+        return EpdPartFull(Frame, EPD_REASON_COLD);
+
+    if ((uint32_t) area * 100 > (uint32_t) EPD_FRAME_SIZE * EPD_PART_MAX_PERCENT ||
+        changed * 100 > EPD_PIXELS * EPD_PART_MAX_PERCENT)
+        return EpdPartFull(Frame, EPD_REASON_AREA);
+
+    for (i = 0; i < EPD_PART_REGIONS; i++)
+    {
+        if (Changed[i] && (Runs[i] >= EPD_PART_FULL_INTERVAL || (uint32_t) Ghost[i] + Changed[i] > budget))
+            return EpdPartFull(Frame, EPD_REASON_GHOST);
+    }
+
+    EpdDisPartWindows(Frame, rects, count);
+    for (i = 0; i < EPD_PART_REGIONS; i++)
+    {
+        if (!Changed[i])
+            continue;
+        Ghost[i] += Changed[i];
+        Runs[i]++;
+    }
+    PartInFlight = 1;
+    EpdPartClear();
+    EpdPartRecord(EPD_REFRESH_PART, EPD_REASON_NONE);
+    return EPD_REFRESH_PART;
+}
+
+/* Some region is far enough into its budget to be worth a full refresh while nobody looks */
+uint8_t EpdPartCleanupDue(void)
+{
+    uint32_t limit = (uint32_t) EpdPartBudget(EpdPartTemperature()) * EPD_PART_CLEAN_PERCENT / 100;
+    uint8_t i;
+
+    for (i = 0; i < EPD_PART_REGIONS; i++)
+    {
+        if (Ghost[i] > limit)
+            return 1;
+    }
+    return 0;
+}
+
+uint8_t EpdPartCleanup(unsigned char *Frame)
+{
+    if (!EpdPartCleanupDue())
+        return EPD_REFRESH_NONE;
+    return EpdPartFull(Frame, EPD_REASON_CLEANUP);
+}
+
+/* Fills pData with the EPD_PART_REPORT_SIZE byte policy report */
+uint8_t EpdPartBuildReport(uint8_t *pData)
+{
+    uint16_t budget = EpdPartBudget(Stats.Temperature);
+    uint32_t ghost, worst = 0;
+    uint8_t i, at = 8;
+
+    for (i = 0; i < EPD_PART_REGIONS; i++)
+    {
+        ghost = (uint32_t) Ghost[i] * 100 / budget;
+        if (ghost > worst)
+            worst = ghost;
+    }
+
+    pData[0] = 'P';
+    pData[1] = EPD_PART_REPORT_VERSION;
+    pData[2] = Stats.Last;
+    pData[3] = Stats.Reason;
+    pData[4] = Stats.Changed;
+    pData[5] = worst > 0xFF ? 0xFF : (uint8_t) worst;
+    pData[6] = (uint8_t) Stats.Temperature;
+    pData[7] = 0;
+    for (i = 0; i <= EPD_REFRESH_FULL; i++, at += 2)
+    {
+        pData[at] = Stats.Counts[i] & 0xFF;
+        pData[at + 1] = Stats.Counts[i] >> 8;
+    }
+    for (i = EPD_REASON_FORCED; i < EPD_REASON_COUNT; i++, at += 2)
+    {
+        pData[at] = Stats.Reasons[i] & 0xFF;
+        pData[at + 1] = Stats.Reasons[i] >> 8;
+    }
+    return at;
+}
@@ -0,0 +1,76 @@
+#ifndef _DISPLAY_EPD_PARTIAL_H_
+#define _DISPLAY_EPD_PARTIAL_H_
+
+#include <stdint.h>
+#include "epd_w21.h"
+
+#define EPD_PART_MAX_RECTS      EPD_MAX_WINDOWS
+#define EPD_PART_MERGE_ROWS     8     // clean rows bridged when merging two dirty runs
+#define EPD_PART_MAX_PERCENT    50    // larger changes go through a full refresh
+#define EPD_PART_FULL_INTERVAL  10    // partial updates of a region before it needs a full refresh
+
+/*
+ * Ghosting budget. The panel is split in EPD_PART_REGIONS bands of rows;
+ * every pixel a partial refresh flips adds to its band's ghost, and a band
+ * may take EPD_PART_GHOST_BUDGET percent of its pixels worth of flips
+ * before the next change there goes through a full refresh. Past
+ * EPD_PART_CLEAN_PERCENT of the budget a full refresh is also run once the
+ * card has been left alone, see EpdPartCleanupDue().
+ */
+#define EPD_PART_REGIONS        8
+#define EPD_PART_GHOST_BUDGET   100
+#define EPD_PART_CLEAN_PERCENT  25
+
+/* Below EPD_PART_COLD_C only full refreshes, below EPD_PART_COOL_C half the budget */
+#define EPD_PART_COLD_C         5
+#define EPD_PART_COOL_C         15
+#define EPD_TEMP_UNKNOWN        127
+
+#define EPD_REFRESH_NONE    0
+#define EPD_REFRESH_PART    1
+#define EPD_REFRESH_FULL    2
+
+/* Why the last full refresh was chosen */
+#define EPD_REASON_NONE     0
+#define EPD_REASON_FORCED   1   // invalidated, or the partial refresh in flight was overtaken
+#define EPD_REASON_AREA     2   // too much of the panel changed
+#define EPD_REASON_GHOST    3   // a region ran out of ghosting budget
+#define EPD_REASON_COLD     4
+#define EPD_REASON_CLEANUP  5   // idle cleanup
+#define EPD_REASON_COUNT    6
+
+/*
+ * Policy report, answer to an EPD_PART_QUERY_SIZE query 'E' 0:
+ *  0  'P'
+ *  1  Version      EPD_PART_REPORT_VERSION
+ *  2  Last         EPD_REFRESH_* of the last update
+ *  3  Reason       EPD_REASON_* of the last update
+ *  4  Changed      pixels the last update changed, percent of the panel
+ *  5  Ghost        worst region, percent of its budget
+ *  6  Temperature  degrees C, EPD_TEMP_UNKNOWN without a sensor
+ *  7  Reserved
+ *  8  Counts       EPD_REFRESH_NONE, _PART and _FULL updates, LE16 each
+ *  14 Reasons      full refreshes per EPD_REASON_FORCED .. _CLEANUP, LE16 each
+ */
+#define EPD_PART_QUERY_SIZE     2
+#define EPD_PART_REPORT_VERSION 1
+#define EPD_PART_REPORT_SIZE    (8 + 3 * 2 + (EPD_REASON_COUNT - 1) * 2)
+
+/* Panel temperature in degrees C, EPD_TEMP_UNKNOWN when there is no sensor */
+int8_t EpdPartTemperature(void);
+
+void EpdPartInvalidate(void);
+
+void EpdPartUpdate(unsigned char *Frame, uint16_t Offset, const uint8_t *pData, uint16_t Length);
+
+uint8_t EpdPartGetRects(EPD_Rect_t *pRects);
+
+uint8_t EpdPartShow(unsigned char *Frame);
+
+uint8_t EpdPartCleanupDue(void);
+
+uint8_t EpdPartCleanup(unsigned char *Frame);
+
+uint8_t EpdPartBuildReport(uint8_t *pData);
+
+#endif
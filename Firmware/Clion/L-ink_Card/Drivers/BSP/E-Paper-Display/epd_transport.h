@@ -0,0 +1,82 @@
+#ifndef _DISPLAY_EPD_TRANSPORT_H_
+#define _DISPLAY_EPD_TRANSPORT_H_
+
+#include <stdint.h>
+
+/*
+ * Low level link between the EPD driver and the panel controller.
+ * epd_w21.c only talks to the panel through one of these, so the byte
+ * stream can go out bit-banged, over SPI1+DMA, or into the host mock.
+ */
+typedef struct
+{
+    void (*Init)(void);
+    void (*SetCS)(uint8_t Level);
+    void (*SetDC)(uint8_t Level);
+    void (*SetRST)(uint8_t Level);
+    uint8_t (*ReadBusy)(void);
+    void (*Write)(const uint8_t *pData, uint16_t Length);
+    void (*Fill)(uint8_t Value, uint16_t Length);
+    void (*Delay)(uint32_t Ms);
+    /* Returns while the bytes may still be going out, WriteWait() before touching pData or the pins */
+    void (*WriteStart)(const uint8_t *pData, uint16_t Length);
+    void (*WriteWait)(void);
+} EPD_IO_t;
+
+/* SPI1 needs SCK on PB3 and MOSI on PB5, see epd_transport_spi.c */
+#ifndef EPD_USE_SPI_DMA
+#define EPD_USE_SPI_DMA 0
+#endif
+
+/* Talk to the mock instead of the panel, for the host simulator */
+#ifndef EPD_USE_MOCK
+#define EPD_USE_MOCK 0
+#endif
+
+/* Shorter writes are sent polled, the DMA setup costs more than it saves */
+#define EPD_SPI_DMA_MIN_LEN 16
+
+extern const EPD_IO_t EpdGpioIO;
+extern const EPD_IO_t EpdSpiIO;
+extern const EPD_IO_t EpdMockIO;
+
+/* Pin helpers shared by the GPIO and SPI backends */
+void EpdGpioSetCS(uint8_t Level);
+void EpdGpioSetDC(uint8_t Level);
+void EpdGpioSetRST(uint8_t Level);
+uint8_t EpdGpioReadBusy(void);
+void EpdGpioDelay(uint32_t Ms);
+
+/* Host mock: records every byte with its D/C level and models BUSY in time */
+#ifndef EPD_MOCK_CAPTURE_SIZE
+#define EPD_MOCK_CAPTURE_SIZE 6000
+#endif
+
+typedef struct
+{
+    uint32_t Bytes;
+    uint32_t DataBytes;
+    uint32_t Commands;
+    uint32_t Transactions;
+    uint32_t Resets;
+    uint32_t BusyPolls;
+    uint32_t BusyBytes;     // sent while BUSY was high, which the controller ignores; the NOP (0xff) aside
+    uint32_t DelayMs;
+    uint32_t ElapsedUs;     // mock clock: SPI time, delays and idle time
+    uint32_t FullRefreshes;
+    uint32_t PartRefreshes;
+} EPD_MockStats_t;
+
+/* Sees every byte the panel receives, the capture only keeps the first ones */
+typedef void (*EPD_MockObserver_t)(uint8_t IsData, uint8_t Value);
+/* Called before the mock clock moves on to Us, may advance it part of the way with EpdMockIdle() */
+typedef void (*EPD_MockClock_t)(uint32_t Us);
+
+void EpdMockReset(uint32_t ByteTimeNs, uint32_t FullBusyMs, uint32_t PartBusyMs);
+void EpdMockSetObserver(EPD_MockObserver_t Observer);
+void EpdMockSetClock(EPD_MockClock_t Clock);
+void EpdMockIdle(uint32_t Us);
+const EPD_MockStats_t *EpdMockGetStats(void);
+uint32_t EpdMockGetCapture(const uint8_t **ppData, const uint8_t **ppIsData);
+
+#endif
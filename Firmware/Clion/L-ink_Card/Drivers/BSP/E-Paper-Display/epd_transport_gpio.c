@@ -0,0 +1,109 @@
+#include "epd_transport.h"
+#include "epd_w21.h"
+#include "stm32l0xx_hal.h"
+
+static void SpiDelay(unsigned char xrate)
+{
+    unsigned char i;
+    while (xrate)
+    {
+        for (i = 0; i < 1; i++);
+        xrate--;
+    }
+}
+
+
+static void SpiWrite(unsigned char value)
+{
+    unsigned char i;
+
+    SpiDelay(1);
+    for (i = 0; i < 8; i++)
+    {
+        EPD_W21_CLK_0;
+        SpiDelay(1);
+        if (value & 0x80)
+            EPD_W21_MOSI_1;
+        else
+            EPD_W21_MOSI_0;
+        value = (value << 1);
+        SpiDelay(1);
+        EPD_W21_CLK_1;
+        SpiDelay(1);
+    }
+}
+
+
+void EpdGpioSetCS(uint8_t Level)
+{
+    if (Level)
+        EPD_W21_CS_1;
+    else
+        EPD_W21_CS_0;
+}
+
+void EpdGpioSetDC(uint8_t Level)
+{
+    if (Level)
+        EPD_W21_DC_1;
+    else
+        EPD_W21_DC_0;
+}
+
+void EpdGpioSetRST(uint8_t Level)
+{
+    if (Level)
+        EPD_W21_RST_1;
+    else
+        EPD_W21_RST_0;
+}
+
+uint8_t EpdGpioReadBusy(void)
+{
+    return isEPD_W21_BUSY != EPD_W21_BUSY_LEVEL;
+}
+
+void EpdGpioDelay(uint32_t Ms)
+{
+    HAL_Delay(Ms);
+}
+
+
+static void EpdGpioInit(void)
+{
+    /* Pins are already set up by MX_GPIO_Init() */
+}
+
+static void EpdGpioWrite(const uint8_t *pData, uint16_t Length)
+{
+    while (Length--)
+    {
+        SpiWrite(*pData++);
+    }
+}
+
+static void EpdGpioFill(uint8_t Value, uint16_t Length)
+{
+    while (Length--)
+    {
+        SpiWrite(Value);
+    }
+}
+
+static void EpdGpioWriteWait(void)
+{
+}
+
+
+const EPD_IO_t EpdGpioIO = {
+        EpdGpioInit,
+        EpdGpioSetCS,
+        EpdGpioSetDC,
+        EpdGpioSetRST,
+        EpdGpioReadBusy,
+        EpdGpioWrite,
+        EpdGpioFill,
+        EpdGpioDelay,
+        EpdGpioWrite,
+        EpdGpioWriteWait
+};
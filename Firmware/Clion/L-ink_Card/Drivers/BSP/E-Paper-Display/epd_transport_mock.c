@@ -0,0 +1,199 @@
+#include "epd_transport.h"
+
+/*
+ * Host-side mock of the panel link. Nothing here touches the HAL, so it
+ * links into a Linux build of the driver: every byte is captured with its
+ * D/C level, SPI time is accounted from ByteTimeNs and BUSY stays high for
+ * FullBusyMs or PartBusyMs of mock time after a master activation (0x20),
+ * depending on the display update sequence (0x22) loaded before it.
+ * Activations that don't display anything are not timed. Bytes the
+ * controller would not take, sent with BUSY high, are counted.
+ */
+
+static uint8_t MockData[EPD_MOCK_CAPTURE_SIZE];
+static uint8_t MockIsData[EPD_MOCK_CAPTURE_SIZE];
+static uint32_t MockLength;
+static EPD_MockStats_t MockStats;
+
+static uint8_t MockCS = 1;
+static uint8_t MockDC;
+static uint32_t MockByteTimeNs;
+static uint32_t MockFullBusyMs;
+static uint32_t MockPartBusyMs;
+static uint32_t MockBusyUntilUs;
+static uint32_t MockElapsedNs;
+static uint8_t MockCommand;
+static uint8_t MockSequence;
+static EPD_MockObserver_t MockObserver;
+static EPD_MockClock_t MockClock;
+
+/* Every move of the clock, the hook gets to run what falls due on the way first */
+static void EpdMockAdvance(uint32_t Us)
+{
+    uint32_t until = MockStats.ElapsedUs + Us;
+
+    if (MockClock)
+        MockClock(until);
+    MockStats.ElapsedUs = until;
+}
+
+void EpdMockReset(uint32_t ByteTimeNs, uint32_t FullBusyMs, uint32_t PartBusyMs)
+{
+    MockLength = 0;
+    MockCS = 1;
+    MockDC = 0;
+    MockByteTimeNs = ByteTimeNs;
+    MockFullBusyMs = FullBusyMs;
+    MockPartBusyMs = PartBusyMs;
+    MockBusyUntilUs = 0;
+    MockElapsedNs = 0;
+    MockCommand = 0;
+    MockSequence = 0;
+    MockStats = (EPD_MockStats_t) {0};
+}
+
+void EpdMockIdle(uint32_t Us)
+{
+    EpdMockAdvance(Us);
+}
+
+void EpdMockSetClock(EPD_MockClock_t Clock)
+{
+    MockClock = Clock;
+}
+
+void EpdMockSetObserver(EPD_MockObserver_t Observer)
+{
+    MockObserver = Observer;
+}
+
+const EPD_MockStats_t *EpdMockGetStats(void)
+{
+    return &MockStats;
+}
+
+uint32_t EpdMockGetCapture(const uint8_t **ppData, const uint8_t **ppIsData)
+{
+    *ppData = MockData;
+    *ppIsData = MockIsData;
+    return MockLength;
+}
+
+
+static void EpdMockInit(void)
+{
+}
+
+static void EpdMockSetCS(uint8_t Level)
+{
+    if (MockCS && !Level)
+        MockStats.Transactions++;
+    MockCS = Level;
+}
+
+static void EpdMockSetDC(uint8_t Level)
+{
+    MockDC = Level;
+}
+
+static void EpdMockSetRST(uint8_t Level)
+{
+    if (!Level)
+    {
+        MockStats.Resets++;
+        MockBusyUntilUs = 0;
+    }
+}
+
+static uint8_t EpdMockReadBusy(void)
+{
+    MockStats.BusyPolls++;
+    return MockStats.ElapsedUs < MockBusyUntilUs;
+}
+
+static void EpdMockByte(uint8_t Value)
+{
+    if (MockCS)
+        return;
+
+    if (MockLength < EPD_MOCK_CAPTURE_SIZE)
+    {
+        MockData[MockLength] = Value;
+        MockIsData[MockLength] = MockDC;
+        MockLength++;
+    }
+    if (MockObserver)
+        MockObserver(MockDC, Value);
+    if (MockStats.ElapsedUs < MockBusyUntilUs && (MockDC || Value != 0xff))
+        MockStats.BusyBytes++;
+
+    MockStats.Bytes++;
+    if (MockDC)
+    {
+        MockStats.DataBytes++;
+        if (MockCommand == 0x22)
+            MockSequence = Value;
+    } else
+    {
+        MockStats.Commands++;
+        MockCommand = Value;
+        // 0x04 runs the display pattern alone, used for partial updates,
+        // sequences without it (power on, 0xc0) don't touch the panel
+        if (Value == 0x20 && (MockSequence & 0x04))
+        {
+            if (MockSequence == 0x04)
+            {
+                MockStats.PartRefreshes++;
+                MockBusyUntilUs = MockStats.ElapsedUs + MockPartBusyMs * 1000;
+            } else
+            {
+                MockStats.FullRefreshes++;
+                MockBusyUntilUs = MockStats.ElapsedUs + MockFullBusyMs * 1000;
+            }
+        }
+    }
+
+    MockElapsedNs += MockByteTimeNs;
+    EpdMockAdvance(MockElapsedNs / 1000);
+    MockElapsedNs %= 1000;
+}
+
+static void EpdMockWrite(const uint8_t *pData, uint16_t Length)
+{
+    while (Length--)
+    {
+        EpdMockByte(*pData++);
+    }
+}
+
+static void EpdMockFill(uint8_t Value, uint16_t Length)
+{
+    while (Length--)
+    {
+        EpdMockByte(Value);
+    }
+}
+
+static void EpdMockDelay(uint32_t Ms)
+{
+    MockStats.DelayMs += Ms;
+    EpdMockAdvance(Ms * 1000);
+}
+
+static void EpdMockWriteWait(void)
+{
+}
+
+
+const EPD_IO_t EpdMockIO = {
+        EpdMockInit,
+        EpdMockSetCS,
+        EpdMockSetDC,
+        EpdMockSetRST,
+        EpdMockReadBusy,
+        EpdMockWrite,
+        EpdMockFill,
+        EpdMockDelay,
+        EpdMockWrite,
+        EpdMockWriteWait
+};
@@ -0,0 +1,143 @@
+#include "epd_transport.h"
+#include "main.h"
+
+/*
+ * SPI1 + DMA1 channel 3 backend.
+ *
+ * The current board routes the panel clock to PA6 and data to PA5, which
+ * SPI1 cannot drive (SCK is PA5/PB3, MOSI is PA7/PB5). This backend needs
+ * the panel CLK wired to PB3 and DIN to PB5; CS, DC, RST and BUSY stay on
+ * their GPIOs. Build with EPD_USE_SPI_DMA=1 on such boards, MX_GPIO_Init()
+ * then hands PB3 and PB5 to SPI1.
+ */
+
+DMA_HandleTypeDef hdma_spi1_tx;
+
+static volatile uint8_t SpiTxDone = 1;
+
+static void EpdSpiTxCplt(DMA_HandleTypeDef *hdma)
+{
+    SpiTxDone = 1;
+}
+
+static void EpdSpiWaitIdle(void)
+{
+    while (!(SPI1->SR & SPI_SR_TXE));
+    while (SPI1->SR & SPI_SR_BSY);
+}
+
+static void EpdSpiInit(void)
+{
+    __HAL_RCC_SPI1_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    /* Master, mode 0, MSB first, transmit only on one line, fPCLK/4 */
+    SPI1->CR1 = 0;
+    SPI1->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_0 |
+                SPI_CR1_BIDIMODE | SPI_CR1_BIDIOE;
+    SPI1->CR1 |= SPI_CR1_SPE;
+
+    hdma_spi1_tx.Instance = DMA1_Channel3;
+    hdma_spi1_tx.Init.Request = DMA_REQUEST_1;
+    hdma_spi1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_spi1_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi1_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spi1_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi1_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi1_tx.Init.Mode = DMA_NORMAL;
+    hdma_spi1_tx.Init.Priority = DMA_PRIORITY_LOW;
+    if (HAL_DMA_Init(&hdma_spi1_tx) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    hdma_spi1_tx.XferCpltCallback = EpdSpiTxCplt;
+
+    HAL_NVIC_SetPriority(DMA1_Channel2_3_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
+}
+
+static void EpdSpiPolled(const uint8_t *pData, uint16_t Length, uint8_t Increment)
+{
+    while (Length--)
+    {
+        while (!(SPI1->SR & SPI_SR_TXE));
+        *(volatile uint8_t *) &SPI1->DR = *pData;
+        if (Increment)
+            pData++;
+    }
+    EpdSpiWaitIdle();
+}
+
+static void EpdSpiDmaStart(const uint8_t *pData, uint16_t Length, uint8_t Increment)
+{
+    if (Increment)
+        SET_BIT(hdma_spi1_tx.Instance->CCR, DMA_CCR_MINC);
+    else
+        CLEAR_BIT(hdma_spi1_tx.Instance->CCR, DMA_CCR_MINC);
+
+    SpiTxDone = 0;
+    HAL_DMA_Start_IT(&hdma_spi1_tx, (uint32_t) pData, (uint32_t) &SPI1->DR, Length);
+    SPI1->CR2 |= SPI_CR2_TXDMAEN;
+}
+
+static void EpdSpiWriteWait(void)
+{
+    if (!(SPI1->CR2 & SPI_CR2_TXDMAEN))
+        return;
+
+    /* Sleep until the transfer complete interrupt, SysTick also wakes us */
+    while (!SpiTxDone)
+    {
+        __WFI();
+    }
+
+    SPI1->CR2 &= ~SPI_CR2_TXDMAEN;
+    EpdSpiWaitIdle();
+}
+
+static void EpdSpiDma(const uint8_t *pData, uint16_t Length, uint8_t Increment)
+{
+    EpdSpiDmaStart(pData, Length, Increment);
+    EpdSpiWriteWait();
+}
+
+static void EpdSpiWrite(const uint8_t *pData, uint16_t Length)
+{
+    if (Length < EPD_SPI_DMA_MIN_LEN)
+        EpdSpiPolled(pData, Length, 1);
+    else
+        EpdSpiDma(pData, Length, 1);
+}
+
+static void EpdSpiFill(uint8_t Value, uint16_t Length)
+{
+    static uint8_t FillValue;
+
+    FillValue = Value;
+    if (Length < EPD_SPI_DMA_MIN_LEN)
+        EpdSpiPolled(&FillValue, Length, 0);
+    else
+        EpdSpiDma(&FillValue, Length, 0);
+}
+
+static void EpdSpiWriteStart(const uint8_t *pData, uint16_t Length)
+{
+    if (Length < EPD_SPI_DMA_MIN_LEN)
+        EpdSpiPolled(pData, Length, 1);
+    else
+        EpdSpiDmaStart(pData, Length, 1);
+}
+
+
+const EPD_IO_t EpdSpiIO = {
+        EpdSpiInit,
+        EpdGpioSetCS,
+        EpdGpioSetDC,
+        EpdGpioSetRST,
+        EpdGpioReadBusy,
+        EpdSpiWrite,
+        EpdSpiFill,
+        EpdGpioDelay,
+        EpdSpiWriteStart,
+        EpdSpiWriteWait
+};
@@ -1,41 +1,37 @@
 #include "epd_w21_config.h"
+#include "epd_transport.h"
 #include "stm32l0xx_hal.h"
+#include "telemetry.h"
 
-void SpiDelay(unsigned char xrate)
+#if EPD_USE_MOCK
+static const EPD_IO_t *EpdIO = &EpdMockIO;
+#elif EPD_USE_SPI_DMA
+static const EPD_IO_t *EpdIO = &EpdSpiIO;
+#else
+static const EPD_IO_t *EpdIO = &EpdGpioIO;
+#endif
+
+void EpdSetTransport(const EPD_IO_t *pIO)
 {
-    unsigned char i;
-    while (xrate)
-    {
-        for (i = 0; i < 1; i++);
-        xrate--;
-    }
+    EpdIO = pIO;
 }
 
+/* Refresh in flight, finished from EpdProcess() once BUSY has dropped */
+static volatile unsigned char EpdRefreshing = 0;
+static EPD_DoneCallback_t EpdDoneCallback = 0;
 
-void DriverDelay(unsigned long xms)
-{
-    HAL_Delay(xms);
-}
+/* Set by EpdInitDeferred(), the panel is started on the way into the next command */
+static unsigned char EpdInitPending = 0;
 
+/* Windows rewritten into the previous-frame RAM after a partial refresh */
+static const unsigned char *EpdPendingFrame = 0;
+static EPD_Rect_t EpdPendingRects[EPD_MAX_WINDOWS];
+static unsigned char EpdPendingCount = 0;
 
-void SpiWrite(unsigned char value)
-{
-    unsigned char i;
 
-    SpiDelay(1);
-    for (i = 0; i < 8; i++)
-    {
-        EPD_W21_CLK_0;
-        SpiDelay(1);
-        if (value & 0x80)
-            EPD_W21_MOSI_1;
-        else
-            EPD_W21_MOSI_0;
-        value = (value << 1);
-        SpiDelay(1);
-        EPD_W21_CLK_1;
-        SpiDelay(1);
-    }
+void DriverDelay(unsigned long xms)
+{
+    EpdIO->Delay(xms);
 }
 
 
@@ -82,28 +78,61 @@ const unsigned char LUTDefault_full[31] = {
 };
 
 
-static unsigned char ReadBusy(void)
+/* Waits for BUSY to drop, returns the ms spent. power.c sleeps in STOP here */
+__weak unsigned long EpdBusyWait(void)
+{
+    DriverDelay(10);
+    return 10;
+}
+
+/* Last call before a refresh starts the charge pumps, Full or partial. supply.c holds it until there is the energy */
+__weak void EpdSupplyWait(unsigned char Full)
 {
-    unsigned long i = 0;
+    UNUSED(Full);
+}
+
 
+static unsigned char ReadBusy(void)
+{
+    unsigned long waited = 0;
+    uint32_t start = TelemetryNow();
 
-    for (i = 0; i < 400; i++)
+    while (waited < EPD_BUSY_TIMEOUT)
     {
-        if (isEPD_W21_BUSY == EPD_W21_BUSY_LEVEL)
+        if (!EpdIO->ReadBusy())
         {
+            if (waited)
+                TelemetryStop(TELEMETRY_BUSY, start);
             return 1;
         }
-        DriverDelay(10);
+        waited += EpdBusyWait();
     }
+    TelemetryStop(TELEMETRY_BUSY, start);
     return 0;
 }
 
+/* Every panel transaction is charged to the SPI stage, CS low to CS high */
+static uint32_t EpdSelectStamp;
+
+static void EpdW21Select(void)
+{
+    EpdSelectStamp = TelemetryNow();
+    EpdIO->SetCS(0);
+}
+
+static void EpdW21Deselect(void)
+{
+    EpdIO->SetCS(1);
+    TelemetryStop(TELEMETRY_SPI, EpdSelectStamp);
+}
+
+
 static void EpdW21WriteCMD(unsigned char command)
 {
-    EPD_W21_CS_0;
-    EPD_W21_DC_0;        // command write
-    SpiWrite(command);
-    EPD_W21_CS_1;
+    EpdW21Select();
+    EpdIO->SetDC(0);        // command write
+    EpdIO->Write(&command, 1);
+    EpdW21Deselect();
 }
 
 static void EpdW21WriteCMD_p1(unsigned char command, unsigned char para)
@@ -111,43 +140,30 @@ static void EpdW21WriteCMD_p1(unsigned char command, unsigned char para)
     //while(isEPD_W21_BUSY == 1);	// wait
     ReadBusy();
 
-    EPD_W21_CS_0;
-    EPD_W21_DC_0;        // command write
-    SpiWrite(command);
-    EPD_W21_DC_1;        // command write
-    SpiWrite(para);
-    EPD_W21_CS_1;
+    EpdW21Select();
+    EpdIO->SetDC(0);        // command write
+    EpdIO->Write(&command, 1);
+    EpdIO->SetDC(1);        // command write
+    EpdIO->Write(&para, 1);
+    EpdW21Deselect();
 }
 
 static void EpdW21Write(unsigned char *value, unsigned char datalen)
 {
-    unsigned char i = 0;
-    unsigned char *ptemp;
+    EpdW21Select();
+    EpdIO->SetDC(0);        // command write
+    EpdIO->Write(value, 1);
 
-    ptemp = value;
-
-    EPD_W21_CS_0;
-    EPD_W21_DC_0;        // command write
-
-    SpiWrite(*ptemp);
-    ptemp++;
-
-    EPD_W21_DC_1;        // data write
-
-    for (i = 0; i < datalen - 1; i++)    // sub the command
-    {
-        SpiWrite(*ptemp);
-        ptemp++;
-    }
-
-    EPD_W21_CS_1;
+    EpdIO->SetDC(1);        // data write
+    EpdIO->Write(value + 1, datalen - 1);    // sub the command
 
+    EpdW21Deselect();
 }
 
 static void EpdW21WriteDispRam(unsigned char XSize, unsigned int YSize,
                                unsigned char *Dispbuff)
 {
-    int i = 0, j = 0;
+    const unsigned char WriteRam = 0x24;
 
     if (XSize % 8 != 0)
     {
@@ -158,27 +174,20 @@ static void EpdW21WriteDispRam(unsigned char XSize, unsigned int YSize,
     //while(isEPD_W21_BUSY == 1);	//wait
     ReadBusy();
 
-    EPD_W21_CS_0;
-    EPD_W21_DC_0;        //command write
-    SpiWrite(0x24);
+    EpdW21Select();
+    EpdIO->SetDC(0);        //command write
+    EpdIO->Write(&WriteRam, 1);
 
-    EPD_W21_DC_1;        //data write
-    for (i = 0; i < YSize; i++)
-    {
-        for (j = 0; j < XSize; j++)
-        {
-            SpiWrite(*Dispbuff);
-            Dispbuff++;
-        }
-    }
+    EpdIO->SetDC(1);        //data write
+    EpdIO->Write(Dispbuff, XSize * YSize);
 
-    EPD_W21_CS_1;
+    EpdW21Deselect();
 }
 
 static void EpdW21WriteDispRamMono(unsigned char XSize, unsigned int YSize,
                                    unsigned char dispdata)
 {
-    int i = 0, j = 0;
+    const unsigned char WriteRam = 0x24;
 
     if (XSize % 8 != 0)
     {
@@ -188,20 +197,14 @@ static void EpdW21WriteDispRamMono(unsigned char XSize, unsigned int YSize,
     //while(isEPD_W21_BUSY == 1);	// wait
     ReadBusy();
 
-    EPD_W21_CS_0;
-    EPD_W21_DC_0;        // command write
-    SpiWrite(0x24);
+    EpdW21Select();
+    EpdIO->SetDC(0);        // command write
+    EpdIO->Write(&WriteRam, 1);
 
-    EPD_W21_DC_1;        // data write
-    for (i = 0; i < YSize; i++)
-    {
-        for (j = 0; j < XSize; j++)
-        {
-            SpiWrite(dispdata);
-        }
-    }
+    EpdIO->SetDC(1);        // data write
+    EpdIO->Fill(dispdata, XSize * YSize);
 
-    EPD_W21_CS_1;
+    EpdW21Deselect();
 }
 
 static void EpdW21PowerOn(void)
@@ -263,9 +266,11 @@ static void EpdW21DispInit(void)
 
 static void EpdW21Init(void)
 {
-    EPD_W21_RST_0;        // Module reset
+    EpdIO->Init();
+
+    EpdIO->SetRST(0);        // Module reset
     DriverDelay(100);
-    EPD_W21_RST_1;
+    EpdIO->SetRST(1);
     DriverDelay(100);
 
     EpdW21DispInit();        // pannel configure
@@ -273,17 +278,23 @@ static void EpdW21Init(void)
 
 static void EpdW21Update(void)
 {
+    EpdSupplyWait(1);
     EpdW21WriteCMD_p1(0x22, 0xc7);
     EpdW21WriteCMD(0x20);
     EpdW21WriteCMD(0xff);
+    EpdRefreshing = 1;
+    TelemetryCount(TELEMETRY_FULL);
 }
 
 static void EpdW21UpdatePart(void)
 {
+    EpdSupplyWait(0);
     EpdW21WriteCMD_p1(0x22, 0x04);
     //EpdW21WriteCMD_p1(0x22,0x08);
     EpdW21WriteCMD(0x20);
     EpdW21WriteCMD(0xff);
+    EpdRefreshing = 1;
+    TelemetryCount(TELEMETRY_PART);
 }
 
 static void EpdW21WirteLUT(unsigned char *LUTvalue, unsigned char Size)
@@ -291,17 +302,144 @@ static void EpdW21WirteLUT(unsigned char *LUTvalue, unsigned char Size)
     EpdW21Write(LUTvalue, Size);
 }
 
+/* LUT in the controller: 0 full, 1 partial or EPD_LUT_NONE */
+#define EPD_LUT_NONE 0xFF
 
-void EpdInitFull(void)
+static unsigned char EpdLutPart = 0;
+
+static void EpdW21SelectLUT(unsigned char part)
+{
+    if (part == EpdLutPart)
+        return;
+
+    ReadBusy();
+    if (part)
+        EpdW21WirteLUT((unsigned char *) LUTDefault_part, sizeof(LUTDefault_part));
+    else
+        EpdW21WirteLUT((unsigned char *) LUTDefault_full, sizeof(LUTDefault_full));
+    EpdLutPart = part;
+}
+
+static void EpdW21SetWindow(unsigned char xByteStart, unsigned char xByteEnd,
+                            unsigned char rowStart, unsigned char rowEnd)
+{
+    // frame row 0 is gate yDot - 1, the RAM pointer counts Y down
+    unsigned int yTop = yDot - 1 - rowStart;
+    unsigned int yBottom = yDot - 1 - rowEnd;
+
+    PartDisplay(xByteStart, xByteEnd, yTop % 256, yTop / 256, yBottom % 256, yBottom / 256);
+}
+
+static void EpdW21WriteDispRamWindow(const unsigned char *Frame, const EPD_Rect_t *Rect)
+{
+    const unsigned char WriteRam = 0x24;
+    unsigned char row;
+
+    EpdW21SetWindow(Rect->X0, Rect->X1, Rect->Y0, Rect->Y1);
+    ReadBusy();
+
+    EpdW21Select();
+    EpdIO->SetDC(0);        // command write
+    EpdIO->Write(&WriteRam, 1);
+
+    EpdIO->SetDC(1);        // data write
+    for (row = Rect->Y0; row <= Rect->Y1; row++)
+    {
+        EpdIO->Write(Frame + row * EPD_ROW_BYTES + Rect->X0, Rect->X1 - Rect->X0 + 1);
+    }
+
+    EpdW21Deselect();
+}
+
+
+static void EpdW21Complete(void)
 {
+    unsigned char i;
+
+    for (i = 0; i < EpdPendingCount; i++)
+        EpdW21WriteDispRamWindow(EpdPendingFrame, &EpdPendingRects[i]);
+    EpdPendingCount = 0;
+
+    EpdRefreshing = 0;
+    if (EpdDoneCallback)
+        EpdDoneCallback();
+}
+
+/* Reset, configuration and LUT, 0 full or 1 partial */
+static void EpdW21Start(unsigned char part)
+{
+    uint32_t start = TelemetryNow();
+
+    EpdInitPending = 0;
     EpdW21Init();            // display
-    EpdW21WirteLUT((unsigned char *) LUTDefault_full, sizeof(LUTDefault_full));
+    if (part)
+        EpdW21WirteLUT((unsigned char *) LUTDefault_part, sizeof(LUTDefault_part));
+    else
+        EpdW21WirteLUT((unsigned char *) LUTDefault_full, sizeof(LUTDefault_full));
+    EpdLutPart = part;
 
     EpdW21PowerOn();
+    TelemetryStop(TELEMETRY_PANEL_INIT, start);
+}
+
+/* Blocks until a refresh still in flight is done, before the next command */
+static void EpdW21Finish(void)
+{
+    if (EpdInitPending)
+        EpdW21Start(0);
+    if (!EpdRefreshing)
+        return;
+
+    ReadBusy();
+    EpdW21Complete();
+}
+
+
+void EpdSetDoneCallback(EPD_DoneCallback_t Callback)
+{
+    EpdDoneCallback = Callback;
+}
+
+unsigned char EpdIsBusy(void)
+{
+    return EpdRefreshing;
+}
+
+void EpdProcess(void)
+{
+    if (EpdRefreshing && !EpdIO->ReadBusy())
+        EpdW21Complete();
+}
+
+void EpdInitFull(void)
+{
+    EpdInitPending = 0;
+    EpdW21Finish();
+    EpdW21Start(0);
+}
+
+void EpdInitPart(void)
+{
+    EpdInitPending = 0;
+    EpdW21Finish();
+    EpdW21Start(1);
+}
+
+/*
+ * EpdInitFull() without the wait: the panel reset (2 x 100 ms) and the
+ * LUT upload happen on the way into the first command that needs them,
+ * so a boot that never gets a frame never pays for them.
+ */
+void EpdInitDeferred(void)
+{
+    EpdInitPending = 1;
 }
 
 void EpdDisFull(unsigned char *DisBuffer, unsigned char Label)
 {
+    EpdW21Finish();
+    EpdW21SelectLUT(0);
+    EpdW21SetRamArea(0x00, (xDot - 1) / 8, (yDot - 1) % 256, (yDot - 1) / 256, 0x00, 0x00);
     EpdW21SetRamPointer(0x00, (yDot - 1) % 256, (yDot - 1) / 256);    // set ram
     if (Label == 0)
     {
@@ -313,3 +451,220 @@ void EpdDisFull(unsigned char *DisBuffer, unsigned char Label)
     EpdW21Update();
 
 }
+
+void EpdDisPart(unsigned char xStart, unsigned char xEnd, unsigned long yStart, unsigned long yEnd,
+                unsigned char *DisBuffer, unsigned char Label)
+{
+    unsigned char i;
+
+    EpdW21Finish();
+    EpdW21SelectLUT(1);
+
+    // the second pass loads the same image into the controller's previous-frame RAM,
+    // which takes nothing while BUSY is high: this one waits the refresh out
+    for (i = 0; i < 2; i++)
+    {
+        PartDisplay(xStart / 8, xEnd / 8, yEnd % 256, yEnd / 256, yStart % 256, yStart / 256);
+        if (Label == 0)
+            EpdW21WriteDispRamMono(xEnd - xStart, yEnd - yStart + 1, DisBuffer[0]);
+        else
+            EpdW21WriteDispRam(xEnd - xStart, yEnd - yStart + 1, DisBuffer);
+
+        if (i == 0)
+        {
+            EpdW21UpdatePart();
+            EpdW21Finish();
+        }
+    }
+}
+
+void EpdDisPartWindows(const unsigned char *Frame, const EPD_Rect_t *Rects, unsigned char Count)
+{
+    unsigned char i;
+
+    EpdW21Finish();
+    EpdW21SelectLUT(1);
+
+    if (Count > EPD_MAX_WINDOWS)
+        Count = EPD_MAX_WINDOWS;
+
+    for (i = 0; i < Count; i++)
+    {
+        EpdW21WriteDispRamWindow(Frame, &Rects[i]);
+        EpdPendingRects[i] = Rects[i];
+    }
+
+    EpdW21UpdatePart();
+
+    // the second pass waits for BUSY, so it runs from EpdProcess()
+    EpdPendingFrame = Frame;
+    EpdPendingCount = Count;
+}
+
+/* Writes the whole RAM from Producer through the two bands at pBands, returns the rows written */
+static unsigned int EpdW21WriteBands(EPD_BandProducer_t Producer, unsigned char *pBands)
+{
+    const unsigned char WriteRam = 0x24;
+    unsigned char *band = pBands;
+    unsigned int row = 0;
+    unsigned int rows, next;
+
+    EpdW21SetRamArea(0x00, (xDot - 1) / 8, (yDot - 1) % 256, (yDot - 1) / 256, 0x00, 0x00);
+    EpdW21SetRamPointer(0x00, (yDot - 1) % 256, (yDot - 1) / 256);
+    ReadBusy();
+
+    EpdW21Select();
+    EpdIO->SetDC(0);        // command write
+    EpdIO->Write(&WriteRam, 1);
+
+    EpdIO->SetDC(1);        // data write
+    rows = Producer(0, band, EPD_BAND_ROWS);
+    while (rows && row + rows <= yDot)
+    {
+        EpdIO->WriteStart(band, rows * EPD_ROW_BYTES);
+        row += rows;
+
+        band = band == pBands ? pBands + EPD_BAND_ROWS * EPD_ROW_BYTES : pBands;
+        next = row < yDot ? Producer(row, band, EPD_BAND_ROWS) : 0;
+        EpdIO->WriteWait();
+        rows = next;
+    }
+
+    EpdW21Deselect();
+    return row;
+}
+
+/*
+ * Full refresh pulled band by band from Producer, without a frame buffer.
+ * Each band is decoded while the previous one is still going out, pBands
+ * holds EPD_BANDS_SIZE bytes for the two of them. Returns 0 and leaves the panel as it is when the producer gives up early, the
+ * rows already written stay in the controller RAM.
+ */
+unsigned char EpdDisBands(EPD_BandProducer_t Producer, unsigned char *pBands)
+{
+    EpdW21Finish();
+    EpdW21SelectLUT(0);
+
+    if (EpdW21WriteBands(Producer, pBands) != yDot)
+        return 0;
+    EpdW21Update();
+    return 1;
+}
+
+/*
+ * Grayscale pass waveform, same layout as LUTDefault_part: one VS byte per
+ * phase (old/new pixel 00, 01, 10, 11 from the top bits down) and a TP
+ * nibble per phase, low nibble first. Pixels written 0 are driven towards
+ * black (VSL) for Frames frames whatever they were, the others float (VSS).
+ */
+#define EPD_LUT_VS_GRAY     0x88
+#define EPD_LUT_PHASES      20
+#define EPD_LUT_PHASE_MAX   15
+
+static const unsigned char EpdGrayFrames[EPD_GRAY_PASSES] = EPD_GRAY_FRAMES;
+
+static void EpdW21GrayLUT(unsigned int Frames)
+{
+    unsigned char lut[sizeof(LUTDefault_part)] = {0x32};
+    unsigned char phase, count;
+
+    for (phase = 0; phase < EPD_LUT_PHASES && Frames; phase++)
+    {
+        count = Frames < EPD_LUT_PHASE_MAX ? Frames : EPD_LUT_PHASE_MAX;
+        lut[1 + phase] = EPD_LUT_VS_GRAY;
+        lut[1 + EPD_LUT_PHASES + phase / 2] |= phase % 2 ? count << 4 : count;
+        Frames -= count;
+    }
+    EpdW21WirteLUT(lut, sizeof(lut));
+}
+
+/* Pass 0 darkens levels 0 and 1, pass 1 levels 0 and 2, pass 2 level 0 */
+void EpdGrayPlane(unsigned char Pass, const unsigned char *pHigh, const unsigned char *pLow, unsigned char *pOut)
+{
+    unsigned char i;
+
+    for (i = 0; i < EPD_ROW_BYTES; i++)
+    {
+        if (Pass == 0)
+            pOut[i] = pHigh[i];
+        else if (Pass == 1)
+            pOut[i] = pLow[i];
+        else
+            pOut[i] = pHigh[i] | pLow[i];
+    }
+}
+
+static EPD_GrayProducer_t EpdGrayProducer;
+static unsigned char EpdGrayPass;
+
+static unsigned int EpdW21GrayBand(unsigned int Row, unsigned char *pBand, unsigned int Rows)
+{
+    return EpdGrayProducer(EpdGrayPass, Row, pBand, Rows);
+}
+
+/*
+ * 2bpp image in EPD_GRAY_PASSES partial passes over a white full refresh.
+ * Each pass writes one plane from Producer and darkens its 0 pixels for
+ * EpdGrayFrames[pass] frames, so a level's gray is the sum of the passes
+ * it takes part in. The last pass finishes from EpdProcess().
+ */
+unsigned char EpdDisGray(EPD_GrayProducer_t Producer, unsigned char *pBands)
+{
+    unsigned char pass;
+
+    EpdDisFull(0, 0);
+    ReadBusy();
+    EpdRefreshing = 0;
+    // the full update sequence switched the analog part off
+    EpdW21PowerOn();
+
+    EpdGrayProducer = Producer;
+    for (pass = 0; pass < EPD_GRAY_PASSES; pass++)
+    {
+        EpdGrayPass = pass;
+        if (EpdW21WriteBands(EpdW21GrayBand, pBands) != yDot)
+            break;
+
+        EpdW21GrayLUT(EpdGrayFrames[pass]);
+        EpdW21UpdatePart();
+        if (pass + 1 < EPD_GRAY_PASSES)
+        {
+            ReadBusy();
+            EpdRefreshing = 0;
+        }
+    }
+
+    // neither stock LUT is loaded any more
+    EpdLutPart = EPD_LUT_NONE;
+    return pass == EPD_GRAY_PASSES;
+}
+
+void EpdStreamBegin(void)
+{
+    EpdW21Finish();
+    EpdW21SelectLUT(0);
+    EpdW21SetRamArea(0x00, (xDot - 1) / 8, (yDot - 1) % 256, (yDot - 1) / 256, 0x00, 0x00);
+}
+
+void EpdStreamWrite(unsigned int Offset, const unsigned char *pData, unsigned int Length)
+{
+    const unsigned char WriteRam = 0x24;
+    unsigned int y = yDot - 1 - Offset / EPD_ROW_BYTES;
+
+    EpdW21SetRamPointer(Offset % EPD_ROW_BYTES, y % 256, y / 256);
+    ReadBusy();
+
+    EpdW21Select();
+    EpdIO->SetDC(0);        // command write
+    EpdIO->Write(&WriteRam, 1);
+
+    EpdIO->SetDC(1);        // data write
+    EpdIO->Write(pData, Length);
+
+    EpdW21Deselect();
+}
+
+void EpdStreamShow(void)
+{
+    EpdW21Update();
+}
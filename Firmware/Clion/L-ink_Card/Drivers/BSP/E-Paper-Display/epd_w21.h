@@ -1,18 +1,98 @@
 #ifndef _DISPLAY_EPD_W21_H_
 #define _DISPLAY_EPD_W21_H_
 
+#include "epd_transport.h"
+
+#define xDot 200
+#define yDot 200
+
+#define EPD_ROW_BYTES   (xDot / 8)
+#define EPD_FRAME_SIZE  (EPD_ROW_BYTES * yDot)
+
+/* Window in frame buffer coordinates: X in bytes, Y in rows, both inclusive */
+typedef struct
+{
+    unsigned char X0;
+    unsigned char X1;
+    unsigned char Y0;
+    unsigned char Y1;
+} EPD_Rect_t;
+
+/* Most windows one partial refresh can carry */
+#define EPD_MAX_WINDOWS 4
+
+/*
+ * Band producer for EpdDisBands(): fills pBand with up to Rows rows of the
+ * frame starting at Row, EPD_ROW_BYTES per row, and returns how many it
+ * wrote, 0 to give up. It runs while the previous band goes out on SPI, so
+ * it must not talk to the panel.
+ */
+typedef unsigned int (*EPD_BandProducer_t)(unsigned int Row, unsigned char *pBand, unsigned int Rows);
+
+/* Rows per band, the caller lends the driver two bands */
+#ifndef EPD_BAND_ROWS
+#define EPD_BAND_ROWS 8
+#endif
+
+#define EPD_BANDS_SIZE (2 * EPD_BAND_ROWS * EPD_ROW_BYTES)
+
+/* Same as EPD_BandProducer_t, Pass is the grayscale pass being written */
+typedef unsigned int (*EPD_GrayProducer_t)(unsigned char Pass, unsigned int Row, unsigned char *pBand,
+                                           unsigned int Rows);
+
+/* Darkening passes of a 2bpp image, see EpdDisGray() */
+#define EPD_GRAY_PASSES 3
+
+/* Frames each pass drives for, level 1 gets the first, level 2 the second, black all three */
+#ifndef EPD_GRAY_FRAMES
+#define EPD_GRAY_FRAMES {21, 8, 40}
+#endif
+
+/* Called from EpdProcess() when a refresh has finished */
+typedef void (*EPD_DoneCallback_t)(void);
+
+/* Longest a full refresh may keep BUSY high */
+#define EPD_BUSY_TIMEOUT 4000
+
 extern void DriverDelay(unsigned long xms);
 
+extern unsigned long EpdBusyWait(void);
+
+extern void EpdSupplyWait(unsigned char Full);
+
 extern void EpdDisPart(unsigned char xStart, unsigned char xEnd, unsigned long yStart, unsigned long yEnd,
                        unsigned char *DisBuffer, unsigned char Label);
 
 extern void EpdDisFull(unsigned char *DisBuffer, unsigned char Label);
 
+extern void EpdDisPartWindows(const unsigned char *Frame, const EPD_Rect_t *Rects, unsigned char Count);
+
+extern unsigned char EpdDisBands(EPD_BandProducer_t Producer, unsigned char *pBands);
+
+extern unsigned char EpdDisGray(EPD_GrayProducer_t Producer, unsigned char *pBands);
+
+extern void EpdGrayPlane(unsigned char Pass, const unsigned char *pHigh, const unsigned char *pLow,
+                         unsigned char *pOut);
+
+extern void EpdStreamBegin(void);
+
+extern void EpdStreamWrite(unsigned int Offset, const unsigned char *pData, unsigned int Length);
+
+extern void EpdStreamShow(void);
+
 extern void EpdInitFull(void);
 
 extern void EpdInitPart(void);
 
-extern void SpiWrite(unsigned char value);
+extern void EpdInitDeferred(void);
+
+extern void EpdSetTransport(const EPD_IO_t *pIO);
+
+extern void EpdSetDoneCallback(EPD_DoneCallback_t Callback);
+
+extern unsigned char EpdIsBusy(void);
+
+extern void EpdProcess(void);
 
 #define EPD_W21_MOSI_0    HAL_GPIO_WritePin(GPIOA,GPIO_PIN_5,GPIO_PIN_RESET)
 #define EPD_W21_MOSI_1    HAL_GPIO_WritePin(GPIOA,GPIO_PIN_5,GPIO_PIN_SET)
@@ -3,9 +3,6 @@
 
 #include "epd_w21.h"
 
-#define xDot 200
-#define yDot 200
-
 unsigned char GDOControl[] = {0x01, (yDot - 1) % 256, (yDot - 1) / 256, 0x00}; //for 1.54inch
 unsigned char softStart[] = {0x0c, 0xd7, 0xd6, 0x9d};
 unsigned char ramBypass[] = {0x21, 0x8f};        // Display update
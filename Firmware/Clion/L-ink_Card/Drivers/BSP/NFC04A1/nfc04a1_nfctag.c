@@ -736,6 +736,45 @@ int32_t NFC04A1_NFCTAG_ReadMailboxData(uint32_t Instance, uint8_t * const pData,
   return ST25DV_ReadMailboxData(&NfcTagObj, pData, TarAddr, NbByte);
 }
 
+/**
+  * @brief  Starts a DMA read of N bytes from the Mailbox, the bus driver calls
+  *         BSP_I2C1_RxCpltCallback() once the data is in.
+  * @param  pData   Pointer on the buffer, must stay valid until the callback.
+  * @param  Offset  Offset in the Mailbox memory, byte number to start the read.
+  * @param  NbByte  Number of bytes to be read.
+  * @return int32_t enum status.
+  */
+int32_t NFC04A1_NFCTAG_ReadMailboxData_DMA(uint32_t Instance, uint8_t * const pData,  const uint16_t TarAddr,  const uint16_t NbByte )
+{
+  UNUSED(Instance);
+  if( (TarAddr + NbByte) > ST25DV_MAX_MAILBOX_LENGTH )
+  {
+    return NFCTAG_ERROR;
+  }
+  if( NFC04A1_I2C_ReadReg16_DMA(ST25DV_ADDR_DATA_I2C, ST25DV_MAILBOX_RAM_REG + TarAddr, pData, NbByte) != BSP_ERROR_NONE )
+  {
+    return NFCTAG_ERROR;
+  }
+  return NFCTAG_OK;
+}
+
+/**
+  * @brief  Starts a DMA read of MB_CTRL_Dyn and MB_LEN_Dyn, the bus driver calls
+  *         BSP_I2C1_RxCpltCallback() once both bytes are in.
+  * @param  pData   2 bytes: the ST25DV_MB_CTRL_DYN_* bits then the message length - 1,
+  *                 must stay valid until the callback.
+  * @return int32_t enum status.
+  */
+int32_t NFC04A1_NFCTAG_ReadMBStatus_DMA(uint32_t Instance, uint8_t * const pData)
+{
+  UNUSED(Instance);
+  if( NFC04A1_I2C_ReadReg16_DMA(ST25DV_ADDR_DATA_I2C, ST25DV_MB_CTRL_DYN_REG, pData, 2) != BSP_ERROR_NONE )
+  {
+    return NFCTAG_ERROR;
+  }
+  return NFCTAG_OK;
+}
+
 /**
   * @brief  Writes N bytes of data in the Mailbox, starting from first Mailbox Address.
   * @param  pData   Pointer to the buffer containing the data to be written.
@@ -117,6 +117,8 @@ int32_t NFC04A1_NFCTAG_WriteMBMode(uint32_t Instance, const ST25DV_EN_STATUS MB_
 int32_t NFC04A1_NFCTAG_ReadMBWDG(uint32_t Instance, uint8_t * const pWdgDelay );
 int32_t NFC04A1_NFCTAG_WriteMBWDG(uint32_t Instance, const uint8_t WdgDelay );
 int32_t NFC04A1_NFCTAG_ReadMailboxData(uint32_t Instance, uint8_t * const pData,  const uint16_t TarAddr,  const uint16_t NbByte );
+int32_t NFC04A1_NFCTAG_ReadMailboxData_DMA(uint32_t Instance, uint8_t * const pData,  const uint16_t TarAddr,  const uint16_t NbByte );
+int32_t NFC04A1_NFCTAG_ReadMBStatus_DMA(uint32_t Instance, uint8_t * const pData );
 int32_t NFC04A1_NFCTAG_WriteMailboxData(uint32_t Instance, const uint8_t * const pData,  const uint16_t NbByte );
 int32_t NFC04A1_NFCTAG_ReadMailboxRegister(uint32_t Instance, uint8_t * const pData,  const uint16_t TarAddr,  const uint16_t NbByte );
 int32_t NFC04A1_NFCTAG_WriteMailboxRegister(uint32_t Instance, const uint8_t * const pData,  const uint16_t TarAddr,  const uint16_t NbByte );
@@ -2,10 +2,25 @@
 #include "app_nfc.h"
 #include "nfc04a1_nfctag.h"
 #include "../E-Paper-Display/epd_w21.h"
-#include <stdio.h>
+#include "../E-Paper-Display/epd_partial.h"
+#include "frame_codec.h"
+#include "image_store.h"
+#include "frame_link.h"
+#include "frame_delta.h"
+#include "fw_update.h"
+#include "fw_flash.h"
+#include "draw_render.h"
+#include "power.h"
+#include "supply.h"
+#include "nvm.h"
+#include "clock.h"
+#include "telemetry.h"
+#include "log.h"
+#include <string.h>
 
 uint8_t cnt = 0;
 uint16_t mblength;
+uint8_t mblength8;
 ST25DV_MB_CTRL_DYN_STATUS mbctrldynstatus;
 ST25DV_EN_STATUS MB_mode;
 ST25DV_PASSWD passwd;
@@ -16,71 +31,125 @@ void MX_NFC4_MAILBOX_Init(void);
 
 void MX_NFC4_MAILBOX_Process(void);
 
+static void FrameShown(void);
+
+static void MX_NFC4_STORE_Init(void);
+
+static void MX_NFC4_DELTA_Init(void);
+
+#if FW_UPDATE
+static void MX_NFC4_UPDATE_Init(void);
+#endif
+
 void MX_NFC_Init(void)
 {
     MX_NFC4_MAILBOX_Init();
+    SupplyInit();
+    MX_NFC4_STORE_Init();
+    MX_NFC4_DELTA_Init();
+#if FW_UPDATE
+    MX_NFC4_UPDATE_Init();
+#endif
+    EpdSetDoneCallback(FrameShown);
 }
 
 void MX_NFC_Process(void)
 {
     MX_NFC4_MAILBOX_Process();
+    EpdProcess();
 }
 
 
-void MX_NFC4_MAILBOX_Init(void)
+/* Static registers the card relies on, and the word kept in NVM_TAG_CONFIG once they are in place */
+#define NFC_GPO_CONFIG      (ST25DV_GPO_ENABLE_MASK | ST25DV_GPO_RFGETMSG_MASK | ST25DV_GPO_RFPUTMSG_MASK)
+#define NFC_TAG_CONFIG      (0x4C000000UL | ((uint32_t) ST25DV_EH_ACTIVE_AFTER_BOOT << 16) | NFC_GPO_CONFIG)
+
+/*
+ * Checks the static configuration register by register and writes only
+ * what differs, each write being ~5 ms of tag EEPROM programming. Cut
+ * short by a power loss, the next boot picks up from what is in place.
+ * Once all of it is, NVM_TAG_CONFIG says so and later boots skip the
+ * session, the reads and the writes.
+ */
+static void MailboxConfigure(void)
 {
-    /* Init ST25DV driver */
-    while (NFC04A1_NFCTAG_Init(NFC04A1_NFCTAG_INSTANCE) != NFCTAG_OK);
+    ST25DV_EH_MODE_STATUS ehMode;
+    uint16_t gpo;
+    int32_t status = NFCTAG_OK;
+
+    if (NvmRead(NVM_TAG_CONFIG) == NFC_TAG_CONFIG)
+    {
+        TelemetryCount(TELEMETRY_CONFIG_CACHED);
+        return;
+    }
 
     /* You need to present password to change static configuration */
     NFC04A1_NFCTAG_ReadI2CSecuritySession_Dyn(NFC04A1_NFCTAG_INSTANCE, &i2csso);
     if (i2csso == ST25DV_SESSION_CLOSED)
     {
         /* if I2C session is closed, present password to open session */
-        passwd.MsbPasswd = 0;
-        passwd.LsbPasswd = 0;
+        passwd.MsbPasswd = 0; /* Default value for password */
+        passwd.LsbPasswd = 0; /* change it if password has been modified */
         NFC04A1_NFCTAG_PresentI2CPassword(NFC04A1_NFCTAG_INSTANCE, passwd);
     }
 
     /* Energy harvesting activated after Power On Reset */
-    NFC04A1_NFCTAG_WriteEHMode(NFC04A1_NFCTAG_INSTANCE, ST25DV_EH_ACTIVE_AFTER_BOOT);
-    NFC04A1_NFCTAG_SetEHENMode_Dyn(NFC04A1_NFCTAG_INSTANCE);
+    if (NFC04A1_NFCTAG_ReadEHMode(NFC04A1_NFCTAG_INSTANCE, &ehMode) != NFCTAG_OK ||
+        ehMode != ST25DV_EH_ACTIVE_AFTER_BOOT)
+        status |= NFC04A1_NFCTAG_WriteEHMode(NFC04A1_NFCTAG_INSTANCE, ST25DV_EH_ACTIVE_AFTER_BOOT);
 
     /* If not activated, activate Mailbox, as long as MB is ON EEPROM is not available */
-    NFC04A1_NFCTAG_ReadMBMode(NFC04A1_NFCTAG_INSTANCE, &MB_mode);
-    if (MB_mode == ST25DV_DISABLE)
-    {
-        /* You need to present password before changing static configuration */
-        NFC04A1_NFCTAG_ReadI2CSecuritySession_Dyn(NFC04A1_NFCTAG_INSTANCE, &i2csso);
-        if (i2csso == ST25DV_SESSION_CLOSED)
-        {
-            /* if I2C session is closed, present password to open session */
-            passwd.MsbPasswd = 0; /* Default value for password */
-            passwd.LsbPasswd = 0; /* change it if password has been modified */
-            NFC04A1_NFCTAG_PresentI2CPassword(NFC04A1_NFCTAG_INSTANCE, passwd);
-        }
-        NFC04A1_NFCTAG_WriteMBMode(NFC04A1_NFCTAG_INSTANCE, ST25DV_ENABLE);
+    if (NFC04A1_NFCTAG_ReadMBMode(NFC04A1_NFCTAG_INSTANCE, &MB_mode) != NFCTAG_OK || MB_mode == ST25DV_DISABLE)
+        status |= NFC04A1_NFCTAG_WriteMBMode(NFC04A1_NFCTAG_INSTANCE, ST25DV_ENABLE);
 
-        /* Close session as dynamic register doesn't need open session for modification */
-        passwd.MsbPasswd = 123;
-        passwd.LsbPasswd = 123;
-        NFC04A1_NFCTAG_PresentI2CPassword(NFC04A1_NFCTAG_INSTANCE, passwd);
-    }
+    /* GPO on mailbox traffic */
+    if (NFC04A1_NFCTAG_GetITStatus(NFC04A1_NFCTAG_INSTANCE, &gpo) != NFCTAG_OK || gpo != NFC_GPO_CONFIG)
+        status |= NFC04A1_NFCTAG_ConfigIT(NFC04A1_NFCTAG_INSTANCE, NFC_GPO_CONFIG);
+
+    /* Close session as dynamic register doesn't need open session for modification */
+    passwd.MsbPasswd = 123;
+    passwd.LsbPasswd = 123;
+    NFC04A1_NFCTAG_PresentI2CPassword(NFC04A1_NFCTAG_INSTANCE, passwd);
+
+    if (status == NFCTAG_OK)
+        NvmWrite(NVM_TAG_CONFIG, NFC_TAG_CONFIG);
+}
+
+/*
+ * Boot in stages, each timed to telemetry: wait for the tag, bring its
+ * static configuration in line, then the dynamic registers that every
+ * power cycle clears. The panel is left for the first frame (see
+ * EpdInitDeferred()).
+ */
+void MX_NFC4_MAILBOX_Init(void)
+{
+    ST25DV_EN_STATUS mbEnabled;
+    uint32_t start = TelemetryNow();
 
-    /* Enable Mailbox in dynamique register */
+    /* Init ST25DV driver. The tag boots off the same supply: nap while it does rather than spin */
+    while (NFC04A1_NFCTAG_Init(NFC04A1_NFCTAG_INSTANCE) != NFCTAG_OK)
+        PowerNap(NFC_TAG_RETRY_MS);
+    TelemetryStop(TELEMETRY_BOOT_TAG, start);
+
+    start = TelemetryNow();
+    MailboxConfigure();
+
+    /* Enable Mailbox in dynamique register. Refused, the static mode was changed behind the cache's back */
+    NFC04A1_NFCTAG_SetEHENMode_Dyn(NFC04A1_NFCTAG_INSTANCE);
     NFC04A1_NFCTAG_SetMBEN_Dyn(NFC04A1_NFCTAG_INSTANCE);
-    printf("\n\r\n\rMailbox is activated");
+    if (NFC04A1_NFCTAG_GetMBEN_Dyn(NFC04A1_NFCTAG_INSTANCE, &mbEnabled) == NFCTAG_OK && mbEnabled != ST25DV_ENABLE)
+    {
+        NvmWrite(NVM_TAG_CONFIG, 0);
+        MailboxConfigure();
+        NFC04A1_NFCTAG_SetMBEN_Dyn(NFC04A1_NFCTAG_INSTANCE);
+    }
+    TelemetryStop(TELEMETRY_BOOT_CONFIG, start);
+    LOG(LOG_MAILBOX_ON);
 
     /* Set EXTI settings for GPO Interrupt */
     NFC04A1_GPO_Init();
-    /* Present configuration password */
-    passwd.MsbPasswd = 0; /* Default value for password */
-    passwd.LsbPasswd = 0; /* change it if password has been modified */
-    NFC04A1_NFCTAG_PresentI2CPassword(NFC04A1_NFCTAG_INSTANCE, passwd);
-    /* Set GPO Configuration */
-    NFC04A1_NFCTAG_ConfigIT(NFC04A1_NFCTAG_INSTANCE,
-                            ST25DV_GPO_ENABLE_MASK | ST25DV_GPO_RFGETMSG_MASK | ST25DV_GPO_RFPUTMSG_MASK);
-
+    /* A message put before, while the bootloader had the tag, raised no edge here: look once */
+    GPOActivated = 1;
 }
 
 /**
@@ -88,66 +157,695 @@ void MX_NFC4_MAILBOX_Init(void)
 * @retval None
 */
 
+#if !NFC_STREAM_TO_EPD
 extern unsigned char nfcBuffer[];
-int bufferIndex = 0;
+#endif
+
+/*
+ * With NFC_MAILBOX_DMA the GPO interrupt drains the mailbox into one of two
+ * buffers: MB_CTRL_Dyn and MB_LEN_Dyn, then the message, both DMA reads
+ * chained from BSP_I2C1_RxCpltCallback(). Reading the message frees the
+ * mailbox, so the reader sends the next one while the main loop still
+ * works on this one. A buffer is busy from the end of its read until its
+ * message has been dispatched; with both busy, the GPO waits for one.
+ */
+#if NFC_MAILBOX_DMA
+#define MB_BUFFERS          2
+#else
+#define MB_BUFFERS          1
+#endif
+
+#define MB_DRAIN_IDLE       0
+#define MB_DRAIN_STATUS     1   // reading MB_CTRL_Dyn and MB_LEN_Dyn
+#define MB_DRAIN_DATA       2   // reading the message
+
+static uint8_t mbBuffers[MB_BUFFERS][FRAME_CHUNK_MAX];
+/* The message being dispatched, also scratch for what runs outside a dispatch */
+uint8_t *mbBuffer = mbBuffers[0];
+FRAME_Header_t frameHeader;
+FRAME_Decoder_t frameDecoder;
+uint8_t frameActive = 0;
+uint8_t frameLegacy = 0;
+uint8_t frameStoring = 0;
+uint8_t frameGrayShow = 0;
+uint8_t storeSaveSlot = STORE_SLOT_NONE;
+uint8_t storeShown = STORE_SLOT_NONE;
+uint8_t storeBoot = STORE_SLOT_NONE;
+LINK_Transfer_t linkTransfer;
+DELTA_Transfer_t frameDelta;
+#if FW_UPDATE
+UPDATE_Transfer_t fwUpdate;
+#endif
+static uint32_t mbReadStamp;
+#if NFC_MAILBOX_DMA
+static volatile uint16_t mbLengths[MB_BUFFERS];     // 0 while the buffer is free
+static uint8_t mbCtrl[MB_BUFFERS];
+static uint8_t mbStatus[2];
+static volatile uint8_t mbDrain = MB_DRAIN_IDLE;
+static volatile uint8_t mbPaused = 0;
+static uint8_t mbFill = 0;
+static uint8_t mbTake = 0;
+#endif
+
+/* Decoding, rendering and panel transfers are bursts, over sooner on the PLL. Not on a supply running low */
+static void NfcBoost(void)
+{
+    ClockSet(SupplyLevel() == SUPPLY_LEVEL_LOW ? CLOCK_LEVEL_RUN : CLOCK_LEVEL_BOOST);
+}
+
+/* Called before the first FrameSink() of a frame */
+static void FrameBegin(void)
+{
+    NfcBoost();
+#if NFC_STREAM_TO_EPD
+    EpdStreamBegin();
+#endif
+}
+
+static void FrameSink(uint16_t Offset, const uint8_t *pData, uint16_t Length)
+{
+#if NFC_STREAM_TO_EPD
+    /* Mailbox is free again, the reader sends the next chunk while this one goes out on SPI */
+    EpdStreamWrite(Offset, pData, Length);
+#else
+    EpdPartUpdate(nfcBuffer, Offset, pData, Length);
+    DeltaFrameChanged(&frameDelta);
+#endif
+}
+
+#if !NFC_STREAM_TO_EPD
+/* A delta patches the frame it was checked against, it doesn't void itself */
+static void DeltaSink(uint16_t Offset, const uint8_t *pData, uint16_t Length)
+{
+    EpdPartUpdate(nfcBuffer, Offset, pData, Length);
+}
+#endif
+
+/* The refresh runs on its own, the mailbox keeps being served meanwhile */
+static void FrameShow(void)
+{
+    NfcBoost();
+#if NFC_STREAM_TO_EPD
+    EpdStreamShow();
+#else
+    EpdPartShow((unsigned char *) nfcBuffer);
+#endif
+}
+
+static void FrameShown(void)
+{
+    LOG(LOG_REFRESH_DONE);
+#if !NFC_STREAM_TO_EPD
+    /* Restarted by every refresh, so the cleanup waits for the card to be left alone.
+       A slot cycle wakes us up anyway and owns the timer */
+    if (!StoreGetTable()->Cycle)
+        PowerSetWakeupTimer(EpdPartCleanupDue() ? NFC_CLEANUP_IDLE_MS : 0);
+#endif
+}
+
+static void MX_NFC4_DELTA_Init(void)
+{
+#if NFC_STREAM_TO_EPD
+    /* The panel RAM can't be read back, there is no frame to patch */
+    DeltaInit(&frameDelta, NULL, NULL);
+#else
+    DeltaInit(&frameDelta, nfcBuffer, DeltaSink);
+#endif
+}
+
+#if FW_UPDATE
+static void MX_NFC4_UPDATE_Init(void)
+{
+    UpdateInit(&fwUpdate, FwFlashGet());
+}
+#endif
+
+static void MX_NFC4_STORE_Init(void)
+{
+    uint32_t start = TelemetryNow();
+    int32_t status = StoreInit();
+
+    TelemetryStop(TELEMETRY_BOOT_STORE, start);
+    if (status != STORE_OK)
+        return;
+
+    /* Shown from the first MX_NFC_Process(), which starts the panel */
+    storeBoot = StoreGetTable()->Active;
+    if (StoreGetTable()->Cycle)
+        PowerSetWakeupTimer(StoreGetTable()->Cycle * 1000UL);
+}
+
+static unsigned char *bandOut;
+static uint8_t grayPass;
+
+#if NFC_STREAM_TO_EPD
+/* The two bands EpdDisBands() and EpdDisGray() write from */
+static unsigned char epdBands[EPD_BANDS_SIZE];
+#define GRAY_BANDS epdBands
+#else
+/* A gray image has no frame to keep, nfcBuffer lends its first rows */
+#define GRAY_BANDS nfcBuffer
+#endif
+
+/* Each decoded band holds FRAME_DECODE_ROWS / 2 rows of both planes */
+static void GraySink(uint16_t Offset, const uint8_t *pData, uint16_t Length)
+{
+    uint16_t row;
+
+    UNUSED(Offset);
+    for (row = 0; row < Length / (2 * FRAME_ROW_BYTES); row++)
+        EpdGrayPlane(grayPass, pData + 2 * row * FRAME_ROW_BYTES, pData + (2 * row + 1) * FRAME_ROW_BYTES,
+                     bandOut + row * FRAME_ROW_BYTES);
+}
+
+/* EpdDisGray() producer, the slot is replayed from the start for every pass */
+static unsigned int GrayBand(unsigned char Pass, unsigned int Row, unsigned char *pBand, unsigned int Rows)
+{
+    if (Rows < FRAME_DECODE_ROWS / 2)
+        return 0;
+    if (Row == 0 && StoreRewind(&frameDecoder) != STORE_OK)
+        return 0;
+
+    grayPass = Pass;
+    bandOut = pBand;
+    return StoreDecodeBand(&frameDecoder) == STORE_ERROR ? 0 : FRAME_DECODE_ROWS / 2;
+}
+
+#if NFC_STREAM_TO_EPD
+static void BandSink(uint16_t Offset, const uint8_t *pData, uint16_t Length)
+{
+    UNUSED(Offset);
+    memcpy(bandOut, pData, Length);
+}
+
+/* EpdDisBands() producer, the next slot band is decoded while the last one goes out */
+static unsigned int SlotBand(unsigned int Row, unsigned char *pBand, unsigned int Rows)
+{
+    UNUSED(Row);
+    if (Rows < FRAME_DECODE_ROWS)
+        return 0;
+
+    bandOut = pBand;
+    return StoreDecodeBand(&frameDecoder) == STORE_ERROR ? 0 : FRAME_DECODE_ROWS;
+}
+
+static unsigned int DrawBand(unsigned int Row, unsigned char *pBand, unsigned int Rows)
+{
+    if (Rows < DRAW_BAND_ROWS)
+        return 0;
+
+    return DrawProduce(Row, pBand);
+}
+#endif
+
+static void SlotSink(uint16_t Offset, const uint8_t *pData, uint16_t Length)
+{
+    if (frameDecoder.Header.Flags & FRAME_FLAG_GRAY)
+        GraySink(Offset, pData, Length);
+    else
+#if NFC_STREAM_TO_EPD
+        BandSink(Offset, pData, Length);
+#else
+        FrameSink(Offset, pData, Length);
+#endif
+}
+
+static uint8_t GrayShow(void)
+{
+    uint8_t shown = EpdDisGray(GrayBand, GRAY_BANDS);
+
+#if !NFC_STREAM_TO_EPD
+    /* What the partial refresh compares against is gone, start over from white */
+    memset(nfcBuffer, 0xFF, EPD_FRAME_SIZE);
+    EpdPartInvalidate();
+    DeltaFrameChanged(&frameDelta);
+#endif
+    return shown;
+}
+
+static uint8_t StoreShowSlot(uint8_t Slot)
+{
+#if !NFC_STREAM_TO_EPD
+    int32_t status;
+#endif
+
+    if (StoreOpen(Slot, &frameDecoder, SlotSink, mbBuffer, FRAME_CHUNK_MAX) != STORE_OK)
+        return 0;
+    if (frameDecoder.Header.Flags & FRAME_FLAG_GRAY)
+        return GrayShow();
+
+#if NFC_STREAM_TO_EPD
+    return EpdDisBands(SlotBand, epdBands);
+#else
+    do
+        status = StoreDecodeBand(&frameDecoder);
+    while (status == STORE_OK);
+    if (status != STORE_DONE)
+        return 0;
+    FrameShow();
+    return 1;
+#endif
+}
+
+static void StoreShow(uint8_t Slot, uint8_t Persist)
+{
+    if (Slot == STORE_SLOT_NEXT)
+        Slot = StoreNext(storeShown);
+    if (Slot == STORE_SLOT_NONE)
+        return;
+
+    NfcBoost();
+    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_2, GPIO_PIN_SET);
+    if (StoreShowSlot(Slot))
+    {
+        storeShown = Slot;
+        if (Persist)
+            StoreSetActive(Slot);
+    }
+    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_2, GPIO_PIN_RESET);
+}
+
+/* Renders a drawing program over the current image or a fresh background */
+static void DrawShow(void)
+{
+#if NFC_STREAM_TO_EPD
+    uint8_t buffer[DRAW_LOAD_CHUNK];
+#endif
+
+    if (DrawCheck(mbBuffer, mblength) != DRAW_OK)
+        return;
+    NfcBoost();
+
+#if NFC_STREAM_TO_EPD
+    /* The panel RAM can't be read back, DRAW_BG_KEEP is refused */
+    if (DrawBegin(mbBuffer, mblength, NULL, &frameDecoder, buffer, sizeof(buffer)) == DRAW_OK)
+        EpdDisBands(DrawBand, epdBands);
+#else
+    if (DrawRender(mbBuffer, mblength, nfcBuffer, &frameDecoder, FrameSink) == DRAW_OK)
+        FrameShow();
+#endif
+}
+
+/* The partial refresh policy picks the window unless the delta asks for a full refresh */
+static void DeltaShow(int32_t Status)
+{
+    if (Status != FRAME_DONE)
+        return;
+    if (frameDelta.Flags & DELTA_FLAG_FULL)
+        EpdPartInvalidate();
+    FrameShow();
+}
+
+static void StoreCommand(uint8_t Command, uint8_t Slot, uint16_t Arg)
+{
+    switch (Command)
+    {
+        case STORE_CMD_SAVE:
+            storeSaveSlot = Slot;
+            break;
+
+        case STORE_CMD_SHOW:
+            StoreShow(Slot, 1);
+            break;
+
+        case STORE_CMD_ERASE:
+            StoreErase(Slot);
+            break;
+
+        case STORE_CMD_CYCLE:
+            StoreSetCycle(Arg);
+            PowerSetWakeupTimer(Arg * 1000UL);
+            break;
+    }
+}
+
+#if NFC_MAILBOX_DMA
+/* Any context: starts a drain when the GPO is pending, nothing is in flight and the next buffer is free */
+static void MailboxKick(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint8_t start;
+
+    __disable_irq();
+    start = GPOActivated && !mbPaused && mbDrain == MB_DRAIN_IDLE && !mbLengths[mbFill];
+    if (start)
+    {
+        /* Cleared first, a message landing while this one is read raises the GPO again */
+        GPOActivated = 0;
+        mbDrain = MB_DRAIN_STATUS;
+    }
+    __set_PRIMASK(primask);
+    if (!start)
+        return;
+
+    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_2, GPIO_PIN_SET);
+    mbReadStamp = TelemetryNow();
+    PowerHold();
+    if (NFC04A1_NFCTAG_ReadMBStatus_DMA(NFC04A1_NFCTAG_INSTANCE, mbStatus) != NFCTAG_OK)
+    {
+        /* The bus is held by a blocking transfer, BSP_I2C1_IdleCallback() comes back */
+        mbDrain = MB_DRAIN_IDLE;
+        GPOActivated = 1;
+        PowerRelease();
+    }
+}
+
+/* Keeps the drain away from mbBuffer while it is scratch, 0 when a message is in the way */
+static uint8_t MailboxPause(void)
+{
+    mbPaused = 1;
+    if (mbDrain == MB_DRAIN_IDLE && !mbLengths[0] && !mbLengths[1])
+        return 1;
+    mbPaused = 0;
+    return 0;
+}
+
+static void MailboxResume(void)
+{
+    mbPaused = 0;
+    MailboxKick();
+}
+#else
+#define MailboxPause()      1
+#define MailboxResume()
+#endif
+
+void MX_NFC_Timer(void)
+{
+    /* Never cut into a transfer, the decoder and mbBuffer are shared. Nor
+       into the reserve of a card living off the field: the next wakeup is
+       soon enough */
+    if (frameActive || (SUPPLY_GOVERNOR && !SupplyAllows(SUPPLY_FULL_MV)) || !MailboxPause())
+        return;
+
+    if (StoreGetTable()->Cycle)
+        StoreShow(STORE_SLOT_NEXT, 0);
+#if !NFC_STREAM_TO_EPD
+    else if (!EpdIsBusy())
+    {
+        NfcBoost();
+        EpdPartCleanup(nfcBuffer);
+    }
+#endif
+    MailboxResume();
+}
+
+/* Nothing half done: the main loop may drop to CLOCK_LEVEL_LOW until the next message */
+uint8_t MX_NFC_IsIdle(void)
+{
+    if (frameActive || GPOActivated || storeBoot != STORE_SLOT_NONE ||
+        linkTransfer.Status == LINK_STATUS_RECEIVING || frameDelta.Status == DELTA_STATUS_RECEIVING)
+        return 0;
+#if NFC_MAILBOX_DMA
+    if (mbLengths[mbTake] || mbDrain != MB_DRAIN_IDLE)
+        return 0;
+#endif
+    return 1;
+}
+
+#if FW_UPDATE
+/*
+ * Between messages, once a start checked out. Not in the middle of a
+ * refresh, nor on a reserve short of the seconds of programming the
+ * bootloader is in for, nor with a message read ahead that it would
+ * never see: the update stays with the application, its data messages
+ * are dropped and each one tries again. The reader resumes from the Seq
+ * the status gives.
+ */
+static void UpdateHandOver(void)
+{
+    uint8_t start[UPDATE_START_SIZE];
+
+    if (fwUpdate.Status == UPDATE_STATUS_RECEIVING && !EpdIsBusy() &&
+        (!SUPPLY_GOVERNOR || SupplyAllows(SUPPLY_FULL_MV)) && MailboxPause())
+    {
+        UpdateBuildStart(&fwUpdate, start);
+        FwFlashReceive(start);
+        MailboxResume();
+    }
+}
+#endif
+
+/* Acts on the message read into mbBuffer */
+static void MailboxDispatch(void)
+{
+    int32_t status;
+
+    /* Control messages and headers only count between frames, every message
+       of a transfer goes to the decoder whatever it looks like. Except a
+       legacy header in a legacy transfer: that is how the old app starts
+       over, and its data messages are all 200 bytes */
+    if (!frameActive && mblength == STORE_CMD_SIZE && mbBuffer[0] == STORE_MAGIC) // slot command
+    {
+        StoreCommand(mbBuffer[1], mbBuffer[2], mbBuffer[2] | (mbBuffer[3] << 8));
+    } else if (!frameActive && mbBuffer[0] == 'T' && mblength == LINK_START_SIZE) // reliable transfer
+    {
+        if (LinkStart(&linkTransfer, mbBuffer, mblength, FrameSink) == FRAME_OK &&
+            linkTransfer.Missing == linkTransfer.Chunks)
+            FrameBegin();
+    } else if (!frameActive && mbBuffer[0] == 'C' && linkTransfer.Status == LINK_STATUS_RECEIVING)
+    {
+        if (LinkChunk(&linkTransfer, &frameDecoder, mbBuffer, mblength) == FRAME_DONE)
+            FrameShow();
+    } else if (!frameActive && mbBuffer[0] == 'Q' && mblength == LINK_QUERY_SIZE)
+    {
+        /* Picked up by the reader's next read, tells it which chunks to resend */
+        LinkBuildAck(&linkTransfer, mbBuffer);
+        NFC04A1_NFCTAG_WriteMailboxData(NFC04A1_NFCTAG_INSTANCE, mbBuffer, LINK_ACK_SIZE);
+    } else if (!frameActive && mbBuffer[0] == 'E' && mblength == EPD_PART_QUERY_SIZE) // refresh policy report
+    {
+        NFC04A1_NFCTAG_WriteMailboxData(NFC04A1_NFCTAG_INSTANCE, mbBuffer, EpdPartBuildReport(mbBuffer));
+    } else if (!frameActive && mbBuffer[0] == 'M' && mblength == TELEMETRY_QUERY_SIZE) // telemetry report
+    {
+        NFC04A1_NFCTAG_WriteMailboxData(NFC04A1_NFCTAG_INSTANCE, mbBuffer, TelemetryBuildReport(mbBuffer));
+    } else if (!frameActive && mbBuffer[0] == 'X' && mblength >= DELTA_START_SIZE) // delta against the frame shown
+    {
+        /* The frame id may have to be worked out again */
+        NfcBoost();
+        DeltaShow(DeltaStart(&frameDelta, mbBuffer, mblength));
+    } else if (!frameActive && mbBuffer[0] == 'Y' && frameDelta.Status == DELTA_STATUS_RECEIVING)
+    {
+        DeltaShow(DeltaPatch(&frameDelta, mbBuffer, mblength));
+    } else if (!frameActive && mbBuffer[0] == 'F' && mblength == DELTA_QUERY_SIZE) // frame id and delta status
+    {
+        NFC04A1_NFCTAG_WriteMailboxData(NFC04A1_NFCTAG_INSTANCE, mbBuffer, DeltaBuildReply(&frameDelta, mbBuffer));
+#if FW_UPDATE
+    } else if (!frameActive && mbBuffer[0] == 'U' && mblength == UPDATE_START_SIZE) // firmware update
+    {
+        /* A patch checks the running image first, the bootloader takes it from there */
+        NfcBoost();
+        UpdateStart(&fwUpdate, mbBuffer, mblength);
+    } else if (!frameActive && mbBuffer[0] == 'W' && fwUpdate.Status == UPDATE_STATUS_RECEIVING)
+    {
+        /* The bootloader's, not handed over yet */
+    } else if (!frameActive && mbBuffer[0] == 'V' && mblength == UPDATE_QUERY_SIZE) // update status
+    {
+        /* An install is the bootloader's, there is nothing here to install */
+        if (mbBuffer[1] != UPDATE_QUERY_INSTALL)
+        {
+            NfcBoost();
+            NFC04A1_NFCTAG_WriteMailboxData(NFC04A1_NFCTAG_INSTANCE, mbBuffer, UpdateBuildReply(&fwUpdate, mbBuffer));
+        }
+#endif
+    } else if (!frameActive && mbBuffer[0] == DRAW_MAGIC && mblength >= DRAW_HEADER_SIZE) // drawing commands
+    {
+        DrawShow();
+    } else if ((!frameActive || (frameLegacy && mblength == FRAME_LEGACY_HEADER_SIZE)) &&
+               FrameParseHeader(mbBuffer, mblength, &frameHeader) == FRAME_OK) // frame header
+    {
+        frameLegacy = (mblength == FRAME_LEGACY_HEADER_SIZE);
+        /* A gray image is shown from a slot, pass by pass, the scratch slot takes it unless one was chosen */
+        frameGrayShow = (storeSaveSlot == STORE_SLOT_NONE && (frameHeader.Flags & FRAME_FLAG_GRAY));
+        if (frameGrayShow)
+            storeSaveSlot = NFC_GRAY_SLOT;
+        frameStoring = (storeSaveSlot != STORE_SLOT_NONE);
+        if (frameStoring)
+            frameActive = (StoreWriteBegin(storeSaveSlot, &frameHeader) == STORE_OK);
+        else
+        {
+            FrameBegin();
+            FrameDecodeInit(&frameDecoder, &frameHeader, FrameSink);
+            frameActive = 1;
+        }
+        storeSaveSlot = STORE_SLOT_NONE;
+    } else if (frameActive && frameStoring) // picture data for a slot
+    {
+        status = StoreWrite(mbBuffer, mblength);
+        if (status != STORE_OK)
+        {
+            frameActive = 0;
+            if (status == STORE_DONE && frameGrayShow)
+                StoreShow(NFC_GRAY_SLOT, 0);
+        }
+    } else if (frameActive) // picture data
+    {
+        status = FrameDecode(&frameDecoder, mbBuffer, mblength);
+        if (status != FRAME_OK)
+        {
+            frameActive = 0;
+            if (status == FRAME_DONE)
+                FrameShow();
+        }
+    }
+}
+
+#if SUPPLY_GOVERNOR
+/*
+ * Once VDD fell under SUPPLY_LOW_MV no more messages are taken until the
+ * field brought it back. The reader's next one waits in the tag, a
+ * brownout halfway through a transfer would lose all of it.
+ */
+static void MailboxSupply(void)
+{
+    SupplyUpdate();
+    if (SupplyLevel() != SUPPLY_LEVEL_LOW)
+        return;
+#if NFC_MAILBOX_DMA
+    mbPaused = 1;
+#endif
+    SupplyWaitFor(SUPPLY_RESUME_MV);
+    MailboxResume();
+}
+#else
+#define MailboxSupply()
+#endif
 
 void MX_NFC4_MAILBOX_Process(void)
 {
+    MailboxSupply();
+    if (storeBoot != STORE_SLOT_NONE && MailboxPause())
+    {
+        StoreShow(storeBoot, 0);
+        storeBoot = STORE_SLOT_NONE;
+        MailboxResume();
+    }
+
+#if NFC_MAILBOX_DMA
+    /* Also retries a drain that failed */
+    MailboxKick();
+
+    while (mbLengths[mbTake])
+    {
+        mbBuffer = mbBuffers[mbTake];
+        mblength = mbLengths[mbTake];
+        LOG(LOG_MAILBOX_STATUS, mblength, (mbCtrl[mbTake] & ST25DV_MB_CTRL_DYN_HOSTMISSMSG_MASK) != 0,
+            (mbCtrl[mbTake] & ST25DV_MB_CTRL_DYN_RFMISSMSG_MASK) != 0,
+            (mbCtrl[mbTake] & ST25DV_MB_CTRL_DYN_HOSTPUTMSG_MASK) != 0,
+            (mbCtrl[mbTake] & ST25DV_MB_CTRL_DYN_RFPUTMSG_MASK) != 0);
+        MailboxDispatch();
+
+        mbLengths[mbTake] = 0;
+        mbTake = (mbTake + 1) % MB_BUFFERS;
+#if FW_UPDATE
+        UpdateHandOver();
+#endif
+        /* The reader keeps both buffers busy for a whole transfer */
+        MailboxSupply();
+        /* A message may be waiting for the buffer just freed */
+        MailboxKick();
+    }
+    if (mbDrain == MB_DRAIN_IDLE)
+        HAL_GPIO_WritePin(GPIOA, GPIO_PIN_2, GPIO_PIN_RESET);
+#else
     if (GPOActivated == 1)
     {
+        /* Cleared first, a message landing while this one is handled raises the GPO again */
+        GPOActivated = 0;
+
         /* Check if Mailbox is available */
         NFC04A1_NFCTAG_ReadMBCtrl_Dyn(NFC04A1_NFCTAG_INSTANCE, &mbctrldynstatus);
+        if (mbctrldynstatus.HostMissMsg)
+            TelemetryCount(TELEMETRY_HOST_MISS);
+        if (mbctrldynstatus.RFMissMsg)
+            TelemetryCount(TELEMETRY_RF_MISS);
 
         if (mbctrldynstatus.RfPutMsg == 1)
         {
             /* Read length of message */
-            NFC04A1_NFCTAG_ReadMBLength_Dyn(NFC04A1_NFCTAG_INSTANCE, (uint8_t *) &mblength);
-            mblength += 1;
-
-#if DEBUG
-            /* Read mailbox status */
-            NFC04A1_NFCTAG_ReadMBCtrl_Dyn(NFC04A1_NFCTAG_INSTANCE, &mbctrldynstatus);
-            printf("\n\r\n\rCtrl MB status register value:");
-            printf("\n\rHost(i2c) Missed Message  = %d", mbctrldynstatus.HostMissMsg);
-            printf("\n\rRF(reader) Missed Message = %d", mbctrldynstatus.RFMissMsg);
-            printf("\n\rHost(i2c) Put Message     = %d", mbctrldynstatus.HostPutMsg);
-            printf("\n\rRF(reader) Put Message    = %d", mbctrldynstatus.RfPutMsg);
-            printf("\n\rMailbox Enable            = %d", mbctrldynstatus.MbEnable);
-#endif
-
-            if (mblength == 3) // frame header
-            {
-                bufferIndex = 0;
-            } else if (mblength == 200) // picture data
-            {
-                HAL_GPIO_WritePin(GPIOA, GPIO_PIN_2, GPIO_PIN_SET);
-
-                /* Read all data in Mailbox */
-                NFC04A1_NFCTAG_ReadMailboxData(NFC04A1_NFCTAG_INSTANCE, nfcBuffer + bufferIndex, 0, 200);
-                bufferIndex += 200;
-
-                HAL_GPIO_WritePin(GPIOA, GPIO_PIN_2, GPIO_PIN_RESET);
-            }
-
-            if (bufferIndex == 5000)
-            {
-                bufferIndex = 0;
-
-                EpdDisFull((unsigned char *) nfcBuffer, 1);
-                HAL_Delay(3000);
-            }
+            /* The register holds length - 1, a full 256-byte message doesn't fit a byte */
+            NFC04A1_NFCTAG_ReadMBLength_Dyn(NFC04A1_NFCTAG_INSTANCE, &mblength8);
+            mblength = mblength8 + 1;
+
+            LOG(LOG_MAILBOX_STATUS, mblength, mbctrldynstatus.HostMissMsg, mbctrldynstatus.RFMissMsg,
+                mbctrldynstatus.HostPutMsg, mbctrldynstatus.RfPutMsg);
 
+            HAL_GPIO_WritePin(GPIOA, GPIO_PIN_2, GPIO_PIN_SET);
+            mbReadStamp = TelemetryNow();
+
+            /* Read all data in Mailbox */
+            NFC04A1_NFCTAG_ReadMailboxData(NFC04A1_NFCTAG_INSTANCE, mbBuffer, 0, mblength);
+            TelemetryStop(TELEMETRY_I2C, mbReadStamp);
+            MailboxDispatch();
+#if FW_UPDATE
+            UpdateHandOver();
+#endif
+
+            HAL_GPIO_WritePin(GPIOA, GPIO_PIN_2, GPIO_PIN_RESET);
         }
+    }
+#endif
+}
 
-        GPOActivated = 0;
+#if NFC_MAILBOX_DMA
+/* Interrupt context, the end of a status or message read started by the drain */
+void BSP_I2C1_RxCpltCallback(int32_t Status)
+{
+    uint8_t fill = mbFill;
+
+    if (Status == BSP_ERROR_NONE && mbDrain == MB_DRAIN_STATUS)
+    {
+        if (mbStatus[0] & ST25DV_MB_CTRL_DYN_HOSTMISSMSG_MASK)
+            TelemetryCount(TELEMETRY_HOST_MISS);
+        if (mbStatus[0] & ST25DV_MB_CTRL_DYN_RFMISSMSG_MASK)
+            TelemetryCount(TELEMETRY_RF_MISS);
+
+        if (mbStatus[0] & ST25DV_MB_CTRL_DYN_RFPUTMSG_MASK)
+        {
+            mbDrain = MB_DRAIN_DATA;
+            mbCtrl[fill] = mbStatus[0];
+            /* The length register holds length - 1, a full 256-byte message doesn't fit a byte */
+            if (NFC04A1_NFCTAG_ReadMailboxData_DMA(NFC04A1_NFCTAG_INSTANCE, mbBuffers[fill], 0,
+                                                   mbStatus[1] + 1) == NFCTAG_OK)
+                return;
+            Status = BSP_ERROR_BUSY;
+        }
+    } else if (Status == BSP_ERROR_NONE && mbDrain == MB_DRAIN_DATA)
+    {
+        TelemetryStop(TELEMETRY_I2C, mbReadStamp);
+        mbLengths[fill] = mbStatus[1] + 1;
+        mbFill = (fill + 1) % MB_BUFFERS;
+        PowerNotify(POWER_EVENT_NFC);
+    }
+
+    mbDrain = MB_DRAIN_IDLE;
+    PowerRelease();
+    if (Status == BSP_ERROR_NONE)
+    {
+        MailboxKick();
+        return;
     }
+
+    /* Not retried from here, a NACKing tag would keep the interrupt busy. The main loop tries again */
+    GPOActivated = 1;
+    PowerNotify(POWER_EVENT_NFC);
 }
 
+/* A drain the GPO couldn't start while a blocking transfer held the bus */
+void BSP_I2C1_IdleCallback(void)
+{
+    MailboxKick();
+}
+#endif
+
 
 void BSP_GPO_Callback(void)
 {
     /* Prevent unused argument(s) compilation warning */
     GPOActivated = 1;
+    PowerNotify(POWER_EVENT_NFC);
+#if NFC_MAILBOX_DMA
+    MailboxKick();
+#endif
     /* This function should be implemented by the user application.
        It is called into this driver when an event on Button is triggered. */
 }
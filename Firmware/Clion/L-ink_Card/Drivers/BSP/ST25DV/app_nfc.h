@@ -5,8 +5,35 @@
  extern "C" {
 #endif
  
+/* Write mailbox chunks straight into the panel RAM instead of staging the frame in nfcBuffer */
+#ifndef NFC_STREAM_TO_EPD
+#define NFC_STREAM_TO_EPD 0
+#endif
+ 
+/* Drain the mailbox from the GPO interrupt with I2C DMA reads, into two buffers taken in turn */
+#ifndef NFC_MAILBOX_DMA
+#define NFC_MAILBOX_DMA 1
+#endif
+ 
+/* Slot a gray image is written to before it is shown, when no save slot was chosen */
+#ifndef NFC_GRAY_SLOT
+#define NFC_GRAY_SLOT 7
+#endif
+ 
+/* Nap between tries while the tag boots */
+#ifndef NFC_TAG_RETRY_MS
+#define NFC_TAG_RETRY_MS 2
+#endif
+ 
+/* Quiet time after a refresh before the ghosting left by partial refreshes is cleaned up */
+#ifndef NFC_CLEANUP_IDLE_MS
+#define NFC_CLEANUP_IDLE_MS 60000
+#endif
+ 
 void MX_NFC_Init(void);
 void MX_NFC_Process(void);
+void MX_NFC_Timer(void);
+uint8_t MX_NFC_IsIdle(void);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,381 @@
+#include "draw_render.h"
+#include "image_store.h"
+#include <string.h>
+
+#define DRAW_WIDTH          (FRAME_ROW_BYTES * 8)
+#define DRAW_CMD_SIZE       6     // every command starts with 6 bytes
+
+/* Program being rendered */
+static const uint8_t *DrawProgram;
+static uint16_t DrawLength;
+static const uint8_t *DrawFrame;
+static const uint8_t *DrawBlit;
+static FRAME_Decoder_t *DrawDecoder;
+static uint8_t *DrawOut;
+
+static uint16_t DrawCommandSize(const uint8_t *pCmd, uint16_t Left)
+{
+    if (Left < DRAW_CMD_SIZE)
+        return 0;
+
+    switch (pCmd[0])
+    {
+        case DRAW_CMD_TEXT:
+            return DRAW_CMD_SIZE + pCmd[5];
+        case DRAW_CMD_QR:
+            return DRAW_CMD_SIZE + (pCmd[5] * pCmd[5] + 7) / 8;
+        case DRAW_CMD_LINE:
+        case DRAW_CMD_RECT:
+        case DRAW_CMD_FILL:
+        case DRAW_CMD_BLIT:
+            return DRAW_CMD_SIZE;
+    }
+    return 0;
+}
+
+int32_t DrawCheck(const uint8_t *pData, uint16_t Length)
+{
+    uint16_t at, size;
+    uint8_t blits = 0;
+    uint8_t color;
+
+    if (Length < DRAW_HEADER_SIZE || pData[0] != DRAW_MAGIC || pData[1] != DRAW_VERSION ||
+        pData[2] > DRAW_BG_KEEP)
+        return DRAW_ERROR;
+
+    for (at = DRAW_HEADER_SIZE; at < Length; at += size)
+    {
+        size = DrawCommandSize(&pData[at], Length - at);
+        if (size == 0 || size > Length - at)
+            return DRAW_ERROR;
+
+        color = pData[at + 5];
+        switch (pData[at])
+        {
+            case DRAW_CMD_TEXT:
+                color = pData[at + 4];
+                if ((pData[at + 3] & DRAW_TEXT_SCALE_MASK) == 0 ||
+                    (pData[at + 3] & DRAW_TEXT_SCALE_MASK) > DRAW_TEXT_MAX_SCALE)
+                    return DRAW_ERROR;
+                break;
+
+            case DRAW_CMD_QR:
+                color = pData[at + 4];
+                if (pData[at + 3] == 0 || pData[at + 5] == 0)
+                    return DRAW_ERROR;
+                break;
+
+            case DRAW_CMD_BLIT:
+                color = DRAW_BLACK;
+                if (++blits > 1 || pData[at + 1] >= STORE_MAX_SLOTS)
+                    return DRAW_ERROR;
+                break;
+        }
+        if (color > DRAW_INVERT)
+            return DRAW_ERROR;
+    }
+
+    return DRAW_OK;
+}
+
+/* Pixels X0..X1 of one band row, a set bit is white */
+static void DrawSpan(uint8_t *pBand, int16_t Row, int16_t X0, int16_t X1, uint8_t Color)
+{
+    uint8_t *line = pBand + Row * FRAME_ROW_BYTES;
+    uint8_t mask;
+    int16_t byte;
+
+    if (X0 < 0)
+        X0 = 0;
+    if (X1 >= DRAW_WIDTH)
+        X1 = DRAW_WIDTH - 1;
+
+    for (byte = X0 / 8; byte <= X1 / 8 && X0 <= X1; byte++)
+    {
+        mask = 0xFF;
+        if (byte == X0 / 8)
+            mask &= 0xFF >> (X0 % 8);
+        if (byte == X1 / 8)
+            mask &= 0xFF << (7 - X1 % 8);
+
+        if (Color == DRAW_WHITE)
+            line[byte] |= mask;
+        else if (Color == DRAW_BLACK)
+            line[byte] &= ~mask;
+        else
+            line[byte] ^= mask;
+    }
+}
+
+/* A W x H block, only the rows falling in the band starting at BandY */
+static void DrawBlock(uint8_t *pBand, int16_t BandY, int16_t X, int16_t Y, int16_t W, int16_t H, uint8_t Color)
+{
+    int16_t y = Y < BandY ? BandY : Y;
+    int16_t end = Y + H < BandY + DRAW_BAND_ROWS ? Y + H : BandY + DRAW_BAND_ROWS;
+
+    for (; y < end; y++)
+        DrawSpan(pBand, y - BandY, X, X + W - 1, Color);
+}
+
+static void DrawText(uint8_t *pBand, int16_t BandY, const uint8_t *pCmd)
+{
+    uint8_t scale = pCmd[3] & DRAW_TEXT_SCALE_MASK;
+    uint8_t bold = pCmd[3] & DRAW_TEXT_BOLD;
+    const uint8_t *text = pCmd + DRAW_CMD_SIZE;
+    const uint8_t *glyph;
+    int16_t x = pCmd[1];
+    int16_t y = pCmd[2];
+    uint8_t i, col, row, bits, c;
+
+    for (i = 0; i < pCmd[5]; i++)
+    {
+        c = text[i];
+        if (c == '\n')
+        {
+            x = pCmd[1];
+            y += (DRAW_FONT_HEIGHT + 1) * scale;
+            continue;
+        }
+
+        if (y < BandY + DRAW_BAND_ROWS && y + DRAW_FONT_HEIGHT * scale > BandY)
+        {
+            if (c < DRAW_FONT_FIRST || c > DRAW_FONT_LAST)
+                c = '?';
+            glyph = DrawFont[c - DRAW_FONT_FIRST];
+
+            // bold ORs every column into the next one, spilling into the gap
+            for (col = 0; col < DRAW_FONT_WIDTH + (bold ? 1 : 0); col++)
+            {
+                bits = col < DRAW_FONT_WIDTH ? glyph[col] : 0;
+                if (bold && col > 0)
+                    bits |= glyph[col - 1];
+
+                for (row = 0; row < DRAW_FONT_HEIGHT; row++)
+                {
+                    if (bits & (1 << row))
+                        DrawBlock(pBand, BandY, x + col * scale, y + row * scale, scale, scale, pCmd[4]);
+                }
+            }
+        }
+        x += (DRAW_FONT_WIDTH + 1) * scale;
+    }
+}
+
+static void DrawLine(uint8_t *pBand, int16_t BandY, const uint8_t *pCmd)
+{
+    int16_t x0 = pCmd[1], y0 = pCmd[2];
+    int16_t x1 = pCmd[3], y1 = pCmd[4];
+    int16_t dx = x1 > x0 ? x1 - x0 : x0 - x1;
+    int16_t dy = y1 > y0 ? y0 - y1 : y1 - y0;
+    int16_t sx = x0 < x1 ? 1 : -1;
+    int16_t sy = y0 < y1 ? 1 : -1;
+    int16_t err = dx + dy;
+    int16_t e2;
+
+    if ((y0 < BandY && y1 < BandY) || (y0 >= BandY + DRAW_BAND_ROWS && y1 >= BandY + DRAW_BAND_ROWS))
+        return;
+
+    // the whole line is walked for every band it crosses, each pixel is set once
+    for (;;)
+    {
+        if (y0 >= BandY && y0 < BandY + DRAW_BAND_ROWS)
+            DrawSpan(pBand, y0 - BandY, x0, x0, pCmd[5]);
+        if (x0 == x1 && y0 == y1)
+            break;
+
+        e2 = 2 * err;
+        if (e2 >= dy)
+        {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+static void DrawRect(uint8_t *pBand, int16_t BandY, const uint8_t *pCmd)
+{
+    int16_t x = pCmd[1], y = pCmd[2];
+    int16_t w = pCmd[3], h = pCmd[4];
+
+    if (w == 0 || h == 0)
+        return;
+
+    // sides stop short of the corners so DRAW_INVERT doesn't cancel them
+    DrawBlock(pBand, BandY, x, y, w, 1, pCmd[5]);
+    if (h > 1)
+        DrawBlock(pBand, BandY, x, y + h - 1, w, 1, pCmd[5]);
+    DrawBlock(pBand, BandY, x, y + 1, 1, h - 2, pCmd[5]);
+    if (w > 1)
+        DrawBlock(pBand, BandY, x + w - 1, y + 1, 1, h - 2, pCmd[5]);
+}
+
+static void DrawQr(uint8_t *pBand, int16_t BandY, const uint8_t *pCmd)
+{
+    const uint8_t *bits = pCmd + DRAW_CMD_SIZE;
+    int16_t x = pCmd[1], y = pCmd[2];
+    uint8_t scale = pCmd[3];
+    uint8_t size = pCmd[5];
+    uint16_t bit;
+    uint8_t row, col, run;
+
+    for (row = 0; row < size; row++)
+    {
+        if (y + (row + 1) * scale <= BandY)
+            continue;
+        if (y + row * scale >= BandY + DRAW_BAND_ROWS)
+            break;
+
+        // dark modules next to each other go out as one span
+        for (col = 0; col < size; col += run)
+        {
+            for (run = 0; col + run < size; run++)
+            {
+                bit = row * size + col + run;
+                if (!(bits[bit / 8] & (0x80 >> (bit % 8))))
+                    break;
+            }
+            if (run)
+                DrawBlock(pBand, BandY, x + col * scale, y + row * scale, run * scale, scale, pCmd[4]);
+            else
+                run = 1;
+        }
+    }
+}
+
+/* Everything but the blit, in program order */
+static void DrawBand(uint8_t *pBand, int16_t BandY)
+{
+    const uint8_t *cmd;
+    uint16_t at;
+
+    for (at = DRAW_HEADER_SIZE; at < DrawLength; at += DrawCommandSize(cmd, DrawLength - at))
+    {
+        cmd = &DrawProgram[at];
+        switch (cmd[0])
+        {
+            case DRAW_CMD_TEXT:
+                DrawText(pBand, BandY, cmd);
+                break;
+            case DRAW_CMD_LINE:
+                DrawLine(pBand, BandY, cmd);
+                break;
+            case DRAW_CMD_RECT:
+                DrawRect(pBand, BandY, cmd);
+                break;
+            case DRAW_CMD_FILL:
+                DrawBlock(pBand, BandY, cmd[1], cmd[2], cmd[3], cmd[4], cmd[5]);
+                break;
+            case DRAW_CMD_QR:
+                DrawQr(pBand, BandY, cmd);
+                break;
+        }
+    }
+}
+
+static uint8_t DrawBackground(uint16_t Offset)
+{
+    if (DrawProgram[2] == DRAW_BG_KEEP)
+        return DrawFrame[Offset];
+    return DrawProgram[2] == DRAW_BG_WHITE ? 0xFF : 0x00;
+}
+
+/*
+ * Sink of the slot decode: keeps the blit area of the decoded band and puts
+ * the background around it. DrawOut may be the decoder's own band.
+ */
+static void DrawBlitSink(uint16_t Offset, const uint8_t *pData, uint16_t Length)
+{
+    int16_t x0 = DrawBlit[2], y0 = DrawBlit[3];
+    int16_t x1 = x0 + DrawBlit[4] - 1, y1 = y0 + DrawBlit[5] - 1;
+    int16_t row, byte;
+    uint16_t i;
+    uint8_t mask;
+
+    for (i = 0; i < Length; i++)
+    {
+        row = Offset / FRAME_ROW_BYTES + i / FRAME_ROW_BYTES;
+        byte = i % FRAME_ROW_BYTES;
+
+        mask = 0;
+        if (row >= y0 && row <= y1 && byte >= x0 / 8 && byte <= x1 / 8)
+        {
+            mask = 0xFF;
+            if (byte == x0 / 8)
+                mask &= 0xFF >> (x0 % 8);
+            if (byte == x1 / 8)
+                mask &= 0xFF << (7 - x1 % 8);
+        }
+        DrawOut[i] = (pData[i] & mask) | (DrawBackground(Offset + i) & ~mask);
+    }
+}
+
+int32_t DrawBegin(const uint8_t *pData, uint16_t Length, const uint8_t *pFrame, FRAME_Decoder_t *pDec,
+                  uint8_t *pBuffer, uint16_t Size)
+{
+    uint16_t at;
+
+    if (pData[2] == DRAW_BG_KEEP && pFrame == NULL)
+        return DRAW_ERROR;
+
+    DrawProgram = pData;
+    DrawLength = Length;
+    DrawFrame = pFrame;
+    DrawDecoder = pDec;
+
+    DrawBlit = NULL;
+    for (at = DRAW_HEADER_SIZE; at < Length; at += DrawCommandSize(&pData[at], Length - at))
+    {
+        if (pData[at] == DRAW_CMD_BLIT)
+            DrawBlit = &pData[at];
+    }
+
+    // the slot is decoded one band at a time as the program is rendered, gray rows don't fit a band
+    if (DrawBlit && (StoreOpen(DrawBlit[1], pDec, DrawBlitSink, pBuffer, Size) != STORE_OK ||
+                     (pDec->Header.Flags & FRAME_FLAG_GRAY)))
+        return DRAW_ERROR;
+
+    return DRAW_OK;
+}
+
+uint8_t DrawProduce(uint8_t Row, uint8_t *pBand)
+{
+    uint16_t i;
+
+    if (DrawBlit)
+    {
+        DrawOut = pBand;
+        if (StoreDecodeBand(DrawDecoder) == STORE_ERROR)
+            return 0;
+    } else
+    {
+        for (i = 0; i < DRAW_BAND_ROWS * FRAME_ROW_BYTES; i++)
+            pBand[i] = DrawBackground(Row * FRAME_ROW_BYTES + i);
+    }
+
+    DrawBand(pBand, Row);
+    return DRAW_BAND_ROWS;
+}
+
+int32_t DrawRender(const uint8_t *pData, uint16_t Length, const uint8_t *pFrame, FRAME_Decoder_t *pDec,
+                   FRAME_Sink_t Sink)
+{
+    uint8_t buffer[DRAW_LOAD_CHUNK];
+    uint8_t row;
+
+    if (DrawBegin(pData, Length, pFrame, pDec, buffer, sizeof(buffer)) != DRAW_OK)
+        return DRAW_ERROR;
+
+    for (row = 0; row < FRAME_ROWS; row += DRAW_BAND_ROWS)
+    {
+        if (DrawProduce(row, pDec->Band) == 0)
+            return DRAW_ERROR;
+        Sink(row * FRAME_ROW_BYTES, pDec->Band, sizeof(pDec->Band));
+    }
+
+    return DRAW_OK;
+}
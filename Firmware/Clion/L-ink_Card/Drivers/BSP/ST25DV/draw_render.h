@@ -0,0 +1,103 @@
+#ifndef __DRAW_RENDER_H
+#define __DRAW_RENDER_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include "frame_codec.h"
+
+/*
+ * Drawing commands, rasterized on the card.
+ *
+ * One mailbox message holds a whole program. The frame is rendered
+ * FRAME_DECODE_ROWS rows at a time in the decoder's band buffer and handed
+ * to the same sink as a decoded frame, so it takes the partial refresh or
+ * streaming path like any other image and needs no frame-sized buffer.
+ *
+ * Header (DRAW_HEADER_SIZE bytes):
+ *  0  Magic        'D'
+ *  1  Version      DRAW_VERSION
+ *  2  Background   DRAW_BG_*, DRAW_BG_KEEP draws over the image shown
+ *  3  Reserved
+ *
+ * Commands follow back to back, coordinates in pixels, (0, 0) top left:
+ *  'T' x y style color n chars[n]      text, 5x7 font in 6x8 cells,
+ *                                      style = scale 1..8 | DRAW_TEXT_BOLD,
+ *                                      '\n' starts a new line at x
+ *  'L' x0 y0 x1 y1 color               line
+ *  'R' x y w h color                   rectangle outline
+ *  'F' x y w h color                   filled rectangle
+ *  'Q' x y scale color size bits[]     QR code from its module matrix, size
+ *                                      x size modules, row major, MSB first,
+ *                                      1 = dark; the reader does the encoding
+ *  'B' slot x y w h                    copy that area of a stored slot,
+ *                                      once per program, drawn first
+ *
+ * Colors are DRAW_BLACK, DRAW_WHITE or DRAW_INVERT. Anything outside the
+ * panel is clipped.
+ */
+
+#define DRAW_MAGIC              'D'
+#define DRAW_VERSION            1
+#define DRAW_HEADER_SIZE        4
+
+#define DRAW_BG_BLACK           0
+#define DRAW_BG_WHITE           1
+#define DRAW_BG_KEEP            2
+
+#define DRAW_BLACK              0
+#define DRAW_WHITE              1
+#define DRAW_INVERT             2
+
+#define DRAW_CMD_TEXT           'T'
+#define DRAW_CMD_LINE           'L'
+#define DRAW_CMD_RECT           'R'
+#define DRAW_CMD_FILL           'F'
+#define DRAW_CMD_QR             'Q'
+#define DRAW_CMD_BLIT           'B'
+
+#define DRAW_TEXT_SCALE_MASK    0x0F
+#define DRAW_TEXT_BOLD          0x10
+#define DRAW_TEXT_MAX_SCALE     8
+
+#define DRAW_FONT_WIDTH         5
+#define DRAW_FONT_HEIGHT        7
+#define DRAW_FONT_FIRST         0x20
+#define DRAW_FONT_LAST          0x7E
+
+/* Rows rendered at a time, a blit follows the decoder's bands */
+#define DRAW_BAND_ROWS          FRAME_DECODE_ROWS
+
+/* EEPROM read size for a blit, DrawRender() keeps it on the stack */
+#define DRAW_LOAD_CHUNK         64
+
+#define DRAW_OK                 0
+#define DRAW_ERROR              (-1)
+
+/* DRAW_FONT_WIDTH columns per glyph, bit 0 is the top row */
+extern const uint8_t DrawFont[DRAW_FONT_LAST - DRAW_FONT_FIRST + 1][DRAW_FONT_WIDTH];
+
+/* Checks the header and every command, nothing is drawn from a bad program */
+int32_t DrawCheck(const uint8_t *pData, uint16_t Length);
+
+/*
+ * Starts rendering a checked program. pFrame is the image currently shown,
+ * needed by DRAW_BG_KEEP (NULL when there is none). pDec decodes the slot
+ * of a 'B' command, reading the EEPROM through pBuffer.
+ */
+int32_t DrawBegin(const uint8_t *pData, uint16_t Length, const uint8_t *pFrame, FRAME_Decoder_t *pDec,
+                  uint8_t *pBuffer, uint16_t Size);
+
+/* Renders the next DRAW_BAND_ROWS rows, from the top, returns 0 on error */
+uint8_t DrawProduce(uint8_t Row, uint8_t *pBand);
+
+/* The whole program into Sink, one band at a time through pDec's band buffer */
+int32_t DrawRender(const uint8_t *pData, uint16_t Length, const uint8_t *pFrame, FRAME_Decoder_t *pDec,
+                   FRAME_Sink_t Sink);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
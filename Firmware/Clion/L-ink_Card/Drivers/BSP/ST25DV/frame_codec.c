@@ -0,0 +1,193 @@
+#include "frame_codec.h"
+#include <string.h>
+
+/* States of the PackBits parser, kept in FRAME_Decoder_t.Control */
+#define CODEC_CONTROL   0
+#define CODEC_LITERAL   1
+#define CODEC_REPEAT    2
+#define CODEC_RUN       3     // emitting Count copies of Value, may span bands
+
+int32_t FrameParseHeader(const uint8_t *pData, uint16_t Length, FRAME_Header_t *pHeader)
+{
+    if (Length == FRAME_LEGACY_HEADER_SIZE)
+    {
+        pHeader->Format = FRAME_FORMAT_RAW;
+        pHeader->Flags = 0;
+        pHeader->PayloadSize = FRAME_RAW_SIZE;
+        pHeader->RawSize = FRAME_RAW_SIZE;
+        return FRAME_OK;
+    }
+
+    if (Length != FRAME_HEADER_SIZE || pData[0] != FRAME_MAGIC || pData[1] != FRAME_VERSION)
+        return FRAME_ERROR;
+
+    pHeader->Format = pData[2];
+    pHeader->Flags = pData[3];
+    pHeader->PayloadSize = pData[4] | (pData[5] << 8);
+    pHeader->RawSize = pData[6] | (pData[7] << 8);
+
+    if (pHeader->Format > FRAME_FORMAT_RLE ||
+        pHeader->RawSize != (pHeader->Flags & FRAME_FLAG_GRAY ? FRAME_GRAY_SIZE : FRAME_RAW_SIZE))
+        return FRAME_ERROR;
+
+    return FRAME_OK;
+}
+
+void FrameBuildHeader(const FRAME_Header_t *pHeader, uint8_t *pData)
+{
+    pData[0] = FRAME_MAGIC;
+    pData[1] = FRAME_VERSION;
+    pData[2] = pHeader->Format;
+    pData[3] = pHeader->Flags;
+    pData[4] = pHeader->PayloadSize & 0xFF;
+    pData[5] = pHeader->PayloadSize >> 8;
+    pData[6] = pHeader->RawSize & 0xFF;
+    pData[7] = pHeader->RawSize >> 8;
+}
+
+void FrameDecodeInit(FRAME_Decoder_t *pDec, const FRAME_Header_t *pHeader, FRAME_Sink_t Sink)
+{
+    pDec->Header = *pHeader;
+    pDec->Sink = Sink;
+    pDec->Base = 0;
+    pDec->In = 0;
+    pDec->Out = 0;
+    pDec->Control = CODEC_CONTROL;
+    pDec->Count = 0;
+    pDec->Value = 0;
+    pDec->Flushed = 0;
+    pDec->Col = 0;
+    pDec->Fill = 0;
+    memset(pDec->Prev, 0, sizeof(pDec->Prev));
+}
+
+static void FrameFlush(FRAME_Decoder_t *pDec)
+{
+    if (pDec->Fill)
+    {
+        pDec->Sink(pDec->Base + pDec->Out - pDec->Fill, pDec->Band, pDec->Fill);
+        pDec->Fill = 0;
+        pDec->Flushed = 1;
+    }
+}
+
+static int32_t FrameEmit(FRAME_Decoder_t *pDec, uint8_t Value)
+{
+    if (pDec->Out >= pDec->Header.RawSize)
+        return FRAME_ERROR;
+
+    if (pDec->Header.Flags & FRAME_FLAG_ROW_DELTA)
+    {
+        Value ^= pDec->Prev[pDec->Col];
+        pDec->Prev[pDec->Col] = Value;
+    }
+    if (++pDec->Col == FRAME_ROW_BYTES)
+        pDec->Col = 0;
+
+    pDec->Band[pDec->Fill++] = Value;
+    pDec->Out++;
+
+    if (pDec->Fill == sizeof(pDec->Band) || pDec->Out == pDec->Header.RawSize)
+        FrameFlush(pDec);
+
+    return FRAME_OK;
+}
+
+/* Feeds pData to the decoder, with Band set it stops right after a band went to the sink */
+static int32_t FrameRun(FRAME_Decoder_t *pDec, const uint8_t *pData, uint16_t Length, uint8_t Band, uint16_t *pUsed)
+{
+    uint16_t used = 0;
+    uint8_t value;
+
+    if (pDec->In + Length > pDec->Header.PayloadSize)
+        return FRAME_ERROR;
+
+    pDec->Flushed = 0;
+    for (;;)
+    {
+        while (pDec->Control == CODEC_RUN && pDec->Count && !(Band && pDec->Flushed))
+        {
+            if (FrameEmit(pDec, pDec->Value) != FRAME_OK)
+                return FRAME_ERROR;
+            pDec->Count--;
+        }
+        if (pDec->Control == CODEC_RUN && pDec->Count == 0)
+            pDec->Control = CODEC_CONTROL;
+
+        if ((Band && pDec->Flushed) || used == Length)
+            break;
+        value = pData[used++];
+
+        if (pDec->Header.Format == FRAME_FORMAT_RAW)
+        {
+            if (FrameEmit(pDec, value) != FRAME_OK)
+                return FRAME_ERROR;
+            continue;
+        }
+
+        switch (pDec->Control)
+        {
+            case CODEC_CONTROL:
+                if (value < 0x80)
+                {
+                    pDec->Count = value + 1;
+                    pDec->Control = CODEC_LITERAL;
+                } else if (value > 0x80)
+                {
+                    pDec->Count = 257 - value;
+                    pDec->Control = CODEC_REPEAT;
+                }
+                break;
+
+            case CODEC_LITERAL:
+                if (FrameEmit(pDec, value) != FRAME_OK)
+                    return FRAME_ERROR;
+                if (--pDec->Count == 0)
+                    pDec->Control = CODEC_CONTROL;
+                break;
+
+            case CODEC_REPEAT:
+                pDec->Value = value;
+                pDec->Control = CODEC_RUN;
+                break;
+        }
+    }
+
+    pDec->In += used;
+    *pUsed = used;
+
+    if (pDec->In == pDec->Header.PayloadSize && pDec->Control != CODEC_RUN)
+        return pDec->Out == pDec->Header.RawSize ? FRAME_DONE : FRAME_ERROR;
+
+    return pDec->Flushed && Band ? FRAME_BAND : FRAME_OK;
+}
+
+int32_t FrameDecode(FRAME_Decoder_t *pDec, const uint8_t *pData, uint16_t Length)
+{
+    uint16_t used;
+
+    return FrameRun(pDec, pData, Length, 0, &used);
+}
+
+int32_t FrameDecodeBand(FRAME_Decoder_t *pDec, const uint8_t *pData, uint16_t Length, uint16_t *pUsed)
+{
+    return FrameRun(pDec, pData, Length, 1, pUsed);
+}
+
+/* CRC-32 (IEEE, zlib compatible), nibble table to stay small in flash */
+uint32_t FrameCrc32(uint32_t Crc, const uint8_t *pData, uint16_t Length)
+{
+    static const uint32_t Table[16] = {
+            0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+            0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    Crc = ~Crc;
+    while (Length--)
+    {
+        Crc ^= *pData++;
+        Crc = (Crc >> 4) ^ Table[Crc & 0x0F];
+        Crc = (Crc >> 4) ^ Table[Crc & 0x0F];
+    }
+    return ~Crc;
+}
@@ -0,0 +1,106 @@
+#ifndef __FRAME_CODEC_H
+#define __FRAME_CODEC_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Image transfer format.
+ *
+ * A transfer starts with one header message and is followed by payload
+ * messages of any length up to the 256-byte mailbox. The legacy 3-byte
+ * header announces 25 x 200 bytes of raw 1bpp data. Until the payload is
+ * in, every message is payload, one that looks like a header too; only a
+ * legacy header restarts a legacy transfer.
+ *
+ *  0  Magic        'L'
+ *  1  Version      FRAME_VERSION
+ *  2  Format       FRAME_FORMAT_*
+ *  3  Flags        FRAME_FLAG_*
+ *  4  PayloadSize  bytes following the header, little endian
+ *  6  RawSize      decoded size, FRAME_RAW_SIZE or FRAME_GRAY_SIZE
+ *
+ * FRAME_FORMAT_RLE is PackBits: a control byte n < 0x80 copies the next
+ * n + 1 bytes, n > 0x80 repeats the next byte 257 - n times, 0x80 is a
+ * no-op. With FRAME_FLAG_ROW_DELTA every decoded byte is XORed with the
+ * byte above it, so vertical structure turns into runs of zeros.
+ *
+ * FRAME_FLAG_GRAY carries a 2bpp image as two bitplanes, interleaved per
+ * row: FRAME_ROW_BYTES of the high plane, then FRAME_ROW_BYTES of the low
+ * plane. Level = high * 2 + low, 0 is black and 3 white. Gray frames are
+ * shown in several passes, so they only go through a slot.
+ */
+
+#define FRAME_MAGIC                 'L'
+#define FRAME_VERSION               1
+#define FRAME_HEADER_SIZE           8
+#define FRAME_LEGACY_HEADER_SIZE    3
+#define FRAME_CHUNK_MAX             256
+
+#define FRAME_FORMAT_RAW            0
+#define FRAME_FORMAT_RLE            1
+
+#define FRAME_FLAG_ROW_DELTA        0x01
+#define FRAME_FLAG_GRAY             0x02
+
+#define FRAME_ROW_BYTES             25
+#define FRAME_ROWS                  200
+#define FRAME_RAW_SIZE              (FRAME_ROW_BYTES * FRAME_ROWS)
+#define FRAME_GRAY_SIZE             (2 * FRAME_RAW_SIZE)
+#define FRAME_DECODE_ROWS           8
+
+#define FRAME_OK                    0
+#define FRAME_DONE                  1
+#define FRAME_BAND                  2
+#define FRAME_ERROR                 (-1)
+
+typedef struct
+{
+    uint8_t Format;
+    uint8_t Flags;
+    uint16_t PayloadSize;
+    uint16_t RawSize;
+} FRAME_Header_t;
+
+typedef void (*FRAME_Sink_t)(uint16_t Offset, const uint8_t *pData, uint16_t Length);
+
+typedef struct
+{
+    FRAME_Header_t Header;
+    FRAME_Sink_t Sink;
+    uint16_t Base;      // added to every offset passed to Sink
+    uint16_t In;
+    uint16_t Out;
+    uint8_t Control;
+    uint8_t Count;
+    uint8_t Value;      // byte being repeated
+    uint8_t Flushed;    // a band went to Sink during the last call
+    uint8_t Col;
+    uint16_t Fill;
+    uint8_t Band[FRAME_ROW_BYTES * FRAME_DECODE_ROWS];
+    uint8_t Prev[FRAME_ROW_BYTES];
+} FRAME_Decoder_t;
+
+int32_t FrameParseHeader(const uint8_t *pData, uint16_t Length, FRAME_Header_t *pHeader);
+void FrameBuildHeader(const FRAME_Header_t *pHeader, uint8_t *pData);
+
+void FrameDecodeInit(FRAME_Decoder_t *pDec, const FRAME_Header_t *pHeader, FRAME_Sink_t Sink);
+int32_t FrameDecode(FRAME_Decoder_t *pDec, const uint8_t *pData, uint16_t Length);
+
+/*
+ * Pull side of FrameDecode(): returns FRAME_BAND as soon as a band has
+ * gone to Sink, with *pUsed bytes of pData consumed. Call again with the
+ * rest, even when empty, a run may still be pending.
+ */
+int32_t FrameDecodeBand(FRAME_Decoder_t *pDec, const uint8_t *pData, uint16_t Length, uint16_t *pUsed);
+
+/* Start with Crc = 0, feed the previous result to continue */
+uint32_t FrameCrc32(uint32_t Crc, const uint8_t *pData, uint16_t Length);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,149 @@
+#include "frame_delta.h"
+#include <stddef.h>
+
+static uint32_t DeltaLe32(const uint8_t *pData)
+{
+    return pData[0] | (pData[1] << 8) | ((uint32_t) pData[2] << 16) | ((uint32_t) pData[3] << 24);
+}
+
+void DeltaInit(DELTA_Transfer_t *pDelta, const uint8_t *pFrame, FRAME_Sink_t Sink)
+{
+    pDelta->Status = pFrame ? DELTA_STATUS_IDLE : DELTA_STATUS_UNSUPPORTED;
+    pDelta->Known = 0;
+    pDelta->pFrame = pFrame;
+    pDelta->Sink = Sink;
+}
+
+void DeltaFrameChanged(DELTA_Transfer_t *pDelta)
+{
+    pDelta->Known = 0;
+    if (pDelta->Status == DELTA_STATUS_RECEIVING)
+        pDelta->Status = DELTA_STATUS_ERROR;
+}
+
+/* ~6 ms of CRC at 16 MHz, only run when the frame changed since the last time */
+uint32_t DeltaFrameId(DELTA_Transfer_t *pDelta)
+{
+    if (pDelta->pFrame == NULL)
+        return 0;
+    if (!pDelta->Known)
+    {
+        pDelta->FrameId = FrameCrc32(0, pDelta->pFrame, FRAME_RAW_SIZE);
+        pDelta->Known = 1;
+    }
+    return pDelta->FrameId;
+}
+
+/* Every run must be in the frame and the last one must end the message */
+static uint8_t DeltaCheckRuns(const uint8_t *pData, uint16_t Length)
+{
+    uint16_t at = 0;
+    uint16_t offset;
+    uint8_t length;
+
+    while (at < Length)
+    {
+        if (Length - at < DELTA_RUN_HEADER_SIZE)
+            return 0;
+        offset = pData[at] | (pData[at + 1] << 8);
+        length = pData[at + 2];
+        at += DELTA_RUN_HEADER_SIZE;
+        if (length == 0 || length > Length - at || (uint32_t) offset + length > FRAME_RAW_SIZE)
+            return 0;
+        at += length;
+    }
+    return 1;
+}
+
+static void DeltaApply(DELTA_Transfer_t *pDelta, uint8_t *pData, uint16_t Length)
+{
+    uint16_t at = 0;
+    uint16_t offset;
+    uint8_t length, i;
+
+    while (at < Length)
+    {
+        offset = pData[at] | (pData[at + 1] << 8);
+        length = pData[at + 2];
+        at += DELTA_RUN_HEADER_SIZE;
+        for (i = 0; i < length; i++)
+            pData[at + i] ^= pDelta->pFrame[offset + i];
+        pDelta->Sink(offset, pData + at, length);
+        at += length;
+    }
+}
+
+static int32_t DeltaEnd(DELTA_Transfer_t *pDelta)
+{
+    if (pDelta->Messages > pDelta->Seq)
+        return FRAME_OK;
+
+    /* Worked out from the frame itself, it is also what the next delta is checked against */
+    pDelta->Known = 0;
+    if (DeltaFrameId(pDelta) != pDelta->Target)
+    {
+        pDelta->Status = DELTA_STATUS_ERROR;
+        return FRAME_ERROR;
+    }
+    pDelta->Status = DELTA_STATUS_DONE;
+    return FRAME_DONE;
+}
+
+int32_t DeltaStart(DELTA_Transfer_t *pDelta, uint8_t *pData, uint16_t Length)
+{
+    if (pDelta->pFrame == NULL)
+        return FRAME_ERROR;
+
+    if (Length < DELTA_START_SIZE || pData[0] != 'X' || pData[1] != DELTA_VERSION ||
+        !DeltaCheckRuns(pData + DELTA_START_SIZE, Length - DELTA_START_SIZE))
+    {
+        pDelta->Status = DELTA_STATUS_ERROR;
+        return FRAME_ERROR;
+    }
+    if (DeltaLe32(pData + 4) != DeltaFrameId(pDelta))
+    {
+        pDelta->Status = DELTA_STATUS_STALE;
+        return FRAME_ERROR;
+    }
+
+    pDelta->Status = DELTA_STATUS_RECEIVING;
+    pDelta->Flags = pData[2];
+    pDelta->Messages = pData[3];
+    pDelta->Seq = 0;
+    pDelta->Target = DeltaLe32(pData + 8);
+    DeltaApply(pDelta, pData + DELTA_START_SIZE, Length - DELTA_START_SIZE);
+    return DeltaEnd(pDelta);
+}
+
+int32_t DeltaPatch(DELTA_Transfer_t *pDelta, uint8_t *pData, uint16_t Length)
+{
+    if (pDelta->Status != DELTA_STATUS_RECEIVING)
+        return FRAME_ERROR;
+
+    /* A patch went missing: what is applied so far stays, the FrameId tells */
+    if (Length < DELTA_PATCH_HEADER_SIZE || pData[0] != 'Y' || pData[1] != pDelta->Seq ||
+        !DeltaCheckRuns(pData + DELTA_PATCH_HEADER_SIZE, Length - DELTA_PATCH_HEADER_SIZE))
+    {
+        pDelta->Status = DELTA_STATUS_ERROR;
+        return FRAME_ERROR;
+    }
+
+    pDelta->Seq++;
+    DeltaApply(pDelta, pData + DELTA_PATCH_HEADER_SIZE, Length - DELTA_PATCH_HEADER_SIZE);
+    return DeltaEnd(pDelta);
+}
+
+uint16_t DeltaBuildReply(DELTA_Transfer_t *pDelta, uint8_t *pData)
+{
+    uint32_t id = DeltaFrameId(pDelta);
+
+    pData[0] = 'F';
+    pData[1] = pDelta->Status;
+    pData[2] = 0;
+    pData[3] = 0;
+    pData[4] = id & 0xFF;
+    pData[5] = (id >> 8) & 0xFF;
+    pData[6] = (id >> 16) & 0xFF;
+    pData[7] = id >> 24;
+    return DELTA_REPLY_SIZE;
+}
@@ -0,0 +1,102 @@
+#ifndef __FRAME_DELTA_H
+#define __FRAME_DELTA_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include "frame_codec.h"
+
+/*
+ * Delta upload against the frame on display.
+ *
+ * The card keeps the frame it shows, so a small change only needs the
+ * bytes that differ: runs of XOR data at absolute offsets, applied in
+ * place. A frame is named by its FrameCrc32() over the FRAME_RAW_SIZE
+ * bytes. A delta names the frame it was made against and the one it
+ * makes, and is refused unless the first is the frame the card holds.
+ *
+ * Start (DELTA_START_SIZE bytes + runs):
+ *  0  'X'
+ *  1  Version      DELTA_VERSION
+ *  2  Flags        DELTA_FLAG_*
+ *  3  Messages     patch messages that follow, 0 when every run fits here
+ *  4  BaseId       frame the delta applies to, LE
+ *  8  TargetId     frame once applied, LE
+ *
+ * Patch (DELTA_PATCH_HEADER_SIZE bytes + runs), in order:
+ *  0  'Y'
+ *  1  Seq          0 .. Messages - 1
+ *
+ * Run, never split across messages:
+ *  0  Offset       first frame byte, LE
+ *  2  Length       1 .. 255
+ *  3  Length bytes XORed into the frame
+ *
+ * Query (DELTA_QUERY_SIZE bytes): 'F' 0. The card answers through the mailbox:
+ *  0  'F'
+ *  1  Status       DELTA_STATUS_* of the last delta
+ *  2  Reserved
+ *  4  FrameId      frame the card holds now, LE
+ *
+ * The reader queries the FrameId, sends a delta against it and queries
+ * again. Anything but DELTA_STATUS_DONE with the TargetId it expects
+ * means the frame goes up in full. A message is checked before any of its
+ * runs is applied, but a delta cut short leaves the frame half patched:
+ * its FrameId then matches neither end, so nothing stale builds on it.
+ */
+
+#define DELTA_VERSION           1
+#define DELTA_START_SIZE        12
+#define DELTA_PATCH_HEADER_SIZE 2
+#define DELTA_RUN_HEADER_SIZE   3
+#define DELTA_RUN_MAX           255
+#define DELTA_QUERY_SIZE        2
+#define DELTA_REPLY_SIZE        8
+
+#define DELTA_FLAG_FULL         0x01    // show with a full refresh, not the partial policy
+
+#define DELTA_STATUS_IDLE       0
+#define DELTA_STATUS_RECEIVING  1
+#define DELTA_STATUS_DONE       2
+#define DELTA_STATUS_STALE      3       // BaseId is not the frame held, nothing was applied
+#define DELTA_STATUS_ERROR      4       // bad message, lost patch or wrong TargetId
+#define DELTA_STATUS_UNSUPPORTED 5      // no frame kept to patch (NFC_STREAM_TO_EPD)
+
+typedef struct
+{
+    uint8_t Status;
+    uint8_t Flags;
+    uint8_t Messages;
+    uint8_t Seq;        // next patch expected
+    uint8_t Known;      // FrameId is up to date
+    uint32_t FrameId;
+    uint32_t Target;
+    const uint8_t *pFrame;
+    FRAME_Sink_t Sink;
+} DELTA_Transfer_t;
+
+/* pFrame is the FRAME_RAW_SIZE frame on display, NULL when none is kept. Sink writes to it */
+void DeltaInit(DELTA_Transfer_t *pDelta, const uint8_t *pFrame, FRAME_Sink_t Sink);
+
+/* Something other than Sink wrote to the frame: a delta in progress is void, the FrameId is worked out again */
+void DeltaFrameChanged(DELTA_Transfer_t *pDelta);
+
+uint32_t DeltaFrameId(DELTA_Transfer_t *pDelta);
+
+/*
+ * Start and patch messages. The XOR data in pData is turned into frame
+ * data in place before it goes to Sink. Return FRAME_OK while patches
+ * are due, FRAME_DONE once the frame matches TargetId, FRAME_ERROR
+ * otherwise.
+ */
+int32_t DeltaStart(DELTA_Transfer_t *pDelta, uint8_t *pData, uint16_t Length);
+int32_t DeltaPatch(DELTA_Transfer_t *pDelta, uint8_t *pData, uint16_t Length);
+
+uint16_t DeltaBuildReply(DELTA_Transfer_t *pDelta, uint8_t *pData);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,122 @@
+#include "frame_link.h"
+#include <string.h>
+
+#define LINK_CRC16_INIT 0xFFFF
+
+/* CRC16/CCITT-FALSE, poly 0x1021, start with LINK_CRC16_INIT */
+uint16_t LinkCrc16(uint16_t Crc, const uint8_t *pData, uint16_t Length)
+{
+    uint8_t i;
+
+    while (Length--)
+    {
+        Crc ^= (uint16_t) *pData++ << 8;
+        for (i = 0; i < 8; i++)
+            Crc = (Crc & 0x8000) ? (Crc << 1) ^ 0x1021 : Crc << 1;
+    }
+    return Crc;
+}
+
+static uint32_t LinkManifestCrc(const LINK_Transfer_t *pLink)
+{
+    uint8_t crc[2];
+    uint32_t result = 0;
+    uint8_t i;
+
+    for (i = 0; i < pLink->Chunks; i++)
+    {
+        crc[0] = pLink->ChunkCrc[i] & 0xFF;
+        crc[1] = pLink->ChunkCrc[i] >> 8;
+        result = FrameCrc32(result, crc, sizeof(crc));
+    }
+    return result;
+}
+
+int32_t LinkStart(LINK_Transfer_t *pLink, const uint8_t *pData, uint16_t Length, FRAME_Sink_t Sink)
+{
+    uint32_t crc;
+
+    if (Length != LINK_START_SIZE || pData[0] != 'T' || pData[1] != LINK_VERSION ||
+        pData[2] > FRAME_FORMAT_RLE || (pData[3] & FRAME_FLAG_GRAY) || pData[4] == 0 || pData[4] > LINK_MAX_CHUNKS)
+        return FRAME_ERROR;
+
+    crc = pData[6] | (pData[7] << 8) | ((uint32_t) pData[8] << 16) | ((uint32_t) pData[9] << 24);
+
+    /* Same transfer again, the reader reconnected: keep what we have */
+    if (pLink->Status == LINK_STATUS_RECEIVING && pLink->Crc == crc && pLink->Format == pData[2] &&
+        pLink->Flags == pData[3] && pLink->Chunks == pData[4])
+        return FRAME_OK;
+
+    pLink->Status = LINK_STATUS_RECEIVING;
+    pLink->Format = pData[2];
+    pLink->Flags = pData[3];
+    pLink->Chunks = pData[4];
+    pLink->Missing = pData[4];
+    pLink->Crc = crc;
+    pLink->Sink = Sink;
+    memset(pLink->Received, 0, sizeof(pLink->Received));
+
+    return FRAME_OK;
+}
+
+/*
+ * Decodes one chunk into the sink. Returns FRAME_DONE once every chunk is
+ * in and the frame CRC matches, FRAME_ERROR for a chunk that was rejected.
+ */
+int32_t LinkChunk(LINK_Transfer_t *pLink, FRAME_Decoder_t *pDec, const uint8_t *pData, uint16_t Length)
+{
+    FRAME_Header_t header;
+    uint8_t seq = pData[1];
+    uint16_t offset, crc;
+
+    if (pLink->Status != LINK_STATUS_RECEIVING || Length <= LINK_CHUNK_HEADER_SIZE || pData[0] != 'C')
+        return FRAME_ERROR;
+
+    crc = LinkCrc16(LINK_CRC16_INIT, pData, 6);
+    crc = LinkCrc16(crc, pData + LINK_CHUNK_HEADER_SIZE, Length - LINK_CHUNK_HEADER_SIZE);
+    if (crc != (pData[6] | (pData[7] << 8)) || seq >= pLink->Chunks)
+        return FRAME_ERROR;
+
+    /* A duplicate of a chunk we already have */
+    if (pLink->Received[seq / 8] & (1 << (seq % 8)))
+        return FRAME_OK;
+
+    header.Format = pLink->Format;
+    header.Flags = pLink->Flags;
+    header.PayloadSize = Length - LINK_CHUNK_HEADER_SIZE;
+    header.RawSize = pData[4] | (pData[5] << 8);
+    offset = pData[2] | (pData[3] << 8);
+    if ((uint32_t) offset + header.RawSize > FRAME_RAW_SIZE || offset % FRAME_ROW_BYTES)
+        return FRAME_ERROR;
+
+    FrameDecodeInit(pDec, &header, pLink->Sink);
+    pDec->Base = offset;
+    if (FrameDecode(pDec, pData + LINK_CHUNK_HEADER_SIZE, header.PayloadSize) != FRAME_DONE)
+        return FRAME_ERROR;
+
+    pLink->Received[seq / 8] |= 1 << (seq % 8);
+    pLink->ChunkCrc[seq] = crc;
+    if (--pLink->Missing)
+        return FRAME_OK;
+
+    if (LinkManifestCrc(pLink) != pLink->Crc)
+    {
+        /* Something got in that does not belong to this frame, start over */
+        memset(pLink->Received, 0, sizeof(pLink->Received));
+        pLink->Missing = pLink->Chunks;
+        pLink->Status = LINK_STATUS_CRC_ERROR;
+        return FRAME_ERROR;
+    }
+
+    pLink->Status = LINK_STATUS_DONE;
+    return FRAME_DONE;
+}
+
+uint16_t LinkBuildAck(const LINK_Transfer_t *pLink, uint8_t *pData)
+{
+    pData[0] = 'A';
+    pData[1] = pLink->Status;
+    pData[2] = pLink->Chunks;
+    memcpy(pData + 3, pLink->Received, sizeof(pLink->Received));
+    return LINK_ACK_SIZE;
+}
@@ -0,0 +1,80 @@
+#ifndef __FRAME_LINK_H
+#define __FRAME_LINK_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include "frame_codec.h"
+
+/*
+ * Reliable transfer on top of frame_codec.
+ *
+ * The frame is cut in row-aligned bands, each encoded on its own (PackBits
+ * and row delta restart at every chunk), so chunks decode in any order
+ * straight to their place and nothing is buffered on the card.
+ *
+ * Start (LINK_START_SIZE bytes), resumes if it matches the transfer in progress:
+ *  0  'T'
+ *  1  Version      LINK_VERSION
+ *  2  Format       FRAME_FORMAT_*
+ *  3  Flags        FRAME_FLAG_*
+ *  4  Chunks       1 .. LINK_MAX_CHUNKS
+ *  5  Reserved
+ *  6  Crc32        CRC32 of all chunk CRC16s in sequence order (LE each), LE
+ *
+ * Chunk (LINK_CHUNK_HEADER_SIZE bytes + encoded band):
+ *  0  'C'
+ *  1  Seq
+ *  2  Offset       first decoded byte in the frame, LE
+ *  4  RawLength    decoded bytes, LE
+ *  6  Crc16        CRC16/CCITT of bytes 0..5 and the band, LE
+ *
+ * Query (LINK_QUERY_SIZE bytes): 'Q' 0. The card answers through the mailbox:
+ *  0  'A'
+ *  1  Status       LINK_STATUS_*
+ *  2  Chunks
+ *  3  Received     bitmap, bit n of byte n / 8 set once chunk n is in
+ *
+ * Chunks that fail their CRC are dropped; the reader resends whatever the
+ * bitmap is missing. A bad frame CRC ends the transfer with
+ * LINK_STATUS_CRC_ERROR and the reader starts over.
+ */
+
+#define LINK_VERSION            1
+#define LINK_START_SIZE         10
+#define LINK_CHUNK_HEADER_SIZE  8
+#define LINK_CHUNK_DATA_MAX     (FRAME_CHUNK_MAX - LINK_CHUNK_HEADER_SIZE)
+#define LINK_QUERY_SIZE         2
+#define LINK_MAX_CHUNKS         64
+#define LINK_ACK_SIZE           (3 + LINK_MAX_CHUNKS / 8)
+
+#define LINK_STATUS_IDLE        0
+#define LINK_STATUS_RECEIVING   1
+#define LINK_STATUS_DONE        2
+#define LINK_STATUS_CRC_ERROR   3
+
+typedef struct
+{
+    uint8_t Status;
+    uint8_t Format;
+    uint8_t Flags;
+    uint8_t Chunks;
+    uint8_t Missing;
+    uint32_t Crc;
+    FRAME_Sink_t Sink;
+    uint8_t Received[LINK_MAX_CHUNKS / 8];
+    uint16_t ChunkCrc[LINK_MAX_CHUNKS];
+} LINK_Transfer_t;
+
+uint16_t LinkCrc16(uint16_t Crc, const uint8_t *pData, uint16_t Length);
+
+int32_t LinkStart(LINK_Transfer_t *pLink, const uint8_t *pData, uint16_t Length, FRAME_Sink_t Sink);
+int32_t LinkChunk(LINK_Transfer_t *pLink, FRAME_Decoder_t *pDec, const uint8_t *pData, uint16_t Length);
+uint16_t LinkBuildAck(const LINK_Transfer_t *pLink, uint8_t *pData);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
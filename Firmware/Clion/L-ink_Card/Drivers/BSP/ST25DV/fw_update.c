@@ -0,0 +1,272 @@
+#include "fw_update.h"
+#include <string.h>
+
+static uint32_t UpdateLe32(const uint8_t *pData)
+{
+    return pData[0] | (pData[1] << 8) | ((uint32_t) pData[2] << 16) | ((uint32_t) pData[3] << 24);
+}
+
+static void UpdatePutLe32(uint8_t *pData, uint32_t Value)
+{
+    pData[0] = Value & 0xFF;
+    pData[1] = (Value >> 8) & 0xFF;
+    pData[2] = (Value >> 16) & 0xFF;
+    pData[3] = Value >> 24;
+}
+
+void UpdateInit(UPDATE_Transfer_t *pUpdate, const UPDATE_Flash_t *pFlash)
+{
+    pUpdate->Status = UPDATE_STATUS_IDLE;
+    pUpdate->Known = 0;
+    pUpdate->Rewritten = 0;
+    pUpdate->pFlash = pFlash;
+}
+
+uint32_t UpdateRunningCrc(UPDATE_Transfer_t *pUpdate)
+{
+    const uint8_t *at = pUpdate->pFlash->pRunning;
+    uint32_t left = pUpdate->pFlash->RunningSize;
+    uint32_t crc = 0;
+    uint16_t length;
+
+    if (!pUpdate->Known)
+    {
+        for (; left; left -= length, at += length)
+        {
+            length = left > 0x8000 ? 0x8000 : (uint16_t) left;
+            crc = FrameCrc32(crc, at, length);
+        }
+        pUpdate->RunningCrc = crc;
+        pUpdate->Known = 1;
+    }
+    return pUpdate->RunningCrc;
+}
+
+static int32_t UpdateFail(UPDATE_Transfer_t *pUpdate)
+{
+    pUpdate->Status = UPDATE_STATUS_ERROR;
+    return FRAME_ERROR;
+}
+
+/*
+ * Half goes out, the page erased first when it starts one, what it held
+ * kept for the copies still to come. The last one is padded with erased
+ * bytes.
+ */
+static int32_t UpdateFlush(UPDATE_Transfer_t *pUpdate)
+{
+    const UPDATE_Flash_t *flash = pUpdate->pFlash;
+    uint32_t written = pUpdate->Written;
+
+    memset((uint8_t *) pUpdate->Half + pUpdate->Fill, 0, UPDATE_HALF_PAGE_SIZE - pUpdate->Fill);
+    if (written % UPDATE_PAGE_SIZE == 0)
+    {
+        memcpy((uint8_t *) flash->pSaved + written % UPDATE_SAVED_SIZE, flash->pRunning + written, UPDATE_PAGE_SIZE);
+        pUpdate->Rewritten = 1;
+        if (flash->Erase(written) != 0)
+            return FRAME_ERROR;
+    }
+    if (flash->Program(written, pUpdate->Half) != 0)
+        return FRAME_ERROR;
+    pUpdate->Written += UPDATE_HALF_PAGE_SIZE;
+    pUpdate->Fill = 0;
+    return FRAME_OK;
+}
+
+static int32_t UpdatePut(UPDATE_Transfer_t *pUpdate, const uint8_t *pData, uint32_t Length)
+{
+    uint32_t length;
+
+    if (pUpdate->Written + pUpdate->Fill + Length > pUpdate->Size)
+        return FRAME_ERROR;
+
+    while (Length)
+    {
+        length = UPDATE_HALF_PAGE_SIZE - pUpdate->Fill;
+        if (length > Length)
+            length = Length;
+        memcpy((uint8_t *) pUpdate->Half + pUpdate->Fill, pData, length);
+        pUpdate->Fill += length;
+        pData += length;
+        Length -= length;
+        if (pUpdate->Fill == UPDATE_HALF_PAGE_SIZE && UpdateFlush(pUpdate) != FRAME_OK)
+            return FRAME_ERROR;
+    }
+    return FRAME_OK;
+}
+
+/* Old image bytes at Offset, up to *pLength of them: still in flash past the pages erased, or saved. NULL once gone */
+static const uint8_t *UpdateOld(UPDATE_Transfer_t *pUpdate, uint32_t Offset, uint32_t *pLength)
+{
+    const UPDATE_Flash_t *flash = pUpdate->pFlash;
+    uint32_t erased = (pUpdate->Written + UPDATE_PAGE_SIZE - 1) / UPDATE_PAGE_SIZE * UPDATE_PAGE_SIZE;
+
+    if (Offset >= erased)
+        return flash->pRunning + Offset;
+    if (Offset + UPDATE_SAVED_SIZE < erased)
+        return NULL;
+    if (*pLength > UPDATE_PAGE_SIZE - Offset % UPDATE_PAGE_SIZE)
+        *pLength = UPDATE_PAGE_SIZE - Offset % UPDATE_PAGE_SIZE;
+    return (const uint8_t *) flash->pSaved + Offset % UPDATE_SAVED_SIZE;
+}
+
+/* Never more than Half has room for at a time: a flush may erase the page the next bytes come from */
+static int32_t UpdateCopy(UPDATE_Transfer_t *pUpdate)
+{
+    uint32_t offset = pUpdate->Copy[0] | (pUpdate->Copy[1] << 8);
+    uint32_t left = pUpdate->Copy[2] | (pUpdate->Copy[3] << 8);
+    uint32_t length;
+    const uint8_t *from;
+
+    if (left == 0 || offset + left > pUpdate->pFlash->RunningSize)
+        return FRAME_ERROR;
+    for (; left; left -= length, offset += length)
+    {
+        length = UPDATE_HALF_PAGE_SIZE - pUpdate->Fill;
+        if (length > left)
+            length = left;
+        from = UpdateOld(pUpdate, offset, &length);
+        if (from == NULL || UpdatePut(pUpdate, from, length) != FRAME_OK)
+            return FRAME_ERROR;
+    }
+    return FRAME_OK;
+}
+
+static int32_t UpdatePatch(UPDATE_Transfer_t *pUpdate, const uint8_t *pData, uint16_t Length)
+{
+    uint16_t at = 0;
+    uint16_t length;
+
+    while (at < Length)
+    {
+        if (pUpdate->Literal)
+        {
+            length = Length - at < pUpdate->Literal ? Length - at : pUpdate->Literal;
+            if (UpdatePut(pUpdate, pData + at, length) != FRAME_OK)
+                return FRAME_ERROR;
+            pUpdate->Literal -= length;
+            at += length;
+        } else if (pUpdate->CopyHave)
+        {
+            pUpdate->Copy[pUpdate->CopyHave++ - 1] = pData[at++];
+            if (pUpdate->CopyHave == UPDATE_COPY_SIZE)
+            {
+                pUpdate->CopyHave = 0;
+                if (UpdateCopy(pUpdate) != FRAME_OK)
+                    return FRAME_ERROR;
+            }
+        } else if (pData[at] <= UPDATE_OP_LITERAL_MAX)
+            pUpdate->Literal = pData[at++] + 1;
+        else if (pData[at++] == UPDATE_OP_COPY)
+            pUpdate->CopyHave = 1;
+        else
+            return FRAME_ERROR;
+    }
+    return FRAME_OK;
+}
+
+int32_t UpdateStart(UPDATE_Transfer_t *pUpdate, const uint8_t *pData, uint16_t Length)
+{
+    uint32_t size, crc, base;
+
+    if (Length != UPDATE_START_SIZE || pData[0] != 'U' || pData[1] != UPDATE_VERSION)
+        return UpdateFail(pUpdate);
+
+    size = UpdateLe32(pData + 4);
+    crc = UpdateLe32(pData + 8);
+    base = UpdateLe32(pData + 12);
+    if (pUpdate->Status == UPDATE_STATUS_RECEIVING && pUpdate->Flags == pData[2] &&
+        pUpdate->Size == size && pUpdate->Crc == crc && pUpdate->BaseCrc == base)
+        return FRAME_OK;
+
+    if (size == 0 || size > pUpdate->pFlash->RegionSize)
+        return UpdateFail(pUpdate);
+    if ((pData[2] & UPDATE_FLAG_PATCH) && (pUpdate->Rewritten || base != UpdateRunningCrc(pUpdate)))
+    {
+        pUpdate->Status = UPDATE_STATUS_STALE;
+        return FRAME_ERROR;
+    }
+
+    pUpdate->Status = UPDATE_STATUS_RECEIVING;
+    pUpdate->Flags = pData[2];
+    pUpdate->Size = size;
+    pUpdate->Crc = crc;
+    pUpdate->BaseCrc = base;
+    pUpdate->Seq = 0;
+    pUpdate->Fill = 0;
+    pUpdate->Written = 0;
+    pUpdate->Literal = 0;
+    pUpdate->CopyHave = 0;
+    return FRAME_OK;
+}
+
+int32_t UpdateData(UPDATE_Transfer_t *pUpdate, const uint8_t *pData, uint16_t Length)
+{
+    const uint8_t *image = pUpdate->pFlash->pRunning;
+    uint32_t left, crc = 0;
+    uint16_t length;
+    int32_t status;
+
+    if (pUpdate->Status != UPDATE_STATUS_RECEIVING)
+        return FRAME_ERROR;
+    if (Length < UPDATE_DATA_HEADER_SIZE || pData[0] != 'W' || (pData[2] | (pData[3] << 8)) != pUpdate->Seq)
+        return FRAME_OK;
+
+    pData += UPDATE_DATA_HEADER_SIZE;
+    Length -= UPDATE_DATA_HEADER_SIZE;
+    if (pUpdate->Flags & UPDATE_FLAG_PATCH)
+        status = UpdatePatch(pUpdate, pData, Length);
+    else
+        status = UpdatePut(pUpdate, pData, Length);
+    if (status != FRAME_OK)
+        return UpdateFail(pUpdate);
+    pUpdate->Seq++;
+
+    if (pUpdate->Written + pUpdate->Fill < pUpdate->Size)
+        return FRAME_OK;
+    if (pUpdate->Literal || pUpdate->CopyHave || (pUpdate->Fill && UpdateFlush(pUpdate) != FRAME_OK))
+        return UpdateFail(pUpdate);
+
+    /* Read back from the region, as it will run */
+    for (left = pUpdate->Size; left; left -= length, image += length)
+    {
+        length = left > 0x8000 ? 0x8000 : (uint16_t) left;
+        crc = FrameCrc32(crc, image, length);
+    }
+    if (crc != pUpdate->Crc)
+        return UpdateFail(pUpdate);
+    pUpdate->Status = UPDATE_STATUS_DONE;
+    return FRAME_DONE;
+}
+
+uint16_t UpdateBuildStart(const UPDATE_Transfer_t *pUpdate, uint8_t *pData)
+{
+    pData[0] = 'U';
+    pData[1] = UPDATE_VERSION;
+    pData[2] = pUpdate->Flags;
+    pData[3] = 0;
+    UpdatePutLe32(pData + 4, pUpdate->Size);
+    UpdatePutLe32(pData + 8, pUpdate->Crc);
+    UpdatePutLe32(pData + 12, pUpdate->BaseCrc);
+    return UPDATE_START_SIZE;
+}
+
+uint16_t UpdateBuildReply(UPDATE_Transfer_t *pUpdate, uint8_t *pData)
+{
+    uint8_t receiving = pUpdate->Status == UPDATE_STATUS_RECEIVING;
+    uint32_t written = 0;
+
+    if (receiving)
+        written = pUpdate->Written + pUpdate->Fill;
+    else if (pUpdate->Status == UPDATE_STATUS_DONE)
+        written = pUpdate->Size;
+
+    pData[0] = 'V';
+    pData[1] = pUpdate->Status;
+    pData[2] = receiving ? pUpdate->Seq & 0xFF : 0;
+    pData[3] = receiving ? pUpdate->Seq >> 8 : 0;
+    UpdatePutLe32(pData + 4, written);
+    UpdatePutLe32(pData + 8, pUpdate->Rewritten ? 0 : pUpdate->pFlash->RunningSize);
+    UpdatePutLe32(pData + 12, pUpdate->Rewritten ? 0 : UpdateRunningCrc(pUpdate));
+    return UPDATE_REPLY_SIZE;
+}
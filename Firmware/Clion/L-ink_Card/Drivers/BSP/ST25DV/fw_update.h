@@ -0,0 +1,143 @@
+#ifndef __FW_UPDATE_H
+#define __FW_UPDATE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include "frame_codec.h"
+
+/*
+ * Firmware update over the mailbox.
+ *
+ * The flash has no room for a second image, so the new one is written
+ * over the one running, by the bootloader: the application checks the
+ * start message and hands the transfer over with a reset, the bootloader
+ * takes the data messages and only marks the application region
+ * bootable again once the image in it checks out against its CRC. It
+ * comes whole, or as a patch against the image running before: runs
+ * copied from it and literal bytes, so a build that only moved or
+ * changed a little costs a fraction of its size on the air. Images are
+ * named by their FrameCrc32().
+ *
+ * A copy reads the old image ahead of the pages rewritten so far, or up
+ * to UPDATE_BACK_MAX behind in the pages kept in RAM before their erase,
+ * which covers code moved up by what was inserted before it.
+ *
+ * Start (UPDATE_START_SIZE bytes), resumes if it matches the update in progress:
+ *  0  'U'
+ *  1  Version      UPDATE_VERSION
+ *  2  Flags        UPDATE_FLAG_*
+ *  3  Reserved
+ *  4  Size         image bytes, LE
+ *  8  Crc          of the image, LE
+ * 12  BaseCrc      UPDATE_FLAG_PATCH: of the image the patch applies to, LE
+ *
+ * Data (UPDATE_DATA_HEADER_SIZE bytes + stream), in order:
+ *  0  'W'
+ *  1  Reserved
+ *  2  Seq          0, 1, ... LE
+ *  4  image bytes, or patch ops; an op may go on in the next message
+ *
+ * Patch op:
+ *  0x00 .. 0x7F    n + 1 literal bytes follow
+ *  0x80            Offset LE16, Length LE16: bytes copied from the running image
+ *
+ * Query (UPDATE_QUERY_SIZE bytes): 'V' UPDATE_QUERY_*. A status query is
+ * answered through the mailbox:
+ *  0  'V'
+ *  1  Status       UPDATE_STATUS_*
+ *  2  Seq          next data message expected, LE
+ *  4  Written      image bytes in the application region, LE
+ *  8  RunningSize  LE, 0 once writing began: no image left to patch
+ * 12  RunningCrc   LE
+ *
+ * A data message out of sequence is dropped, the reader resumes from the
+ * Seq the status gives. UPDATE_QUERY_INSTALL only takes once the status
+ * is UPDATE_STATUS_DONE: the card resets and comes back on the new image,
+ * which the next status query shows in RunningCrc.
+ */
+
+#define UPDATE_VERSION          1
+#define UPDATE_START_SIZE       16
+#define UPDATE_DATA_HEADER_SIZE 4
+#define UPDATE_DATA_MAX         (FRAME_CHUNK_MAX - UPDATE_DATA_HEADER_SIZE)
+#define UPDATE_QUERY_SIZE       2
+#define UPDATE_REPLY_SIZE       16
+
+#define UPDATE_FLAG_PATCH       0x01
+
+#define UPDATE_OP_LITERAL_MAX   0x7F
+#define UPDATE_OP_COPY          0x80
+#define UPDATE_COPY_SIZE        5
+
+#define UPDATE_QUERY_STATUS     0
+#define UPDATE_QUERY_INSTALL    1
+
+#define UPDATE_STATUS_IDLE      0
+#define UPDATE_STATUS_RECEIVING 1
+#define UPDATE_STATUS_DONE      2
+#define UPDATE_STATUS_STALE     3       // BaseCrc is not the running image, nothing was written
+#define UPDATE_STATUS_ERROR     4       // bad start or op, flash failure, or the image fails its CRC
+
+#define UPDATE_PAGE_SIZE        128     // erased at once
+#define UPDATE_HALF_PAGE_SIZE   64      // programmed at once
+#define UPDATE_SAVED_SIZE       0x1000  // old pages kept in RAM once erased
+#define UPDATE_BACK_MAX         (UPDATE_SAVED_SIZE - UPDATE_HALF_PAGE_SIZE)     // a copy's source behind its destination
+
+/* The application region, the image in it and where the old pages go */
+typedef struct
+{
+    const uint8_t *pRunning;
+    uint32_t RunningSize;       // 0 when it holds nothing a patch applies to
+    uint32_t RegionSize;
+    uint32_t *pSaved;           // UPDATE_SAVED_SIZE, NULL where nothing is written
+    /* UPDATE_PAGE_SIZE at Offset, 0 on success */
+    int32_t (*Erase)(uint32_t Offset);
+    /* UPDATE_HALF_PAGE_SIZE at Offset, in a page erased since. 0 on success */
+    int32_t (*Program)(uint32_t Offset, const uint32_t *pWords);
+} UPDATE_Flash_t;
+
+typedef struct
+{
+    uint8_t Status;
+    uint8_t Flags;
+    uint8_t Known;      // RunningCrc is worked out
+    uint8_t Literal;    // patch: literal bytes still due
+    uint8_t CopyHave;   // patch: copy op bytes in Copy, 0 when none is open
+    uint8_t Rewritten;  // a page of the running image was erased, nothing left to patch
+    uint8_t Copy[UPDATE_COPY_SIZE - 1];
+    uint16_t Seq;
+    uint16_t Fill;      // bytes in Half
+    uint32_t Size;
+    uint32_t Crc;
+    uint32_t BaseCrc;
+    uint32_t Written;   // programmed to the application region
+    uint32_t RunningCrc;
+    const UPDATE_Flash_t *pFlash;
+    uint32_t Half[UPDATE_HALF_PAGE_SIZE / 4];
+} UPDATE_Transfer_t;
+
+void UpdateInit(UPDATE_Transfer_t *pUpdate, const UPDATE_Flash_t *pFlash);
+
+/* ~60 ms of CRC at 16 MHz the first time, the image doesn't change until the next reset */
+uint32_t UpdateRunningCrc(UPDATE_Transfer_t *pUpdate);
+
+/*
+ * Start and data messages. Return FRAME_OK while data is due, FRAME_DONE
+ * once the application region holds the whole image and it matches Crc,
+ * FRAME_ERROR otherwise.
+ */
+int32_t UpdateStart(UPDATE_Transfer_t *pUpdate, const uint8_t *pData, uint16_t Length);
+int32_t UpdateData(UPDATE_Transfer_t *pUpdate, const uint8_t *pData, uint16_t Length);
+
+/* The start message of the update in progress, for the bootloader to take it over */
+uint16_t UpdateBuildStart(const UPDATE_Transfer_t *pUpdate, uint8_t *pData);
+
+uint16_t UpdateBuildReply(UPDATE_Transfer_t *pUpdate, uint8_t *pData);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
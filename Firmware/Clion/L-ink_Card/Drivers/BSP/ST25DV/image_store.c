@@ -0,0 +1,362 @@
+#include "image_store.h"
+#include "nfc04a1_nfctag.h"
+#include <string.h>
+
+static STORE_Table_t StoreTable;
+static uint16_t StoreBlocks = 0;   // EEPROM size in blocks, table block included
+
+/* Slot being written */
+static uint8_t WriteSlot = STORE_SLOT_NONE;
+static STORE_Entry_t WriteEntry;
+static uint16_t WriteFill;
+
+/* Slot being decoded, see StoreOpen() */
+static uint8_t *ReadBuffer;
+static uint16_t ReadSize;
+static uint16_t ReadStart;
+static uint16_t ReadAddr;
+static uint16_t ReadLeft;
+static uint16_t ReadFill;
+static uint16_t ReadPos;
+
+static uint16_t StoreAddr(uint8_t Block)
+{
+    return STORE_BASE + Block * STORE_BLOCK_SIZE;
+}
+
+static void StorePut16(uint8_t *pData, uint16_t Value)
+{
+    pData[0] = Value & 0xFF;
+    pData[1] = Value >> 8;
+}
+
+static void StorePut32(uint8_t *pData, uint32_t Value)
+{
+    StorePut16(pData, Value & 0xFFFF);
+    StorePut16(pData + 2, Value >> 16);
+}
+
+static uint16_t StoreGet16(const uint8_t *pData)
+{
+    return pData[0] | (pData[1] << 8);
+}
+
+static uint32_t StoreGet32(const uint8_t *pData)
+{
+    return StoreGet16(pData) | ((uint32_t) StoreGet16(pData + 2) << 16);
+}
+
+static int32_t StoreRead(uint16_t Addr, uint8_t *pData, uint16_t Length)
+{
+    if (NFC04A1_NFCTAG_ReadData(NFC04A1_NFCTAG_INSTANCE, pData, Addr, Length) != NFCTAG_OK)
+        return STORE_ERROR;
+    return STORE_OK;
+}
+
+static int32_t StoreWriteRaw(uint16_t Addr, const uint8_t *pData, uint16_t Length)
+{
+    if (NFC04A1_NFCTAG_WriteData(NFC04A1_NFCTAG_INSTANCE, pData, Addr, Length) != NFCTAG_OK)
+        return STORE_ERROR;
+    return STORE_OK;
+}
+
+static int32_t StoreSaveTable(void)
+{
+    uint8_t table[STORE_TABLE_SIZE];
+    uint8_t *entry = table + 6;
+    uint8_t i;
+
+    table[0] = STORE_MAGIC;
+    table[1] = STORE_VERSION;
+    table[2] = StoreTable.Active;
+    table[3] = 0;
+    StorePut16(table + 4, StoreTable.Cycle);
+    for (i = 0; i < STORE_MAX_SLOTS; i++, entry += STORE_ENTRY_SIZE)
+    {
+        entry[0] = StoreTable.Entries[i].Block;
+        entry[1] = StoreTable.Entries[i].Blocks;
+        StorePut16(entry + 2, StoreTable.Entries[i].Size);
+        StorePut32(entry + 4, StoreTable.Entries[i].Crc);
+    }
+    StorePut32(entry, FrameCrc32(0, table, entry - table));
+
+    return StoreWriteRaw(STORE_BASE, table, sizeof(table));
+}
+
+int32_t StoreInit(void)
+{
+    ST25DV_MEM_SIZE size;
+    uint8_t table[STORE_TABLE_SIZE];
+    const uint8_t *entry = table + 6;
+    uint32_t bytes;
+    uint8_t i;
+
+    memset(&StoreTable, 0, sizeof(StoreTable));
+    StoreTable.Active = STORE_SLOT_NONE;
+    WriteSlot = STORE_SLOT_NONE;
+
+    if (NFC04A1_NFCTAG_ReadMemSize(NFC04A1_NFCTAG_INSTANCE, &size) != NFCTAG_OK)
+        return STORE_ERROR;
+    bytes = (uint32_t) (size.Mem_Size + 1) * (size.BlockSize + 1);
+    StoreBlocks = (bytes - STORE_BASE) / STORE_BLOCK_SIZE;
+    if (StoreBlocks > STORE_MAX_BLOCKS)
+        StoreBlocks = STORE_MAX_BLOCKS;
+
+    if (StoreRead(STORE_BASE, table, sizeof(table)) != STORE_OK)
+        return STORE_ERROR;
+
+    /* A blank or foreign EEPROM just means an empty store */
+    if (table[0] != STORE_MAGIC || table[1] != STORE_VERSION ||
+        StoreGet32(table + sizeof(table) - 4) != FrameCrc32(0, table, sizeof(table) - 4))
+        return STORE_OK;
+
+    StoreTable.Active = table[2];
+    StoreTable.Cycle = StoreGet16(table + 4);
+    for (i = 0; i < STORE_MAX_SLOTS; i++, entry += STORE_ENTRY_SIZE)
+    {
+        if (entry[0] == 0 || entry[0] + entry[1] > StoreBlocks)
+            continue;
+        StoreTable.Entries[i].Block = entry[0];
+        StoreTable.Entries[i].Blocks = entry[1];
+        StoreTable.Entries[i].Size = StoreGet16(entry + 2);
+        StoreTable.Entries[i].Crc = StoreGet32(entry + 4);
+    }
+    if (StoreTable.Active >= STORE_MAX_SLOTS || StoreTable.Entries[StoreTable.Active].Blocks == 0)
+        StoreTable.Active = STORE_SLOT_NONE;
+
+    return STORE_OK;
+}
+
+const STORE_Table_t *StoreGetTable(void)
+{
+    return &StoreTable;
+}
+
+/* First fit run of free blocks, the blocks of slot Skip count as free */
+static uint8_t StoreAlloc(uint16_t Blocks, uint8_t Skip)
+{
+    uint16_t start = 1;
+    uint8_t i;
+    const STORE_Entry_t *entry;
+
+    while (start + Blocks <= StoreBlocks)
+    {
+        for (i = 0; i < STORE_MAX_SLOTS; i++)
+        {
+            entry = &StoreTable.Entries[i];
+            if (i == Skip || entry->Blocks == 0)
+                continue;
+            if (start < entry->Block + entry->Blocks && entry->Block < start + Blocks)
+                break;
+        }
+        if (i == STORE_MAX_SLOTS)
+            return start;
+        start = entry->Block + entry->Blocks;
+    }
+    return 0;
+}
+
+int32_t StoreWriteBegin(uint8_t Slot, const FRAME_Header_t *pHeader)
+{
+    uint8_t header[FRAME_HEADER_SIZE];
+    uint16_t blocks;
+    uint8_t block;
+
+    WriteSlot = STORE_SLOT_NONE;
+    if (Slot >= STORE_MAX_SLOTS || pHeader->PayloadSize > 0xFFFF - FRAME_HEADER_SIZE)
+        return STORE_ERROR;
+
+    WriteEntry.Size = FRAME_HEADER_SIZE + pHeader->PayloadSize;
+    blocks = (WriteEntry.Size + STORE_BLOCK_SIZE - 1) / STORE_BLOCK_SIZE;
+    if (blocks > 0xFF)
+        return STORE_ERROR;
+
+    /* Keep the old image until the new one is complete if there is room */
+    block = StoreAlloc(blocks, STORE_SLOT_NONE);
+    if (block == 0)
+    {
+        block = StoreAlloc(blocks, Slot);
+        if (block == 0)
+            return STORE_ERROR;
+        if (StoreErase(Slot) != STORE_OK)
+            return STORE_ERROR;
+    }
+
+    WriteEntry.Block = block;
+    WriteEntry.Blocks = blocks;
+
+    FrameBuildHeader(pHeader, header);
+    if (StoreWriteRaw(StoreAddr(block), header, sizeof(header)) != STORE_OK)
+        return STORE_ERROR;
+    WriteEntry.Crc = FrameCrc32(0, header, sizeof(header));
+    WriteFill = sizeof(header);
+    WriteSlot = Slot;
+
+    return STORE_OK;
+}
+
+int32_t StoreWrite(const uint8_t *pData, uint16_t Length)
+{
+    if (WriteSlot == STORE_SLOT_NONE || WriteFill + Length > WriteEntry.Size)
+    {
+        WriteSlot = STORE_SLOT_NONE;
+        return STORE_ERROR;
+    }
+
+    if (StoreWriteRaw(StoreAddr(WriteEntry.Block) + WriteFill, pData, Length) != STORE_OK)
+    {
+        WriteSlot = STORE_SLOT_NONE;
+        return STORE_ERROR;
+    }
+    WriteEntry.Crc = FrameCrc32(WriteEntry.Crc, pData, Length);
+    WriteFill += Length;
+
+    if (WriteFill < WriteEntry.Size)
+        return STORE_OK;
+
+    /* Complete, the table entry is what makes it visible */
+    StoreTable.Entries[WriteSlot] = WriteEntry;
+    WriteSlot = STORE_SLOT_NONE;
+    if (StoreSaveTable() != STORE_OK)
+        return STORE_ERROR;
+    return STORE_DONE;
+}
+
+int32_t StoreErase(uint8_t Slot)
+{
+    if (Slot >= STORE_MAX_SLOTS)
+        return STORE_ERROR;
+
+    StoreTable.Entries[Slot].Blocks = 0;
+    if (StoreTable.Active == Slot)
+        StoreTable.Active = STORE_SLOT_NONE;
+    return StoreSaveTable();
+}
+
+int32_t StoreSetCycle(uint16_t Seconds)
+{
+    StoreTable.Cycle = Seconds;
+    return StoreSaveTable();
+}
+
+int32_t StoreSetActive(uint8_t Slot)
+{
+    if (StoreTable.Active == Slot)
+        return STORE_OK;
+    StoreTable.Active = Slot;
+    return StoreSaveTable();
+}
+
+uint8_t StoreNext(uint8_t Slot)
+{
+    uint8_t i;
+
+    if (Slot >= STORE_MAX_SLOTS)
+        Slot = STORE_MAX_SLOTS - 1;
+
+    for (i = 1; i <= STORE_MAX_SLOTS; i++)
+    {
+        if (StoreTable.Entries[(Slot + i) % STORE_MAX_SLOTS].Blocks)
+            return (Slot + i) % STORE_MAX_SLOTS;
+    }
+    return STORE_SLOT_NONE;
+}
+
+/*
+ * Checks the slot CRC and gets the decoder ready for it. The EEPROM is
+ * read Size bytes at a time into pBuffer, at least a header, which must
+ * stay around until the slot has been decoded.
+ */
+int32_t StoreOpen(uint8_t Slot, FRAME_Decoder_t *pDec, FRAME_Sink_t Sink, uint8_t *pBuffer, uint16_t Size)
+{
+    const STORE_Entry_t *entry;
+    FRAME_Header_t header;
+    uint16_t addr, left, length;
+    uint32_t crc = 0;
+
+    if (Slot >= STORE_MAX_SLOTS || StoreTable.Entries[Slot].Blocks == 0 || Size < FRAME_HEADER_SIZE)
+        return STORE_ERROR;
+    entry = &StoreTable.Entries[Slot];
+
+    for (addr = StoreAddr(entry->Block), left = entry->Size; left; addr += length, left -= length)
+    {
+        length = left < Size ? left : Size;
+        if (StoreRead(addr, pBuffer, length) != STORE_OK)
+            return STORE_ERROR;
+        crc = FrameCrc32(crc, pBuffer, length);
+    }
+    if (crc != entry->Crc)
+        return STORE_ERROR;
+
+    addr = StoreAddr(entry->Block);
+    if (StoreRead(addr, pBuffer, FRAME_HEADER_SIZE) != STORE_OK ||
+        FrameParseHeader(pBuffer, FRAME_HEADER_SIZE, &header) != FRAME_OK)
+        return STORE_ERROR;
+    FrameDecodeInit(pDec, &header, Sink);
+
+    ReadStart = addr + FRAME_HEADER_SIZE;
+    ReadBuffer = pBuffer;
+    ReadSize = Size;
+
+    return StoreRewind(pDec);
+}
+
+/* Back to the first band of the slot opened last, it is not checked again */
+int32_t StoreRewind(FRAME_Decoder_t *pDec)
+{
+    FRAME_Header_t header = pDec->Header;
+
+    if (!ReadBuffer)
+        return STORE_ERROR;
+
+    FrameDecodeInit(pDec, &header, pDec->Sink);
+    ReadAddr = ReadStart;
+    ReadLeft = header.PayloadSize;
+    ReadFill = 0;
+    ReadPos = 0;
+
+    return STORE_OK;
+}
+
+/* Decodes until the next band has gone to the sink, STORE_DONE after the last one */
+int32_t StoreDecodeBand(FRAME_Decoder_t *pDec)
+{
+    int32_t status;
+    uint16_t used;
+
+    do
+    {
+        if (ReadPos == ReadFill && ReadLeft)
+        {
+            ReadFill = ReadLeft < ReadSize ? ReadLeft : ReadSize;
+            if (StoreRead(ReadAddr, ReadBuffer, ReadFill) != STORE_OK)
+                return STORE_ERROR;
+            ReadAddr += ReadFill;
+            ReadLeft -= ReadFill;
+            ReadPos = 0;
+        }
+
+        status = FrameDecodeBand(pDec, ReadBuffer + ReadPos, ReadFill - ReadPos, &used);
+        ReadPos += used;
+        if (status == FRAME_ERROR)
+            return STORE_ERROR;
+    } while (status == FRAME_OK);
+
+    return status == FRAME_DONE ? STORE_DONE : STORE_OK;
+}
+
+/* Replays a whole slot through the decoder into Sink */
+int32_t StoreLoad(uint8_t Slot, FRAME_Decoder_t *pDec, FRAME_Sink_t Sink, uint8_t *pBuffer, uint16_t Size)
+{
+    int32_t status;
+
+    if (StoreOpen(Slot, pDec, Sink, pBuffer, Size) != STORE_OK)
+        return STORE_ERROR;
+
+    do
+    {
+        status = StoreDecodeBand(pDec);
+    } while (status == STORE_OK);
+
+    return status == STORE_DONE ? STORE_OK : STORE_ERROR;
+}
@@ -0,0 +1,91 @@
+#ifndef __IMAGE_STORE_H
+#define __IMAGE_STORE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include "frame_codec.h"
+
+/*
+ * Image slots in the ST25DV user EEPROM.
+ *
+ * Block 0 holds the slot table, the rest is split in STORE_BLOCK_SIZE
+ * blocks. A slot is a run of blocks holding exactly what came over the
+ * mailbox: the 8-byte frame header followed by its payload, so a slot
+ * replays through the same decoder as a live transfer.
+ *
+ * Table:
+ *  0  Magic        'S'
+ *  1  Version      STORE_VERSION
+ *  2  Active       slot shown at boot, STORE_SLOT_NONE if none
+ *  3  Reserved
+ *  4  Cycle        seconds between slots when cycling, 0 = off, LE
+ *  6  Entries      STORE_MAX_SLOTS x { Block, Blocks, Size LE, Crc32 LE }
+ *  .. Crc32        over everything above, LE
+ *
+ * Control messages (4 bytes, only between frames):
+ *  'S' STORE_CMD_SAVE  slot  -      the next frame goes to the slot, not the panel
+ *  'S' STORE_CMD_SHOW  slot  -      show a slot, STORE_SLOT_NEXT for the next used one
+ *  'S' STORE_CMD_ERASE slot  -      free a slot
+ *  'S' STORE_CMD_CYCLE secs(LE)     show the next slot every secs seconds, 0 = off
+ */
+
+#define STORE_MAGIC             'S'
+#define STORE_VERSION           1
+#define STORE_BASE              0x0000
+#define STORE_BLOCK_SIZE        128
+#define STORE_MAX_SLOTS         8
+#define STORE_MAX_BLOCKS        256
+#define STORE_ENTRY_SIZE        8
+#define STORE_TABLE_SIZE        (6 + STORE_MAX_SLOTS * STORE_ENTRY_SIZE + 4)
+
+#define STORE_SLOT_NONE         0xFF
+#define STORE_SLOT_NEXT         0xFE
+
+#define STORE_CMD_SIZE          4
+#define STORE_CMD_SAVE          1
+#define STORE_CMD_SHOW          2
+#define STORE_CMD_ERASE         3
+#define STORE_CMD_CYCLE         4
+
+#define STORE_OK                0
+#define STORE_DONE              1
+#define STORE_ERROR             (-1)
+
+typedef struct
+{
+    uint8_t Block;
+    uint8_t Blocks;     // 0 when the slot is free
+    uint16_t Size;      // header + payload bytes
+    uint32_t Crc;
+} STORE_Entry_t;
+
+typedef struct
+{
+    uint8_t Active;
+    uint16_t Cycle;
+    STORE_Entry_t Entries[STORE_MAX_SLOTS];
+} STORE_Table_t;
+
+int32_t StoreInit(void);
+const STORE_Table_t *StoreGetTable(void);
+
+int32_t StoreWriteBegin(uint8_t Slot, const FRAME_Header_t *pHeader);
+int32_t StoreWrite(const uint8_t *pData, uint16_t Length);
+
+int32_t StoreErase(uint8_t Slot);
+int32_t StoreSetCycle(uint16_t Seconds);
+uint8_t StoreNext(uint8_t Slot);
+
+int32_t StoreOpen(uint8_t Slot, FRAME_Decoder_t *pDec, FRAME_Sink_t Sink, uint8_t *pBuffer, uint16_t Size);
+int32_t StoreDecodeBand(FRAME_Decoder_t *pDec);
+int32_t StoreRewind(FRAME_Decoder_t *pDec);
+int32_t StoreLoad(uint8_t Slot, FRAME_Decoder_t *pDec, FRAME_Sink_t Sink, uint8_t *pBuffer, uint16_t Size);
+int32_t StoreSetActive(uint8_t Slot);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,65 @@
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+
+/*
+ * Clock governor. The card spends most of its life waiting for the
+ * reader, and what little runs in between (a wakeup, an interrupt
+ * noting an event) doesn't need 16 MHz. Decoding, rendering and panel
+ * transfers on the other hand are bursts, over sooner on the PLL.
+ *
+ *  CLOCK_LEVEL_LOW     MSI 131 kHz, range 3. I2C1 has no valid timing
+ *                      and USART1 no baud rate this slow: both are
+ *                      parked, a mailbox drain started from the GPO
+ *                      waits for the main loop to raise the clock.
+ *  CLOCK_LEVEL_RUN     HSI16, range 1, the reset configuration.
+ *  CLOCK_LEVEL_BOOST   HSI16 x 4 / 2 PLL, 32 MHz, range 1, one wait
+ *                      state. The PLL stops in STOP, it is locked
+ *                      again before anything runs after a wakeup.
+ *
+ * Every switch retimes I2C1 and USART1 for the new PCLK, after waiting
+ * for both to be idle. Main loop only.
+ */
+
+#ifndef CLOCK_GOVERNOR
+#define CLOCK_GOVERNOR 1
+#endif
+
+#define CLOCK_LEVEL_LOW     0
+#define CLOCK_LEVEL_RUN     1
+#define CLOCK_LEVEL_BOOST   2
+#define CLOCK_LEVELS        3
+
+/* Current budget per level in uA, running from flash, for the charge estimate */
+#define CLOCK_BUDGET_LOW_UA     35U
+#define CLOCK_BUDGET_RUN_UA     2600U
+#define CLOCK_BUDGET_BOOST_UA   6500U
+
+typedef struct
+{
+    uint32_t Ms[CLOCK_LEVELS];          // run time per level, STOP excluded
+    uint32_t Switches;
+} CLOCK_Stats_t;
+
+/* SystemClock_Config() left the card at CLOCK_LEVEL_RUN */
+void ClockInit(void);
+
+/* Returns the level it switches from, a no-op when already there */
+uint8_t ClockSet(uint8_t Level);
+uint8_t ClockGetLevel(void);
+
+/* power.c, around STOP: its time is nobody's, and the PLL comes back */
+void ClockStop(void);
+void ClockResume(void);
+
+const CLOCK_Stats_t *ClockGetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
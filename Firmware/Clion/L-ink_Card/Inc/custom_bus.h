@@ -86,6 +86,7 @@ typedef struct
   */
 
 extern I2C_HandleTypeDef hi2c1;
+extern DMA_HandleTypeDef hdma_i2c1_rx;
 
 /**
   * @}
@@ -104,6 +105,11 @@ int32_t BSP_I2C1_WriteReg(uint16_t Addr, uint16_t Reg, uint8_t *pData, uint16_t
 int32_t BSP_I2C1_ReadReg(uint16_t Addr, uint16_t Reg, uint8_t *pData, uint16_t Length);
 int32_t BSP_I2C1_WriteReg16(uint16_t Addr, uint16_t Reg, uint8_t *pData, uint16_t Length);
 int32_t BSP_I2C1_ReadReg16(uint16_t Addr, uint16_t Reg, uint8_t *pData, uint16_t Length);
+int32_t BSP_I2C1_ReadReg16_DMA(uint16_t Addr, uint16_t Reg, uint8_t *pData, uint16_t Length);
+void BSP_I2C1_RxCpltCallback(int32_t Status);
+void BSP_I2C1_IdleCallback(void);
+int32_t BSP_I2C1_Suspend(void);
+int32_t BSP_I2C1_Resume(void);
 int32_t BSP_I2C1_Send(uint16_t DevAddr, uint8_t *pData, uint16_t Length);
 int32_t BSP_I2C1_Recv(uint16_t DevAddr, uint8_t *pData, uint16_t Length);
 int32_t BSP_I2C1_SendRecv(uint16_t DevAddr, uint8_t *pTxdata, uint8_t *pRxdata, uint16_t Length);
@@ -0,0 +1,47 @@
+#ifndef __FW_FLASH_H
+#define __FW_FLASH_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+#include "fw_update.h"
+
+/*
+ * The 64 KB of flash, for updates over NFC (fw_update.h): the bootloader
+ * (Boot/boot.c) and the application region after it. The application is
+ * linked for its region (STM32L051K8Tx_SLOT.ld). There is no room for a
+ * second copy of it: on an update start the application checks the
+ * start message and resets into the bootloader, which receives the image
+ * over the one running and only marks the region bootable again once it
+ * checks out. Until then, a power loss comes back to the bootloader.
+ *
+ * With FW_UPDATE, the CMake option, on by default. Without it the
+ * application keeps the whole flash and the bootloader is left out.
+ */
+
+#ifndef FW_UPDATE
+#define FW_UPDATE 0
+#endif
+
+#define FW_BOOT_ADDRESS     FLASH_BASE
+#define FW_BOOT_SIZE        0x1000U
+#define FW_APP_ADDRESS      (FW_BOOT_ADDRESS + FW_BOOT_SIZE)
+#define FW_APP_SIZE         (0x10000U - FW_BOOT_SIZE)     // 60 KB
+
+/* NVM_FW_STATE */
+#define FW_STATE_NONE       0           // the application is to be started
+#define FW_STATE_RECEIVE    1           // the bootloader is to take the update NVM_FW_START holds, nothing written yet
+#define FW_STATE_WRITING    2           // the application region is being rewritten, not to be run until an image checks out
+
+/* The running image as its .bin holds it */
+const UPDATE_Flash_t *FwFlashGet(void);
+
+/* Hands the update pStart begins (UPDATE_START_SIZE) to the bootloader and resets. Only returns if the NVM write fails */
+void FwFlashReceive(const uint8_t *pStart);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,53 @@
+#ifndef __LOG_H
+#define __LOG_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+#include "log_messages.h"
+
+/*
+ * Binary log over USART1. LOG() only copies the message ID and its
+ * arguments into a ring buffer as a record (see log_messages.h), the TX
+ * DMA drains it in the background and the formats are expanded by the
+ * host decoder. Records that don't fit are dropped and counted, LOG()
+ * never waits.
+ *
+ * Main loop only, the ring has a single writer.
+ */
+
+#ifndef LOG_ENABLE
+#define LOG_ENABLE 1
+#endif
+
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE     64      // a power of two, holds two full records
+#endif
+
+typedef enum
+{
+#define LOG_ID(Id, Format) Id,
+    LOG_MESSAGES(LOG_ID)
+#undef LOG_ID
+    LOG_COUNT
+} LOG_Id_t;
+
+#if LOG_ENABLE
+#define LOG(Id, ...) \
+    do \
+    { \
+        const uint32_t logArgs[] = {0, ##__VA_ARGS__}; \
+        LogWrite(Id, logArgs + 1, sizeof(logArgs) / sizeof(logArgs[0]) - 1); \
+    } while (0)
+#else
+#define LOG(Id, ...) do {} while (0)
+#endif
+
+void LogWrite(uint8_t Id, const uint32_t *pArgs, uint8_t Count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
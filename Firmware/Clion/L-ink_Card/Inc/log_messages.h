@@ -0,0 +1,33 @@
+#ifndef __LOG_MESSAGES_H
+#define __LOG_MESSAGES_H
+
+/*
+ * Log messages, shared by the card and the host decoder (log-decode). The
+ * card only sends the ID and the arguments, the format is expanded on the
+ * host. Arguments are 32-bit unsigned, print them with %lu.
+ *
+ * The ID is the position in the list: append new messages at the end so
+ * older captures still decode.
+ */
+
+/*
+ * Record, little endian:
+ *  0  LOG_SYNC
+ *  1  ID
+ *  2  Count    arguments, up to LOG_MAX_ARGS
+ *  3  Tick     HAL tick in ms, 32 bits
+ *  7  Count x 32-bit arguments
+ */
+#define LOG_SYNC            0xA5
+#define LOG_HEADER_SIZE     7
+#define LOG_MAX_ARGS        6
+
+#define LOG_MESSAGES(X) \
+    X(LOG_DROPPED,          "%lu log records dropped, the UART fell behind") \
+    X(LOG_MAILBOX_ON,       "Mailbox is activated") \
+    X(LOG_MAILBOX_STATUS,   "Mailbox: %lu bytes, host missed %lu, rf missed %lu, host put %lu, rf put %lu") \
+    X(LOG_REFRESH_DONE,     "Refresh done") \
+    X(LOG_SUPPLY,           "Supply: %lu mV, field %lu, harvesting %lu") \
+    X(LOG_SUPPLY_WAIT,      "Supply: waited %lu ms for %lu mV, at %lu mV, field %lu")
+
+#endif
@@ -78,6 +78,10 @@ void Error_Handler(void);
 #define INK_RST_GPIO_Port GPIOB
 #define INK_IS_BUSY_Pin GPIO_PIN_8
 #define INK_IS_BUSY_GPIO_Port GPIOA
+#define INK_SPI_SCK_Pin GPIO_PIN_3
+#define INK_SPI_SCK_GPIO_Port GPIOB
+#define INK_SPI_MOSI_Pin GPIO_PIN_5
+#define INK_SPI_MOSI_GPIO_Port GPIOB
 /* USER CODE BEGIN Private defines */
 
 /* USER CODE END Private defines */
@@ -53,6 +53,7 @@ extern "C" {
 #define NFC04A1_I2C_Init         BSP_I2C1_Init
 #define NFC04A1_I2C_DeInit       BSP_I2C1_DeInit
 #define NFC04A1_I2C_ReadReg16    BSP_I2C1_ReadReg16
+#define NFC04A1_I2C_ReadReg16_DMA BSP_I2C1_ReadReg16_DMA
 #define NFC04A1_I2C_WriteReg16   BSP_I2C1_WriteReg16
 #define NFC04A1_I2C_Recv         BSP_I2C1_Recv
 #define NFC04A1_I2C_IsReady      BSP_I2C1_IsReady
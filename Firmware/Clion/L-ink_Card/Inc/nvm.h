@@ -0,0 +1,32 @@
+#ifndef __NVM_H
+#define __NVM_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+
+/*
+ * Words kept in the MCU's data EEPROM, for what is worth remembering
+ * across a power loss without asking the tag: on a harvested supply
+ * every I2C transaction at boot is time the field may not give. A word
+ * reads 0 until first written, a write of the value already there is
+ * skipped so the cells only wear when something changes.
+ */
+
+#define NVM_TAG_CONFIG      0       // ST25DV static configuration known to be in place
+#define NVM_FW_STATE        1       // FW_STATE_*, for the bootloader (fw_flash.h)
+#define NVM_FW_SIZE         2       // image in the application region, as of the last update start or install
+#define NVM_FW_START        3       // .. 6, the update start message FW_STATE_RECEIVE goes on with, LE
+#define NVM_WORDS           7
+
+uint32_t NvmRead(uint8_t Word);
+
+/* ~3 ms of programming, main loop only. Returns HAL_OK once the word holds Value */
+HAL_StatusTypeDef NvmWrite(uint8_t Word, uint32_t Value);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
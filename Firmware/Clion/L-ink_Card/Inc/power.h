@@ -0,0 +1,54 @@
+#ifndef __POWER_H
+#define __POWER_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+
+/* Park in STOP between events, set to 0 to use plain sleep while debugging */
+#ifndef POWER_USE_STOP
+#define POWER_USE_STOP 1
+#endif
+
+/* Wakeup sources, set from interrupt context */
+#define POWER_EVENT_NFC         0x01U
+#define POWER_EVENT_EPD         0x02U
+#define POWER_EVENT_TIMER       0x04U
+
+typedef enum
+{
+    POWER_STATE_RUN = 0,
+    POWER_STATE_STOP,
+    POWER_STATE_COUNT
+} POWER_State_t;
+
+/* STOP current in uA for the charge estimate, run time goes by clock level (clock.h) */
+#define POWER_BUDGET_STOP_UA    2U      // STOP, LSI + RTC running
+
+typedef struct
+{
+    uint32_t Ms[POWER_STATE_COUNT];
+    uint32_t Entries[POWER_STATE_COUNT];
+    uint32_t Wakeups[3];    // NFC, EPD, TIMER
+} POWER_Stats_t;
+
+void PowerInit(void);
+void PowerNotify(uint32_t Events);
+uint32_t PowerWaitEvent(void);
+uint32_t PowerSleep(void);
+void PowerSetWakeupTimer(uint32_t Ms);
+void PowerHold(void);
+void PowerRelease(void);
+void PowerRtcIRQHandler(void);
+uint32_t PowerGetTime(void);
+const POWER_Stats_t *PowerGetStats(void);
+uint32_t PowerGetChargeUc(void);
+uint16_t PowerGetVddMv(void);
+void PowerNap(uint32_t Ms);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
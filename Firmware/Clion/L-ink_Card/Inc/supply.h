@@ -0,0 +1,59 @@
+#ifndef __SUPPLY_H
+#define __SUPPLY_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+
+/*
+ * Energy governor for a card living off the ST25DV energy harvesting
+ * output. VDD is sampled against VREFINT, the field and the harvester
+ * are read from EH_CTRL_Dyn. Work that can wait is held while the field
+ * recharges the storage capacitor, the MCU napping in STOP meanwhile:
+ *  - a refresh, before the panel starts its charge pumps, until VDD is
+ *    up to SUPPLY_FULL_MV, SUPPLY_PART_MV for a partial one,
+ *  - the mailbox drain, once VDD fell under SUPPLY_LOW_MV, until it is
+ *    back over SUPPLY_RESUME_MV. The reader's next message waits in the
+ *    tag and the transfer goes on from there, where a brownout would
+ *    have lost it,
+ *  - timer work (slot cycling, ghosting cleanup) unless there is a field
+ *    or enough banked for a full refresh.
+ * Without a field nothing recharges, so nothing is waited for. No wait
+ * lasts longer than SUPPLY_WAIT_MS.
+ */
+
+#ifndef SUPPLY_GOVERNOR
+#define SUPPLY_GOVERNOR 1
+#endif
+
+#define SUPPLY_FULL_MV      2900
+#define SUPPLY_PART_MV      2600
+#define SUPPLY_RESUME_MV    2500
+#define SUPPLY_LOW_MV       2200
+#define SUPPLY_POLL_MS      100     // VDD is sampled at most this often outside a wait
+#define SUPPLY_NAP_MS       50
+#define SUPPLY_WAIT_MS      30000
+
+#define SUPPLY_LEVEL_OK     0
+#define SUPPLY_LEVEL_LOW    1       // under SUPPLY_LOW_MV, until back over SUPPLY_RESUME_MV
+
+void SupplyInit(void);
+
+/* Main loop, samples VDD every SUPPLY_POLL_MS */
+void SupplyUpdate(void);
+
+uint8_t SupplyLevel(void);
+uint16_t SupplyGetMv(void);
+
+/* Naps until VDD reaches Mv, the field goes or SUPPLY_WAIT_MS is up. Returns the ms waited */
+uint32_t SupplyWaitFor(uint16_t Mv);
+
+/* Mv is there already, or a field is there to bring it */
+uint8_t SupplyAllows(uint16_t Mv);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
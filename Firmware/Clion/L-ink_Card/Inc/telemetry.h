@@ -0,0 +1,69 @@
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+
+/*
+ * Field counters, fetched by the reader with a TELEMETRY_QUERY_SIZE
+ * query 'M' 0. The card answers through the mailbox (little endian):
+ *  0  'M'
+ *  1  Version      TELEMETRY_VERSION
+ *  2  Stages       TELEMETRY_STAGES
+ *  3  Reserved
+ *  4  CyclesPerMs  TELEMETRY_CYCLES_PER_MS, to turn cycles into time
+ *  8  Stages x { Count, Cycles, MaxCycles }, 32 bits each
+ *  .. Counters     TELEMETRY_COUNTERS x 16 bits
+ *  .. RunMs, StopMs                        32 bits each
+ *  .. Wakeups      NFC, EPD, TIMER         16 bits each
+ *  .. ClockMs      run time per clock level, CLOCK_LEVELS x 32 bits
+ *  .. Switches     clock level changes     32 bits
+ *
+ * Every counter wraps, the reader works with differences between two
+ * fetches. Each one has a single writer, either the main loop or one
+ * interrupt, so they are updated without masking interrupts.
+ */
+
+#define TELEMETRY_VERSION       3
+#define TELEMETRY_QUERY_SIZE    2
+
+/* Timed stages */
+#define TELEMETRY_I2C           0   // mailbox drain, read start to data in mbBuffer
+#define TELEMETRY_SPI           1   // panel transactions, CS low to CS high
+#define TELEMETRY_BUSY          2   // blocking waits for the panel to drop BUSY
+#define TELEMETRY_BOOT_TAG      3   // boot, until the ST25DV answers
+#define TELEMETRY_BOOT_CONFIG   4   // boot, ST25DV static configuration checked and written
+#define TELEMETRY_BOOT_STORE    5   // boot, slot table read
+#define TELEMETRY_PANEL_INIT    6   // panel reset and LUT, put off from boot to the first refresh
+#define TELEMETRY_STAGES        7
+
+/* Counted events */
+#define TELEMETRY_HOST_MISS     0   // HostMissMsg seen in MB_CTRL_Dyn
+#define TELEMETRY_RF_MISS       1   // RFMissMsg seen in MB_CTRL_Dyn
+#define TELEMETRY_FULL          2   // full refreshes started
+#define TELEMETRY_PART          3   // partial refreshes started
+#define TELEMETRY_CONFIG_CACHED 4   // boots that found the static configuration in the data EEPROM
+#define TELEMETRY_COUNTERS      5
+
+#define TELEMETRY_REPORT_SIZE   (8 + TELEMETRY_STAGES * 12 + TELEMETRY_COUNTERS * 2 + 8 + 3 * 2 + 3 * 4 + 4)
+
+/* Stages are timed in cycles of a 16 MHz clock, whatever clock.c runs the core at */
+#define TELEMETRY_CYCLES_PER_MS 16000U
+
+/* Cycle stamp from SysTick and the HAL tick, the M0+ has no DWT cycle counter */
+uint32_t TelemetryNow(void);
+
+/* Charges the cycles since Start, a TelemetryNow() stamp, to Stage */
+void TelemetryStop(uint8_t Stage, uint32_t Start);
+
+void TelemetryCount(uint8_t Counter);
+
+uint8_t TelemetryBuildReport(uint8_t *pData);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,142 @@
+#include "clock.h"
+#include "custom_bus.h"
+#include "usart.h"
+
+static CLOCK_Stats_t ClockStats;
+static uint8_t ClockLevel = CLOCK_LEVEL_RUN;
+static uint32_t ClockStamp = 0;
+
+/* Charge the run time since the last stamp to the current level */
+static void ClockSettle(void)
+{
+    uint32_t now = HAL_GetTick();
+
+    ClockStats.Ms[ClockLevel] += now - ClockStamp;
+    ClockStamp = now;
+}
+
+void ClockInit(void)
+{
+    ClockLevel = CLOCK_LEVEL_RUN;
+    ClockStamp = HAL_GetTick();
+}
+
+static void ClockSource(uint32_t Source, uint32_t Status)
+{
+    __HAL_RCC_SYSCLK_CONFIG(Source);
+    while (__HAL_RCC_GET_SYSCLK_SOURCE() != Status);
+}
+
+static void ClockPllOn(void)
+{
+    __HAL_RCC_PLL_CONFIG(RCC_PLLSOURCE_HSI, RCC_PLL_MUL4, RCC_PLL_DIV2);
+    __HAL_RCC_PLL_ENABLE();
+    while (!(RCC->CR & RCC_CR_PLLRDY));
+}
+
+static void ClockScale(uint32_t Range)
+{
+    __HAL_PWR_VOLTAGESCALING_CONFIG(Range);
+    while (__HAL_PWR_GET_FLAG(PWR_FLAG_VOS));
+}
+
+/* Interrupts masked, I2C1 and USART1 idle */
+static void ClockApply(uint8_t From, uint8_t To)
+{
+    if (From == CLOCK_LEVEL_LOW)
+    {
+        /* Range 1 before anything faster than 4.2 MHz */
+        ClockScale(PWR_REGULATOR_VOLTAGE_SCALE1);
+        __HAL_RCC_HSI_ENABLE();
+        while (!(RCC->CR & RCC_CR_HSIRDY));
+    }
+
+    if (To == CLOCK_LEVEL_BOOST)
+    {
+        ClockPllOn();
+        __HAL_FLASH_SET_LATENCY(FLASH_LATENCY_1);
+        ClockSource(RCC_SYSCLKSOURCE_PLLCLK, RCC_SYSCLKSOURCE_STATUS_PLLCLK);
+    } else if (To == CLOCK_LEVEL_RUN)
+    {
+        ClockSource(RCC_SYSCLKSOURCE_HSI, RCC_SYSCLKSOURCE_STATUS_HSI);
+        __HAL_FLASH_SET_LATENCY(FLASH_LATENCY_0);
+        __HAL_RCC_PLL_DISABLE();
+    } else
+    {
+        __HAL_RCC_MSI_RANGE_CONFIG(RCC_MSIRANGE_1);
+        __HAL_RCC_MSI_ENABLE();
+        while (!(RCC->CR & RCC_CR_MSIRDY));
+        ClockSource(RCC_SYSCLKSOURCE_MSI, RCC_SYSCLKSOURCE_STATUS_MSI);
+        __HAL_FLASH_SET_LATENCY(FLASH_LATENCY_0);
+        __HAL_RCC_PLL_DISABLE();
+        __HAL_RCC_HSI_DISABLE();
+        ClockScale(PWR_REGULATOR_VOLTAGE_SCALE3);
+    }
+
+    if (From == CLOCK_LEVEL_LOW)
+        __HAL_RCC_MSI_DISABLE();
+
+    /* HSI16 is out of range 3, a STOP taken at CLOCK_LEVEL_LOW has to end on the MSI */
+    __HAL_RCC_WAKEUPSTOP_CLK_CONFIG(To == CLOCK_LEVEL_LOW ? RCC_STOP_WAKEUPCLOCK_MSI : RCC_STOP_WAKEUPCLOCK_HSI);
+
+    SystemCoreClockUpdate();
+    HAL_InitTick(TICK_INT_PRIORITY);
+}
+
+uint8_t ClockSet(uint8_t Level)
+{
+    uint8_t from = ClockLevel;
+    uint32_t primask;
+
+    if (!CLOCK_GOVERNOR || Level == from)
+        return from;
+
+    /* Whatever is on the wire finishes at the timing it started with */
+    for (;;)
+    {
+        primask = __get_PRIMASK();
+        __disable_irq();
+        if (huart1.gState == HAL_UART_STATE_READY && BSP_I2C1_Suspend() == BSP_ERROR_NONE)
+            break;
+        __set_PRIMASK(primask);
+    }
+
+    ClockSettle();
+    ClockApply(from, Level);
+    ClockLevel = Level;
+    ClockStats.Switches++;
+
+    MX_USART1_UART_Retime();
+    __set_PRIMASK(primask);
+
+    /* Stays parked at CLOCK_LEVEL_LOW, a drain refused meanwhile starts now otherwise */
+    BSP_I2C1_Resume();
+    return from;
+}
+
+uint8_t ClockGetLevel(void)
+{
+    return ClockLevel;
+}
+
+void ClockStop(void)
+{
+    ClockSettle();
+}
+
+/* Woken up on HSI16 or the MSI, whichever the level had chosen */
+void ClockResume(void)
+{
+    if (ClockLevel == CLOCK_LEVEL_BOOST)
+    {
+        ClockPllOn();
+        ClockSource(RCC_SYSCLKSOURCE_PLLCLK, RCC_SYSCLKSOURCE_STATUS_PLLCLK);
+    }
+    ClockStamp = HAL_GetTick();
+}
+
+const CLOCK_Stats_t *ClockGetStats(void)
+{
+    ClockSettle();
+    return &ClockStats;
+}
@@ -18,6 +18,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "custom_bus.h"
+#include "main.h"
 
 __weak HAL_StatusTypeDef MX_I2C1_Init(I2C_HandleTypeDef* hi2c);								
 
@@ -39,6 +40,7 @@ __weak HAL_StatusTypeDef MX_I2C1_Init(I2C_HandleTypeDef* hi2c);
   */
 
 I2C_HandleTypeDef hi2c1;											
+DMA_HandleTypeDef hdma_i2c1_rx;
 /**
   * @}
   */
@@ -51,6 +53,11 @@ I2C_HandleTypeDef hi2c1;
 static uint32_t IsI2C1MspCbValid = 0;										
 #endif /* USE_HAL_I2C_REGISTER_CALLBACKS */
 static uint32_t I2C1InitCounter = 0;	
+/* A blocking transfer owns the bus, a DMA read started from an interrupt must wait */
+static volatile uint8_t I2C1Held = 0;
+static volatile uint8_t I2C1Deferred = 0;
+/* No timing at the current PCLK1, or one is being worked out: nothing starts */
+static volatile uint8_t I2C1Parked = 0;
 
 /**
   * @}
@@ -62,10 +69,10 @@ static uint32_t I2C1InitCounter = 0;
 
 static void I2C1_MspInit(I2C_HandleTypeDef* hI2c); 
 static void I2C1_MspDeInit(I2C_HandleTypeDef* hI2c);
+static int32_t I2C1_WaitReady(void);
+static void I2C1_Release(void);
 #if (USE_CUBEMX_BSP_V2 == 1)
 static uint32_t I2C_GetTiming(uint32_t clock_src_hz, uint32_t i2cfreq_hz);
-static void Compute_PRESC_SCLDEL_SDADEL(uint32_t clock_src_freq, uint32_t I2C_Speed);
-static uint32_t Compute_SCLL_SCLH (uint32_t clock_src_freq, uint32_t I2C_speed);
 #endif
 
 /**
@@ -168,11 +175,17 @@ int32_t BSP_I2C1_IsReady(uint16_t DevAddr, uint32_t Trials)
 {
   int32_t ret = BSP_ERROR_NONE;
   
+  if (I2C1_WaitReady() != BSP_ERROR_NONE)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
   if (HAL_I2C_IsDeviceReady(&hi2c1, DevAddr, Trials, BUS_I2C1_POLL_TIMEOUT) != HAL_OK)
   {
     ret = BSP_ERROR_BUSY;
   } 
   
+  I2C1_Release();
   return ret;
 }
 
@@ -244,6 +257,11 @@ int32_t BSP_I2C1_WriteReg16(uint16_t DevAddr, uint16_t Reg, uint8_t *pData, uint
   int32_t ret = BSP_ERROR_NONE;
   
   
+  if (I2C1_WaitReady() != BSP_ERROR_NONE)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
   if (HAL_I2C_Mem_Write(&hi2c1, DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, pData, Length, BUS_I2C1_POLL_TIMEOUT) != HAL_OK)
   {
     if (HAL_I2C_GetError(&hi2c1) == HAL_I2C_ERROR_AF)    
@@ -255,6 +273,7 @@ int32_t BSP_I2C1_WriteReg16(uint16_t DevAddr, uint16_t Reg, uint8_t *pData, uint
       ret =  BSP_ERROR_PERIPH_FAILURE;
     }
   }
+  I2C1_Release();
   return ret;
 }
 
@@ -269,6 +288,11 @@ int32_t  BSP_I2C1_ReadReg16(uint16_t DevAddr, uint16_t Reg, uint8_t *pData, uint
 {
   int32_t ret = BSP_ERROR_NONE;  
  
+  if (I2C1_WaitReady() != BSP_ERROR_NONE)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
   if (HAL_I2C_Mem_Read(&hi2c1, DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, pData, Length, BUS_I2C1_POLL_TIMEOUT) != HAL_OK)
   {
     if (HAL_I2C_GetError(&hi2c1) != HAL_I2C_ERROR_AF)
@@ -280,9 +304,112 @@ int32_t  BSP_I2C1_ReadReg16(uint16_t DevAddr, uint16_t Reg, uint8_t *pData, uint
       ret =  BSP_ERROR_PERIPH_FAILURE;
     }
   }
+  I2C1_Release();
+  return ret;
+}
+
+/**
+  * @brief  Start a DMA read of registers (16 bits), returns before the data is in.
+  *         BSP_I2C1_RxCpltCallback() is called from the interrupt when it ends.
+  * @param  DevAddr: Device address on BUS
+  * @param  Reg: The target register address to read
+  * @param  pData: Buffer, must stay valid until the callback
+  * @param  Length Data Length
+  * @retval BSP status
+  */
+int32_t BSP_I2C1_ReadReg16_DMA(uint16_t DevAddr, uint16_t Reg, uint8_t *pData, uint16_t Length)
+{
+  int32_t ret = BSP_ERROR_NONE;
+
+  if (I2C1Held || I2C1Parked || HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY)
+  {
+    I2C1Deferred = 1;
+    return BSP_ERROR_BUSY;
+  }
+
+  if (HAL_I2C_Mem_Read_DMA(&hi2c1, DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, pData, Length) != HAL_OK)
+  {
+    ret = BSP_ERROR_PERIPH_FAILURE;
+  }
   return ret;
 }
 
+/**
+  * @brief  Park the bus ahead of a PCLK1 change, interrupts masked
+  * @retval BSP_ERROR_BUSY while a transfer still runs, nothing changed then
+  */
+int32_t BSP_I2C1_Suspend(void)
+{
+  if (I2C1Held || HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY)
+  {
+    return BSP_ERROR_BUSY;
+  }
+  I2C1Parked = 1;
+  return BSP_ERROR_NONE;
+}
+
+/**
+  * @brief  Retime the bus for the current PCLK1 and take it out of park
+  * @retval BSP_ERROR_BUS_FAILURE when BUS_I2C1_FREQUENCY can't be had, the bus stays parked
+  */
+int32_t BSP_I2C1_Resume(void)
+{
+  uint32_t timing = I2C_GetTiming(HAL_RCC_GetPCLK1Freq(), BUS_I2C1_FREQUENCY);
+
+  if (timing == 0U)
+  {
+    return BSP_ERROR_BUS_FAILURE;
+  }
+
+  /* TIMINGR only takes a new value with PE cleared */
+  __HAL_I2C_DISABLE(&hi2c1);
+  hi2c1.Init.Timing = timing;
+  hi2c1.Instance->TIMINGR = timing;
+  __HAL_I2C_ENABLE(&hi2c1);
+
+  I2C1Parked = 0;
+  if (I2C1Deferred)
+  {
+    I2C1Deferred = 0;
+    BSP_I2C1_IdleCallback();
+  }
+  return BSP_ERROR_NONE;
+}
+
+/**
+  * @brief  The bus was given back by a blocking transfer after a BSP_I2C1_ReadReg16_DMA()
+  *         call was refused for it, runs in the context of that transfer
+  */
+__weak void BSP_I2C1_IdleCallback(void)
+{
+}
+
+/**
+  * @brief  End of a BSP_I2C1_ReadReg16_DMA() transfer, runs in interrupt context
+  * @param  Status: BSP_ERROR_NONE or the failure
+  */
+__weak void BSP_I2C1_RxCpltCallback(int32_t Status)
+{
+  UNUSED(Status);
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+  if (hi2c == &hi2c1)
+  {
+    BSP_I2C1_RxCpltCallback(BSP_ERROR_NONE);
+  }
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+  if (hi2c == &hi2c1)
+  {
+    BSP_I2C1_RxCpltCallback(HAL_I2C_GetError(hi2c) == HAL_I2C_ERROR_AF ?
+                            BSP_ERROR_BUS_ACKNOWLEDGE_FAILURE : BSP_ERROR_PERIPH_FAILURE);
+  }
+}
+
 /**
   * @brief  Send an amount width data through bus (Simplex)
   * @param  DevAddr: Device address on Bus.
@@ -318,6 +445,11 @@ int32_t BSP_I2C1_Send(uint16_t DevAddr, uint8_t *pData, uint16_t Length) {
 int32_t BSP_I2C1_Recv(uint16_t DevAddr, uint8_t *pData, uint16_t Length) {	
   int32_t ret = BSP_ERROR_NONE;
   
+  if (I2C1_WaitReady() != BSP_ERROR_NONE)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
   if (HAL_I2C_Master_Receive(&hi2c1, DevAddr, pData, Length, BUS_I2C1_POLL_TIMEOUT) != HAL_OK)
   {
     if (HAL_I2C_GetError(&hi2c1) != HAL_I2C_ERROR_AF)
@@ -329,6 +461,7 @@ int32_t BSP_I2C1_Recv(uint16_t DevAddr, uint8_t *pData, uint16_t Length) {
       ret =  BSP_ERROR_PERIPH_FAILURE;
     }
   }
+  I2C1_Release();
   return ret;
 }
 
@@ -400,7 +533,12 @@ __weak HAL_StatusTypeDef MX_I2C1_Init(I2C_HandleTypeDef* hi2c)
 {
   HAL_StatusTypeDef ret = HAL_OK;
   hi2c->Instance = I2C1;
-  hi2c->Init.Timing = 0x0010061A;
+  hi2c->Init.Timing = I2C_GetTiming(HAL_RCC_GetPCLK1Freq(), BUS_I2C1_FREQUENCY);
+  if (hi2c->Init.Timing == 0U)
+  {
+    /* No valid timing for this bus speed at the current PCLK1 */
+    return HAL_ERROR;
+  }
   hi2c->Init.OwnAddress1 = 0;
   hi2c->Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
   hi2c->Init.DualAddressMode = I2C_DUALADDRESS_DISABLE;
@@ -423,6 +561,13 @@ __weak HAL_StatusTypeDef MX_I2C1_Init(I2C_HandleTypeDef* hi2c)
     ret = HAL_ERROR;
   }
 
+#if (BUS_I2C1_FREQUENCY > 400000U)
+  /* Fm+ drive on SCL and SDA, the 20 mA sink is needed above 400 kHz */
+  __HAL_RCC_SYSCFG_CLK_ENABLE();
+  HAL_I2CEx_EnableFastModePlus(I2C_FASTMODEPLUS_PB6);
+  HAL_I2CEx_EnableFastModePlus(I2C_FASTMODEPLUS_PB7);
+#endif
+
   return ret;
 }
 
@@ -449,6 +594,27 @@ static void I2C1_MspInit(I2C_HandleTypeDef* i2cHandle)
     __HAL_RCC_I2C1_CLK_ENABLE();
   /* USER CODE BEGIN I2C1_MspInit 1 */
 
+    /* I2C1_RX on DMA1 channel 7, channel 3 is taken by the EPD SPI */
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    hdma_i2c1_rx.Instance = DMA1_Channel7;
+    hdma_i2c1_rx.Init.Request = DMA_REQUEST_6;
+    hdma_i2c1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_i2c1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_i2c1_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_i2c1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_i2c1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_i2c1_rx.Init.Mode = DMA_NORMAL;
+    hdma_i2c1_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    if (HAL_DMA_Init(&hdma_i2c1_rx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+    __HAL_LINKDMA(i2cHandle, hdmarx, hdma_i2c1_rx);
+
+    HAL_NVIC_SetPriority(DMA1_Channel4_5_6_7_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel4_5_6_7_IRQn);
+    HAL_NVIC_SetPriority(I2C1_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(I2C1_IRQn);
   /* USER CODE END I2C1_MspInit 1 */
 }
 
@@ -467,10 +633,201 @@ static void I2C1_MspDeInit(I2C_HandleTypeDef* i2cHandle)
     HAL_GPIO_DeInit(GPIOB, GPIO_PIN_6|GPIO_PIN_7);
 
   /* USER CODE BEGIN I2C1_MspDeInit 1 */
+    HAL_DMA_DeInit(i2cHandle->hdmarx);
+    HAL_NVIC_DisableIRQ(I2C1_IRQn);
 
   /* USER CODE END I2C1_MspDeInit 1 */
 }
 
+static int32_t I2C1_WaitReady(void)
+{
+  uint32_t tickstart = HAL_GetTick();
+  uint32_t primask;
+
+  /* A DMA read may still be running, the blocking calls queue behind it and
+     then hold the bus until I2C1_Release() */
+  if (I2C1Parked)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  for (;;)
+  {
+    primask = __get_PRIMASK();
+    __disable_irq();
+    if (HAL_I2C_GetState(&hi2c1) == HAL_I2C_STATE_READY)
+    {
+      I2C1Held = 1;
+      __set_PRIMASK(primask);
+      return BSP_ERROR_NONE;
+    }
+    __set_PRIMASK(primask);
+
+    if ((HAL_GetTick() - tickstart) > BUS_I2C1_POLL_TIMEOUT)
+    {
+      return BSP_ERROR_BUSY;
+    }
+  }
+}
+
+static void I2C1_Release(void)
+{
+  I2C1Held = 0;
+  if (I2C1Deferred)
+  {
+    I2C1Deferred = 0;
+    BSP_I2C1_IdleCallback();
+  }
+}
+
+#if (USE_CUBEMX_BSP_V2 == 1)
+#define SEC2NSEC                      1000000000UL
+#define I2C_ANALOG_FILTER_DELAY_MIN   50U     /* ns */
+#define I2C_ANALOG_FILTER_DELAY_MAX   260U    /* ns */
+#define I2C_DIGITAL_FILTER_COEF       0U
+#define I2C_PRESC_MAX                 16U
+#define I2C_SCLDEL_MAX                16U
+#define I2C_SDADEL_MAX                16U
+#define I2C_SCLH_MAX                  256U
+#define I2C_SCLL_MAX                  256U
+
+typedef struct
+{
+  uint32_t freq;       /* Frequency in Hz */
+  uint32_t freq_min;   /* Minimum frequency in Hz */
+  uint32_t freq_max;   /* Maximum frequency in Hz */
+  uint32_t hddat_min;  /* Minimum data hold time in ns */
+  uint32_t vddat_max;  /* Maximum data valid time in ns */
+  uint32_t sudat_min;  /* Minimum data setup time in ns */
+  uint32_t lscl_min;   /* Minimum low period of the SCL clock in ns */
+  uint32_t hscl_min;   /* Minimum high period of SCL clock in ns */
+  uint32_t trise;      /* Rise time in ns */
+  uint32_t tfall;      /* Fall time in ns */
+} I2C_Charac_t;
+
+static const I2C_Charac_t I2C_Charac[] =
+{
+  /* Standard mode */
+  {100000U, 80000U, 120000U, 0U, 3450U, 250U, 4700U, 4000U, 640U, 20U},
+  /* Fast mode */
+  {400000U, 320000U, 480000U, 0U, 900U, 100U, 1300U, 600U, 250U, 100U},
+  /* Fast mode plus */
+  {1000000U, 800000U, 1200000U, 0U, 450U, 50U, 500U, 260U, 60U, 100U},
+};
+
+/**
+  * @brief  Compute I2C timing according current I2C clock source and required I2C clock.
+  *         Walks the prescalers with the smallest SCLDEL/SDADEL each, and keeps the
+  *         SCLL/SCLH pair closest to the requested speed, no table kept in RAM.
+  * @param  clock_src_hz I2C clock source in Hz
+  * @param  i2cfreq_hz Required I2C clock in Hz
+  * @retval I2C timing or 0 in case of error
+  */
+static uint32_t I2C_GetTiming(uint32_t clock_src_hz, uint32_t i2cfreq_hz)
+{
+  const I2C_Charac_t *charac = &I2C_Charac[0];
+  uint32_t ti2cclk, ti2cspeed, tpresc, tbase;
+  int32_t tsdadel_min, tsdadel_max, tscldel_min;
+  uint32_t clk_min, clk_max, tscl_l, tscl_h, tscl, error;
+  uint32_t best_error, timing = 0;
+  uint32_t presc, scldel, sdadel, scll, sclh;
+
+  if ((clock_src_hz == 0U) || (i2cfreq_hz == 0U) || (i2cfreq_hz > I2C_Charac[2].freq))
+  {
+    return 0;
+  }
+  while (i2cfreq_hz > charac->freq)
+  {
+    charac++;
+  }
+
+  ti2cclk = (SEC2NSEC + (clock_src_hz / 2U)) / clock_src_hz;
+  ti2cspeed = (SEC2NSEC + (i2cfreq_hz / 2U)) / i2cfreq_hz;
+  clk_max = SEC2NSEC / charac->freq_min;
+  clk_min = SEC2NSEC / charac->freq_max;
+
+  /* Data hold and setup windows, analog filter on and digital filter off */
+  tsdadel_min = (int32_t)charac->tfall + (int32_t)charac->hddat_min - (int32_t)I2C_ANALOG_FILTER_DELAY_MIN -
+                (int32_t)((I2C_DIGITAL_FILTER_COEF + 3U) * ti2cclk);
+  tsdadel_max = (int32_t)charac->vddat_max - (int32_t)charac->trise - (int32_t)I2C_ANALOG_FILTER_DELAY_MAX -
+                (int32_t)((I2C_DIGITAL_FILTER_COEF + 4U) * ti2cclk);
+  tscldel_min = (int32_t)charac->trise + (int32_t)charac->sudat_min;
+  if (tsdadel_min < 0)
+  {
+    tsdadel_min = 0;
+  }
+  if (tsdadel_max < 0)
+  {
+    tsdadel_max = 0;
+  }
+
+  best_error = ti2cspeed;
+  for (presc = 0; presc < I2C_PRESC_MAX; presc++)
+  {
+    tpresc = (presc + 1U) * ti2cclk;
+
+    /* Smallest SCLDEL and SDADEL that fit this prescaler */
+    for (scldel = 0; scldel < I2C_SCLDEL_MAX; scldel++)
+    {
+      if ((int32_t)((scldel + 1U) * tpresc) >= tscldel_min)
+      {
+        break;
+      }
+    }
+    for (sdadel = 0; sdadel < I2C_SDADEL_MAX; sdadel++)
+    {
+      if ((int32_t)(sdadel * tpresc) >= tsdadel_min)
+      {
+        break;
+      }
+    }
+    if ((scldel == I2C_SCLDEL_MAX) || (sdadel == I2C_SDADEL_MAX) || ((int32_t)(sdadel * tpresc) > tsdadel_max))
+    {
+      continue;
+    }
+
+    /* SCL low and high periods, both stretched by the analog filter and sync */
+    tbase = I2C_ANALOG_FILTER_DELAY_MIN + (I2C_DIGITAL_FILTER_COEF + 2U) * ti2cclk;
+    for (scll = 0; scll < I2C_SCLL_MAX; scll++)
+    {
+      tscl_l = tbase + (scll + 1U) * tpresc;
+      if (tscl_l + charac->trise + charac->tfall > clk_max)
+      {
+        break;
+      }
+      if ((tscl_l < charac->lscl_min) || (ti2cclk >= (tscl_l - I2C_ANALOG_FILTER_DELAY_MIN) / 4U))
+      {
+        continue;
+      }
+      for (sclh = 0; sclh < I2C_SCLH_MAX; sclh++)
+      {
+        tscl_h = tbase + (sclh + 1U) * tpresc;
+        tscl = tscl_l + tscl_h + charac->trise + charac->tfall;
+        if (tscl > clk_max)
+        {
+          break;
+        }
+        if ((tscl < clk_min) || (tscl_h < charac->hscl_min) ||
+            (ti2cclk >= (tscl_h - I2C_ANALOG_FILTER_DELAY_MIN) / 2U))
+        {
+          continue;
+        }
+        error = (tscl > ti2cspeed) ? (tscl - ti2cspeed) : (ti2cspeed - tscl);
+        if (error < best_error)
+        {
+          best_error = error;
+          timing = (presc << I2C_TIMINGR_PRESC_Pos) | (scldel << I2C_TIMINGR_SCLDEL_Pos) |
+                   (sdadel << I2C_TIMINGR_SDADEL_Pos) | (sclh << I2C_TIMINGR_SCLH_Pos) |
+                   (scll << I2C_TIMINGR_SCLL_Pos);
+        }
+      }
+    }
+  }
+
+  return timing;
+}
+#endif /* USE_CUBEMX_BSP_V2 */
+
 /**
   * @}
   */
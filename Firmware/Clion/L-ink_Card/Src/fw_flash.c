@@ -0,0 +1,35 @@
+#include "fw_flash.h"
+#include "nvm.h"
+
+/* From the linker script: the image ends with the initial values of .data */
+extern uint32_t _sidata, _sdata, _edata;
+
+/* The application only reads its region, the bootloader writes it */
+static UPDATE_Flash_t FwFlash;
+
+const UPDATE_Flash_t *FwFlashGet(void)
+{
+    FwFlash.pRunning = (const uint8_t *) FW_APP_ADDRESS;
+    FwFlash.RunningSize = (uint32_t) &_sidata + ((uint32_t) &_edata - (uint32_t) &_sdata) - FW_APP_ADDRESS;
+    FwFlash.RegionSize = FW_APP_SIZE;
+    FwFlash.pSaved = NULL;
+    FwFlash.Erase = NULL;
+    FwFlash.Program = NULL;
+    return &FwFlash;
+}
+
+void FwFlashReceive(const uint8_t *pStart)
+{
+    uint8_t i;
+
+    if (NvmWrite(NVM_FW_SIZE, FwFlashGet()->RunningSize) != HAL_OK)
+        return;
+    for (i = 0; i < UPDATE_START_SIZE / 4; i++)
+        if (NvmWrite(NVM_FW_START + i, pStart[i * 4] | (pStart[i * 4 + 1] << 8) | ((uint32_t) pStart[i * 4 + 2] << 16) |
+                                       ((uint32_t) pStart[i * 4 + 3] << 24)) != HAL_OK)
+            return;
+    /* The state last, it is what the bootloader goes by */
+    if (NvmWrite(NVM_FW_STATE, FW_STATE_RECEIVE) != HAL_OK)
+        return;
+    NVIC_SystemReset();
+}
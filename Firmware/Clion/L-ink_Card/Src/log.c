@@ -0,0 +1,104 @@
+#include "log.h"
+#include "usart.h"
+#include "power.h"
+
+/*
+ * Head and tail run free and are masked on access, Head - Tail is the
+ * fill level. LogWrite() moves the head, the end of a DMA transfer moves
+ * the tail and starts the next one. A transfer stops at the end of the
+ * buffer, a record wrapping around goes out in two.
+ */
+
+static uint8_t LogBuffer[LOG_BUFFER_SIZE];
+static volatile uint16_t LogHead = 0;
+static volatile uint16_t LogTail = 0;
+static volatile uint16_t LogSending = 0;
+static uint32_t LogDropped = 0;
+
+/* Interrupts masked, or from the DMA interrupt itself */
+static void LogKick(void)
+{
+    uint16_t tail = LogTail & (LOG_BUFFER_SIZE - 1);
+    uint16_t length = LogHead - LogTail;
+
+    if (LogSending || !length)
+        return;
+    if (length > LOG_BUFFER_SIZE - tail)
+        length = LOG_BUFFER_SIZE - tail;
+
+    /* Set first, the transfer may end before the call returns. No STOP until it does */
+    LogSending = length;
+    PowerHold();
+    if (HAL_UART_Transmit_DMA(&huart1, LogBuffer + tail, length) != HAL_OK)
+    {
+        LogSending = 0;
+        PowerRelease();
+    }
+}
+
+static uint16_t LogPut(uint16_t Head, uint32_t Value, uint8_t Size)
+{
+    while (Size--)
+    {
+        LogBuffer[Head++ & (LOG_BUFFER_SIZE - 1)] = Value & 0xFF;
+        Value >>= 8;
+    }
+    return Head;
+}
+
+static uint8_t LogRecord(uint8_t Id, const uint32_t *pArgs, uint8_t Count)
+{
+    uint16_t head = LogHead;
+
+    if (LOG_BUFFER_SIZE - (uint16_t) (head - LogTail) < LOG_HEADER_SIZE + Count * 4)
+        return 0;
+
+    head = LogPut(head, LOG_SYNC, 1);
+    head = LogPut(head, Id, 1);
+    head = LogPut(head, Count, 1);
+    head = LogPut(head, HAL_GetTick(), 4);
+    while (Count--)
+        head = LogPut(head, *pArgs++, 4);
+    LogHead = head;
+    return 1;
+}
+
+void LogWrite(uint8_t Id, const uint32_t *pArgs, uint8_t Count)
+{
+    uint32_t primask;
+
+    if (Count > LOG_MAX_ARGS)
+        Count = LOG_MAX_ARGS;
+
+    /* Owed before anything newer, so the capture shows where the gap is */
+    if (LogDropped && LogRecord(LOG_DROPPED, &LogDropped, 1))
+        LogDropped = 0;
+    if (LogDropped || !LogRecord(Id, pArgs, Count))
+        LogDropped++;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    LogKick();
+    __set_PRIMASK(primask);
+}
+
+static void LogSent(void)
+{
+    LogTail += LogSending;
+    LogSending = 0;
+    PowerRelease();
+    LogKick();
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    if (huart == &huart1)
+        LogSent();
+}
+
+/* A failed transfer is skipped, the decoder resyncs on the next record */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+    if (huart == &huart1 && LogSending)
+        LogSent();
+}
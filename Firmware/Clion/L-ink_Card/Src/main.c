@@ -25,14 +25,16 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-#include "stdio.h"
 #include "app_nfc.h"
 #include "epd_w21.h"
+#include "power.h"
+#include "clock.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN PTD */
 
+#if !NFC_STREAM_TO_EPD
 unsigned char nfcBuffer[] =
         {
                 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF,
@@ -349,6 +351,7 @@ unsigned char nfcBuffer[] =
                 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF,
                 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF,
         };
+#endif
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
@@ -384,7 +387,7 @@ void SystemClock_Config(void);
 int main(void)
 {
     /* USER CODE BEGIN 1 */
-
+    uint32_t events;
     /* USER CODE END 1 */
 
     /* MCU Configuration--------------------------------------------------------*/
@@ -407,8 +410,10 @@ int main(void)
     MX_GPIO_Init();
     MX_USART1_UART_Init();
     /* USER CODE BEGIN 2 */
+    PowerInit();
+    ClockInit();
     MX_NFC_Init();
-    EpdInitFull();
+    EpdInitDeferred();
     /* USER CODE END 2 */
 
     /* Infinite loop */
@@ -418,6 +423,16 @@ int main(void)
     {
         MX_NFC_Process();
 
+        /* Stay in STOP until the tag, the panel or the RTC needs us, on the MSI between transfers */
+        if (MX_NFC_IsIdle())
+            ClockSet(CLOCK_LEVEL_LOW);
+        events = PowerWaitEvent();
+        if (ClockGetLevel() == CLOCK_LEVEL_LOW)
+            ClockSet(CLOCK_LEVEL_RUN);
+
+        if (events & POWER_EVENT_TIMER)
+            MX_NFC_Timer();
+
         /* USER CODE END WHILE */
 
         /* USER CODE BEGIN 3 */
@@ -471,10 +486,10 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
-int fputc(int ch, FILE *f)
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
-    (void) HAL_UART_Transmit(&huart1, (uint8_t *) &ch, 1, 1000);
-    return ch;
+    if (GPIO_Pin == INK_IS_BUSY_Pin)
+        PowerNotify(POWER_EVENT_EPD);
 }
 /* USER CODE END 4 */
 
@@ -0,0 +1,21 @@
+#include "nvm.h"
+
+#define NVM_ADDRESS(Word)   (DATA_EEPROM_BASE + (Word) * 4)
+
+uint32_t NvmRead(uint8_t Word)
+{
+    return *(__IO uint32_t *) NVM_ADDRESS(Word);
+}
+
+HAL_StatusTypeDef NvmWrite(uint8_t Word, uint32_t Value)
+{
+    HAL_StatusTypeDef status;
+
+    if (NvmRead(Word) == Value)
+        return HAL_OK;
+
+    HAL_FLASHEx_DATAEEPROM_Unlock();
+    status = HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, NVM_ADDRESS(Word), Value);
+    HAL_FLASHEx_DATAEEPROM_Lock();
+    return status;
+}
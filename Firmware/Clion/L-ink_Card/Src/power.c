@@ -0,0 +1,359 @@
+#include "power.h"
+#include "clock.h"
+#include "epd_w21.h"
+
+/*
+ * Event driven low power support.
+ *
+ * The RTC runs from LSI with ck_apre at ~1 kHz, so the sub-second
+ * register gives a millisecond clock that keeps counting in STOP. It
+ * is used to account time per power state and to advance the HAL tick
+ * over STOP periods, where SysTick is halted.
+ */
+
+#define POWER_RTC_PREDIV_A      36U     // 37 kHz / 37 = 1 kHz
+#define POWER_RTC_PREDIV_S      999U    // 1 kHz / 1000 = 1 Hz
+#define POWER_DAY_MS            86400000UL
+
+/* VREFINT raw reading at VDDA = 3 V, factory calibrated */
+#define POWER_VREFINT_CAL       (*(const uint16_t *) 0x1FF80078UL)
+#define POWER_VREFINT_CAL_MV    3000U
+
+static volatile uint32_t PowerEvents = 0;
+static POWER_Stats_t PowerStats;
+static POWER_State_t PowerState = POWER_STATE_RUN;
+static uint32_t PowerStamp = 0;
+static volatile uint8_t PowerHolds = 0;
+static volatile uint8_t PowerNapping = 0;
+
+static uint32_t PowerBcd(uint32_t Value)
+{
+    return (Value >> 4) * 10 + (Value & 0x0F);
+}
+
+uint32_t PowerGetTime(void)
+{
+    uint32_t ssr, tr;
+
+    /* Shadow registers are bypassed, read until two samples agree */
+    do
+    {
+        ssr = RTC->SSR;
+        tr = RTC->TR;
+    } while (ssr != RTC->SSR || tr != RTC->TR);
+
+    return (PowerBcd(tr & (RTC_TR_ST | RTC_TR_SU)) +
+            PowerBcd((tr & (RTC_TR_MNT | RTC_TR_MNU)) >> RTC_TR_MNU_Pos) * 60 +
+            PowerBcd((tr & (RTC_TR_HT | RTC_TR_HU)) >> RTC_TR_HU_Pos) * 3600) * 1000 +
+           (POWER_RTC_PREDIV_S - ssr);
+}
+
+static uint32_t PowerElapsed(uint32_t Since)
+{
+    return (PowerGetTime() + POWER_DAY_MS - Since) % POWER_DAY_MS;
+}
+
+/* Charge the time since the last switch to the current state */
+static void PowerSettle(void)
+{
+    uint32_t now = PowerGetTime();
+
+    PowerStats.Ms[PowerState] += (now + POWER_DAY_MS - PowerStamp) % POWER_DAY_MS;
+    PowerStamp = now;
+}
+
+static void PowerAccount(POWER_State_t State)
+{
+    PowerSettle();
+    PowerStats.Entries[State]++;
+    PowerState = State;
+}
+
+static void PowerRtcInit(void)
+{
+    HAL_PWR_EnableBkUpAccess();
+    __HAL_RCC_LSI_ENABLE();
+    while (__HAL_RCC_GET_FLAG(RCC_FLAG_LSIRDY) == 0);
+    __HAL_RCC_RTC_CONFIG(RCC_RTCCLKSOURCE_LSI);
+    __HAL_RCC_RTC_ENABLE();
+
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+
+    RTC->ISR |= RTC_ISR_INIT;
+    while (!(RTC->ISR & RTC_ISR_INITF));
+    RTC->PRER = POWER_RTC_PREDIV_S;
+    RTC->PRER |= POWER_RTC_PREDIV_A << RTC_PRER_PREDIV_A_Pos;
+    RTC->TR = 0;
+    RTC->CR = RTC_CR_BYPSHAD;
+    RTC->ISR &= ~RTC_ISR_INIT;
+
+    RTC->WPR = 0xFF;
+
+    /* Wakeup timer event is EXTI line 20 */
+    EXTI->IMR |= EXTI_IMR_IM20;
+    EXTI->RTSR |= EXTI_RTSR_RT20;
+    HAL_NVIC_SetPriority(RTC_IRQn, 3, 0);
+    HAL_NVIC_EnableIRQ(RTC_IRQn);
+}
+
+void PowerInit(void)
+{
+    PowerRtcInit();
+
+    /* Leave VREFINT off in STOP and wake on HSI16, which is SYSCLK already. clock.c moves it to the MSI with SYSCLK */
+    HAL_PWREx_EnableUltraLowPower();
+    HAL_PWREx_EnableFastWakeUp();
+    __HAL_RCC_WAKEUPSTOP_CLK_CONFIG(RCC_STOP_WAKEUPCLOCK_HSI);
+
+    PowerStamp = PowerGetTime();
+    PowerStats.Entries[POWER_STATE_RUN] = 1;
+}
+
+void PowerNotify(uint32_t Events)
+{
+    PowerEvents |= Events;
+
+    if (Events & POWER_EVENT_NFC)
+        PowerStats.Wakeups[0]++;
+    if (Events & POWER_EVENT_EPD)
+        PowerStats.Wakeups[1]++;
+    if (Events & POWER_EVENT_TIMER)
+        PowerStats.Wakeups[2]++;
+}
+
+/* Reload and clock selection as they go to WUTR and RTC_CR, the timer stops with Enable 0 */
+static void PowerTimerLoad(uint32_t Reload, uint32_t ClockSelect, uint8_t Enable)
+{
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+
+    RTC->CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+    while (!(RTC->ISR & RTC_ISR_WUTWF));
+
+    if (Enable)
+    {
+        RTC->CR = (RTC->CR & ~RTC_CR_WUCKSEL) | ClockSelect;
+        RTC->WUTR = Reload;
+        RTC->ISR &= ~RTC_ISR_WUTF;
+        RTC->CR |= RTC_CR_WUTE | RTC_CR_WUTIE;
+    }
+
+    RTC->WPR = 0xFF;
+}
+
+void PowerSetWakeupTimer(uint32_t Ms)
+{
+    if (Ms == 0)
+        PowerTimerLoad(0, 0, 0);
+    else if (Ms <= 28000)
+        PowerTimerLoad(Ms * 37 / 16, 0, 1);                      // RTCCLK / 16, ~0.43 ms per count
+    else
+        PowerTimerLoad(Ms / 1000 - 1, RTC_CR_WUCKSEL_2, 1);      // ck_spre, 1 s per count
+}
+
+void PowerRtcIRQHandler(void)
+{
+    if (RTC->ISR & RTC_ISR_WUTF)
+    {
+        RTC->ISR &= ~RTC_ISR_WUTF;
+        /* A nap or a BUSY guard borrowed the timer, its end is nobody else's event */
+        if (PowerNapping)
+            PowerNapping = 0;
+        else
+            PowerNotify(POWER_EVENT_TIMER);
+    }
+    EXTI->PR = EXTI_PR_PIF20;
+}
+
+/* Keep out of STOP while a DMA transfer runs, STOP halts the bus clocks */
+void PowerHold(void)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    PowerHolds++;
+    __set_PRIMASK(primask);
+}
+
+/* May be called from the interrupt ending the transfer */
+void PowerRelease(void)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (PowerHolds)
+        PowerHolds--;
+    __set_PRIMASK(primask);
+}
+
+/* Called with interrupts masked, a pending interrupt still ends WFI */
+static void PowerEnterStop(void)
+{
+#if POWER_USE_STOP
+    uint32_t start;
+
+    if (PowerHolds)
+    {
+        __WFI();
+        return;
+    }
+
+    start = PowerGetTime();
+
+    PowerAccount(POWER_STATE_STOP);
+    ClockStop();
+    HAL_SuspendTick();
+    HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+
+    uwTick += PowerElapsed(start);
+    HAL_ResumeTick();
+    ClockResume();
+    PowerAccount(POWER_STATE_RUN);
+#else
+    __WFI();
+#endif
+}
+
+uint32_t PowerSleep(void)
+{
+    uint32_t start = HAL_GetTick();
+
+    __disable_irq();
+    if (PowerEvents == 0)
+        PowerEnterStop();
+    __enable_irq();
+
+    return HAL_GetTick() - start;
+}
+
+uint32_t PowerWaitEvent(void)
+{
+    uint32_t events;
+
+    __disable_irq();
+    while (PowerEvents == 0)
+    {
+        PowerEnterStop();
+        /* Let the wakeup interrupt run */
+        __enable_irq();
+        __disable_irq();
+    }
+    events = PowerEvents;
+    PowerEvents = 0;
+    __enable_irq();
+
+    return events;
+}
+
+const POWER_Stats_t *PowerGetStats(void)
+{
+    PowerSettle();
+    return &PowerStats;
+}
+
+/* Run time is charged per clock level, clock.c splits it */
+uint32_t PowerGetChargeUc(void)
+{
+    const POWER_Stats_t *stats = PowerGetStats();
+    const CLOCK_Stats_t *clock = ClockGetStats();
+
+    return (uint32_t) (((uint64_t) clock->Ms[CLOCK_LEVEL_LOW] * CLOCK_BUDGET_LOW_UA +
+                        (uint64_t) clock->Ms[CLOCK_LEVEL_RUN] * CLOCK_BUDGET_RUN_UA +
+                        (uint64_t) clock->Ms[CLOCK_LEVEL_BOOST] * CLOCK_BUDGET_BOOST_UA +
+                        (uint64_t) stats->Ms[POWER_STATE_STOP] * POWER_BUDGET_STOP_UA) / 1000);
+}
+
+/*
+ * STOP for Ms whatever else is pending: interrupts are served, their
+ * events wait for the main loop. The wakeup timer is borrowed and given
+ * back afterwards with its period started over.
+ */
+void PowerNap(uint32_t Ms)
+{
+    uint32_t reload = RTC->WUTR;
+    uint32_t clockSelect = RTC->CR & RTC_CR_WUCKSEL;
+    uint8_t enabled = (RTC->CR & RTC_CR_WUTE) != 0;
+
+    PowerNapping = 1;
+    PowerSetWakeupTimer(Ms);
+
+    __disable_irq();
+    while (PowerNapping)
+    {
+        PowerEnterStop();
+        __enable_irq();
+        __disable_irq();
+    }
+    __enable_irq();
+
+    PowerTimerLoad(reload, clockSelect, enabled);
+}
+
+/* VDD from a VREFINT conversion, the ADC is only powered for the measurement */
+uint16_t PowerGetVddMv(void)
+{
+    uint32_t data;
+    volatile uint8_t i;
+
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    __HAL_RCC_ADC1_CLK_ENABLE();
+    SYSCFG->CFGR3 |= SYSCFG_CFGR3_ENBUF_VREFINT_ADC;
+    ADC->CCR |= ADC_CCR_VREFEN;
+    ADC1->CFGR2 = ADC_CFGR2_CKMODE_0;       // PCLK / 2, no extra oscillator
+    ADC1->CR = ADC_CR_ADVREGEN;
+    for (i = 0; i < 40; i++);               // regulator start-up, 20 us
+
+    ADC1->CR |= ADC_CR_ADCAL;
+    while (ADC1->CR & ADC_CR_ADCAL);
+    /* ULP mode leaves VREFINT off in STOP, it takes a while to come back */
+    while (!(SYSCFG->CFGR3 & SYSCFG_CFGR3_VREFINT_RDYF));
+
+    ADC1->SMPR = ADC_SMPR_SMP;              // 160.5 cycles, VREFINT wants 10 us
+    ADC1->CHSELR = ADC_CHSELR_CHSEL17;
+    ADC1->ISR = ADC_ISR_ADRDY;
+    ADC1->CR |= ADC_CR_ADEN;
+    while (!(ADC1->ISR & ADC_ISR_ADRDY));
+    ADC1->CR |= ADC_CR_ADSTART;
+    while (!(ADC1->ISR & ADC_ISR_EOC));
+    data = ADC1->DR;
+
+    ADC1->CR |= ADC_CR_ADDIS;
+    while (ADC1->CR & ADC_CR_ADEN);
+    ADC1->CR = 0;
+    ADC->CCR &= ~ADC_CCR_VREFEN;
+    SYSCFG->CFGR3 &= ~SYSCFG_CFGR3_ENBUF_VREFINT_ADC;
+    __HAL_RCC_ADC1_CLK_DISABLE();
+
+    return data ? POWER_VREFINT_CAL_MV * POWER_VREFINT_CAL / data : 0;
+}
+
+/* Sleep through panel refreshes, the BUSY falling edge wakes us up */
+unsigned long EpdBusyWait(void)
+{
+    uint32_t start = HAL_GetTick();
+    uint8_t guard = !(RTC->CR & RTC_CR_WUTE);
+
+    /* Don't sleep forever on a panel that never releases BUSY. The guard
+       firing is no timer work for the main loop, MX_NFC_Timer() would run
+       for nothing */
+    if (guard)
+    {
+        PowerNapping = 1;
+        PowerSetWakeupTimer(EPD_BUSY_TIMEOUT);
+    }
+
+    __disable_irq();
+    if (HAL_GPIO_ReadPin(INK_IS_BUSY_GPIO_Port, INK_IS_BUSY_Pin) != GPIO_PIN_RESET)
+        PowerEnterStop();
+    __enable_irq();
+
+    /* Stopped first, so the flag can't be left for a later expiry */
+    if (guard)
+    {
+        PowerSetWakeupTimer(0);
+        PowerNapping = 0;
+    }
+
+    return HAL_GetTick() - start;
+}
@@ -0,0 +1,92 @@
+#include "supply.h"
+#include "power.h"
+#include "log.h"
+#include "nfc04a1_nfctag.h"
+
+static uint16_t SupplyMv = 0;
+static uint8_t SupplyState = SUPPLY_LEVEL_OK;
+static uint32_t SupplyStamp = 0;
+
+static void SupplySample(void)
+{
+    SupplyMv = PowerGetVddMv();
+    SupplyStamp = HAL_GetTick();
+
+    if (SupplyMv < SUPPLY_LOW_MV)
+        SupplyState = SUPPLY_LEVEL_LOW;
+    else if (SupplyMv >= SUPPLY_RESUME_MV)
+        SupplyState = SUPPLY_LEVEL_OK;
+}
+
+/* Blocking I2C, main loop only */
+static uint8_t SupplyReadField(ST25DV_EH_CTRL *pEh)
+{
+    if (NFC04A1_NFCTAG_ReadEHCtrl_Dyn(NFC04A1_NFCTAG_INSTANCE, pEh) != NFCTAG_OK)
+        return 0;
+    return pEh->Field_on == ST25DV_ENABLE;
+}
+
+void SupplyInit(void)
+{
+    ST25DV_EH_CTRL eh;
+    uint8_t field = SupplyReadField(&eh);
+
+    SupplySample();
+    LOG(LOG_SUPPLY, SupplyMv, field, field && eh.EH_on == ST25DV_ENABLE);
+    UNUSED(field);      // only logged
+}
+
+void SupplyUpdate(void)
+{
+    if (HAL_GetTick() - SupplyStamp >= SUPPLY_POLL_MS)
+        SupplySample();
+}
+
+uint8_t SupplyLevel(void)
+{
+    return SupplyState;
+}
+
+uint16_t SupplyGetMv(void)
+{
+    return SupplyMv;
+}
+
+uint32_t SupplyWaitFor(uint16_t Mv)
+{
+    ST25DV_EH_CTRL eh;
+    uint32_t start = HAL_GetTick();
+    uint32_t waited;
+    uint8_t field = 1;
+
+    SupplySample();
+    while (SupplyMv < Mv && HAL_GetTick() - start < SUPPLY_WAIT_MS)
+    {
+        field = SupplyReadField(&eh);
+        if (!field)
+            break;
+        PowerNap(SUPPLY_NAP_MS);
+        SupplySample();
+    }
+
+    waited = HAL_GetTick() - start;
+    if (waited)
+        LOG(LOG_SUPPLY_WAIT, waited, Mv, SupplyMv, field);
+    return waited;
+}
+
+uint8_t SupplyAllows(uint16_t Mv)
+{
+    ST25DV_EH_CTRL eh;
+
+    SupplySample();
+    return SupplyMv >= Mv || SupplyReadField(&eh);
+}
+
+#if SUPPLY_GOVERNOR
+/* The panel is loaded and about to start its charge pumps, see epd_w21.c */
+void EpdSupplyWait(unsigned char Full)
+{
+    SupplyWaitFor(Full ? SUPPLY_FULL_MV : SUPPLY_PART_MV);
+}
+#endif
@@ -80,8 +80,14 @@
 /*!< Uncomment the following line if you need to relocate your vector Table in
      Internal SRAM. */
 /* #define VECT_TAB_SRAM */
+#if FW_UPDATE
+#define VECT_TAB_OFFSET  0x1000U /*!< Vector Table base offset field.
+                                   This value must be a multiple of 0x100.
+                                   The application region, after the bootloader */
+#else
 #define VECT_TAB_OFFSET  0x00U /*!< Vector Table base offset field.
                                    This value must be a multiple of 0x100. */
+#endif
 /******************************************************************************/
 /**
   * @}
@@ -0,0 +1,100 @@
+#include "telemetry.h"
+#include "power.h"
+#include "clock.h"
+
+/*
+ * SysTick profiler. SysTick counts core cycles down from LOAD and the HAL
+ * tick counts its reloads, so together they give a cycle stamp good for
+ * ~4 minutes without the DWT the M0+ lacks. The part of a millisecond is
+ * scaled to TELEMETRY_CYCLES_PER_MS, LOAD follows the clock level, and a
+ * stage spanning a level change is still timed right. Over STOP the HAL
+ * tick is advanced from the RTC, a stage spanning STOP is still timed
+ * right to the millisecond.
+ */
+
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Cycles;
+    uint32_t MaxCycles;
+} TELEMETRY_Stage_t;
+
+static TELEMETRY_Stage_t Stages[TELEMETRY_STAGES];
+static uint16_t Counters[TELEMETRY_COUNTERS];
+
+uint32_t TelemetryNow(void)
+{
+    uint32_t tick, value;
+
+    do
+    {
+        tick = HAL_GetTick();
+        value = SysTick->VAL;
+    } while (tick != HAL_GetTick());
+
+    /* Wrapped under an interrupt that keeps the SysTick one from running yet */
+    if ((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && value > SysTick->LOAD / 2)
+        tick++;
+
+    return tick * TELEMETRY_CYCLES_PER_MS + (SysTick->LOAD - value) * TELEMETRY_CYCLES_PER_MS / (SysTick->LOAD + 1);
+}
+
+void TelemetryStop(uint8_t Stage, uint32_t Start)
+{
+    uint32_t cycles = TelemetryNow() - Start;
+    TELEMETRY_Stage_t *stage = &Stages[Stage];
+
+    stage->Count++;
+    stage->Cycles += cycles;
+    if (cycles > stage->MaxCycles)
+        stage->MaxCycles = cycles;
+}
+
+void TelemetryCount(uint8_t Counter)
+{
+    Counters[Counter]++;
+}
+
+static uint8_t TelemetryPut(uint8_t *pData, uint8_t At, uint32_t Value, uint8_t Size)
+{
+    while (Size--)
+    {
+        pData[At++] = Value & 0xFF;
+        Value >>= 8;
+    }
+    return At;
+}
+
+/* Fills pData with the TELEMETRY_REPORT_SIZE byte record */
+uint8_t TelemetryBuildReport(uint8_t *pData)
+{
+    const POWER_Stats_t *power = PowerGetStats();
+    const CLOCK_Stats_t *clock = ClockGetStats();
+    uint8_t at = 0;
+    uint8_t i;
+
+    pData[at++] = 'M';
+    pData[at++] = TELEMETRY_VERSION;
+    pData[at++] = TELEMETRY_STAGES;
+    pData[at++] = 0;
+    at = TelemetryPut(pData, at, TELEMETRY_CYCLES_PER_MS, 4);
+
+    for (i = 0; i < TELEMETRY_STAGES; i++)
+    {
+        at = TelemetryPut(pData, at, Stages[i].Count, 4);
+        at = TelemetryPut(pData, at, Stages[i].Cycles, 4);
+        at = TelemetryPut(pData, at, Stages[i].MaxCycles, 4);
+    }
+    for (i = 0; i < TELEMETRY_COUNTERS; i++)
+        at = TelemetryPut(pData, at, Counters[i], 2);
+
+    at = TelemetryPut(pData, at, power->Ms[POWER_STATE_RUN], 4);
+    at = TelemetryPut(pData, at, power->Ms[POWER_STATE_STOP], 4);
+    for (i = 0; i < 3; i++)
+        at = TelemetryPut(pData, at, power->Wakeups[i], 2);
+    for (i = 0; i < CLOCK_LEVELS; i++)
+        at = TelemetryPut(pData, at, clock->Ms[i], 4);
+    at = TelemetryPut(pData, at, clock->Switches, 4);
+
+    return at;
+}
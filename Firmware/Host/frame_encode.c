@@ -0,0 +1,317 @@
+#include "frame_encode.h"
+#include <string.h>
+
+/*
+ * Host side of frame_codec: builds the header and payload the card's
+ * FrameDecode() expects. Returns the total size written to pOut,
+ * header included.
+ */
+
+static uint16_t PackBits(const uint8_t *pIn, uint16_t Length, uint8_t *pOut)
+{
+    uint16_t in = 0;
+    uint16_t out = 0;
+    uint16_t run;
+    uint16_t literal;
+
+    while (in < Length)
+    {
+        run = 1;
+        while (in + run < Length && run < 128 && pIn[in + run] == pIn[in])
+            run++;
+
+        if (run >= 2)
+        {
+            pOut[out++] = (uint8_t) (257 - run);
+            pOut[out++] = pIn[in];
+            in += run;
+            continue;
+        }
+
+        /*
+         * Literal until the next run of three or more: cutting one for a
+         * pair costs a control byte, and the output could grow past
+         * FRAME_ENCODE_MAX
+         */
+        literal = 1;
+        while (in + literal < Length && literal < 128 &&
+               !(in + literal + 2 < Length && pIn[in + literal] == pIn[in + literal + 1] &&
+                 pIn[in + literal] == pIn[in + literal + 2]))
+            literal++;
+
+        pOut[out++] = (uint8_t) (literal - 1);
+        memcpy(&pOut[out], &pIn[in], literal);
+        out += literal;
+        in += literal;
+    }
+
+    return out;
+}
+
+/* pRaw is FRAME_GRAY_SIZE bytes with FRAME_FLAG_GRAY, planes already interleaved */
+int32_t FrameEncode(const uint8_t *pRaw, uint8_t Format, uint8_t Flags, uint8_t *pOut)
+{
+    uint8_t filtered[FRAME_GRAY_SIZE];
+    FRAME_Header_t header;
+    const uint8_t *src = pRaw;
+    uint16_t size = Flags & FRAME_FLAG_GRAY ? FRAME_GRAY_SIZE : FRAME_RAW_SIZE;
+    uint16_t i;
+
+    if (Format > FRAME_FORMAT_RLE)
+        return FRAME_ERROR;
+
+    if (Flags & FRAME_FLAG_ROW_DELTA)
+    {
+        for (i = 0; i < size; i++)
+            filtered[i] = pRaw[i] ^ (i < FRAME_ROW_BYTES ? 0 : pRaw[i - FRAME_ROW_BYTES]);
+        src = filtered;
+    }
+
+    header.Format = Format;
+    header.Flags = Flags;
+    header.RawSize = size;
+    if (Format == FRAME_FORMAT_RAW)
+    {
+        memcpy(pOut + FRAME_HEADER_SIZE, src, size);
+        header.PayloadSize = size;
+    } else
+    {
+        header.PayloadSize = PackBits(src, size, pOut + FRAME_HEADER_SIZE);
+    }
+    FrameBuildHeader(&header, pOut);
+
+    return FRAME_HEADER_SIZE + header.PayloadSize;
+}
+
+static int32_t EncodeBest(const uint8_t *pRaw, uint8_t Flags, uint8_t *pOut)
+{
+    uint8_t candidate[FRAME_GRAY_ENCODE_MAX];
+    int32_t best;
+    int32_t size;
+
+    best = FrameEncode(pRaw, FRAME_FORMAT_RAW, Flags, pOut);
+
+    size = FrameEncode(pRaw, FRAME_FORMAT_RLE, Flags, candidate);
+    if (size < best)
+    {
+        memcpy(pOut, candidate, size);
+        best = size;
+    }
+
+    size = FrameEncode(pRaw, FRAME_FORMAT_RLE, Flags | FRAME_FLAG_ROW_DELTA, candidate);
+    if (size < best)
+    {
+        memcpy(pOut, candidate, size);
+        best = size;
+    }
+
+    return best;
+}
+
+int32_t FrameEncodeBest(const uint8_t *pRaw, uint8_t *pOut)
+{
+    return EncodeBest(pRaw, 0, pOut);
+}
+
+/*
+ * 2bpp image given as two FRAME_RAW_SIZE planes, high then low, each in
+ * panel byte order. The card takes them interleaved row by row.
+ */
+int32_t FrameEncodeGray(const uint8_t *pPlanes, uint8_t *pOut)
+{
+    uint8_t raw[FRAME_GRAY_SIZE];
+    uint16_t row;
+
+    for (row = 0; row < FRAME_ROWS; row++)
+    {
+        memcpy(raw + 2 * row * FRAME_ROW_BYTES, pPlanes + row * FRAME_ROW_BYTES, FRAME_ROW_BYTES);
+        memcpy(raw + (2 * row + 1) * FRAME_ROW_BYTES, pPlanes + FRAME_RAW_SIZE + row * FRAME_ROW_BYTES,
+               FRAME_ROW_BYTES);
+    }
+    return EncodeBest(raw, FRAME_FLAG_GRAY, pOut);
+}
+
+uint16_t FrameMessageCount(int32_t EncodedSize)
+{
+    int32_t payload = EncodedSize - FRAME_HEADER_SIZE;
+
+    return 1 + (payload + FRAME_CHUNK_MAX - 1) / FRAME_CHUNK_MAX;
+}
+
+/* One row band, the row delta restarts at its first row like on the card */
+static uint16_t EncodeBand(const uint8_t *pRaw, uint8_t Format, uint8_t Flags, uint8_t Row, uint8_t Rows,
+                           uint8_t *pOut)
+{
+    uint8_t band[FRAME_RAW_SIZE];
+    uint16_t length = Rows * FRAME_ROW_BYTES;
+    uint16_t i;
+
+    pRaw += Row * FRAME_ROW_BYTES;
+    for (i = 0; i < length; i++)
+    {
+        band[i] = pRaw[i];
+        if ((Flags & FRAME_FLAG_ROW_DELTA) && i >= FRAME_ROW_BYTES)
+            band[i] ^= pRaw[i - FRAME_ROW_BYTES];
+    }
+
+    if (Format == FRAME_FORMAT_RAW)
+    {
+        memcpy(pOut, band, length);
+        return length;
+    }
+    return PackBits(band, length, pOut);
+}
+
+/*
+ * Builds a frame_link transfer: the start message followed by one chunk
+ * per row band, each band as many rows as fit in LINK_CHUNK_DATA_MAX.
+ * Messages are written back to back to pOut, their sizes to pSizes.
+ * Returns the number of messages, start included. Gray frames only go
+ * through a slot, the card refuses them here.
+ */
+int32_t FrameEncodeLink(const uint8_t *pRaw, uint8_t Format, uint8_t Flags, uint8_t *pOut, uint16_t *pSizes)
+{
+    uint8_t band[FRAME_ENCODE_MAX];
+    uint8_t crc16[2];
+    uint8_t *start = pOut;
+    uint8_t *chunk = pOut + LINK_START_SIZE;
+    uint32_t crc = 0;
+    uint16_t size, fit, chunkCrc;
+    uint8_t row = 0;
+    uint8_t rows;
+    uint8_t count = 0;
+
+    if (Format > FRAME_FORMAT_RLE || (Flags & FRAME_FLAG_GRAY))
+        return FRAME_ERROR;
+
+    while (row < FRAME_ROWS)
+    {
+        if (count == LINK_MAX_CHUNKS)
+            return FRAME_ERROR;
+
+        /* Grow the band until the next row would not fit */
+        fit = 0;
+        for (rows = 1; row + rows <= FRAME_ROWS; rows++)
+        {
+            size = EncodeBand(pRaw, Format, Flags, row, rows, band);
+            if (size > LINK_CHUNK_DATA_MAX)
+                break;
+            fit = size;
+        }
+        rows--;
+        if (rows == 0)
+            return FRAME_ERROR;
+        EncodeBand(pRaw, Format, Flags, row, rows, chunk + LINK_CHUNK_HEADER_SIZE);
+
+        chunk[0] = 'C';
+        chunk[1] = count;
+        chunk[2] = (row * FRAME_ROW_BYTES) & 0xFF;
+        chunk[3] = (row * FRAME_ROW_BYTES) >> 8;
+        chunk[4] = (rows * FRAME_ROW_BYTES) & 0xFF;
+        chunk[5] = (rows * FRAME_ROW_BYTES) >> 8;
+        chunkCrc = LinkCrc16(0xFFFF, chunk, 6);
+        chunkCrc = LinkCrc16(chunkCrc, chunk + LINK_CHUNK_HEADER_SIZE, fit);
+        chunk[6] = crc16[0] = chunkCrc & 0xFF;
+        chunk[7] = crc16[1] = chunkCrc >> 8;
+        crc = FrameCrc32(crc, crc16, sizeof(crc16));
+
+        pSizes[1 + count++] = LINK_CHUNK_HEADER_SIZE + fit;
+        chunk += LINK_CHUNK_HEADER_SIZE + fit;
+        row += rows;
+    }
+
+    start[0] = 'T';
+    start[1] = LINK_VERSION;
+    start[2] = Format;
+    start[3] = Flags;
+    start[4] = count;
+    start[5] = 0;
+    start[6] = crc & 0xFF;
+    start[7] = (crc >> 8) & 0xFF;
+    start[8] = (crc >> 16) & 0xFF;
+    start[9] = crc >> 24;
+    pSizes[0] = LINK_START_SIZE;
+
+    return 1 + count;
+}
+
+/* Equal bytes a run bridges rather than paying for the next run header */
+#define DELTA_BRIDGE        DELTA_RUN_HEADER_SIZE
+
+static void PutLe32(uint8_t *pData, uint32_t Value)
+{
+    pData[0] = Value & 0xFF;
+    pData[1] = (Value >> 8) & 0xFF;
+    pData[2] = (Value >> 16) & 0xFF;
+    pData[3] = Value >> 24;
+}
+
+/*
+ * Builds a frame_delta transfer turning the frame pBase, the one on
+ * display, into pRaw: the start message and as many patch messages as
+ * the runs need, back to back in pOut with their sizes in pSizes, like
+ * FrameEncodeLink(). Returns the number of messages, FRAME_ERROR past
+ * 1 + LINK_MAX_CHUNKS of them; the caller compares with a full upload.
+ */
+int32_t FrameEncodeDelta(const uint8_t *pBase, const uint8_t *pRaw, uint8_t Flags, uint8_t *pOut, uint16_t *pSizes)
+{
+    uint8_t *message = pOut;
+    uint16_t used = DELTA_START_SIZE;
+    uint16_t count = 1;
+    uint16_t at = 0;
+    uint16_t end, same, length, i;
+
+    while (at < FRAME_RAW_SIZE)
+    {
+        if (pBase[at] == pRaw[at])
+        {
+            at++;
+            continue;
+        }
+
+        /* Extend over short equal gaps, stop at the run, message or frame limit */
+        end = at + 1;
+        same = 0;
+        while (end + same < FRAME_RAW_SIZE && end + same - at < DELTA_RUN_MAX && same <= DELTA_BRIDGE)
+        {
+            if (pBase[end + same] != pRaw[end + same])
+            {
+                end += same + 1;
+                same = 0;
+            } else
+                same++;
+        }
+
+        if (FRAME_CHUNK_MAX - used < DELTA_RUN_HEADER_SIZE + 1)
+        {
+            if (count == 1 + LINK_MAX_CHUNKS)
+                return FRAME_ERROR;
+            pSizes[count - 1] = used;
+            message += used;
+            message[0] = 'Y';
+            message[1] = count - 1;
+            used = DELTA_PATCH_HEADER_SIZE;
+            count++;
+        }
+        length = end - at;
+        if (length > FRAME_CHUNK_MAX - used - DELTA_RUN_HEADER_SIZE)
+            length = FRAME_CHUNK_MAX - used - DELTA_RUN_HEADER_SIZE;
+
+        message[used++] = at & 0xFF;
+        message[used++] = at >> 8;
+        message[used++] = length;
+        for (i = 0; i < length; i++)
+            message[used++] = pBase[at + i] ^ pRaw[at + i];
+        at += length;
+    }
+    pSizes[count - 1] = used;
+
+    pOut[0] = 'X';
+    pOut[1] = DELTA_VERSION;
+    pOut[2] = Flags;
+    pOut[3] = count - 1;
+    PutLe32(pOut + 4, FrameCrc32(0, pBase, FRAME_RAW_SIZE));
+    PutLe32(pOut + 8, FrameCrc32(0, pRaw, FRAME_RAW_SIZE));
+
+    return count;
+}
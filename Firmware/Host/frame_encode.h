@@ -0,0 +1,31 @@
+#ifndef __FRAME_ENCODE_H
+#define __FRAME_ENCODE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "frame_codec.h"
+#include "frame_link.h"
+#include "frame_delta.h"
+
+/* Worst case PackBits output for one frame: a control byte per 128 literals */
+#define FRAME_ENCODE_MAX    (FRAME_HEADER_SIZE + FRAME_RAW_SIZE + FRAME_RAW_SIZE / 128 + 1)
+
+/* Same for a 2bpp FRAME_FLAG_GRAY frame */
+#define FRAME_GRAY_ENCODE_MAX (FRAME_HEADER_SIZE + FRAME_GRAY_SIZE + FRAME_GRAY_SIZE / 128 + 1)
+
+/* Start message plus every chunk at full size */
+#define FRAME_LINK_ENCODE_MAX (LINK_START_SIZE + LINK_MAX_CHUNKS * FRAME_CHUNK_MAX)
+
+int32_t FrameEncode(const uint8_t *pRaw, uint8_t Format, uint8_t Flags, uint8_t *pOut);
+int32_t FrameEncodeBest(const uint8_t *pRaw, uint8_t *pOut);
+int32_t FrameEncodeGray(const uint8_t *pPlanes, uint8_t *pOut);
+uint16_t FrameMessageCount(int32_t EncodedSize);
+int32_t FrameEncodeLink(const uint8_t *pRaw, uint8_t Format, uint8_t Flags, uint8_t *pOut, uint16_t *pSizes);
+int32_t FrameEncodeDelta(const uint8_t *pBase, const uint8_t *pRaw, uint8_t Flags, uint8_t *pOut, uint16_t *pSizes);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fw_update.h"
+
+/*
+ * fw-patch [-p running.bin] <new.bin> <out.bin>
+ *
+ * Turns a firmware image, the L-ink_Card.bin the build writes, into a
+ * firmware update for the card (fw_update.h): messages written with a
+ * leading byte holding their length - 1, like link-encode -l, for the
+ * reader app or host-sim. The start and data messages are followed by a
+ * status query, the install and a second query that shows the new image
+ * running.
+ *
+ * With -p the image goes as a patch against running.bin, the image the
+ * card runs now: whatever the two share is copied on the card from its
+ * own flash. The matcher is greedy over a hash of 4-byte strings, enough
+ * for builds where code moved or a few functions changed. The card
+ * writes the image over running.bin, so a copy's source is never more
+ * than UPDATE_BACK_MAX behind where it goes.
+ */
+
+#define PATCH_IMAGE_MAX     0x10000     // copy offsets are 16 bits
+#define PATCH_STREAM_MAX    (PATCH_IMAGE_MAX * 2)
+#define PATCH_OUT_MAX       (PATCH_STREAM_MAX * 2)
+#define PATCH_HASH_BITS     14
+#define PATCH_CHAIN_MAX     64          // candidates tried per position
+#define PATCH_COPY_MIN      8           // shorter matches cost more than the literal bytes
+
+typedef struct
+{
+    uint8_t *pData;
+    int32_t Size;
+    int32_t Literal;    // start of the literal bytes not written yet
+} PATCH_Stream_t;
+
+static uint32_t PatchHash(const uint8_t *pData)
+{
+    uint32_t key = pData[0] | (pData[1] << 8) | ((uint32_t) pData[2] << 16) | ((uint32_t) pData[3] << 24);
+
+    return (key * 2654435761U) >> (32 - PATCH_HASH_BITS);
+}
+
+static void PatchLiterals(PATCH_Stream_t *pStream, const uint8_t *pNew, int32_t End)
+{
+    int32_t length;
+
+    while (pStream->Literal < End)
+    {
+        length = End - pStream->Literal;
+        if (length > UPDATE_OP_LITERAL_MAX + 1)
+            length = UPDATE_OP_LITERAL_MAX + 1;
+        pStream->pData[pStream->Size++] = (uint8_t) (length - 1);
+        memcpy(pStream->pData + pStream->Size, pNew + pStream->Literal, length);
+        pStream->Size += length;
+        pStream->Literal += length;
+    }
+}
+
+static void PatchCopy(PATCH_Stream_t *pStream, int32_t Offset, int32_t Length)
+{
+    uint8_t *op = pStream->pData + pStream->Size;
+
+    op[0] = UPDATE_OP_COPY;
+    op[1] = Offset & 0xFF;
+    op[2] = Offset >> 8;
+    op[3] = Length & 0xFF;
+    op[4] = Length >> 8;
+    pStream->Size += UPDATE_COPY_SIZE;
+}
+
+/* Patch ops turning pOld into pNew, returns the stream size */
+static int32_t PatchEncode(const uint8_t *pOld, int32_t OldSize, const uint8_t *pNew, int32_t NewSize, uint8_t *pOut)
+{
+    static int32_t head[1 << PATCH_HASH_BITS];
+    static int32_t chain[PATCH_IMAGE_MAX];
+    PATCH_Stream_t stream = {pOut, 0, 0};
+    int32_t i, at, candidate, tries, length, best, bestAt;
+
+    memset(head, 0xFF, sizeof(head));
+    for (i = 0; i + 4 <= OldSize; i++)
+    {
+        chain[i] = head[PatchHash(pOld + i)];
+        head[PatchHash(pOld + i)] = i;
+    }
+
+    for (at = 0; at < NewSize;)
+    {
+        best = 0;
+        bestAt = 0;
+        candidate = at + 4 <= NewSize ? head[PatchHash(pNew + at)] : -1;
+        /* Candidates come latest first, the rest are further behind still */
+        for (tries = 0; candidate >= 0 && candidate + UPDATE_BACK_MAX >= at && tries < PATCH_CHAIN_MAX;
+             tries++, candidate = chain[candidate])
+        {
+            for (length = 0; at + length < NewSize && candidate + length < OldSize && length < 0xFFFF &&
+                             pNew[at + length] == pOld[candidate + length]; length++);
+            if (length > best)
+            {
+                best = length;
+                bestAt = candidate;
+            }
+        }
+
+        if (best < PATCH_COPY_MIN)
+        {
+            at++;
+            continue;
+        }
+        PatchLiterals(&stream, pNew, at);
+        PatchCopy(&stream, bestAt, best);
+        at += best;
+        stream.Literal = at;
+    }
+    PatchLiterals(&stream, pNew, NewSize);
+    return stream.Size;
+}
+
+static void PatchLe32(uint8_t *pData, uint32_t Value)
+{
+    pData[0] = Value & 0xFF;
+    pData[1] = (Value >> 8) & 0xFF;
+    pData[2] = (Value >> 16) & 0xFF;
+    pData[3] = Value >> 24;
+}
+
+static uint8_t *PatchMessage(uint8_t *pOut, const uint8_t *pMessage, int32_t Length)
+{
+    *pOut++ = (uint8_t) (Length - 1);
+    memcpy(pOut, pMessage, Length);
+    return pOut + Length;
+}
+
+/* Start, data, then query, install and query again. Returns the file size, messages in pCount */
+static int32_t PatchMessages(const uint8_t *pStream, int32_t Size, uint8_t Flags, uint32_t ImageSize,
+                             uint32_t Crc, uint32_t BaseCrc, uint8_t *pOut, int32_t *pCount)
+{
+    static const uint8_t Status[UPDATE_QUERY_SIZE] = {'V', UPDATE_QUERY_STATUS};
+    static const uint8_t Install[UPDATE_QUERY_SIZE] = {'V', UPDATE_QUERY_INSTALL};
+    uint8_t message[FRAME_CHUNK_MAX];
+    uint8_t *out = pOut;
+    int32_t at, length;
+    uint16_t seq = 0;
+
+    message[0] = 'U';
+    message[1] = UPDATE_VERSION;
+    message[2] = Flags;
+    message[3] = 0;
+    PatchLe32(message + 4, ImageSize);
+    PatchLe32(message + 8, Crc);
+    PatchLe32(message + 12, BaseCrc);
+    out = PatchMessage(out, message, UPDATE_START_SIZE);
+
+    for (at = 0; at < Size; at += length, seq++)
+    {
+        length = Size - at < UPDATE_DATA_MAX ? Size - at : UPDATE_DATA_MAX;
+        message[0] = 'W';
+        message[1] = 0;
+        message[2] = seq & 0xFF;
+        message[3] = seq >> 8;
+        memcpy(message + UPDATE_DATA_HEADER_SIZE, pStream + at, length);
+        out = PatchMessage(out, message, UPDATE_DATA_HEADER_SIZE + length);
+    }
+
+    out = PatchMessage(out, Status, UPDATE_QUERY_SIZE);
+    out = PatchMessage(out, Install, UPDATE_QUERY_SIZE);
+    out = PatchMessage(out, Status, UPDATE_QUERY_SIZE);
+    *pCount = 1 + seq + 3;
+    return (int32_t) (out - pOut);
+}
+
+static uint32_t PatchCrc(const uint8_t *pData, int32_t Size)
+{
+    uint32_t crc = 0;
+    uint16_t length;
+
+    for (; Size; Size -= length, pData += length)
+    {
+        length = Size > 0x8000 ? 0x8000 : (uint16_t) Size;
+        crc = FrameCrc32(crc, pData, length);
+    }
+    return crc;
+}
+
+static int32_t ReadImage(const char *pName, uint8_t *pData)
+{
+    FILE *f = fopen(pName, "rb");
+    size_t length = f == NULL ? 0 : fread(pData, 1, PATCH_IMAGE_MAX + 1, f);
+
+    if (f != NULL)
+        fclose(f);
+    return length == 0 || length > PATCH_IMAGE_MAX ? -1 : (int32_t) length;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t running[PATCH_IMAGE_MAX + 1];
+    static uint8_t image[PATCH_IMAGE_MAX + 1];
+    static uint8_t stream[PATCH_STREAM_MAX];
+    static uint8_t out[PATCH_OUT_MAX];
+    const uint8_t *data = image;
+    int32_t runningSize = 0, size, streamSize, outSize, count;
+    uint32_t baseCrc = 0;
+    uint8_t flags = 0;
+    FILE *f;
+
+    if (argc == 5 && strcmp(argv[1], "-p") == 0)
+    {
+        runningSize = ReadImage(argv[2], running);
+        if (runningSize < 0)
+        {
+            fprintf(stderr, "%s: expected a firmware image up to %d bytes\n", argv[2], PATCH_IMAGE_MAX);
+            return 1;
+        }
+        flags = UPDATE_FLAG_PATCH;
+        baseCrc = PatchCrc(running, runningSize);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s [-p running.bin] <new.bin> <out.bin>\n", argv[0]);
+        return 2;
+    }
+
+    size = ReadImage(argv[1], image);
+    if (size < 0)
+    {
+        fprintf(stderr, "%s: expected a firmware image up to %d bytes\n", argv[1], PATCH_IMAGE_MAX);
+        return 1;
+    }
+
+    streamSize = size;
+    if (flags & UPDATE_FLAG_PATCH)
+    {
+        streamSize = PatchEncode(running, runningSize, image, size, stream);
+        data = stream;
+    }
+    outSize = PatchMessages(data, streamSize, flags, size, PatchCrc(image, size), baseCrc, out, &count);
+
+    f = fopen(argv[2], "wb");
+    if (f == NULL || fwrite(out, 1, outSize, f) != (size_t) outSize)
+    {
+        fprintf(stderr, "%s: write failed\n", argv[2]);
+        return 1;
+    }
+    fclose(f);
+
+    if (flags & UPDATE_FLAG_PATCH)
+        printf("image %d bytes crc %08lx, patch %d bytes against %08lx, %d messages (full: %d messages)\n",
+               (int) size, (unsigned long) PatchCrc(image, size), (int) streamSize, (unsigned long) baseCrc,
+               (int) count, (int) (4 + (size + UPDATE_DATA_MAX - 1) / UPDATE_DATA_MAX));
+    else
+        printf("image %d bytes crc %08lx, %d messages\n", (int) size, (unsigned long) PatchCrc(image, size),
+               (int) count);
+    return 0;
+}
@@ -0,0 +1,271 @@
+#include "image_convert.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bayer 8x8, scaled to thresholds 0 .. 254 */
+static const uint8_t Bayer[8][8] = {
+        {  2, 130,  34, 162,  10, 138,  42, 170},
+        {194,  66, 226,  98, 202,  74, 234, 106},
+        { 50, 178,  18, 146,  58, 186,  26, 154},
+        {242, 114, 210,  82, 250, 122, 218,  90},
+        { 14, 142,  46, 174,   6, 134,  38, 166},
+        {206,  78, 238, 110, 198,  70, 230, 102},
+        { 62, 190,  30, 158,  54, 182,  22, 150},
+        {254, 126, 222,  94, 246, 118, 214,  86}
+};
+
+static int32_t PnmField(FILE *f, uint32_t *pValue)
+{
+    int c = fgetc(f);
+
+    for (;;)
+    {
+        if (c == '#')
+            while (c != '\n' && c != EOF)
+                c = fgetc(f);
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            c = fgetc(f);
+        else
+            break;
+    }
+    if (c < '0' || c > '9')
+        return IMAGE_ERROR;
+
+    *pValue = 0;
+    while (c >= '0' && c <= '9')
+    {
+        if (*pValue > 100000)
+            return IMAGE_ERROR;
+        *pValue = *pValue * 10 + (c - '0');
+        c = fgetc(f);
+    }
+    /* A single whitespace ends the last field before the pixels */
+    return IMAGE_OK;
+}
+
+int32_t ImageRead(const char *pName, IMAGE_t *pImage)
+{
+    FILE *f = fopen(pName, "rb");
+    uint32_t maxval;
+    size_t size;
+    char magic[2];
+
+    pImage->pPixels = NULL;
+    if (f == NULL)
+        return IMAGE_ERROR;
+
+    if (fread(magic, 1, 2, f) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6') ||
+        PnmField(f, &pImage->Width) != IMAGE_OK || PnmField(f, &pImage->Height) != IMAGE_OK ||
+        PnmField(f, &maxval) != IMAGE_OK || maxval != 255 || pImage->Width == 0 || pImage->Height == 0)
+    {
+        fclose(f);
+        return IMAGE_ERROR;
+    }
+
+    pImage->Channels = magic[1] == '6' ? 3 : 1;
+    size = (size_t) pImage->Width * pImage->Height * pImage->Channels;
+    pImage->pPixels = malloc(size);
+    if (pImage->pPixels == NULL || fread(pImage->pPixels, 1, size, f) != size)
+    {
+        fclose(f);
+        ImageFree(pImage);
+        return IMAGE_ERROR;
+    }
+    fclose(f);
+    return IMAGE_OK;
+}
+
+void ImageFree(IMAGE_t *pImage)
+{
+    free(pImage->pPixels);
+    pImage->pPixels = NULL;
+}
+
+/* Rec. 601 weights, 8 bits of fraction */
+static uint8_t ImageLuma(const uint8_t *pPixel, uint8_t Channels)
+{
+    if (Channels == 1)
+        return pPixel[0];
+    return (uint8_t) ((77 * pPixel[0] + 150 * pPixel[1] + 29 * pPixel[2] + 128) >> 8);
+}
+
+/* Source pixels [pFrom[i], pTo[i]) under each of Count output pixels, one at least when scaling up */
+static void ImageSpans(uint32_t Source, uint32_t Count, uint32_t *pFrom, uint32_t *pTo)
+{
+    uint32_t i;
+
+    for (i = 0; i < Count; i++)
+    {
+        pFrom[i] = (uint32_t) ((uint64_t) i * Source / Count);
+        pTo[i] = (uint32_t) ((uint64_t) (i + 1) * Source / Count);
+        if (pTo[i] == pFrom[i])
+            pTo[i]++;
+    }
+}
+
+void ImageFit(const IMAGE_t *pImage, uint8_t *pLuma)
+{
+    uint32_t xFrom[IMAGE_WIDTH], xTo[IMAGE_WIDTH], yFrom[IMAGE_HEIGHT], yTo[IMAGE_HEIGHT];
+    uint32_t width, height, left, top;
+    uint32_t x, y, sx, sy, sum, count;
+    const uint8_t *row;
+
+    /* Longer side to the panel, the other one in proportion */
+    if ((uint64_t) pImage->Width * IMAGE_HEIGHT >= (uint64_t) pImage->Height * IMAGE_WIDTH)
+    {
+        width = IMAGE_WIDTH;
+        height = (uint32_t) ((uint64_t) pImage->Height * IMAGE_WIDTH / pImage->Width);
+    } else
+    {
+        height = IMAGE_HEIGHT;
+        width = (uint32_t) ((uint64_t) pImage->Width * IMAGE_HEIGHT / pImage->Height);
+    }
+    if (width == 0)
+        width = 1;
+    if (height == 0)
+        height = 1;
+    left = (IMAGE_WIDTH - width) / 2;
+    top = (IMAGE_HEIGHT - height) / 2;
+
+    memset(pLuma, 255, IMAGE_PIXELS);
+    ImageSpans(pImage->Width, width, xFrom, xTo);
+    ImageSpans(pImage->Height, height, yFrom, yTo);
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            sum = 0;
+            for (sy = yFrom[y]; sy < yTo[y]; sy++)
+            {
+                row = pImage->pPixels + ((size_t) sy * pImage->Width + xFrom[x]) * pImage->Channels;
+                for (sx = xFrom[x]; sx < xTo[x]; sx++, row += pImage->Channels)
+                    sum += ImageLuma(row, pImage->Channels);
+            }
+            count = (yTo[y] - yFrom[y]) * (xTo[x] - xFrom[x]);
+            pLuma[(top + y) * IMAGE_WIDTH + left + x] = (uint8_t) ((sum + count / 2) / count);
+        }
+    }
+}
+
+/*
+ * level = (v * (Levels - 1) + threshold) / 255, with the division done as
+ * ((n + 1) * 257) >> 16, exact for the n seen here. No branches and no
+ * carried state along the row: the compiler vectorizes the inner loop.
+ */
+static void ImageOrdered(uint8_t *pLuma, uint8_t Levels)
+{
+    uint16_t thresholds[IMAGE_WIDTH];
+    uint16_t steps = Levels - 1;
+    uint8_t *row;
+    uint32_t x, y, n;
+
+    for (y = 0; y < IMAGE_HEIGHT; y++)
+    {
+        for (x = 0; x < IMAGE_WIDTH; x++)
+            thresholds[x] = Bayer[y & 7][x & 7];
+
+        row = pLuma + y * IMAGE_WIDTH;
+        for (x = 0; x < IMAGE_WIDTH; x++)
+        {
+            n = row[x] * steps + thresholds[x];
+            row[x] = (uint8_t) (((n + 1) * 257) >> 16);
+        }
+    }
+}
+
+/* Error in 1/16 steps onto two rows with a pixel of margin either side, every other row right to left */
+static void ImageDiffusion(uint8_t *pLuma, uint8_t Levels)
+{
+    int16_t errors[2][IMAGE_WIDTH + 2];
+    int16_t *here, *below;
+    int32_t steps = Levels - 1;
+    int32_t x, y, dir, end, value, level, error;
+
+    memset(errors, 0, sizeof(errors));
+    for (y = 0; y < IMAGE_HEIGHT; y++)
+    {
+        here = errors[y & 1] + 1;
+        below = errors[(y + 1) & 1] + 1;
+        memset(below - 1, 0, sizeof(errors[0]));
+
+        dir = y & 1 ? -1 : 1;
+        x = y & 1 ? IMAGE_WIDTH - 1 : 0;
+        end = y & 1 ? -1 : IMAGE_WIDTH;
+        for (; x != end; x += dir)
+        {
+            value = pLuma[y * IMAGE_WIDTH + x] + here[x] / 16;
+            level = (value * steps + 127) / 255;
+            if (level < 0)
+                level = 0;
+            if (level > steps)
+                level = steps;
+            pLuma[y * IMAGE_WIDTH + x] = (uint8_t) level;
+
+            error = value - level * 255 / steps;
+            here[x + dir] += (int16_t) (error * 7);
+            below[x - dir] += (int16_t) (error * 3);
+            below[x] += (int16_t) (error * 5);
+            below[x + dir] += (int16_t) error;
+        }
+    }
+}
+
+void ImageDither(uint8_t *pLuma, uint8_t Levels, uint8_t Method)
+{
+    if (Method == IMAGE_DITHER_DIFFUSION)
+        ImageDiffusion(pLuma, Levels);
+    else
+        ImageOrdered(pLuma, Levels);
+}
+
+void ImagePack(const uint8_t *pLevels, uint8_t *pRaw)
+{
+    uint32_t i, bit;
+    uint8_t byte;
+
+    for (i = 0; i < FRAME_RAW_SIZE; i++, pLevels += 8)
+    {
+        byte = 0;
+        for (bit = 0; bit < 8; bit++)
+            byte |= (pLevels[bit] & 1) << (7 - bit);
+        pRaw[i] = byte;
+    }
+}
+
+void ImagePackGray(const uint8_t *pLevels, uint8_t *pPlanes)
+{
+    uint32_t i, bit;
+    uint8_t high, low;
+
+    for (i = 0; i < FRAME_RAW_SIZE; i++, pLevels += 8)
+    {
+        high = low = 0;
+        for (bit = 0; bit < 8; bit++)
+        {
+            high |= ((pLevels[bit] >> 1) & 1) << (7 - bit);
+            low |= (pLevels[bit] & 1) << (7 - bit);
+        }
+        pPlanes[i] = high;
+        pPlanes[FRAME_RAW_SIZE + i] = low;
+    }
+}
+
+int32_t ImageConvert(const IMAGE_t *pImage, uint8_t Gray, uint8_t Method, uint8_t *pOut)
+{
+    uint8_t luma[IMAGE_PIXELS];
+
+    if (pImage->pPixels == NULL)
+        return IMAGE_ERROR;
+
+    ImageFit(pImage, luma);
+    ImageDither(luma, Gray ? 4 : 2, Method);
+    if (Gray)
+    {
+        ImagePackGray(luma, pOut);
+        return FRAME_GRAY_SIZE;
+    }
+    ImagePack(luma, pOut);
+    return FRAME_RAW_SIZE;
+}
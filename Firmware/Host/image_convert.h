@@ -0,0 +1,60 @@
+#ifndef __IMAGE_CONVERT_H
+#define __IMAGE_CONVERT_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include "frame_codec.h"
+
+/*
+ * Any picture to a frame the card shows as it is: scaled to fit the
+ * panel, centered on white, dithered to 2 or 4 levels and packed in the
+ * card's byte order. Rows top to bottom, FRAME_ROW_BYTES per row, the
+ * left pixel in the MSB, 1 is white; the driver's data entry mode (X
+ * increase, Y decrease) puts row 0 at the top of the panel. A gray image
+ * is a high plane then a low plane, as link-encode takes it.
+ *
+ * Nothing is shared between calls, threads can convert side by side.
+ */
+
+#define IMAGE_WIDTH         (FRAME_ROW_BYTES * 8)
+#define IMAGE_HEIGHT        FRAME_ROWS
+#define IMAGE_PIXELS        (IMAGE_WIDTH * IMAGE_HEIGHT)
+
+#define IMAGE_DITHER_ORDERED    0   // 8x8 Bayer, stable patterns that pack and patch well
+#define IMAGE_DITHER_DIFFUSION  1   // Floyd-Steinberg, serpentine, finer for photos
+
+#define IMAGE_OK            0
+#define IMAGE_ERROR         (-1)
+
+typedef struct
+{
+    uint32_t Width;
+    uint32_t Height;
+    uint8_t Channels;       // 1 gray, 3 RGB, 8 bits each
+    uint8_t *pPixels;       // rows top to bottom, allocated by ImageRead()
+} IMAGE_t;
+
+/* Binary PGM (P5) or PPM (P6), 8 bits. Anything else converts to these with any image tool */
+int32_t ImageRead(const char *pName, IMAGE_t *pImage);
+void ImageFree(IMAGE_t *pImage);
+
+/* IMAGE_PIXELS of luma, 0 black .. 255 white, each one the average of the source pixels it covers */
+void ImageFit(const IMAGE_t *pImage, uint8_t *pLuma);
+
+/* pLuma in place, to levels 0 .. Levels - 1. Levels is 2 or 4 */
+void ImageDither(uint8_t *pLuma, uint8_t Levels, uint8_t Method);
+
+/* From ImageDither() levels to FRAME_RAW_SIZE, or FRAME_GRAY_SIZE of planes */
+void ImagePack(const uint8_t *pLevels, uint8_t *pRaw);
+void ImagePackGray(const uint8_t *pLevels, uint8_t *pPlanes);
+
+/* All of the above, returns the size written to pOut: FRAME_RAW_SIZE, or FRAME_GRAY_SIZE when Gray */
+int32_t ImageConvert(const IMAGE_t *pImage, uint8_t Gray, uint8_t Method, uint8_t *pOut);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "image_convert.h"
+#include "frame_encode.h"
+
+/*
+ * image-prep [-g] [-f] [-e] [-b] [-j jobs] [-o dir] <image.ppm|image.pgm> ...
+ *
+ * Turns pictures into frames for the card, see image_convert.h. Each
+ * input gives <name>.bin next to it, or in dir with -o: a raw 5000-byte
+ * frame, or with -g a raw 10000-byte 2bpp image. With -e the v1 stream
+ * link-encode writes is stored instead, header then payload, to be sent
+ * in FRAME_CHUNK_MAX-byte mailbox messages. Every output also goes to
+ * link-encode and host-sim as it is.
+ *
+ * -f dithers with Floyd-Steinberg instead of the ordered 8x8 Bayer
+ * matrix. The ordered patterns stay put when the picture changes a
+ * little, which packs better and keeps deltas small.
+ *
+ * The inputs are shared out over jobs threads, one per core by default.
+ * -b converts without writing anything and only reports the throughput;
+ * name the same picture a thousand times for a steady figure.
+ */
+
+typedef struct
+{
+    char **pNames;
+    int Count;
+    int Next;
+    int Failed;
+    long Bytes;
+    pthread_mutex_t Lock;
+} PREP_Queue_t;
+
+static uint8_t Gray = 0;
+static uint8_t Method = IMAGE_DITHER_ORDERED;
+static uint8_t Encode = 0;
+static uint8_t Bench = 0;
+static const char *OutDir = NULL;
+
+static double Seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* <dir or the input's own>/<input name without extension>.bin */
+static void OutName(const char *pIn, char *pOut, size_t Size)
+{
+    const char *base = strrchr(pIn, '/');
+    const char *dot;
+    int dirLength;
+
+    base = base == NULL ? pIn : base + 1;
+    dot = strrchr(base, '.');
+    if (dot == NULL || dot == base)
+        dot = base + strlen(base);
+
+    if (OutDir != NULL)
+        snprintf(pOut, Size, "%s/%.*s.bin", OutDir, (int) (dot - base), base);
+    else
+    {
+        dirLength = (int) (base - pIn);
+        snprintf(pOut, Size, "%.*s%.*s.bin", dirLength, pIn, (int) (dot - base), base);
+    }
+}
+
+static int32_t Prepare(const char *pName, uint8_t *pRaw, uint8_t *pEncoded)
+{
+    IMAGE_t image;
+    char out[1024];
+    const uint8_t *data = pRaw;
+    int32_t size;
+    FILE *f;
+
+    if (ImageRead(pName, &image) != IMAGE_OK)
+    {
+        fprintf(stderr, "%s: not a binary 8-bit PGM or PPM\n", pName);
+        return -1;
+    }
+    size = ImageConvert(&image, Gray, Method, pRaw);
+    ImageFree(&image);
+
+    if (Encode)
+    {
+        size = Gray ? FrameEncodeGray(pRaw, pEncoded) : FrameEncodeBest(pRaw, pEncoded);
+        data = pEncoded;
+    }
+    if (size < 0 || Bench)
+        return size;
+
+    OutName(pName, out, sizeof(out));
+    f = fopen(out, "wb");
+    if (f == NULL || fwrite(data, 1, size, f) != (size_t) size)
+    {
+        fprintf(stderr, "%s: write failed\n", out);
+        if (f != NULL)
+            fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return size;
+}
+
+static void *Worker(void *pArg)
+{
+    uint8_t raw[FRAME_GRAY_SIZE];
+    uint8_t encoded[FRAME_GRAY_ENCODE_MAX];
+    PREP_Queue_t *queue = pArg;
+    int32_t size;
+    int i;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue->Lock);
+        i = queue->Next++;
+        pthread_mutex_unlock(&queue->Lock);
+        if (i >= queue->Count)
+            return NULL;
+
+        size = Prepare(queue->pNames[i], raw, encoded);
+
+        pthread_mutex_lock(&queue->Lock);
+        if (size < 0)
+            queue->Failed++;
+        else
+            queue->Bytes += size;
+        pthread_mutex_unlock(&queue->Lock);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    PREP_Queue_t queue;
+    pthread_t *threads;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    double start, seconds;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "gfebj:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'g':
+                Gray = 1;
+                break;
+            case 'f':
+                Method = IMAGE_DITHER_DIFFUSION;
+                break;
+            case 'e':
+                Encode = 1;
+                break;
+            case 'b':
+                Bench = 1;
+                break;
+            case 'j':
+                jobs = atol(optarg);
+                break;
+            case 'o':
+                OutDir = optarg;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-g] [-f] [-e] [-b] [-j jobs] [-o dir] <image.ppm|image.pgm> ...\n", argv[0]);
+        return 2;
+    }
+
+    queue.pNames = argv + optind;
+    queue.Count = argc - optind;
+    queue.Next = 0;
+    queue.Failed = 0;
+    queue.Bytes = 0;
+    pthread_mutex_init(&queue.Lock, NULL);
+
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > queue.Count)
+        jobs = queue.Count;
+    threads = malloc(jobs * sizeof(pthread_t));
+    if (threads == NULL)
+        return 1;
+
+    start = Seconds();
+    for (i = 0; i < jobs; i++)
+        pthread_create(&threads[i], NULL, Worker, &queue);
+    for (i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+    seconds = Seconds() - start;
+    free(threads);
+
+    printf("%d images, %d failed, %ld bytes, %.1f ms, %.1f images/s on %ld threads\n",
+           queue.Count - queue.Failed, queue.Failed, queue.Bytes, seconds * 1e3,
+           (queue.Count - queue.Failed) / (seconds > 0 ? seconds : 1e-9), jobs);
+    return queue.Failed ? 1 : 0;
+}
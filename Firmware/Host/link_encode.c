@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include "frame_encode.h"
+
+/*
+ * link-encode [-l] <frame.bin> <out.bin>
+ * link-encode -d <shown.bin> <frame.bin> <out.bin>
+ *
+ * Packs a raw 5000-byte 1bpp frame (panel byte order) into the header +
+ * payload stream the card expects. The header goes out as the first
+ * mailbox message, the payload in FRAME_CHUNK_MAX-byte messages. A
+ * 10000-byte file is a 2bpp image, its high plane then its low plane.
+ *
+ * With -l the frame is cut for the reliable frame_link transfer instead,
+ * and every message is written with a leading byte holding its length - 1.
+ *
+ * With -d the frame is sent as a frame_delta transfer against shown.bin,
+ * the frame the card holds, written as messages like -l.
+ */
+
+static int32_t WriteMessages(const uint8_t *pMessages, const uint16_t *pSizes, int32_t Count, uint8_t *pOut)
+{
+    uint8_t *out = pOut;
+    int32_t i;
+
+    for (i = 0; i < Count; i++)
+    {
+        *out++ = pSizes[i] - 1;
+        memcpy(out, pMessages, pSizes[i]);
+        out += pSizes[i];
+        pMessages += pSizes[i];
+    }
+    return out - pOut;
+}
+
+static int32_t EncodeLink(const uint8_t *pRaw, uint8_t *pOut)
+{
+    static uint8_t messages[FRAME_LINK_ENCODE_MAX];
+    static const uint8_t Formats[3][2] = {
+            {FRAME_FORMAT_RAW, 0},
+            {FRAME_FORMAT_RLE, 0},
+            {FRAME_FORMAT_RLE, FRAME_FLAG_ROW_DELTA}
+    };
+    uint16_t sizes[1 + LINK_MAX_CHUNKS];
+    int32_t best = -1;
+    int32_t count, size, i, j;
+
+    for (i = 0; i < 3; i++)
+    {
+        count = FrameEncodeLink(pRaw, Formats[i][0], Formats[i][1], messages, sizes);
+        if (count < 0)
+            continue;
+
+        for (j = 0, size = 0; j < count; j++)
+            size += 1 + sizes[j];
+        if (best >= 0 && size >= best)
+            continue;
+
+        WriteMessages(messages, sizes, count, pOut);
+        best = size;
+    }
+
+    return best;
+}
+
+static int32_t ReadFrame(const char *pName, uint8_t *pRaw, size_t Size)
+{
+    FILE *f = fopen(pName, "rb");
+    size_t length = f == NULL ? 0 : fread(pRaw, 1, Size, f);
+
+    if (f != NULL)
+        fclose(f);
+    return (int32_t) length;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t raw[FRAME_GRAY_SIZE + 1];
+    static uint8_t shown[FRAME_RAW_SIZE + 1];
+    static uint8_t messages[FRAME_LINK_ENCODE_MAX];
+    static uint8_t out[FRAME_LINK_ENCODE_MAX + 1 + LINK_MAX_CHUNKS];
+    uint16_t sizes[1 + LINK_MAX_CHUNKS];
+    FILE *f;
+    int32_t size, count;
+    size_t length;
+    int link = 0;
+    int delta = 0;
+
+    if (argc == 4 && strcmp(argv[1], "-l") == 0)
+    {
+        link = 1;
+        argv++;
+        argc--;
+    } else if (argc == 5 && strcmp(argv[1], "-d") == 0)
+    {
+        delta = 1;
+        if (ReadFrame(argv[2], shown, sizeof(shown)) != FRAME_RAW_SIZE)
+        {
+            fprintf(stderr, "%s: expected %d bytes of frame data\n", argv[2], FRAME_RAW_SIZE);
+            return 1;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s [-l] <frame.bin> <out.bin>\n"
+                        "       %s -d <shown.bin> <frame.bin> <out.bin>\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    length = ReadFrame(argv[1], raw, sizeof(raw));
+    if (length != FRAME_RAW_SIZE && length != FRAME_GRAY_SIZE)
+    {
+        fprintf(stderr, "%s: expected %d or %d bytes of frame data\n", argv[1], FRAME_RAW_SIZE, FRAME_GRAY_SIZE);
+        return 1;
+    }
+
+    if (length == FRAME_GRAY_SIZE && (link || delta))
+    {
+        fprintf(stderr, "%s: gray frames go to a slot, not over the link or delta transfer\n", argv[1]);
+        return 1;
+    }
+
+    count = 0;
+    if (delta)
+    {
+        count = FrameEncodeDelta(shown, raw, 0, messages, sizes);
+        size = count < 0 ? count : WriteMessages(messages, sizes, count, out);
+    } else if (length == FRAME_GRAY_SIZE)
+        size = FrameEncodeGray(raw, out);
+    else
+        size = link ? EncodeLink(raw, out) : FrameEncodeBest(raw, out);
+    if (size < 0)
+    {
+        fprintf(stderr, "%s: frame does not fit in %d chunks\n", argv[1], LINK_MAX_CHUNKS);
+        return 1;
+    }
+
+    f = fopen(argv[2], "wb");
+    if (f == NULL || fwrite(out, 1, size, f) != (size_t) size)
+    {
+        fprintf(stderr, "%s: write failed\n", argv[2]);
+        return 1;
+    }
+    fclose(f);
+
+    if (delta)
+        printf("delta, %d messages, %d bytes (full: %d messages)\n", (int) count, (int) size,
+               FrameMessageCount(FrameEncodeBest(raw, messages)));
+    else if (link)
+        printf("format %d flags 0x%02x, %d chunks, %d bytes\n", out[3], out[4], out[5], (int) size);
+    else
+        printf("format %d flags 0x%02x payload %d bytes, %d messages (raw: %d)\n",
+               out[2], out[3], (int) (size - FRAME_HEADER_SIZE), FrameMessageCount(size),
+               FrameMessageCount(FRAME_HEADER_SIZE + length));
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "log_messages.h"
+
+/*
+ * log-decode [capture.bin]
+ *
+ * Expands the binary log the card sends on USART1 (see log.h) into text,
+ * one line per record with the card's millisecond tick. Reads stdin
+ * without a file, so a serial port can be piped in. Bytes that don't
+ * start a valid record are skipped, a capture may begin mid-record.
+ */
+
+static const char *const Formats[] = {
+#define LOG_FORMAT(Id, Format) Format,
+        LOG_MESSAGES(LOG_FORMAT)
+#undef LOG_FORMAT
+};
+
+#define LOG_FORMATS (sizeof(Formats) / sizeof(Formats[0]))
+
+static uint32_t DecodeLe32(const uint8_t *pData)
+{
+    return pData[0] | (pData[1] << 8) | (pData[2] << 16) | ((uint32_t) pData[3] << 24);
+}
+
+static int ReadBytes(FILE *f, uint8_t *pData, size_t Length)
+{
+    return fread(pData, 1, Length, f) == Length;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t record[LOG_HEADER_SIZE + LOG_MAX_ARGS * 4];
+    unsigned long args[LOG_MAX_ARGS] = {0};
+    unsigned long skipped = 0;
+    FILE *f = stdin;
+    int c, i;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [capture.bin]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 2 && !(f = fopen(argv[1], "rb")))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    while ((c = fgetc(f)) != EOF)
+    {
+        if (c != LOG_SYNC)
+        {
+            skipped++;
+            continue;
+        }
+        record[0] = c;
+        if (!ReadBytes(f, record + 1, LOG_HEADER_SIZE - 1))
+            break;
+        if (record[1] >= LOG_FORMATS || record[2] > LOG_MAX_ARGS)
+        {
+            skipped += LOG_HEADER_SIZE;
+            continue;
+        }
+        if (!ReadBytes(f, record + LOG_HEADER_SIZE, record[2] * 4))
+            break;
+
+        for (i = 0; i < LOG_MAX_ARGS; i++)
+            args[i] = i < record[2] ? DecodeLe32(record + LOG_HEADER_SIZE + i * 4) : 0;
+        printf("%10.3f  ", DecodeLe32(record + 3) / 1000.0);
+        printf(Formats[record[1]], args[0], args[1], args[2], args[3], args[4], args[5]);
+        printf("\n");
+    }
+
+    if (skipped)
+        fprintf(stderr, "%lu bytes skipped\n", skipped);
+    if (f != stdin)
+        fclose(f);
+    return 0;
+}
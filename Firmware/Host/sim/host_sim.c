@@ -0,0 +1,520 @@
+#include "sim.h"
+#include "app_nfc.h"
+#include "power.h"
+#include "clock.h"
+#include "epd_w21.h"
+#include "epd_partial.h"
+#include "telemetry.h"
+#include "frame_encode.h"
+#include "fw_update.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * host-sim [-s spi_ns] [-r rf_us] [-o overhead_us] [-i i2c_us] [-d drop%] [-f full_ms] [-p part_ms]
+ *          [-e harvest_uA] [-c cap_uF] [-g out.pgm] [-w idle_ms] [-F running.bin] [-x] <file|-> ...
+ *
+ * Runs the card's main loop against the simulated tag and panel, one
+ * transfer per file ("-" reads stdin, so a socket can be piped in). A file
+ * is taken as:
+ *   - a raw 5000-byte frame, sent as the best v1 stream,
+ *   - a raw 10000-byte 2bpp image, high plane then low plane, sent as a
+ *     gray v1 stream; the mean panel reflectance of each level is printed,
+ *   - a v1 stream from link-encode (starts with 'L'), cut into mailbox
+ *     messages like a reader would,
+ *   - otherwise a link-encode -l message file: each message preceded by
+ *     its length - 1. A link transfer is followed by queries, and whatever
+ *     the ACK reports missing is sent again. A delta transfer is
+ *     followed by an 'F' query. Policy, telemetry, frame id and firmware
+ *     update replies the card writes back are printed.
+ * With -w the card is left alone for idle_ms after the last file, so
+ * timer work (slot cycling, ghosting cleanup) runs, the reader's field
+ * off. With -g the panel image at the end is written as a PGM.
+ *
+ * -x floods the mailbox: the reader puts each message in the moment the
+ * card has read the one before, no RF time in between. Every frame file
+ * must then come out on the panel exactly, which it only does if no
+ * chunk was lost or taken out of order on the way through the ping-pong
+ * buffers; the chunks/s the card kept up with is printed, and the exit
+ * status is 1 if any frame came out wrong.
+ *
+ * -F puts the firmware image a patch from fw-patch is made against in the
+ * card's application region; an update start runs the bootloader, which
+ * writes the new image over it.
+ *
+ * With -e the card lives off the field instead of a battery: VDD is a
+ * cap_uF capacitor (4700 by default) the harvester charges at harvest_uA
+ * while the field is on. The lowest VDD and the brownouts are reported.
+ */
+
+#define SIM_MESSAGES_MAX    256     // a whole firmware image, link transfers need 1 + LINK_MAX_CHUNKS
+#define SIM_FILE_MAX        (SIM_MESSAGES_MAX * (1 + FRAME_CHUNK_MAX))
+#define SIM_LINK_ROUNDS     32
+
+unsigned char nfcBuffer[EPD_FRAME_SIZE];
+
+static const uint8_t *LinkMessages[SIM_MESSAGES_MAX];
+static uint16_t LinkSizes[SIM_MESSAGES_MAX];
+static uint16_t LinkCount = 0;
+static uint16_t LinkRounds = 0;
+static uint8_t LinkStatus = LINK_STATUS_IDLE;
+static uint8_t Flood = 0;
+static uint16_t FloodFailed = 0;
+
+static const uint8_t Query[LINK_QUERY_SIZE] = {'Q', 0};
+static const uint8_t DeltaQuery[DELTA_QUERY_SIZE] = {'F', 0};
+
+static void LinkQueueAll(void)
+{
+    uint16_t i;
+
+    for (i = 0; i < LinkCount; i++)
+        SimReaderQueue(LinkMessages[i], LinkSizes[i]);
+    SimReaderQueue(Query, sizeof(Query));
+}
+
+static uint16_t ReportLe16(const uint8_t *pData)
+{
+    return pData[0] | (pData[1] << 8);
+}
+
+static uint32_t ReportLe32(const uint8_t *pData)
+{
+    return ReportLe16(pData) | ((uint32_t) ReportLe16(pData + 2) << 16);
+}
+
+static void PolicyReport(const uint8_t *pData)
+{
+    printf("  policy: last %u reason %u, changed %u%%, ghost %u%%, %u none %u part %u full"
+           " (forced %u area %u ghost %u cold %u cleanup %u)\n",
+           pData[2], pData[3], pData[4], pData[5], ReportLe16(pData + 8), ReportLe16(pData + 10),
+           ReportLe16(pData + 12), ReportLe16(pData + 14), ReportLe16(pData + 16), ReportLe16(pData + 18),
+           ReportLe16(pData + 20), ReportLe16(pData + 22));
+}
+
+static void TelemetryReport(const uint8_t *pData)
+{
+    static const char *names[TELEMETRY_STAGES] = {"i2c", "spi", "busy", "boot tag", "boot config", "boot store",
+                                                  "panel init"};
+    uint32_t perMs = ReportLe32(pData + 4);
+    const uint8_t *stage = pData + 8;
+    const uint8_t *counters = stage + TELEMETRY_STAGES * 12;
+    const uint8_t *power = counters + TELEMETRY_COUNTERS * 2;
+    uint8_t i;
+
+    printf("  telemetry:");
+    for (i = 0; i < TELEMETRY_STAGES; i++, stage += 12)
+        printf("%s %s %lu x %.2f ms (max %.2f)", i % 3 ? "," : i ? "\n  telemetry:" : "", names[i],
+               (unsigned long) ReportLe32(stage), (double) ReportLe32(stage + 4) / perMs,
+               (double) ReportLe32(stage + 8) / perMs);
+    printf("\n  telemetry: miss host %u rf %u, %u full %u part, config cached %u\n",
+           ReportLe16(counters), ReportLe16(counters + 2), ReportLe16(counters + 4), ReportLe16(counters + 6),
+           ReportLe16(counters + 8));
+    printf("  telemetry: run %lu ms stop %lu ms, wakeups nfc %u epd %u timer %u\n",
+           (unsigned long) ReportLe32(power), (unsigned long) ReportLe32(power + 4),
+           ReportLe16(power + 8), ReportLe16(power + 10), ReportLe16(power + 12));
+    printf("  telemetry: clock low %lu ms run %lu ms boost %lu ms, %lu switches\n",
+           (unsigned long) ReportLe32(power + 14), (unsigned long) ReportLe32(power + 18),
+           (unsigned long) ReportLe32(power + 22), (unsigned long) ReportLe32(power + 26));
+}
+
+/* The reader side of frame_link: resend what the card reports missing */
+static void ReaderReply(const uint8_t *pData, uint16_t Length)
+{
+    uint16_t seq;
+
+    if (Length == EPD_PART_REPORT_SIZE && pData[0] == 'P')
+    {
+        PolicyReport(pData);
+        return;
+    }
+    if (Length == TELEMETRY_REPORT_SIZE && pData[0] == 'M')
+    {
+        TelemetryReport(pData);
+        return;
+    }
+    if (Length == DELTA_REPLY_SIZE && pData[0] == 'F')
+    {
+        printf("  frame: id %08lx, delta status %u\n", (unsigned long) ReportLe32(pData + 4), pData[1]);
+        return;
+    }
+    if (Length == UPDATE_REPLY_SIZE && pData[0] == 'V')
+    {
+        printf("  firmware: running %lu bytes crc %08lx, update status %u, seq %u, %lu bytes written\n",
+               (unsigned long) ReportLe32(pData + 8), (unsigned long) ReportLe32(pData + 12), pData[1],
+               ReportLe16(pData + 2), (unsigned long) ReportLe32(pData + 4));
+        return;
+    }
+    if (Length != LINK_ACK_SIZE || pData[0] != 'A')
+        return;
+
+    LinkStatus = pData[1];
+    LinkRounds++;
+    if (LinkStatus == LINK_STATUS_DONE || LinkRounds > SIM_LINK_ROUNDS)
+        return;
+
+    /* Also covers a lost start message: the card is idle and knows no chunks */
+    if (LinkStatus != LINK_STATUS_RECEIVING)
+    {
+        LinkQueueAll();
+        return;
+    }
+
+    for (seq = 0; seq < pData[2] && seq + 1 < LinkCount; seq++)
+    {
+        if (!(pData[3 + seq / 8] & (1 << (seq % 8))))
+            SimReaderQueue(LinkMessages[1 + seq], LinkSizes[1 + seq]);
+    }
+    SimReaderQueue(Query, sizeof(Query));
+}
+
+static int32_t QueueFile(const uint8_t *pData, int32_t Size)
+{
+    static uint8_t encoded[FRAME_GRAY_ENCODE_MAX];
+    int32_t at;
+
+    LinkCount = 0;
+    LinkRounds = 0;
+    LinkStatus = LINK_STATUS_IDLE;
+
+    if (Size == FRAME_RAW_SIZE)
+    {
+        Size = FrameEncodeBest(pData, encoded);
+        pData = encoded;
+    } else if (Size == FRAME_GRAY_SIZE)
+    {
+        Size = FrameEncodeGray(pData, encoded);
+        pData = encoded;
+    }
+
+    if (Size > FRAME_HEADER_SIZE && pData[0] == FRAME_MAGIC)
+    {
+        SimReaderQueue(pData, FRAME_HEADER_SIZE);
+        for (at = FRAME_HEADER_SIZE; at < Size; at += FRAME_CHUNK_MAX)
+            SimReaderQueue(pData + at, Size - at < FRAME_CHUNK_MAX ? Size - at : FRAME_CHUNK_MAX);
+        return 0;
+    }
+
+    for (at = 0; at < Size; at += 1 + pData[at] + 1)
+    {
+        if (at + 1 + pData[at] + 1 > Size || LinkCount == SIM_MESSAGES_MAX)
+            return -1;
+        LinkMessages[LinkCount] = pData + at + 1;
+        LinkSizes[LinkCount++] = pData[at] + 1;
+    }
+    if (LinkCount == 0)
+        return -1;
+
+    /* Plain message files go out as they are, transfers get their ACK loop */
+    if (LinkMessages[0][0] == 'T' && LinkSizes[0] == LINK_START_SIZE)
+    {
+        LinkQueueAll();
+    } else
+    {
+        for (at = 0; at < LinkCount; at++)
+            SimReaderQueue(LinkMessages[at], LinkSizes[at]);
+        if (LinkMessages[0][0] == 'X' && LinkSizes[0] >= DELTA_START_SIZE)
+            SimReaderQueue(DeltaQuery, sizeof(DeltaQuery));
+    }
+    return 0;
+}
+
+static int32_t ReadFile(const char *pName, uint8_t *pData)
+{
+    FILE *f = strcmp(pName, "-") == 0 ? stdin : fopen(pName, "rb");
+    int32_t size;
+
+    if (f == NULL)
+        return -1;
+    size = (int32_t) fread(pData, 1, SIM_FILE_MAX, f);
+    if (f != stdin)
+        fclose(f);
+    return size;
+}
+
+/* Everything below is counted since the start of the transfer */
+static SIM_RfStats_t RfStart;
+static EPD_MockStats_t EpdStart;
+static POWER_Stats_t PowerStart;
+static CLOCK_Stats_t ClockStart;
+static uint32_t ChargeStart;
+static uint32_t BrownoutsStart;
+
+static void Snapshot(void)
+{
+    RfStart = *SimReaderStats();
+    EpdStart = *EpdMockGetStats();
+    PowerStart = *PowerGetStats();
+    ClockStart = *ClockGetStats();
+    ChargeStart = PowerGetChargeUc();
+    BrownoutsStart = SimSupplyStats()->Brownouts;
+    SimSupplyResetMin();
+}
+
+static void Report(const char *pName)
+{
+    const SIM_RfStats_t *rf = SimReaderStats();
+    const EPD_MockStats_t *epd = EpdMockGetStats();
+    const POWER_Stats_t *power = PowerGetStats();
+    const CLOCK_Stats_t *clock = ClockGetStats();
+    uint32_t us = epd->ElapsedUs - EpdStart.ElapsedUs;
+
+    printf("\n%s: %lu.%03lu ms", pName, (unsigned long) us / 1000, (unsigned long) us % 1000);
+    if (LinkCount && LinkMessages[0][0] == 'T')
+        printf(", link %s after %u acks", LinkStatus == LINK_STATUS_DONE ? "done" : "FAILED", LinkRounds);
+    printf("\n");
+
+    /* Message rate up to the last one read, the refresh after it doesn't count */
+    if (rf->Messages != RfStart.Messages && rf->DrainedUs > EpdStart.ElapsedUs)
+        printf("  rf: %.1f messages/s\n",
+               (rf->Messages - RfStart.Messages) * 1e6 / (rf->DrainedUs - EpdStart.ElapsedUs));
+    printf("  rf: %lu messages, %lu bytes, %lu dropped, %lu replies, %lu ms on air, %lu ms on i2c\n",
+           (unsigned long) (rf->Messages - RfStart.Messages), (unsigned long) (rf->Bytes - RfStart.Bytes),
+           (unsigned long) (rf->Dropped - RfStart.Dropped), (unsigned long) (rf->Replies - RfStart.Replies),
+           (unsigned long) (rf->RfUs - RfStart.RfUs) / 1000, (unsigned long) (rf->I2cUs - RfStart.I2cUs) / 1000);
+    printf("  epd: %lu spi bytes, %lu full + %lu partial refreshes\n",
+           (unsigned long) (epd->Bytes - EpdStart.Bytes),
+           (unsigned long) (epd->FullRefreshes - EpdStart.FullRefreshes),
+           (unsigned long) (epd->PartRefreshes - EpdStart.PartRefreshes));
+    if (epd->BusyBytes != EpdStart.BusyBytes)
+        printf("  epd: %lu bytes sent while BUSY\n", (unsigned long) (epd->BusyBytes - EpdStart.BusyBytes));
+    printf("  mcu: %lu ms run, %lu ms stop, %lu uC\n",
+           (unsigned long) (power->Ms[POWER_STATE_RUN] - PowerStart.Ms[POWER_STATE_RUN]),
+           (unsigned long) (power->Ms[POWER_STATE_STOP] - PowerStart.Ms[POWER_STATE_STOP]),
+           (unsigned long) (PowerGetChargeUc() - ChargeStart));
+    printf("  clock: %lu ms low, %lu ms run, %lu ms boost, %lu switches\n",
+           (unsigned long) (clock->Ms[CLOCK_LEVEL_LOW] - ClockStart.Ms[CLOCK_LEVEL_LOW]),
+           (unsigned long) (clock->Ms[CLOCK_LEVEL_RUN] - ClockStart.Ms[CLOCK_LEVEL_RUN]),
+           (unsigned long) (clock->Ms[CLOCK_LEVEL_BOOST] - ClockStart.Ms[CLOCK_LEVEL_BOOST]),
+           (unsigned long) (clock->Switches - ClockStart.Switches));
+    if (SimConfig.HarvestUa)
+        printf("  supply: %lu mV, lowest %lu mV, %lu brownouts\n", (unsigned long) SimSupplyMv(),
+               (unsigned long) SimSupplyStats()->MinMv,
+               (unsigned long) (SimSupplyStats()->Brownouts - BrownoutsStart));
+}
+
+/* Mean reflectance of the pixels of each level, to see the LUT timings spread them */
+static void ReportGray(const uint8_t *pPlanes)
+{
+    uint32_t sum[4] = {0}, count[4] = {0};
+    uint16_t row, col, at;
+    uint8_t bit, level;
+
+    for (row = 0; row < FRAME_ROWS; row++)
+    {
+        for (col = 0; col < FRAME_ROW_BYTES * 8; col++)
+        {
+            at = row * FRAME_ROW_BYTES + col / 8;
+            bit = 0x80 >> (col % 8);
+            level = (pPlanes[at] & bit ? 2 : 0) | (pPlanes[FRAME_RAW_SIZE + at] & bit ? 1 : 0);
+            sum[level] += SimPanelPixel(row, col);
+            count[level]++;
+        }
+    }
+
+    printf("  gray:");
+    for (level = 0; level < 4; level++)
+    {
+        if (count[level])
+            printf(" %u=%lu", level, (unsigned long) (sum[level] / count[level]));
+    }
+    printf(" (0 black .. 255 white)\n");
+}
+
+/* Panel rows that don't show the frame, white pixels as 1 */
+static uint16_t PanelMismatch(const uint8_t *pFrame)
+{
+    uint16_t row, col, rows = 0;
+    uint8_t white;
+
+    for (row = 0; row < FRAME_ROWS; row++)
+    {
+        for (col = 0; col < FRAME_ROW_BYTES * 8; col++)
+        {
+            white = (pFrame[row * FRAME_ROW_BYTES + col / 8] >> (7 - col % 8)) & 1;
+            if (white != (SimPanelPixel(row, col) >= 128))
+            {
+                rows++;
+                break;
+            }
+        }
+    }
+    return rows;
+}
+
+static void FloodReport(const uint8_t *pData, int32_t Size)
+{
+    const SIM_RfStats_t *rf = SimReaderStats();
+    uint32_t chunks = rf->Messages - RfStart.Messages;
+    uint32_t us = rf->DrainedUs - EpdStart.ElapsedUs;
+    uint16_t rows;
+
+    printf("  flood: %lu chunks, %.1f chunks/s", (unsigned long) chunks, us ? chunks * 1e6 / us : 0.0);
+    if (Size != FRAME_RAW_SIZE)
+    {
+        printf("\n");
+        return;
+    }
+    rows = PanelMismatch(pData);
+    if (rows)
+    {
+        FloodFailed++;
+        printf(", FAILED: %u panel rows differ from the frame\n", rows);
+    } else
+        printf(", the panel shows the frame\n");
+}
+
+/* The firmware's main loop, until the reader is done and the panel idle */
+static void RunCard(void)
+{
+    uint32_t events;
+
+    /* Left in the bootloader by an update that failed, the card takes the next one there */
+    if (SimFlashBoot())
+        return;
+    do
+    {
+        MX_NFC_Process();
+        if (MX_NFC_IsIdle())
+            ClockSet(CLOCK_LEVEL_LOW);
+        events = PowerWaitEvent();
+        if (ClockGetLevel() == CLOCK_LEVEL_LOW)
+            ClockSet(CLOCK_LEVEL_RUN);
+        if (events & POWER_EVENT_TIMER)
+            MX_NFC_Timer();
+    } while (events);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t file[SIM_FILE_MAX];
+    uint32_t byteNs = 2000, fullMs = 2000, partMs = 300;
+    int32_t size;
+    const char *pgm = NULL;
+    FILE *uart = NULL;
+    uint32_t idleMs = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:o:i:d:e:c:f:p:g:w:u:F:x")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                byteNs = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                SimConfig.RfByteUs = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                SimConfig.RfMessageUs = strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                SimConfig.I2cByteUs = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                SimConfig.DropPercent = strtoul(optarg, NULL, 0);
+                break;
+            case 'e':
+                SimConfig.HarvestUa = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                SimConfig.CapUf = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                fullMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                partMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'g':
+                pgm = optarg;
+                break;
+            case 'w':
+                idleMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'u':
+                uart = fopen(optarg, "wb");
+                if (!uart)
+                {
+                    perror(optarg);
+                    return 1;
+                }
+                SimUartCapture(uart);
+                break;
+            case 'F':
+                size = ReadFile(optarg, file);
+                if (size < 0 || SimFlashLoad(file, size) != 0)
+                {
+                    fprintf(stderr, "%s: no firmware image that fits the slot\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'x':
+                Flood = 1;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-s spi_ns] [-r rf_us] [-o overhead_us] [-i i2c_us] [-d drop%%] [-e harvest_uA] [-c cap_uF]"
+                        " [-f full_ms] [-p part_ms] [-g out.pgm] [-w idle_ms] [-u uart.bin] [-F running.bin] [-x] <file|-> ...\n", argv[0]);
+        return 2;
+    }
+    if (Flood)
+    {
+        SimConfig.RfMessageUs = 0;
+        SimConfig.RfByteUs = 0;
+    }
+
+    srand(1);
+    EpdMockReset(byteNs, fullMs, partMs);
+    SimPanelInit();
+    SimReaderOnReply(ReaderReply);
+
+    PowerInit();
+    ClockInit();
+    MX_NFC_Init();
+    EpdInitDeferred();
+
+    for (; optind < argc; optind++)
+    {
+        size = ReadFile(argv[optind], file);
+        if (size <= 0 || QueueFile(file, size) != 0)
+        {
+            fprintf(stderr, "%s: not a frame, v1 stream or message file\n", argv[optind]);
+            return 1;
+        }
+
+        Snapshot();
+        RunCard();
+        Report(argv[optind]);
+        if (size == FRAME_GRAY_SIZE)
+            ReportGray(file);
+        if (Flood)
+            FloodReport(file, size);
+    }
+
+    if (idleMs)
+    {
+        Snapshot();
+        LinkCount = 0;
+        SimSupplyField(0);
+        SimStayUntil(SimNowUs() + idleMs * 1000);
+        RunCard();
+        Report("idle");
+    }
+
+    if (pgm && SimPanelWritePgm(pgm) != 0)
+    {
+        fprintf(stderr, "%s: write failed\n", pgm);
+        return 1;
+    }
+    if (uart)
+        fclose(uart);
+    return FloodFailed ? 1 : 0;
+}
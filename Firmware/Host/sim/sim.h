@@ -0,0 +1,105 @@
+#ifndef __SIM_H
+#define __SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Host simulator of the card. The application layer (app_nfc, image
+ * store, frame codec/link, EPD driver) is built unchanged against a fake
+ * HAL; the ST25DV and its RF reader are modelled in sim_st25dv.c and the
+ * panel by the EPD mock, sim_panel.c works out the image it shows. All
+ * time is the mock clock, in microseconds.
+ */
+
+#define SIM_NEVER           0xFFFFFFFFUL
+#define SIM_MESSAGE_MAX     256
+#define SIM_QUEUE_SIZE      512
+#define SIM_EEPROM_SIZE     8192    // ST25DV64K
+#define SIM_NVM_WRITE_US    3200    // data EEPROM word, erase and program
+#define SIM_FLASH_ERASE_US  3200    // program memory page
+#define SIM_FLASH_WRITE_US  3200    // program memory half page
+
+typedef struct
+{
+    uint32_t RfByteUs;          // RF time per mailbox byte
+    uint32_t RfMessageUs;       // reader turnaround per message
+    uint32_t I2cByteUs;         // I2C time per byte
+    uint32_t EepromBlockUs;     // programming time per 4-byte EEPROM block
+    uint32_t DropPercent;       // RF messages lost on the way in
+    uint32_t HarvestUa;         // energy harvesting current with a field, 0 for an ideal supply
+    uint32_t CapUf;             // storage capacitor on VDD
+    uint32_t EpdUa;             // panel draw while it refreshes
+} SIM_Config_t;
+
+typedef struct
+{
+    uint32_t Messages;
+    uint32_t Bytes;
+    uint32_t Dropped;
+    uint32_t Replies;
+    uint32_t RfUs;
+    uint32_t I2cUs;
+    uint32_t DrainedUs;         // when the last message was read out of the mailbox
+} SIM_RfStats_t;
+
+typedef struct
+{
+    uint32_t MinMv;
+    uint32_t Brownouts;         // times VDD fell under SIM_BROWNOUT_MV
+} SIM_SupplyStats_t;
+
+#define SIM_SUPPLY_MV       3000    // the harvester output clamps here
+#define SIM_BROWNOUT_MV     1800
+
+typedef void (*SIM_ReplyHandler_t)(const uint8_t *pData, uint16_t Length);
+
+extern SIM_Config_t SimConfig;
+
+uint32_t SimNowUs(void);
+void SimRun(uint32_t Us);
+void SimIdle(uint32_t Us);
+uint32_t SimStopUs(void);
+uint8_t SimStopped(void);
+void SimStayUntil(uint32_t Us);
+
+/* No GPO interrupt while the bootloader polls the mailbox */
+void SimGpoMask(uint8_t Masked);
+
+/* Run current at the clock level the card is at */
+uint32_t SimClockUa(void);
+
+void SimReaderQueue(const uint8_t *pData, uint16_t Length);
+void SimReaderQueueFront(const uint8_t *pData, uint16_t Length);
+void SimReaderOnReply(SIM_ReplyHandler_t Handler);
+uint32_t SimReaderNextUs(void);
+uint8_t SimReaderArrive(void);
+const SIM_RfStats_t *SimReaderStats(void);
+
+uint32_t SimI2cNextUs(void);
+void SimI2cComplete(void);
+
+/* VDD with SimConfig.HarvestUa set, charged while the reader's field is on */
+void SimSupplyField(uint8_t On);
+uint8_t SimSupplyFieldOn(void);
+uint32_t SimSupplyMv(void);
+const SIM_SupplyStats_t *SimSupplyStats(void);
+void SimSupplyResetMin(void);
+
+/* An image for the application region, as its .bin holds it. 0, or -1 if it doesn't fit */
+int32_t SimFlashLoad(const uint8_t *pData, uint32_t Size);
+
+/* The bootloader, if the NVM state asks for it as at a reset. 1 while the card stays in it */
+uint8_t SimFlashBoot(void);
+
+/* Bytes the card sends on USART1, for log-decode */
+void SimUartCapture(FILE *pFile);
+
+/* Panel image from the LUT and RAM the driver sends, 0 black .. 255 white */
+#define SIM_PANEL_RATE      0.05    // of the way to black or white per VSL or VSH frame
+
+void SimPanelInit(void);
+uint8_t SimPanelPixel(uint8_t Row, uint8_t Col);
+int32_t SimPanelWritePgm(const char *pName);
+
+#endif
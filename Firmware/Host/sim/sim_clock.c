@@ -0,0 +1,62 @@
+#include "sim.h"
+#include "clock.h"
+
+/*
+ * clock.h on the simulator clock. Only the level is kept, to charge run
+ * time and current to it: the mock costs the same time at every level,
+ * so transfer times read as if at CLOCK_LEVEL_RUN. STOP time is the
+ * simulator's own, ClockStop() and ClockResume() have nothing to do.
+ */
+
+static const uint32_t LevelUa[CLOCK_LEVELS] = {CLOCK_BUDGET_LOW_UA, CLOCK_BUDGET_RUN_UA, CLOCK_BUDGET_BOOST_UA};
+
+static CLOCK_Stats_t Stats;
+static uint32_t LevelUs[CLOCK_LEVELS];
+static uint8_t ClockLevel = CLOCK_LEVEL_RUN;
+static uint32_t RunAtUs = 0;
+
+static void ClockSettle(void)
+{
+    uint32_t run = SimNowUs() - SimStopUs();
+
+    LevelUs[ClockLevel] += run - RunAtUs;
+    RunAtUs = run;
+}
+
+void ClockInit(void)
+{
+    ClockLevel = CLOCK_LEVEL_RUN;
+    RunAtUs = SimNowUs() - SimStopUs();
+}
+
+uint8_t ClockSet(uint8_t Level)
+{
+    uint8_t from = ClockLevel;
+
+    if (!CLOCK_GOVERNOR || Level == from)
+        return from;
+    ClockSettle();
+    ClockLevel = Level;
+    Stats.Switches++;
+    return from;
+}
+
+uint8_t ClockGetLevel(void)
+{
+    return ClockLevel;
+}
+
+const CLOCK_Stats_t *ClockGetStats(void)
+{
+    uint8_t i;
+
+    ClockSettle();
+    for (i = 0; i < CLOCK_LEVELS; i++)
+        Stats.Ms[i] = LevelUs[i] / 1000;
+    return &Stats;
+}
+
+uint32_t SimClockUa(void)
+{
+    return LevelUa[ClockLevel];
+}
@@ -0,0 +1,161 @@
+#include "sim.h"
+#include "boot.h"
+#include "fw_flash.h"
+#include "nvm.h"
+#include "clock.h"
+#include "nfc04a1_nfctag.h"
+#include <string.h>
+
+/*
+ * fw_flash.h on a RAM application region, erased to 0 like the part's
+ * flash. A half page programmed over anything but an erased one fails,
+ * as NOTZEROERR would. The hand-over runs the bootloader's loop
+ * (Boot/boot_receive.c) right there, on the same tag model, and prints
+ * what it left: the rest of the card carries on as it was, where the
+ * real one starts over. A bootloader left without an image gives up when
+ * the reader has nothing more to send, and takes the next file.
+ */
+
+extern UPDATE_Transfer_t fwUpdate;
+extern void BSP_GPO_Callback(void);
+
+static uint8_t AppRegion[FW_APP_SIZE];
+static uint32_t BootSaved[UPDATE_SAVED_SIZE / 4];
+static uint32_t RunningSize;
+static uint32_t PagesErased;
+static UPDATE_Flash_t SimFlash;
+static UPDATE_Flash_t SimBootFlash;
+
+static int32_t SimFlashErase(uint32_t Offset)
+{
+    if (Offset % UPDATE_PAGE_SIZE || Offset + UPDATE_PAGE_SIZE > FW_APP_SIZE)
+        return -1;
+    SimRun(SIM_FLASH_ERASE_US);
+    memset(AppRegion + Offset, 0, UPDATE_PAGE_SIZE);
+    PagesErased++;
+    return 0;
+}
+
+static int32_t SimFlashProgram(uint32_t Offset, const uint32_t *pWords)
+{
+    uint32_t i;
+
+    if (Offset % UPDATE_HALF_PAGE_SIZE || Offset + UPDATE_HALF_PAGE_SIZE > FW_APP_SIZE)
+        return -1;
+    for (i = 0; i < UPDATE_HALF_PAGE_SIZE; i++)
+        if (AppRegion[Offset + i])
+            return -1;
+    SimRun(SIM_FLASH_WRITE_US);
+    memcpy(AppRegion + Offset, pWords, UPDATE_HALF_PAGE_SIZE);
+    return 0;
+}
+
+int32_t SimFlashLoad(const uint8_t *pData, uint32_t Size)
+{
+    if (Size > FW_APP_SIZE)
+        return -1;
+    memset(AppRegion, 0, sizeof(AppRegion));
+    memcpy(AppRegion, pData, Size);
+    RunningSize = Size;
+    return 0;
+}
+
+const UPDATE_Flash_t *FwFlashGet(void)
+{
+    SimFlash.pRunning = AppRegion;
+    SimFlash.RunningSize = RunningSize;
+    SimFlash.RegionSize = FW_APP_SIZE;
+    SimFlash.pSaved = NULL;
+    SimFlash.Erase = NULL;
+    SimFlash.Program = NULL;
+    return &SimFlash;
+}
+
+const UPDATE_Flash_t *BootFlashGet(void)
+{
+    SimBootFlash.pRunning = AppRegion;
+    SimBootFlash.RunningSize = NvmRead(NVM_FW_STATE) == FW_STATE_RECEIVE ? NvmRead(NVM_FW_SIZE) : 0;
+    SimBootFlash.RegionSize = FW_APP_SIZE;
+    SimBootFlash.pSaved = BootSaved;
+    SimBootFlash.Erase = SimFlashErase;
+    SimBootFlash.Program = SimFlashProgram;
+    return &SimBootFlash;
+}
+
+uint16_t BootMailboxRead(uint8_t *pData)
+{
+    ST25DV_MB_CTRL_DYN_STATUS ctrl;
+    uint8_t last;
+
+    if (NFC04A1_NFCTAG_ReadMBCtrl_Dyn(NFC04A1_NFCTAG_INSTANCE, &ctrl) != NFCTAG_OK || !ctrl.RfPutMsg ||
+        NFC04A1_NFCTAG_ReadMBLength_Dyn(NFC04A1_NFCTAG_INSTANCE, &last) != NFCTAG_OK ||
+        NFC04A1_NFCTAG_ReadMailboxData(NFC04A1_NFCTAG_INSTANCE, pData, 0, last + 1) != NFCTAG_OK)
+        return 0;
+    return last + 1;
+}
+
+void BootMailboxWrite(const uint8_t *pData, uint16_t Length)
+{
+    NFC04A1_NFCTAG_WriteMailboxData(NFC04A1_NFCTAG_INSTANCE, pData, Length);
+}
+
+uint8_t BootPause(void)
+{
+    if (SimReaderNextUs() == SIM_NEVER)
+        return 0;
+    SimRun(BOOT_POLL_MS * 1000);
+    return 1;
+}
+
+static uint32_t SimFlashCrc(const uint8_t *pData, uint32_t Size)
+{
+    uint32_t crc = 0;
+    uint16_t length;
+
+    for (; Size; Size -= length, pData += length)
+    {
+        length = Size > 0x8000 ? 0x8000 : (uint16_t) Size;
+        crc = FrameCrc32(crc, pData, length);
+    }
+    return crc;
+}
+
+uint8_t SimFlashBoot(void)
+{
+    if (NvmRead(NVM_FW_STATE) == FW_STATE_NONE)
+        return 0;
+
+    /* On the reset clock */
+    printf("  firmware: bootloader, state %lu\n", (unsigned long) NvmRead(NVM_FW_STATE));
+    ClockSet(CLOCK_LEVEL_RUN);
+    SimGpoMask(1);
+    PagesErased = 0;
+    if (BootReceive())
+    {
+        RunningSize = NvmRead(NVM_FW_SIZE);
+        printf("  firmware: installed %lu bytes, crc %08lx, %lu pages rewritten\n", (unsigned long) RunningSize,
+               (unsigned long) SimFlashCrc(AppRegion, RunningSize), (unsigned long) PagesErased);
+    } else if (NvmRead(NVM_FW_STATE) != FW_STATE_NONE)
+    {
+        printf("  firmware: bootloader left waiting for an image, %lu pages rewritten\n",
+               (unsigned long) PagesErased);
+        return 1;
+    }
+    /* The application looks at the mailbox once as it starts, see MX_NFC4_MAILBOX_Init() */
+    SimGpoMask(0);
+    BSP_GPO_Callback();
+    UpdateInit(&fwUpdate, FwFlashGet());
+    return 0;
+}
+
+void FwFlashReceive(const uint8_t *pStart)
+{
+    uint8_t i;
+
+    NvmWrite(NVM_FW_SIZE, RunningSize);
+    for (i = 0; i < UPDATE_START_SIZE / 4; i++)
+        NvmWrite(NVM_FW_START + i, pStart[i * 4] | (pStart[i * 4 + 1] << 8) | ((uint32_t) pStart[i * 4 + 2] << 16) |
+                                   ((uint32_t) pStart[i * 4 + 3] << 24));
+    NvmWrite(NVM_FW_STATE, FW_STATE_RECEIVE);
+    SimFlashBoot();
+}
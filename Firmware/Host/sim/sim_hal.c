@@ -0,0 +1,118 @@
+#include "sim.h"
+#include "stm32l0xx_hal.h"
+#include "epd_transport.h"
+#include "nvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+GPIO_TypeDef SimGpioA = {0};
+GPIO_TypeDef SimGpioB = {1};
+SCB_Type SimScb = {0};
+UART_HandleTypeDef huart1 = {1};
+
+static FILE *UartCapture = NULL;
+
+uint32_t SystemCoreClock = 16000000;
+
+/* Microseconds spent in STOP, the rest of the mock clock counts as run time */
+static uint32_t StopUs = 0;
+static uint8_t Stopped = 0;
+
+uint32_t SimNowUs(void)
+{
+    return EpdMockGetStats()->ElapsedUs;
+}
+
+void SimRun(uint32_t Us)
+{
+    EpdMockIdle(Us);
+}
+
+void SimIdle(uint32_t Us)
+{
+    Stopped = 1;
+    EpdMockIdle(Us);
+    Stopped = 0;
+    StopUs += Us;
+}
+
+uint32_t SimStopUs(void)
+{
+    return StopUs;
+}
+
+uint8_t SimStopped(void)
+{
+    return Stopped;
+}
+
+/* nvm.h on a RAM copy of the data EEPROM: it stays for the run, like across a power cycle */
+static uint32_t Nvm[NVM_WORDS];
+
+uint32_t NvmRead(uint8_t Word)
+{
+    return Nvm[Word];
+}
+
+HAL_StatusTypeDef NvmWrite(uint8_t Word, uint32_t Value)
+{
+    if (Nvm[Word] != Value)
+    {
+        SimRun(SIM_NVM_WRITE_US);
+        Nvm[Word] = Value;
+    }
+    return HAL_OK;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    UNUSED(GPIOx);
+    UNUSED(GPIO_Pin);
+    UNUSED(PinState);
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    UNUSED(GPIOx);
+    UNUSED(GPIO_Pin);
+    return GPIO_PIN_RESET;
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+    SimRun(Delay * 1000);
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return SimNowUs() / 1000;
+}
+
+SysTick_Type *SimSysTick(void)
+{
+    static SysTick_Type tick;
+    uint32_t perUs = SystemCoreClock / 1000000;
+
+    tick.LOAD = SystemCoreClock / 1000 - 1;
+    tick.VAL = tick.LOAD - (SimNowUs() % 1000) * perUs;
+    return &tick;
+}
+
+void SimUartCapture(FILE *pFile)
+{
+    UartCapture = pFile;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+    if (UartCapture)
+        fwrite(pData, 1, Size, UartCapture);
+    HAL_UART_TxCpltCallback(huart);
+    return HAL_OK;
+}
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "Error_Handler called\n");
+    exit(1);
+}
@@ -0,0 +1,159 @@
+#include "sim.h"
+#include "epd_w21.h"
+#include <stdio.h>
+#include <math.h>
+
+/*
+ * What the panel would look like. Follows the controller commands the EPD
+ * mock sees: RAM window, pointer and writes (0x44, 0x45, 0x4E, 0x4F, 0x24),
+ * the waveform LUT (0x32) and display updates (0x22, 0x20). An update runs
+ * the LUT on every pixel, selected by its previous and new RAM bit; each
+ * frame of VSL moves the reflectance SIM_PANEL_RATE of the way to black,
+ * each frame of VSH the same way to white. That is enough to tell how far
+ * apart the gray levels of a LUT sequence land, not what the ink does.
+ */
+
+#define SIM_PANEL_PHASES    20
+#define SIM_PANEL_LUT_SIZE  30
+
+static uint8_t Ram[yDot][EPD_ROW_BYTES];
+static uint8_t Old[yDot][EPD_ROW_BYTES];
+static double Reflectance[yDot][xDot];
+static uint8_t Lut[SIM_PANEL_LUT_SIZE];
+
+static uint8_t Command;
+static uint8_t Param[SIM_PANEL_LUT_SIZE];
+static uint8_t Count;
+static uint8_t Sequence;
+static uint8_t XStart, XEnd, X;
+static uint16_t YStart, YEnd, Y;
+
+/* An update is affine on the reflectance, R' = Scale * R + Offset, per transition */
+static void Update(void)
+{
+    double scale[4], offset[4], keep;
+    uint8_t t, phase, vs, frames, bit;
+    uint16_t y, x;
+
+    for (t = 0; t < 4; t++)
+    {
+        scale[t] = 1;
+        offset[t] = 0;
+        for (phase = 0; phase < SIM_PANEL_PHASES; phase++)
+        {
+            vs = (Lut[phase] >> (6 - 2 * t)) & 3;
+            frames = (Lut[SIM_PANEL_PHASES + phase / 2] >> (phase % 2 ? 4 : 0)) & 0x0F;
+            keep = pow(1 - SIM_PANEL_RATE, frames);
+            if (vs == 2)            // VSL, towards black
+            {
+                scale[t] *= keep;
+                offset[t] *= keep;
+            } else if (vs == 1)     // VSH, towards white
+            {
+                scale[t] *= keep;
+                offset[t] = offset[t] * keep + 1 - keep;
+            }
+        }
+    }
+
+    for (y = 0; y < yDot; y++)
+    {
+        for (x = 0; x < xDot; x++)
+        {
+            bit = 0x80 >> (x % 8);
+            t = (Old[y][x / 8] & bit ? 2 : 0) | (Ram[y][x / 8] & bit ? 1 : 0);
+            // frame row 0 is gate yDot - 1
+            Reflectance[yDot - 1 - y][x] = scale[t] * Reflectance[yDot - 1 - y][x] + offset[t];
+        }
+    }
+
+    for (y = 0; y < yDot; y++)
+        for (x = 0; x < EPD_ROW_BYTES; x++)
+            Old[y][x] = Ram[y][x];
+}
+
+/* X increments, Y decrements, as the driver sets the data entry mode */
+static void WriteRam(uint8_t Value)
+{
+    if (Y < yDot && X < EPD_ROW_BYTES)
+        Ram[Y][X] = Value;
+
+    if (X++ == XEnd)
+    {
+        X = XStart;
+        Y = Y == YEnd ? YStart : Y - 1;
+    }
+}
+
+static void Observe(uint8_t IsData, uint8_t Value)
+{
+    if (!IsData)
+    {
+        Command = Value;
+        Count = 0;
+        if (Command == 0x20 && (Sequence & 0x04))
+            Update();
+        return;
+    }
+
+    if (Command == 0x24)
+    {
+        WriteRam(Value);
+        return;
+    }
+    if (Count < sizeof(Param))
+        Param[Count++] = Value;
+
+    switch (Command)
+    {
+        case 0x32:
+            Lut[Count - 1] = Value;
+            break;
+        case 0x22:
+            Sequence = Value;
+            break;
+        case 0x44:
+            XStart = Param[0];
+            XEnd = Param[1];
+            break;
+        case 0x45:
+            YStart = Param[0] | (Count > 1 ? Param[1] << 8 : 0);
+            YEnd = Count > 3 ? Param[2] | (Param[3] << 8) : YEnd;
+            break;
+        case 0x4E:
+            X = Param[0];
+            break;
+        case 0x4F:
+            Y = Param[0] | (Count > 1 ? Param[1] << 8 : 0);
+            break;
+    }
+}
+
+void SimPanelInit(void)
+{
+    uint16_t y, x;
+
+    for (y = 0; y < yDot; y++)
+        for (x = 0; x < xDot; x++)
+            Reflectance[y][x] = 1;
+    EpdMockSetObserver(Observe);
+}
+
+uint8_t SimPanelPixel(uint8_t Row, uint8_t Col)
+{
+    return (uint8_t) (Reflectance[Row][Col] * 255 + 0.5);
+}
+
+int32_t SimPanelWritePgm(const char *pName)
+{
+    FILE *f = fopen(pName, "wb");
+    uint16_t y, x;
+
+    if (f == NULL)
+        return -1;
+    fprintf(f, "P5\n%d %d\n255\n", xDot, yDot);
+    for (y = 0; y < yDot; y++)
+        for (x = 0; x < xDot; x++)
+            fputc(SimPanelPixel(y, x), f);
+    return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,281 @@
+#include "sim.h"
+#include "power.h"
+#include "epd_w21.h"
+#include "clock.h"
+
+/*
+ * power.h on the simulator clock. Waiting for an event skips straight to
+ * the next reader message, the end of BUSY or the wakeup timer and counts
+ * that time as STOP; everything else the mock clock advances by is RUN.
+ * The GPO and I2C interrupts are also taken while the card runs, whenever
+ * the clock passes them (see SimClock()).
+ *
+ * With SimConfig.HarvestUa set VDD is the storage capacitor, charged by
+ * the harvester while the field is on and drained by the power budget of
+ * the state and clock level the card is in, plus the panel while it
+ * refreshes.
+ */
+
+extern void BSP_GPO_Callback(void);
+
+static volatile uint32_t Events = 0;
+static POWER_Stats_t Stats;
+static uint32_t TimerPeriodUs = 0;
+static uint32_t TimerDueUs = SIM_NEVER;
+static uint32_t AwakeUntilUs = 0;
+static uint8_t GpoMasked = 0;
+
+static uint8_t SupplyField = 1;
+static uint32_t SupplyAtUs = 0;
+static double SupplyMv = SIM_SUPPLY_MV;
+static SIM_SupplyStats_t SupplyStats = {SIM_SUPPLY_MV, 0};
+
+static void SimClock(uint32_t Us);
+
+void PowerInit(void)
+{
+    Events = 0;
+    TimerPeriodUs = 0;
+    TimerDueUs = SIM_NEVER;
+    EpdMockSetClock(SimClock);
+}
+
+void PowerNotify(uint32_t Set)
+{
+    Events |= Set;
+}
+
+void PowerSetWakeupTimer(uint32_t Ms)
+{
+    TimerPeriodUs = Ms * 1000;
+    TimerDueUs = Ms ? SimNowUs() + TimerPeriodUs : SIM_NEVER;
+}
+
+/* Nothing to halt here, background I2C runs on the simulator clock */
+void PowerHold(void)
+{
+}
+
+void PowerRelease(void)
+{
+}
+
+void PowerRtcIRQHandler(void)
+{
+    PowerNotify(POWER_EVENT_TIMER);
+}
+
+/* Keeps the run going until Us even with nothing but the wakeup timer left */
+void SimStayUntil(uint32_t Us)
+{
+    AwakeUntilUs = Us;
+}
+
+void SimGpoMask(uint8_t Masked)
+{
+    GpoMasked = Masked;
+}
+
+/* Raises the GPO for a reader message that is due, like the EXTI would */
+static uint8_t SimDeliver(void)
+{
+    if (SimReaderNextUs() > SimNowUs())
+        return 0;
+    if (SimReaderArrive() && !GpoMasked)
+        BSP_GPO_Callback();
+    return 1;
+}
+
+/* Charge in and out of the capacitor up to Us, in the state the card is in now */
+static void SimSupply(uint32_t Us)
+{
+    double ua = SupplyField ? SimConfig.HarvestUa : 0;
+    double wasMv = SupplyMv;
+
+    /* Interrupts taken on the way move the clock again, up to where it is already counted */
+    if (Us <= SupplyAtUs)
+        return;
+    ua -= SimStopped() ? POWER_BUDGET_STOP_UA : SimClockUa();
+    if (EpdMockIO.ReadBusy())
+        ua -= SimConfig.EpdUa;
+
+    /* uA x us / uF is pV, a thousandth of a mV */
+    SupplyMv += ua * (Us - SupplyAtUs) / SimConfig.CapUf / 1000;
+    SupplyAtUs = Us;
+    if (SupplyMv > SIM_SUPPLY_MV)
+        SupplyMv = SIM_SUPPLY_MV;
+    if (SupplyMv < 0)
+        SupplyMv = 0;
+
+    if (SupplyMv < SupplyStats.MinMv)
+        SupplyStats.MinMv = (uint32_t) SupplyMv;
+    if (SupplyMv < SIM_BROWNOUT_MV && wasMv >= SIM_BROWNOUT_MV)
+        SupplyStats.Brownouts++;
+}
+
+void SimSupplyField(uint8_t On)
+{
+    SupplyField = On;
+}
+
+uint8_t SimSupplyFieldOn(void)
+{
+    return SupplyField;
+}
+
+uint32_t SimSupplyMv(void)
+{
+    return (uint32_t) SupplyMv;
+}
+
+const SIM_SupplyStats_t *SimSupplyStats(void)
+{
+    return &SupplyStats;
+}
+
+void SimSupplyResetMin(void)
+{
+    SupplyStats.MinMv = (uint32_t) SupplyMv;
+}
+
+/* The mock clock is about to move on to Us: take the interrupts due on the way, each on time */
+static void SimClock(uint32_t Us)
+{
+    static uint8_t inInterrupt = 0;
+    uint32_t next;
+
+    if (SimConfig.HarvestUa)
+        SimSupply(Us);
+    if (inInterrupt)
+        return;
+    inInterrupt = 1;
+    for (;;)
+    {
+        next = SimReaderNextUs() < SimI2cNextUs() ? SimReaderNextUs() : SimI2cNextUs();
+        if (next > Us)
+            break;
+        if (next > SimNowUs())
+            EpdMockIdle(next - SimNowUs());
+        if (SimI2cNextUs() <= SimNowUs())
+            SimI2cComplete();
+        else
+            SimDeliver();
+    }
+    inInterrupt = 0;
+}
+
+uint32_t PowerSleep(void)
+{
+    uint32_t now = SimNowUs();
+    uint32_t next = SimReaderNextUs();
+    uint32_t step;
+
+    if (SimI2cNextUs() <= now)
+    {
+        SimI2cComplete();
+        return 0;
+    }
+
+    if (SimDeliver())
+        return 0;
+
+    if (EpdIsBusy() && !EpdMockIO.ReadBusy())
+    {
+        PowerNotify(POWER_EVENT_EPD);
+        return 0;
+    }
+
+    if (TimerDueUs <= now)
+    {
+        TimerDueUs += TimerPeriodUs;
+        PowerRtcIRQHandler();
+        return 0;
+    }
+
+    if (SimI2cNextUs() < next)
+        next = SimI2cNextUs();
+
+    /* Nothing left to wake up for, the wakeup timer alone doesn't keep the run going */
+    if (next == SIM_NEVER && !EpdIsBusy() && now >= AwakeUntilUs)
+        return 0;
+
+    step = next - now;
+    if (AwakeUntilUs > now && AwakeUntilUs - now < step)
+        step = AwakeUntilUs - now;
+    if (EpdIsBusy() && step > 1000)
+        step = 1000;
+    if (TimerDueUs - now < step)
+        step = TimerDueUs - now;
+
+    Stats.Entries[POWER_STATE_STOP]++;
+    SimIdle(step);
+    return step / 1000;
+}
+
+/* Returns 0 once the reader has nothing left to send and the panel is idle */
+uint32_t PowerWaitEvent(void)
+{
+    uint32_t events;
+
+    while (!Events)
+    {
+        if (SimReaderNextUs() == SIM_NEVER && SimI2cNextUs() == SIM_NEVER && !EpdIsBusy() &&
+            SimNowUs() >= AwakeUntilUs)
+            break;
+        PowerSleep();
+    }
+
+    events = Events;
+    Events = 0;
+    if (events & POWER_EVENT_NFC)
+        Stats.Wakeups[0]++;
+    if (events & POWER_EVENT_EPD)
+        Stats.Wakeups[1]++;
+    if (events & POWER_EVENT_TIMER)
+        Stats.Wakeups[2]++;
+    return events;
+}
+
+uint32_t PowerGetTime(void)
+{
+    return SimNowUs() / 1000;
+}
+
+const POWER_Stats_t *PowerGetStats(void)
+{
+    Stats.Ms[POWER_STATE_STOP] = SimStopUs() / 1000;
+    Stats.Ms[POWER_STATE_RUN] = (SimNowUs() - SimStopUs()) / 1000;
+    return &Stats;
+}
+
+uint32_t PowerGetChargeUc(void)
+{
+    const POWER_Stats_t *stats = PowerGetStats();
+    const CLOCK_Stats_t *clock = ClockGetStats();
+
+    return (uint32_t) (((uint64_t) clock->Ms[CLOCK_LEVEL_LOW] * CLOCK_BUDGET_LOW_UA +
+                        (uint64_t) clock->Ms[CLOCK_LEVEL_RUN] * CLOCK_BUDGET_RUN_UA +
+                        (uint64_t) clock->Ms[CLOCK_LEVEL_BOOST] * CLOCK_BUDGET_BOOST_UA +
+                        (uint64_t) stats->Ms[POWER_STATE_STOP] * POWER_BUDGET_STOP_UA) / 1000);
+}
+
+/* Stays at SIM_SUPPLY_MV without SimConfig.HarvestUa */
+uint16_t PowerGetVddMv(void)
+{
+    return (uint16_t) SupplyMv;
+}
+
+void PowerNap(uint32_t Ms)
+{
+    Stats.Entries[POWER_STATE_STOP]++;
+    SimIdle(Ms * 1000);
+}
+
+/* Blocking BUSY waits sleep too, and keep serving the reader meanwhile */
+unsigned long EpdBusyWait(void)
+{
+    SimI2cComplete();
+    SimDeliver();
+    SimIdle(1000);
+    return 1;
+}
@@ -0,0 +1,437 @@
+#include "sim.h"
+#include "nfc04a1_nfctag.h"
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * ST25DV model: a one-message mailbox between the reader (RF) and the card
+ * (I2C), plus the user EEPROM and the static registers the card sets. The
+ * reader sends its queue one message at a time, each one landing
+ * RfMessageUs + RfByteUs per byte after the mailbox was freed. Card
+ * replies are read back by the reader right away.
+ */
+
+typedef struct
+{
+    uint16_t Length;
+    uint8_t Data[SIM_MESSAGE_MAX];
+} SIM_Message_t;
+
+static SIM_Message_t Queue[SIM_QUEUE_SIZE];
+static uint16_t QueueHead = 0;
+static uint16_t QueueCount = 0;
+
+static SIM_Message_t Mailbox;
+static uint8_t MailboxFull = 0;
+static uint8_t RfMissed = 0;
+static uint32_t NextUs = SIM_NEVER;
+static uint32_t ReaderFreeUs = 0;
+static SIM_ReplyHandler_t ReplyHandler = NULL;
+static SIM_RfStats_t RfStats;
+
+static uint8_t Eeprom[SIM_EEPROM_SIZE];
+
+/* Static registers the card sets, from the factory defaults; each write programs a block */
+static ST25DV_EH_MODE_STATUS EhMode = ST25DV_EH_ON_DEMAND;
+static ST25DV_EN_STATUS MbMode = ST25DV_DISABLE;
+static uint16_t GpoConfig = 0x88;
+static ST25DV_EN_STATUS MbEnabled = ST25DV_DISABLE;
+
+/* Background mailbox read, completes at DmaDoneUs */
+static uint32_t DmaDoneUs = SIM_NEVER;
+static uint16_t DmaEnd = 0;
+
+/* Like custom_bus.c: a blocking transfer holds the bus, a DMA start then waits for it */
+static uint8_t BusHeld = 0;
+static uint8_t BusDeferred = 0;
+
+SIM_Config_t SimConfig = {
+        302,        // 26.48 kbit/s high data rate
+        2000,
+        9,          // 1 MHz Fm+
+        5000,
+        0,
+        0,
+        4700,
+        3000
+};
+
+static uint32_t RfTime(uint16_t Length)
+{
+    return SimConfig.RfMessageUs + Length * SimConfig.RfByteUs;
+}
+
+static void Schedule(void)
+{
+    uint32_t now = SimNowUs();
+
+    if (MailboxFull || QueueCount == 0 || NextUs != SIM_NEVER)
+        return;
+    NextUs = (ReaderFreeUs > now ? ReaderFreeUs : now) + RfTime(Queue[QueueHead].Length);
+}
+
+static void MailboxRelease(uint16_t End)
+{
+    /* Reading up to the last byte frees the mailbox for the reader */
+    if (End == Mailbox.Length)
+    {
+        RfStats.DrainedUs = SimNowUs();
+        MailboxFull = 0;
+        RfMissed = 0;
+        Schedule();
+    }
+}
+
+uint32_t SimI2cNextUs(void)
+{
+    return DmaDoneUs;
+}
+
+void SimI2cComplete(void)
+{
+    if (DmaDoneUs > SimNowUs())
+        return;
+    DmaDoneUs = SIM_NEVER;
+    MailboxRelease(DmaEnd);
+    BSP_I2C1_RxCpltCallback(BSP_ERROR_NONE);
+}
+
+__weak void BSP_I2C1_RxCpltCallback(int32_t Status)
+{
+    UNUSED(Status);
+}
+
+__weak void BSP_I2C1_IdleCallback(void)
+{
+}
+
+static void I2cTime(uint16_t Length)
+{
+    uint32_t us = (Length + 3) * SimConfig.I2cByteUs;
+
+    /* Blocking transfers queue behind the DMA reads in flight, a completion may chain another */
+    while (DmaDoneUs != SIM_NEVER)
+    {
+        SimRun(DmaDoneUs - SimNowUs());
+        SimI2cComplete();
+    }
+
+    RfStats.I2cUs += us;
+    BusHeld = 1;
+    SimRun(us);
+    BusHeld = 0;
+    if (BusDeferred)
+    {
+        BusDeferred = 0;
+        BSP_I2C1_IdleCallback();
+    }
+}
+
+static uint8_t DmaStart(uint16_t Length)
+{
+    if (BusHeld || DmaDoneUs != SIM_NEVER)
+    {
+        BusDeferred = 1;
+        return 0;
+    }
+    RfStats.I2cUs += (Length + 3) * SimConfig.I2cByteUs;
+    DmaDoneUs = SimNowUs() + (Length + 3) * SimConfig.I2cByteUs;
+    return 1;
+}
+
+void SimReaderQueue(const uint8_t *pData, uint16_t Length)
+{
+    SIM_Message_t *msg;
+
+    if (QueueCount == SIM_QUEUE_SIZE || Length > SIM_MESSAGE_MAX)
+        return;
+    msg = &Queue[(QueueHead + QueueCount++) % SIM_QUEUE_SIZE];
+    msg->Length = Length;
+    memcpy(msg->Data, pData, Length);
+    Schedule();
+}
+
+void SimReaderQueueFront(const uint8_t *pData, uint16_t Length)
+{
+    if (QueueCount == SIM_QUEUE_SIZE || Length > SIM_MESSAGE_MAX)
+        return;
+    QueueHead = (QueueHead + SIM_QUEUE_SIZE - 1) % SIM_QUEUE_SIZE;
+    QueueCount++;
+    Queue[QueueHead].Length = Length;
+    memcpy(Queue[QueueHead].Data, pData, Length);
+    Schedule();
+}
+
+void SimReaderOnReply(SIM_ReplyHandler_t Handler)
+{
+    ReplyHandler = Handler;
+}
+
+uint32_t SimReaderNextUs(void)
+{
+    return NextUs;
+}
+
+/* The scheduled message reaches the tag, returns 1 if the GPO fires */
+uint8_t SimReaderArrive(void)
+{
+    SIM_Message_t *msg = &Queue[QueueHead];
+    uint8_t lost;
+
+    if (NextUs == SIM_NEVER)
+        return 0;
+
+    QueueHead = (QueueHead + 1) % SIM_QUEUE_SIZE;
+    QueueCount--;
+    ReaderFreeUs = NextUs;
+    NextUs = SIM_NEVER;
+
+    RfStats.Messages++;
+    RfStats.Bytes += msg->Length;
+    RfStats.RfUs += RfTime(msg->Length);
+
+    lost = SimConfig.DropPercent && (uint32_t) (rand() % 100) < SimConfig.DropPercent;
+    if (lost)
+    {
+        RfStats.Dropped++;
+        RfMissed = 1;
+        /* A reader waiting for an answer asks again */
+        if (msg->Data[0] == 'Q')
+            SimReaderQueueFront(msg->Data, msg->Length);
+        Schedule();
+        return 0;
+    }
+
+    Mailbox = *msg;
+    MailboxFull = 1;
+    return 1;
+}
+
+const SIM_RfStats_t *SimReaderStats(void)
+{
+    return &RfStats;
+}
+
+
+int32_t NFC04A1_NFCTAG_Init(uint32_t Instance)
+{
+    UNUSED(Instance);
+    memset(Eeprom, 0xFF, sizeof(Eeprom));
+    MbEnabled = ST25DV_DISABLE;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_GPO_Init(void)
+{
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ConfigIT(uint32_t Instance, const uint16_t ITConfig)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    SimRun(SimConfig.EepromBlockUs);
+    GpoConfig = ITConfig;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_GetITStatus(uint32_t Instance, uint16_t * const ITConfig)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    *ITConfig = GpoConfig;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadI2CSecuritySession_Dyn(uint32_t Instance, ST25DV_I2CSSO_STATUS * const pSession)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    *pSession = ST25DV_SESSION_OPEN;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_PresentI2CPassword(uint32_t Instance, const ST25DV_PASSWD PassWord)
+{
+    UNUSED(Instance);
+    UNUSED(PassWord);
+    I2cTime(17);
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadEHMode(uint32_t Instance, ST25DV_EH_MODE_STATUS * const pEH_mode)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    *pEH_mode = EhMode;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_WriteEHMode(uint32_t Instance, const ST25DV_EH_MODE_STATUS EH_mode)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    SimRun(SimConfig.EepromBlockUs);
+    EhMode = EH_mode;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_SetEHENMode_Dyn(uint32_t Instance)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadEHCtrl_Dyn(uint32_t Instance, ST25DV_EH_CTRL * const pEH_CTRL)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    pEH_CTRL->EH_EN_Mode = ST25DV_ENABLE;
+    pEH_CTRL->Field_on = SimSupplyFieldOn() ? ST25DV_ENABLE : ST25DV_DISABLE;
+    pEH_CTRL->EH_on = pEH_CTRL->Field_on;
+    pEH_CTRL->VCC_on = SimConfig.HarvestUa ? ST25DV_DISABLE : ST25DV_ENABLE;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadMBMode(uint32_t Instance, ST25DV_EN_STATUS * const pMB_mode)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    *pMB_mode = MbMode;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_WriteMBMode(uint32_t Instance, const ST25DV_EN_STATUS MB_mode)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    SimRun(SimConfig.EepromBlockUs);
+    MbMode = MB_mode;
+    return NFCTAG_OK;
+}
+
+/* Only takes with the mailbox allowed in the static MB_MODE */
+int32_t NFC04A1_NFCTAG_SetMBEN_Dyn(uint32_t Instance)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    MbEnabled = MbMode;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_GetMBEN_Dyn(uint32_t Instance, ST25DV_EN_STATUS * const pMBEN)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    *pMBEN = MbEnabled;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadMBCtrl_Dyn(uint32_t Instance, ST25DV_MB_CTRL_DYN_STATUS * const pCtrlStatus)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    memset(pCtrlStatus, 0, sizeof(*pCtrlStatus));
+    pCtrlStatus->MbEnable = 1;
+    pCtrlStatus->RfPutMsg = MailboxFull;
+    pCtrlStatus->RFMissMsg = RfMissed;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadMBLength_Dyn(uint32_t Instance, uint8_t * const pMBLength)
+{
+    UNUSED(Instance);
+    I2cTime(1);
+    *pMBLength = MailboxFull ? Mailbox.Length - 1 : 0;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadMailboxData(uint32_t Instance, uint8_t * const pData, const uint16_t TarAddr,
+                                       const uint16_t NbByte)
+{
+    UNUSED(Instance);
+    if (!MailboxFull || TarAddr + NbByte > Mailbox.Length)
+        return NFCTAG_ERROR;
+
+    I2cTime(NbByte);
+    memcpy(pData, Mailbox.Data + TarAddr, NbByte);
+    MailboxRelease(TarAddr + NbByte);
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadMailboxData_DMA(uint32_t Instance, uint8_t * const pData, const uint16_t TarAddr,
+                                           const uint16_t NbByte)
+{
+    UNUSED(Instance);
+    if (!MailboxFull || TarAddr + NbByte > Mailbox.Length || !DmaStart(NbByte))
+        return NFCTAG_ERROR;
+
+    /* The data is final already, only the completion waits for the bus */
+    memcpy(pData, Mailbox.Data + TarAddr, NbByte);
+    DmaEnd = TarAddr + NbByte;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadMBStatus_DMA(uint32_t Instance, uint8_t * const pData)
+{
+    UNUSED(Instance);
+    if (!DmaStart(2))
+        return NFCTAG_ERROR;
+
+    pData[0] = ST25DV_MB_CTRL_DYN_MBEN_MASK | (MailboxFull ? ST25DV_MB_CTRL_DYN_RFPUTMSG_MASK : 0) |
+               (RfMissed ? ST25DV_MB_CTRL_DYN_RFMISSMSG_MASK : 0);
+    pData[1] = MailboxFull ? Mailbox.Length - 1 : 0;
+    DmaEnd = 0;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_WriteMailboxData(uint32_t Instance, const uint8_t * const pData, const uint16_t NbByte)
+{
+    UNUSED(Instance);
+    if (MailboxFull || NbByte == 0 || NbByte > SIM_MESSAGE_MAX)
+        return NFCTAG_ERROR;
+
+    I2cTime(NbByte);
+    RfStats.Replies++;
+    ReaderFreeUs = SimNowUs() + RfTime(NbByte);
+    if (ReplyHandler)
+        ReplyHandler(pData, NbByte);
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadMemSize(uint32_t Instance, ST25DV_MEM_SIZE * const pSizeInfo)
+{
+    UNUSED(Instance);
+    I2cTime(3);
+    pSizeInfo->BlockSize = 3;
+    pSizeInfo->Mem_Size = SIM_EEPROM_SIZE / 4 - 1;
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_ReadData(uint32_t Instance, uint8_t * const pData, const uint16_t TarAddr, const uint16_t Size)
+{
+    UNUSED(Instance);
+    if ((uint32_t) TarAddr + Size > SIM_EEPROM_SIZE)
+        return NFCTAG_ERROR;
+
+    I2cTime(Size);
+    memcpy(pData, Eeprom + TarAddr, Size);
+    return NFCTAG_OK;
+}
+
+int32_t NFC04A1_NFCTAG_WriteData(uint32_t Instance, const uint8_t * const pData, const uint16_t TarAddr,
+                                 const uint16_t Size)
+{
+    UNUSED(Instance);
+    uint32_t blocks;
+
+    if ((uint32_t) TarAddr + Size > SIM_EEPROM_SIZE)
+        return NFCTAG_ERROR;
+
+    I2cTime(Size);
+    blocks = (TarAddr % 4 + Size + 3) / 4;
+    SimRun(blocks * SimConfig.EepromBlockUs);
+    memcpy(Eeprom + TarAddr, pData, Size);
+    return NFCTAG_OK;
+}
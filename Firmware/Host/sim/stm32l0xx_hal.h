@@ -0,0 +1,106 @@
+#ifndef __SIM_STM32L0XX_HAL_H
+#define __SIM_STM32L0XX_HAL_H
+
+/*
+ * Just enough of the STM32L0 HAL for the application layer to build on
+ * the host. Time comes from the simulator clock, pins are no-ops.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __weak      __attribute__((weak))
+#define UNUSED(X)   (void) X
+
+typedef struct
+{
+    uint32_t Id;
+} GPIO_TypeDef;
+
+typedef enum
+{
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef enum
+{
+    HAL_OK = 0,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+/* The tag is modelled above the BSP, the bus handles are only declared */
+typedef struct
+{
+    uint32_t Id;
+} I2C_HandleTypeDef;
+
+typedef struct
+{
+    uint32_t Id;
+} DMA_HandleTypeDef;
+
+/* USART1 carries the log, its TX DMA completes at once into SimUartCapture() */
+typedef struct
+{
+    uint32_t Id;
+} UART_HandleTypeDef;
+
+extern GPIO_TypeDef SimGpioA;
+extern GPIO_TypeDef SimGpioB;
+
+#define GPIOA       (&SimGpioA)
+#define GPIOB       (&SimGpioB)
+
+#define GPIO_PIN_0  ((uint16_t) 0x0001)
+#define GPIO_PIN_1  ((uint16_t) 0x0002)
+#define GPIO_PIN_2  ((uint16_t) 0x0004)
+#define GPIO_PIN_3  ((uint16_t) 0x0008)
+#define GPIO_PIN_4  ((uint16_t) 0x0010)
+#define GPIO_PIN_5  ((uint16_t) 0x0020)
+#define GPIO_PIN_6  ((uint16_t) 0x0040)
+#define GPIO_PIN_7  ((uint16_t) 0x0080)
+#define GPIO_PIN_8  ((uint16_t) 0x0100)
+
+/* SysTick at the 16 MHz core clock, VAL follows the simulator clock */
+typedef struct
+{
+    uint32_t CTRL;
+    uint32_t LOAD;
+    uint32_t VAL;
+} SysTick_Type;
+
+typedef struct
+{
+    uint32_t ICSR;
+} SCB_Type;
+
+#define SCB_ICSR_PENDSTSET_Msk  (1UL << 26)
+
+extern SCB_Type SimScb;
+extern uint32_t SystemCoreClock;
+
+SysTick_Type *SimSysTick(void);
+
+#define SysTick     (SimSysTick())
+#define SCB         (&SimScb)
+
+/* Addresses only, sim_flash.c keeps the slots fw_flash.h lays out in RAM */
+#define FLASH_BASE  0x08000000UL
+
+/* Single threaded, interrupts are never taken while code runs */
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t PriMask) { (void) PriMask; }
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_GetTick(void);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <string.h>
+#include "frame_encode.h"
+
+/*
+ * codec-test <case>
+ *
+ * frame_encode.c against the card's decoder: a frame is encoded in every
+ * format and decoded back with FrameDecode(), fed in odd message sizes,
+ * and with FrameDecodeBand(), band by band. Cases:
+ *   white, black   one long run
+ *   random         nothing to pack
+ *   rows           every row the same, only the row delta packs it
+ *   incompressible no two neighbours equal, PackBits at its worst
+ *   truncated      a stream cut short, and a header that says so
+ *   crc            a frame_link transfer with a bad chunk and a bad frame CRC
+ */
+
+static uint8_t Raw[FRAME_RAW_SIZE];
+static uint8_t Got[FRAME_RAW_SIZE];
+static uint8_t Encoded[FRAME_LINK_ENCODE_MAX];
+static int Failures;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+                                             printf(__VA_ARGS__); printf("\n"); Failures++; } } while (0)
+
+static const uint8_t Formats[4][2] = {
+        {FRAME_FORMAT_RAW, 0},
+        {FRAME_FORMAT_RAW, FRAME_FLAG_ROW_DELTA},
+        {FRAME_FORMAT_RLE, 0},
+        {FRAME_FORMAT_RLE, FRAME_FLAG_ROW_DELTA}
+};
+
+static uint32_t Random(uint32_t *pSeed)
+{
+    *pSeed = *pSeed * 1103515245u + 12345u;
+    return *pSeed >> 16;
+}
+
+static void Sink(uint16_t Offset, const uint8_t *pData, uint16_t Length)
+{
+    CHECK(Offset + Length <= FRAME_RAW_SIZE, "sink at %u + %u", Offset, Length);
+    if (Offset + Length <= FRAME_RAW_SIZE)
+        memcpy(Got + Offset, pData, Length);
+}
+
+/* The payload in messages of Chunk bytes, the status of the last one */
+static int32_t Decode(const uint8_t *pStream, int32_t Size, uint16_t Chunk)
+{
+    FRAME_Header_t header;
+    FRAME_Decoder_t dec;
+    int32_t at, status = FRAME_OK;
+    uint16_t length;
+
+    if (FrameParseHeader(pStream, FRAME_HEADER_SIZE, &header) != FRAME_OK)
+        return FRAME_ERROR;
+    FrameDecodeInit(&dec, &header, Sink);
+    for (at = FRAME_HEADER_SIZE; at < Size && status == FRAME_OK; at += length)
+    {
+        length = Size - at < Chunk ? (uint16_t) (Size - at) : Chunk;
+        status = FrameDecode(&dec, pStream + at, length);
+    }
+    return status;
+}
+
+/* Same through FrameDecodeBand(), counting the bands */
+static int32_t DecodeBands(const uint8_t *pStream, int32_t Size, uint16_t Chunk, uint16_t *pBands)
+{
+    FRAME_Header_t header;
+    FRAME_Decoder_t dec;
+    int32_t at = FRAME_HEADER_SIZE, status;
+    uint16_t length, used;
+
+    *pBands = 0;
+    if (FrameParseHeader(pStream, FRAME_HEADER_SIZE, &header) != FRAME_OK)
+        return FRAME_ERROR;
+    FrameDecodeInit(&dec, &header, Sink);
+    do
+    {
+        length = Size - at < Chunk ? (uint16_t) (Size - at) : Chunk;
+        status = FrameDecodeBand(&dec, pStream + at, length, &used);
+        at += used;
+        if (status == FRAME_BAND || status == FRAME_DONE)
+            (*pBands)++;
+    } while (status == FRAME_BAND || (status == FRAME_OK && used));
+    return status;
+}
+
+/* Every format there and back, returns the payload size of each */
+static void RoundTrip(const char *pName, uint16_t *pPayload)
+{
+    static const uint16_t Chunks[] = {1, 7, 200, FRAME_CHUNK_MAX};
+    int32_t size, status;
+    uint16_t bands;
+    uint8_t i, j;
+
+    for (i = 0; i < 4; i++)
+    {
+        size = FrameEncode(Raw, Formats[i][0], Formats[i][1], Encoded);
+        CHECK(size > FRAME_HEADER_SIZE && size <= FRAME_ENCODE_MAX, "%s format %u flags %u: %ld bytes", pName,
+              Formats[i][0], Formats[i][1], (long) size);
+        pPayload[i] = (uint16_t) (size - FRAME_HEADER_SIZE);
+
+        for (j = 0; j < sizeof(Chunks) / sizeof(Chunks[0]); j++)
+        {
+            memset(Got, 0x5A, sizeof(Got));
+            status = Decode(Encoded, size, Chunks[j]);
+            CHECK(status == FRAME_DONE && memcmp(Got, Raw, sizeof(Raw)) == 0,
+                  "%s format %u flags %u in %u-byte messages: status %ld%s", pName, Formats[i][0], Formats[i][1],
+                  Chunks[j], (long) status, memcmp(Got, Raw, sizeof(Raw)) ? ", frame differs" : "");
+
+            memset(Got, 0x5A, sizeof(Got));
+            status = DecodeBands(Encoded, size, Chunks[j], &bands);
+            CHECK(status == FRAME_DONE && memcmp(Got, Raw, sizeof(Raw)) == 0 &&
+                  bands == FRAME_ROWS / FRAME_DECODE_ROWS,
+                  "%s format %u flags %u band by band in %u-byte messages: status %ld, %u bands%s", pName,
+                  Formats[i][0], Formats[i][1], Chunks[j], (long) status, bands,
+                  memcmp(Got, Raw, sizeof(Raw)) ? ", frame differs" : "");
+        }
+    }
+    printf("%s: payload raw %u, raw+delta %u, rle %u, rle+delta %u\n", pName, pPayload[0], pPayload[1],
+           pPayload[2], pPayload[3]);
+}
+
+static void TestRun(uint8_t Value, const char *pName)
+{
+    uint16_t payload[4];
+
+    memset(Raw, Value, sizeof(Raw));
+    RoundTrip(pName, payload);
+    CHECK(payload[2] == 2 * ((FRAME_RAW_SIZE + 127) / 128), "%s: rle payload %u", pName, payload[2]);
+}
+
+static void TestRandom(void)
+{
+    uint32_t seed = 1;
+    uint16_t payload[4];
+    uint16_t i;
+
+    for (i = 0; i < FRAME_RAW_SIZE; i++)
+        Raw[i] = (uint8_t) Random(&seed);
+    RoundTrip("random", payload);
+}
+
+static void TestRows(void)
+{
+    uint32_t seed = 2;
+    uint16_t payload[4];
+    uint16_t i;
+
+    for (i = 0; i < FRAME_ROW_BYTES; i++)
+        Raw[i] = (uint8_t) Random(&seed);
+    for (; i < FRAME_RAW_SIZE; i++)
+        Raw[i] = Raw[i - FRAME_ROW_BYTES];
+    RoundTrip("rows", payload);
+    CHECK(payload[3] < 200 && payload[3] * 4 < payload[2], "rows: rle+delta %u against rle %u", payload[3],
+          payload[2]);
+}
+
+static void TestIncompressible(void)
+{
+    uint16_t payload[4];
+    uint16_t i;
+
+    for (i = 0; i < FRAME_RAW_SIZE; i++)
+        Raw[i] = (uint8_t) (i * 151 + 17);
+    RoundTrip("incompressible", payload);
+    CHECK(payload[2] == FRAME_RAW_SIZE + (FRAME_RAW_SIZE + 127) / 128, "incompressible: rle payload %u", payload[2]);
+}
+
+static void TestTruncated(void)
+{
+    FRAME_Header_t header;
+    uint32_t seed = 3;
+    int32_t size, status;
+    uint16_t bands, i;
+
+    for (i = 0; i < FRAME_RAW_SIZE; i++)
+        Raw[i] = Random(&seed) % 4 ? 0xFF : (uint8_t) Random(&seed);
+    size = FrameEncode(Raw, FRAME_FORMAT_RLE, FRAME_FLAG_ROW_DELTA, Encoded);
+
+    /* The rest may still come: not done, no error */
+    status = Decode(Encoded, size - 10, FRAME_CHUNK_MAX);
+    CHECK(status == FRAME_OK, "cut stream: status %ld", (long) status);
+    status = DecodeBands(Encoded, size - 10, FRAME_CHUNK_MAX, &bands);
+    CHECK(status == FRAME_OK && bands < FRAME_ROWS / FRAME_DECODE_ROWS, "cut stream by band: status %ld, %u bands",
+          (long) status, bands);
+
+    /* The header says the payload ends there, short of a frame */
+    FrameParseHeader(Encoded, FRAME_HEADER_SIZE, &header);
+    header.PayloadSize -= 10;
+    FrameBuildHeader(&header, Encoded);
+    status = Decode(Encoded, size - 10, FRAME_CHUNK_MAX);
+    CHECK(status == FRAME_ERROR, "short payload: status %ld", (long) status);
+    status = DecodeBands(Encoded, size - 10, FRAME_CHUNK_MAX, &bands);
+    CHECK(status == FRAME_ERROR, "short payload by band: status %ld", (long) status);
+
+    /* Bytes past the frame */
+    size = FrameEncode(Raw, FRAME_FORMAT_RAW, 0, Encoded);
+    FrameParseHeader(Encoded, FRAME_HEADER_SIZE, &header);
+    header.PayloadSize += 1;
+    FrameBuildHeader(&header, Encoded);
+    Encoded[size] = 0;
+    status = Decode(Encoded, size + 1, FRAME_CHUNK_MAX);
+    CHECK(status == FRAME_ERROR, "long payload: status %ld", (long) status);
+
+    /* Headers that are not a frame */
+    Encoded[1] = FRAME_VERSION + 1;
+    CHECK(FrameParseHeader(Encoded, FRAME_HEADER_SIZE, &header) == FRAME_ERROR, "version %u accepted", Encoded[1]);
+}
+
+/* Start message and chunks out of FrameEncodeLink(), pMessages[0] the start */
+static int32_t LinkMessages(uint8_t **ppMessages, uint16_t *pSizes)
+{
+    int32_t count = FrameEncodeLink(Raw, FRAME_FORMAT_RLE, FRAME_FLAG_ROW_DELTA, Encoded, pSizes);
+    uint8_t *at = Encoded;
+    int32_t i;
+
+    pSizes[0] = LINK_START_SIZE;
+    for (i = 0; i < count; i++)
+    {
+        ppMessages[i] = at;
+        at += pSizes[i];
+    }
+    return count;
+}
+
+static void TestCrc(void)
+{
+    uint8_t *messages[1 + LINK_MAX_CHUNKS];
+    uint16_t sizes[1 + LINK_MAX_CHUNKS];
+    LINK_Transfer_t link = {0};
+    FRAME_Decoder_t dec;
+    uint32_t seed = 4;
+    int32_t count, status, i;
+
+    for (i = 0; i < FRAME_RAW_SIZE; i++)
+        Raw[i] = (uint8_t) Random(&seed);
+    count = LinkMessages(messages, sizes);
+    CHECK(count > 3, "%ld link messages", (long) count);
+
+    /* A chunk damaged on the way is dropped, its resend goes in */
+    memset(Got, 0x5A, sizeof(Got));
+    CHECK(LinkStart(&link, messages[0], sizes[0], Sink) == FRAME_OK, "start refused");
+    messages[2][LINK_CHUNK_HEADER_SIZE + 3] ^= 0x01;
+    status = LinkChunk(&link, &dec, messages[2], sizes[2]);
+    CHECK(status == FRAME_ERROR && !(link.Received[0] & 0x02) && link.Status == LINK_STATUS_RECEIVING,
+          "damaged chunk: status %ld, link status %u", (long) status, link.Status);
+    messages[2][LINK_CHUNK_HEADER_SIZE + 3] ^= 0x01;
+    for (i = 1; i < count; i++)
+        status = LinkChunk(&link, &dec, messages[i], sizes[i]);
+    CHECK(status == FRAME_DONE && link.Status == LINK_STATUS_DONE && memcmp(Got, Raw, sizeof(Raw)) == 0,
+          "resent chunk: status %ld, link status %u", (long) status, link.Status);
+
+    /* A frame CRC that the chunks don't add up to */
+    messages[0][6] ^= 0x01;
+    CHECK(LinkStart(&link, messages[0], sizes[0], Sink) == FRAME_OK, "start refused");
+    for (i = 1; i < count; i++)
+        status = LinkChunk(&link, &dec, messages[i], sizes[i]);
+    CHECK(status == FRAME_ERROR && link.Status == LINK_STATUS_CRC_ERROR && link.Missing == link.Chunks,
+          "bad frame crc: status %ld, link status %u, %u missing", (long) status, link.Status, link.Missing);
+    printf("crc: %ld messages\n", (long) count);
+}
+
+int main(int argc, char **argv)
+{
+    const char *test = argc == 2 ? argv[1] : "";
+
+    if (strcmp(test, "white") == 0)
+        TestRun(0xFF, "white");
+    else if (strcmp(test, "black") == 0)
+        TestRun(0x00, "black");
+    else if (strcmp(test, "random") == 0)
+        TestRandom();
+    else if (strcmp(test, "rows") == 0)
+        TestRows();
+    else if (strcmp(test, "incompressible") == 0)
+        TestIncompressible();
+    else if (strcmp(test, "truncated") == 0)
+        TestTruncated();
+    else if (strcmp(test, "crc") == 0)
+        TestCrc();
+    else
+    {
+        fprintf(stderr, "usage: %s white|black|random|rows|incompressible|truncated|crc\n", argv[0]);
+        return 2;
+    }
+
+    printf("%s: %d failures\n", test, Failures);
+    return Failures != 0;
+}
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "epd_w21.h"
+#include "telemetry.h"
+#include "sim.h"
+
+/*
+ * epd-test <case>
+ *
+ * The panel driver alone on the mock transport, checked against the byte
+ * stream the controller has to see: every command with D/C low, its
+ * parameters with D/C high. Cases:
+ *   frame  EpdInitFull() and a full frame with EpdDisFull()
+ *   gray   a four level ramp with EpdDisGray(): the white refresh, one
+ *          plane and one LUT of EPD_GRAY_FRAMES per pass, and the grays
+ *          sim_panel.c models from them
+ */
+
+extern const unsigned char LUTDefault_full[31];
+
+static unsigned char Frame[EPD_FRAME_SIZE];
+static unsigned char Bands[EPD_BANDS_SIZE];
+static const unsigned char GrayFrames[EPD_GRAY_PASSES] = EPD_GRAY_FRAMES;
+static int Failures;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+                                             printf(__VA_ARGS__); printf("\n"); Failures++; } } while (0)
+
+/* Not what is under test, the driver only reports to them */
+uint32_t TelemetryNow(void)
+{
+    return 0;
+}
+
+void TelemetryStop(uint8_t Stage, uint32_t Start)
+{
+    (void) Stage;
+    (void) Start;
+}
+
+void TelemetryCount(uint8_t Counter)
+{
+    (void) Counter;
+}
+
+/* Walks the capture one command at a time */
+typedef struct
+{
+    const uint8_t *pData;
+    const uint8_t *pIsData;
+    uint32_t Length;
+    uint32_t At;
+} Capture_t;
+
+static void CaptureStart(Capture_t *pCapture)
+{
+    pCapture->Length = EpdMockGetCapture(&pCapture->pData, &pCapture->pIsData);
+    pCapture->At = 0;
+}
+
+/* The next command must be Command, with Count parameter bytes equal to pParams (NULL: any) */
+static void Expect(Capture_t *pCapture, uint8_t Command, const uint8_t *pParams, uint32_t Count)
+{
+    uint32_t at = pCapture->At;
+    uint32_t i;
+
+    if (at >= pCapture->Length)
+    {
+        CHECK(0, "command 0x%02x missing, capture ends at %lu", Command, (unsigned long) at);
+        return;
+    }
+    CHECK(!pCapture->pIsData[at], "byte %lu: expected command 0x%02x with D/C low", (unsigned long) at, Command);
+    CHECK(pCapture->pData[at] == Command, "byte %lu: command 0x%02x, expected 0x%02x", (unsigned long) at,
+          pCapture->pData[at], Command);
+
+    for (i = 0, at++; at < pCapture->Length && pCapture->pIsData[at]; i++, at++)
+    {
+        if (pParams && i < Count && pCapture->pData[at] != pParams[i])
+        {
+            CHECK(0, "command 0x%02x parameter %lu: 0x%02x, expected 0x%02x", Command, (unsigned long) i,
+                  pCapture->pData[at], pParams[i]);
+            pParams = NULL;
+        }
+    }
+    CHECK(i == Count, "command 0x%02x: %lu parameter bytes, expected %lu", Command, (unsigned long) i,
+          (unsigned long) Count);
+    pCapture->At = at;
+}
+
+/* RAM window and pointer for the whole panel, X bytes up, Y gates down from yDot - 1 */
+static void ExpectWholeWindow(Capture_t *pCapture)
+{
+    static const uint8_t AreaX[] = {0x00, (xDot - 1) / 8};
+    static const uint8_t AreaY[] = {(yDot - 1) % 256, (yDot - 1) / 256, 0x00, 0x00};
+    static const uint8_t PointerX[] = {0x00};
+    static const uint8_t PointerY[] = {(yDot - 1) % 256, (yDot - 1) / 256};
+
+    Expect(pCapture, 0x44, AreaX, sizeof(AreaX));
+    Expect(pCapture, 0x45, AreaY, sizeof(AreaY));
+    Expect(pCapture, 0x4e, PointerX, sizeof(PointerX));
+    Expect(pCapture, 0x4f, PointerY, sizeof(PointerY));
+}
+
+static void TestFrame(void)
+{
+    static const uint8_t Gdo[] = {(yDot - 1) % 256, (yDot - 1) / 256, 0x00};
+    static const uint8_t SoftStart[] = {0xd7, 0xd6, 0x9d};
+    static const uint8_t DummyLine[] = {0x1a};
+    static const uint8_t GateTime[] = {0x08};
+    static const uint8_t EntryMode[] = {0x01};
+    static const uint8_t PowerOn[] = {0xc0};
+    static const uint8_t FullUpdate[] = {0xc7};
+    const EPD_MockStats_t *stats = EpdMockGetStats();
+    Capture_t capture;
+    uint32_t i;
+
+    for (i = 0; i < EPD_FRAME_SIZE; i++)
+        Frame[i] = (uint8_t) (i * 7 + i / EPD_ROW_BYTES);
+
+    EpdMockReset(1000, 2000, 300);
+    EpdInitFull();
+    EpdDisFull(Frame, 1);
+    EpdProcess();
+
+    CaptureStart(&capture);
+    Expect(&capture, 0x01, Gdo, sizeof(Gdo));
+    Expect(&capture, 0x0c, SoftStart, sizeof(SoftStart));
+    Expect(&capture, 0x3a, DummyLine, sizeof(DummyLine));
+    Expect(&capture, 0x3b, GateTime, sizeof(GateTime));
+    Expect(&capture, 0x11, EntryMode, sizeof(EntryMode));
+    ExpectWholeWindow(&capture);
+    Expect(&capture, 0x32, LUTDefault_full + 1, sizeof(LUTDefault_full) - 1);
+    Expect(&capture, 0x22, PowerOn, sizeof(PowerOn));
+    Expect(&capture, 0x20, NULL, 0);
+
+    /* The full LUT is still loaded, the frame goes straight to RAM */
+    ExpectWholeWindow(&capture);
+    Expect(&capture, 0x24, Frame, EPD_FRAME_SIZE);
+    Expect(&capture, 0x22, FullUpdate, sizeof(FullUpdate));
+    Expect(&capture, 0x20, NULL, 0);
+    Expect(&capture, 0xff, NULL, 0);
+    CHECK(capture.At == capture.Length, "%lu bytes after the update", (unsigned long) (capture.Length - capture.At));
+
+    CHECK(stats->Resets == 1, "%lu resets", (unsigned long) stats->Resets);
+    CHECK(stats->FullRefreshes == 1 && stats->PartRefreshes == 0, "%lu full %lu partial refreshes",
+          (unsigned long) stats->FullRefreshes, (unsigned long) stats->PartRefreshes);
+    CHECK(EpdIsBusy(), "refresh finished before BUSY dropped");
+    CHECK(stats->BusyBytes == 0, "%lu bytes sent while BUSY", (unsigned long) stats->BusyBytes);
+    printf("frame: %lu bytes, %lu commands, %lu transactions\n", (unsigned long) stats->Bytes,
+           (unsigned long) stats->Commands, (unsigned long) stats->Transactions);
+}
+
+/* Level of a ramp pixel: four columns 0 black .. 3 white, left to right */
+#define RAMP_LEVEL(x)   ((x) * 4 / xDot)
+#define GRAY_LUT_SIZE   30
+
+static void RampPlanes(unsigned char *pHigh, unsigned char *pLow)
+{
+    unsigned int x;
+
+    memset(pHigh, 0, EPD_ROW_BYTES);
+    memset(pLow, 0, EPD_ROW_BYTES);
+    for (x = 0; x < xDot; x++)
+    {
+        if (RAMP_LEVEL(x) & 2)
+            pHigh[x / 8] |= 0x80 >> (x % 8);
+        if (RAMP_LEVEL(x) & 1)
+            pLow[x / 8] |= 0x80 >> (x % 8);
+    }
+}
+
+static unsigned int RampBand(unsigned char Pass, unsigned int Row, unsigned char *pBand, unsigned int Rows)
+{
+    unsigned char high[EPD_ROW_BYTES], low[EPD_ROW_BYTES];
+    unsigned int i;
+
+    if (Rows > yDot - Row)
+        Rows = yDot - Row;
+    RampPlanes(high, low);
+    for (i = 0; i < Rows; i++)
+        EpdGrayPlane(Pass, high, low, pBand + i * EPD_ROW_BYTES);
+    return Rows;
+}
+
+/* VSL frames the LUT drives a pixel written 0 for; one written 1 must only float */
+static unsigned int GrayLutFrames(const uint8_t *pLut)
+{
+    unsigned int phase, frames = 0;
+    uint8_t vs, count;
+
+    for (phase = 0; phase < 20; phase++)
+    {
+        vs = pLut[phase];
+        count = (pLut[20 + phase / 2] >> (phase % 2 ? 4 : 0)) & 0x0F;
+        if (!count)
+            continue;
+        CHECK(((vs >> 4) & 3) == 0 && (vs & 3) == 0, "phase %u drives pixels written 1, VS 0x%02x", phase, vs);
+        if (((vs >> 6) & 3) == 2 && ((vs >> 2) & 3) == 2)
+            frames += count;
+        else
+            CHECK(((vs >> 6) & 3) == 0 && ((vs >> 2) & 3) == 0, "phase %u VS 0x%02x, not VSL", phase, vs);
+    }
+    return frames;
+}
+
+static void TestGray(void)
+{
+    static const uint8_t PowerOn[] = {0xc0};
+    static const uint8_t FullUpdate[] = {0xc7};
+    static const uint8_t PartUpdate[] = {0x04};
+    const EPD_MockStats_t *stats = EpdMockGetStats();
+    unsigned char high[EPD_ROW_BYTES], low[EPD_ROW_BYTES], row[EPD_ROW_BYTES];
+    uint32_t sum[4] = {0}, count[4] = {0}, mean[4], expected;
+    uint32_t frames[4] = {0, 0, 0, 0};
+    Capture_t capture;
+    uint32_t start;
+    unsigned int pass, y, x;
+
+    EpdMockReset(1000, 2000, 300);
+    SimPanelInit();
+    EpdInitFull();
+    CaptureStart(&capture);
+    start = capture.Length;
+
+    CHECK(EpdDisGray(RampBand, Bands), "EpdDisGray() gave up");
+    EpdProcess();
+
+    /* After the init TestFrame() checks: white, then the analog part on again for the passes */
+    CaptureStart(&capture);
+    capture.At = start;
+    ExpectWholeWindow(&capture);
+    memset(Frame, 0xff, EPD_FRAME_SIZE);
+    Expect(&capture, 0x24, Frame, EPD_FRAME_SIZE);
+    Expect(&capture, 0x22, FullUpdate, sizeof(FullUpdate));
+    Expect(&capture, 0x20, NULL, 0);
+    Expect(&capture, 0xff, NULL, 0);
+    Expect(&capture, 0x22, PowerOn, sizeof(PowerOn));
+    Expect(&capture, 0x20, NULL, 0);
+
+    RampPlanes(high, low);
+    for (pass = 0; pass < EPD_GRAY_PASSES; pass++)
+    {
+        EpdGrayPlane(pass, high, low, row);
+        for (y = 0; y < yDot; y++)
+            memcpy(Frame + y * EPD_ROW_BYTES, row, EPD_ROW_BYTES);
+
+        ExpectWholeWindow(&capture);
+        Expect(&capture, 0x24, Frame, EPD_FRAME_SIZE);
+        if (capture.At < capture.Length && capture.pData[capture.At] == 0x32)
+        {
+            CHECK(capture.Length - capture.At > GRAY_LUT_SIZE, "pass %u LUT cut short", pass);
+            frames[pass] = GrayLutFrames(capture.pData + capture.At + 1);
+        }
+        Expect(&capture, 0x32, NULL, GRAY_LUT_SIZE);
+        CHECK(frames[pass] == GrayFrames[pass], "pass %u drives %lu frames, expected %u", pass,
+              (unsigned long) frames[pass], GrayFrames[pass]);
+        Expect(&capture, 0x22, PartUpdate, sizeof(PartUpdate));
+        Expect(&capture, 0x20, NULL, 0);
+        Expect(&capture, 0xff, NULL, 0);
+    }
+    CHECK(capture.At == capture.Length, "%lu bytes after the last pass", (unsigned long) (capture.Length - capture.At));
+    CHECK(stats->FullRefreshes == 1 && stats->PartRefreshes == EPD_GRAY_PASSES, "%lu full %lu partial refreshes",
+          (unsigned long) stats->FullRefreshes, (unsigned long) stats->PartRefreshes);
+    CHECK(stats->BusyBytes == 0, "%lu bytes sent while BUSY", (unsigned long) stats->BusyBytes);
+
+    /* Level 3 stays white, each other one is darkened by the passes it takes part in */
+    for (y = 0; y < yDot; y++)
+    {
+        for (x = 0; x < xDot; x++)
+        {
+            sum[RAMP_LEVEL(x)] += SimPanelPixel(y, x);
+            count[RAMP_LEVEL(x)]++;
+        }
+    }
+    for (x = 0; x < 4; x++)
+        mean[x] = sum[x] / count[x];
+
+    frames[3] = 0;
+    frames[2] = GrayFrames[1];
+    frames[1] = GrayFrames[0];
+    frames[0] = GrayFrames[0] + GrayFrames[1] + GrayFrames[2];
+    for (x = 0; x < 4; x++)
+    {
+        expected = (uint32_t) (mean[3] * pow(1 - SIM_PANEL_RATE, frames[x]) + 0.5);
+        CHECK(mean[x] + 1 >= expected && mean[x] <= expected + 1, "level %u: %lu, expected %lu after %lu frames", x,
+              (unsigned long) mean[x], (unsigned long) expected, (unsigned long) frames[x]);
+        CHECK(x == 0 || mean[x] > mean[x - 1], "level %u not lighter than level %u", x, x - 1);
+    }
+    CHECK(mean[3] > 240, "white refresh left %lu", (unsigned long) mean[3]);
+
+    printf("gray: 0=%lu 1=%lu 2=%lu 3=%lu, passes of %u %u %u frames\n", (unsigned long) mean[0],
+           (unsigned long) mean[1], (unsigned long) mean[2], (unsigned long) mean[3], GrayFrames[0], GrayFrames[1],
+           GrayFrames[2]);
+}
+
+int main(int argc, char **argv)
+{
+    EpdSetTransport(&EpdMockIO);
+
+    if (argc == 2 && strcmp(argv[1], "frame") == 0)
+        TestFrame();
+    else if (argc == 2 && strcmp(argv[1], "gray") == 0)
+        TestGray();
+    else
+    {
+        fprintf(stderr, "usage: %s frame|gray\n", argv[0]);
+        return 2;
+    }
+
+    printf("%s: %d failures\n", argv[1], Failures);
+    return Failures != 0;
+}
@@ -0,0 +1,49 @@
+# cmake -P expect.cmake -- <command> [args...] [STATUS <code>] [EXPECT <regex>...] [REJECT <regex>...]
+#
+# Runs the command and fails unless it exits with the code (0 by default),
+# every EXPECT regex matches its output and no REJECT regex does. The
+# output is printed either way, ctest shows it for a failing test.
+
+cmake_minimum_required(VERSION 3.7)
+
+set(command)
+set(expect)
+set(reject)
+set(status 0)
+set(mode command)
+
+math(EXPR last "${CMAKE_ARGC} - 1")
+set(started FALSE)
+foreach (i RANGE 1 ${last})
+    set(arg "${CMAKE_ARGV${i}}")
+    if (NOT started)
+        if (arg STREQUAL "--")
+            set(started TRUE)
+        endif ()
+    elseif (arg STREQUAL "STATUS" OR arg STREQUAL "EXPECT" OR arg STREQUAL "REJECT")
+        string(TOLOWER ${arg} mode)
+    elseif (mode STREQUAL "command")
+        list(APPEND command "${arg}")
+    elseif (mode STREQUAL "status")
+        set(status ${arg})
+    else ()
+        list(APPEND ${mode} "${arg}")
+    endif ()
+endforeach ()
+
+execute_process(COMMAND ${command} RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+message("${output}")
+
+if (NOT "${result}" STREQUAL "${status}")
+    message(FATAL_ERROR "exit status ${result}, expected ${status}")
+endif ()
+foreach (re IN LISTS expect)
+    if (NOT output MATCHES "${re}")
+        message(FATAL_ERROR "no match for: ${re}")
+    endif ()
+endforeach ()
+foreach (re IN LISTS reject)
+    if (output MATCHES "${re}")
+        message(FATAL_ERROR "unexpected match for: ${re}")
+    endif ()
+endforeach ()
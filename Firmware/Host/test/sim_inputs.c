@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include "frame_codec.h"
+
+#define FW_OLD_SIZE     12000
+#define FW_INSERT_AT    4000
+#define FW_INSERT_SIZE  300
+
+/*
+ * sim-inputs [dir]
+ * sim-inputs -c <messages.bin> <out.bin>
+ *
+ * Writes the frames the host-sim tests send, so they are the same on
+ * every machine:
+ *   card.bin   a card layout, white with a black border, a title bar
+ *              and text-like lines,
+ *   card2.bin  the same with one line changed, for a partial refresh
+ *              and a small delta,
+ *   ramp.bin   a 2bpp image, the four levels in vertical bands,
+ *   noise.bin  random pixels, which don't compress: a full mailbox
+ *              message for every FRAME_CHUNK_MAX bytes of the frame,
+ *   fw_old.bin a firmware image, and fw_new.bin the next build of it:
+ *              code inserted, a few constants changed, the rest moved,
+ *   header.bin a v1 stream whose last message, cut at FRAME_CHUNK_MAX,
+ *              is 8 literal bytes that read as a frame header.
+ *
+ * With -c a message file (link-encode -l, fw-patch) is copied with one
+ * bit of its second message flipped, as a transfer corrupted on the way.
+ */
+
+static uint8_t Card[FRAME_RAW_SIZE];
+static uint8_t Card2[FRAME_RAW_SIZE];
+static uint8_t Ramp[FRAME_GRAY_SIZE];
+static uint8_t Noise[FRAME_RAW_SIZE];
+static uint8_t FwOld[FW_OLD_SIZE];
+static uint8_t FwNew[FW_OLD_SIZE + FW_INSERT_SIZE];
+static uint8_t Messages[0x20000];
+static uint8_t Stream[2 * FRAME_CHUNK_MAX];
+
+/* A set bit is a white pixel */
+static void Fill(uint8_t *pFrame, uint16_t X0, uint16_t Y0, uint16_t X1, uint16_t Y1, uint8_t White)
+{
+    uint16_t x, y;
+
+    for (y = Y0; y < Y1; y++)
+    {
+        for (x = X0; x < X1; x++)
+        {
+            if (White)
+                pFrame[y * FRAME_ROW_BYTES + x / 8] |= 0x80 >> (x % 8);
+            else
+                pFrame[y * FRAME_ROW_BYTES + x / 8] &= ~(0x80 >> (x % 8));
+        }
+    }
+}
+
+static uint32_t Random(uint32_t *pSeed)
+{
+    *pSeed = *pSeed * 1103515245u + 12345u;
+    return *pSeed >> 16;
+}
+
+/* Words of a line of text, as blocks a glyph high */
+static void Line(uint8_t *pFrame, uint16_t Y, uint32_t Seed)
+{
+    uint16_t x = 12, width;
+
+    while (x < FRAME_ROW_BYTES * 8 - 24)
+    {
+        width = 8 + Random(&Seed) % 40;
+        if (x + width > FRAME_ROW_BYTES * 8 - 12)
+            break;
+        Fill(pFrame, x, Y, x + width, Y + 8, 0);
+        x += width + 6;
+    }
+}
+
+static int WritePath(const char *pPath, const uint8_t *pData, size_t Size)
+{
+    FILE *f = fopen(pPath, "wb");
+
+    if (f == NULL || fwrite(pData, 1, Size, f) != Size)
+    {
+        fprintf(stderr, "%s: write failed\n", pPath);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int WriteFile(const char *pDir, const char *pName, const uint8_t *pData, size_t Size)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", pDir, pName);
+    return WritePath(path, pData, Size);
+}
+
+static int Corrupt(const char *pIn, const char *pOut)
+{
+    FILE *f = fopen(pIn, "rb");
+    size_t size = f == NULL ? 0 : fread(Messages, 1, sizeof(Messages), f);
+    size_t second;
+
+    if (f != NULL)
+        fclose(f);
+    second = 1 + Messages[0] + 1;
+    if (size == 0 || second >= size || second + 1 + Messages[second] + 1 > size)
+    {
+        fprintf(stderr, "%s: expected a message file of two messages or more\n", pIn);
+        return 1;
+    }
+    Messages[second + 1 + (Messages[second] + 1) / 2] ^= 0x10;
+    return WritePath(pOut, Messages, size);
+}
+
+/*
+ * White, then 128 literal bytes ending in a header. No-op control bytes
+ * up front pad the payload to FRAME_CHUNK_MAX + 8.
+ */
+static uint16_t HeaderStream(uint8_t *pOut)
+{
+    static const uint8_t Lookalike[8] = {FRAME_MAGIC, FRAME_VERSION, FRAME_FORMAT_RAW, 0,
+                                         FRAME_RAW_SIZE & 0xFF, FRAME_RAW_SIZE >> 8,
+                                         FRAME_RAW_SIZE & 0xFF, FRAME_RAW_SIZE >> 8};
+    FRAME_Header_t header = {FRAME_FORMAT_RLE, 0, FRAME_CHUNK_MAX + 8, FRAME_RAW_SIZE};
+    uint16_t runs = (FRAME_RAW_SIZE - 128 + 127) / 128;
+    uint16_t out = FRAME_HEADER_SIZE;
+    uint16_t raw = 0;
+    uint16_t i;
+
+    for (i = 0; i < header.PayloadSize - 2 * runs - 1 - 128; i++)
+        pOut[out++] = 0x80;
+    while (raw < FRAME_RAW_SIZE - 128)
+    {
+        i = FRAME_RAW_SIZE - 128 - raw < 128 ? FRAME_RAW_SIZE - 128 - raw : 128;
+        pOut[out++] = (uint8_t) (257 - i);
+        pOut[out++] = 0xFF;
+        raw += i;
+    }
+    pOut[out++] = 127;
+    for (i = 0; i < 120; i++)
+        pOut[out++] = (uint8_t) (i * 151 + 17);
+    memcpy(pOut + out, Lookalike, sizeof(Lookalike));
+    out += sizeof(Lookalike);
+
+    FrameBuildHeader(&header, pOut);
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : ".";
+    uint32_t seed = 1;
+    uint16_t y, level;
+    uint32_t i;
+
+    if (argc == 4 && strcmp(argv[1], "-c") == 0)
+        return Corrupt(argv[2], argv[3]);
+
+    memset(Card, 0xFF, sizeof(Card));
+    Fill(Card, 0, 0, 200, 4, 0);
+    Fill(Card, 0, 196, 200, 200, 0);
+    Fill(Card, 0, 0, 4, 200, 0);
+    Fill(Card, 196, 0, 200, 200, 0);
+    Fill(Card, 4, 4, 196, 40, 0);
+    for (y = 56; y < 180; y += 16)
+        Line(Card, y, y);
+
+    memcpy(Card2, Card, sizeof(Card2));
+    Fill(Card2, 4, 120, 196, 128, 1);
+    Line(Card2, 120, 7);
+
+    /* High plane then low plane, level 0 black .. 3 white */
+    for (level = 0; level < 4; level++)
+    {
+        Fill(Ramp, level * 50, 0, level * 50 + 50, FRAME_ROWS, level & 2);
+        Fill(Ramp + FRAME_RAW_SIZE, level * 50, 0, level * 50 + 50, FRAME_ROWS, level & 1);
+    }
+
+    for (i = 0; i < FW_OLD_SIZE; i++)
+        FwOld[i] = (uint8_t) Random(&seed);
+    memcpy(FwNew, FwOld, FW_INSERT_AT);
+    for (i = 0; i < FW_INSERT_SIZE; i++)
+        FwNew[FW_INSERT_AT + i] = (uint8_t) Random(&seed);
+    memcpy(FwNew + FW_INSERT_AT + FW_INSERT_SIZE, FwOld + FW_INSERT_AT, FW_OLD_SIZE - FW_INSERT_AT);
+    for (i = 0; i < 8; i++)
+        FwNew[1000 + i * 1400] ^= 0x5A;
+
+    for (i = 0; i < FRAME_RAW_SIZE; i++)
+        Noise[i] = (uint8_t) Random(&seed);
+
+    return WriteFile(dir, "card.bin", Card, sizeof(Card)) || WriteFile(dir, "card2.bin", Card2, sizeof(Card2))
+           || WriteFile(dir, "ramp.bin", Ramp, sizeof(Ramp)) || WriteFile(dir, "noise.bin", Noise, sizeof(Noise))
+           || WriteFile(dir, "fw_old.bin", FwOld, sizeof(FwOld))
+           || WriteFile(dir, "fw_new.bin", FwNew, sizeof(FwNew))
+           || WriteFile(dir, "header.bin", Stream, HeaderStream(Stream));
+}
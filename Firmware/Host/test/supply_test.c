@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <string.h>
+#include "supply.h"
+#include "power.h"
+#include "epd_w21.h"
+#include "telemetry.h"
+#include "nfc04a1_nfctag.h"
+
+/*
+ * supply-test <case>
+ *
+ * The energy governor (Src/supply.c) replaying a supply trace: VDD and
+ * the field as the harvester would give them over time, the governor's
+ * naps the only thing moving the clock. The panel driver runs on the
+ * mock transport with the governor's EpdSupplyWait(), so a refresh is
+ * seen at the moment it reaches the panel. Cases:
+ *   steady    a battery-like 3 V: nothing ever waits
+ *   harvest   2.0 V charging up slowly: the full refresh waits for
+ *             SUPPLY_FULL_MV, the partial one after it doesn't
+ *   brownout  a dip to 2.1 V: the mailbox is held from SUPPLY_LOW_MV
+ *             down until SUPPLY_RESUME_MV up, a full refresh started in
+ *             the dip waits for the reserve
+ *   nofield   2.0 V and no field: nothing recharges, nothing waits
+ *   stuck     a field that never brings enough: SUPPLY_WAIT_MS and on
+ */
+
+typedef struct
+{
+    uint32_t Ms;
+    uint16_t Mv;
+    uint8_t Field;
+} TRACE_Point_t;
+
+static const TRACE_Point_t Steady[] = {{0, 3000, 1}};
+static const TRACE_Point_t Harvest[] = {{0, 2000, 1}, {3000, 3000, 1}};
+static const TRACE_Point_t Brownout[] = {{0, 3000, 1}, {1000, 3000, 1}, {1100, 2100, 1}, {1400, 2100, 1},
+                                         {2400, 3000, 1}};
+static const TRACE_Point_t NoField[] = {{0, 2000, 0}};
+static const TRACE_Point_t Stuck[] = {{0, 2400, 1}};
+
+static const TRACE_Point_t *Trace;
+static uint8_t TracePoints;
+static uint32_t Now;
+
+static unsigned char Frame[EPD_FRAME_SIZE];
+static int Failures;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+                                             printf(__VA_ARGS__); printf("\n"); Failures++; } } while (0)
+
+#define TRACE_START(points) (Trace = points, TracePoints = sizeof(points) / sizeof(points[0]), Now = 0)
+
+/* The last point at or before Now, and the next one if there is one */
+static const TRACE_Point_t *TraceAt(const TRACE_Point_t **ppNext)
+{
+    uint8_t i = 0;
+
+    while (i + 1 < TracePoints && Trace[i + 1].Ms <= Now)
+        i++;
+    *ppNext = i + 1 < TracePoints ? &Trace[i + 1] : NULL;
+    return &Trace[i];
+}
+
+/* VDD in a straight line from one point to the next, flat after the last */
+static uint16_t TraceMv(void)
+{
+    const TRACE_Point_t *next;
+    const TRACE_Point_t *at = TraceAt(&next);
+
+    if (next == NULL)
+        return at->Mv;
+    return (uint16_t) (at->Mv + ((int32_t) next->Mv - at->Mv) * (int32_t) (Now - at->Ms) /
+                                (int32_t) (next->Ms - at->Ms));
+}
+
+/* What the governor reads and waits with */
+uint32_t HAL_GetTick(void)
+{
+    return Now;
+}
+
+uint16_t PowerGetVddMv(void)
+{
+    return TraceMv();
+}
+
+void PowerNap(uint32_t Ms)
+{
+    Now += Ms;
+}
+
+int32_t NFC04A1_NFCTAG_ReadEHCtrl_Dyn(uint32_t Instance, ST25DV_EH_CTRL * const pEH_CTRL)
+{
+    const TRACE_Point_t *next;
+
+    UNUSED(Instance);
+    memset(pEH_CTRL, 0, sizeof(*pEH_CTRL));
+    pEH_CTRL->Field_on = TraceAt(&next)->Field ? ST25DV_ENABLE : ST25DV_DISABLE;
+    pEH_CTRL->EH_on = pEH_CTRL->Field_on;
+    return NFCTAG_OK;
+}
+
+/* Not what is under test, the driver only reports to them */
+uint32_t TelemetryNow(void)
+{
+    return 0;
+}
+
+void TelemetryStop(uint8_t Stage, uint32_t Start)
+{
+    (void) Stage;
+    (void) Start;
+}
+
+void TelemetryCount(uint8_t Counter)
+{
+    (void) Counter;
+}
+
+/* Each activation that shows something: when, on what VDD, full or partial */
+typedef struct
+{
+    uint32_t Ms;
+    uint16_t Mv;
+    uint8_t Full;
+} REFRESH_t;
+
+static REFRESH_t Refreshes[4];
+static uint8_t RefreshCount;
+
+static void Observe(uint8_t IsData, uint8_t Value)
+{
+    static uint8_t command, sequence;
+
+    if (IsData)
+    {
+        if (command == 0x22)
+            sequence = Value;
+        return;
+    }
+    command = Value;
+    if (Value == 0x20 && (sequence & 0x04) && RefreshCount < sizeof(Refreshes) / sizeof(Refreshes[0]))
+        Refreshes[RefreshCount++] = (REFRESH_t) {Now, TraceMv(), sequence != 0x04};
+}
+
+static void PanelStart(void)
+{
+    memset(Frame, 0xAA, sizeof(Frame));
+    RefreshCount = 0;
+    EpdMockReset(0, 2000, 300);
+    EpdMockSetObserver(Observe);
+    EpdInitFull();
+}
+
+/* A full refresh then a partial one, the governor deciding when each starts */
+static void PanelRefresh(void)
+{
+    EpdDisFull(Frame, 1);
+    EpdDisPart(0, 63, 0, 15, Frame, 0);
+    CHECK(RefreshCount == 2 && Refreshes[0].Full && !Refreshes[1].Full, "%u refreshes, expected full then partial",
+          RefreshCount);
+    CHECK(EpdMockGetStats()->BusyBytes == 0, "%lu bytes sent while BUSY", (unsigned long) EpdMockGetStats()->BusyBytes);
+}
+
+static void TestSteady(void)
+{
+    TRACE_START(Steady);
+    SupplyInit();
+    CHECK(SupplyLevel() == SUPPLY_LEVEL_OK, "level %u on 3 V", SupplyLevel());
+    CHECK(SupplyAllows(SUPPLY_FULL_MV), "timer work held on 3 V");
+    CHECK(SupplyWaitFor(SUPPLY_FULL_MV) == 0, "waited for a reserve that was there");
+
+    PanelStart();
+    PanelRefresh();
+    CHECK(Now == 0, "refreshes held for %lu ms", (unsigned long) Now);
+    printf("steady: full at %lu ms on %u mV\n", (unsigned long) Refreshes[0].Ms, Refreshes[0].Mv);
+}
+
+static void TestHarvest(void)
+{
+    TRACE_START(Harvest);
+    SupplyInit();
+    CHECK(SupplyLevel() == SUPPLY_LEVEL_LOW, "level %u on 2.0 V", SupplyLevel());
+    CHECK(SupplyAllows(SUPPLY_FULL_MV), "timer work held with the field there to bring the reserve");
+
+    PanelStart();
+    PanelRefresh();
+    /* 1 mV every 3 ms, SUPPLY_FULL_MV at 2700 ms, seen at the next sample */
+    CHECK(Refreshes[0].Mv >= SUPPLY_FULL_MV, "full refresh on %u mV", Refreshes[0].Mv);
+    CHECK(Refreshes[0].Ms >= 2700 && Refreshes[0].Ms <= 2700 + SUPPLY_NAP_MS, "full refresh at %lu ms",
+          (unsigned long) Refreshes[0].Ms);
+    CHECK(Refreshes[1].Ms == Refreshes[0].Ms, "partial refresh held %lu ms on %u mV",
+          (unsigned long) (Refreshes[1].Ms - Refreshes[0].Ms), Refreshes[1].Mv);
+    printf("harvest: full at %lu ms on %u mV, partial at %lu ms\n", (unsigned long) Refreshes[0].Ms,
+           Refreshes[0].Mv, (unsigned long) Refreshes[1].Ms);
+}
+
+static void TestBrownout(void)
+{
+    uint32_t low = 0, ok = 0, waited;
+    uint8_t level, episodes = 0;
+
+    TRACE_START(Brownout);
+    SupplyInit();
+
+    /* The main loop's polling, every 10 ms: one LOW episode, with the hysteresis */
+    level = SupplyLevel();
+    for (Now = 0; Now <= 3000; Now += 10)
+    {
+        SupplyUpdate();
+        if (SupplyLevel() != level)
+        {
+            level = SupplyLevel();
+            if (level == SUPPLY_LEVEL_LOW)
+            {
+                low = Now;
+                episodes++;
+            } else
+                ok = Now;
+        }
+    }
+    /* Under 2200 mV from 1089 ms, back over 2500 mV from 1845 ms */
+    CHECK(episodes == 1, "%u low episodes", episodes);
+    CHECK(low >= 1089 && low <= 1089 + SUPPLY_POLL_MS + 10, "low from %lu ms", (unsigned long) low);
+    CHECK(ok >= 1845 && ok <= 1845 + SUPPLY_POLL_MS + 10, "ok again from %lu ms", (unsigned long) ok);
+
+    /* MailboxSupply() in the dip: no message taken until SUPPLY_RESUME_MV */
+    Now = 1200;
+    waited = SupplyWaitFor(SUPPLY_RESUME_MV);
+    CHECK(SupplyGetMv() >= SUPPLY_RESUME_MV, "mailbox resumed on %u mV", SupplyGetMv());
+    CHECK(Now >= 1845 && Now <= 1845 + SUPPLY_NAP_MS, "mailbox resumed at %lu ms after %lu ms",
+          (unsigned long) Now, (unsigned long) waited);
+    CHECK(SupplyLevel() == SUPPLY_LEVEL_OK, "level %u after the wait", SupplyLevel());
+
+    /* A full refresh started in the dip waits for the reserve, 2289 ms */
+    Now = 1200;
+    PanelStart();
+    PanelRefresh();
+    CHECK(Refreshes[0].Mv >= SUPPLY_FULL_MV, "full refresh on %u mV", Refreshes[0].Mv);
+    CHECK(Refreshes[0].Ms >= 2289 && Refreshes[0].Ms <= 2289 + SUPPLY_NAP_MS, "full refresh at %lu ms",
+          (unsigned long) Refreshes[0].Ms);
+    printf("brownout: low %lu..%lu ms, mailbox back at %lu ms, full at %lu ms on %u mV\n", (unsigned long) low,
+           (unsigned long) ok, (unsigned long) (1200 + waited), (unsigned long) Refreshes[0].Ms, Refreshes[0].Mv);
+}
+
+static void TestNoField(void)
+{
+    TRACE_START(NoField);
+    SupplyInit();
+    CHECK(!SupplyAllows(SUPPLY_FULL_MV), "timer work allowed on 2.0 V without a field");
+
+    PanelStart();
+    PanelRefresh();
+    CHECK(Now == 0, "waited %lu ms for a field that isn't there", (unsigned long) Now);
+    printf("nofield: full at %lu ms on %u mV\n", (unsigned long) Refreshes[0].Ms, Refreshes[0].Mv);
+}
+
+static void TestStuck(void)
+{
+    uint32_t waited;
+
+    TRACE_START(Stuck);
+    SupplyInit();
+    waited = SupplyWaitFor(SUPPLY_FULL_MV);
+    CHECK(waited >= SUPPLY_WAIT_MS && waited < SUPPLY_WAIT_MS + SUPPLY_NAP_MS, "gave up after %lu ms",
+          (unsigned long) waited);
+    printf("stuck: gave up after %lu ms on %u mV\n", (unsigned long) waited, SupplyGetMv());
+}
+
+int main(int argc, char **argv)
+{
+    const char *test = argc == 2 ? argv[1] : "";
+
+#if !SUPPLY_GOVERNOR
+    /* Refreshes don't wait for anything, there is no policy to check */
+    printf("%s: built without SUPPLY_GOVERNOR, skipped\n", test);
+    return 77;
+#endif
+    EpdSetTransport(&EpdMockIO);
+
+    if (strcmp(test, "steady") == 0)
+        TestSteady();
+    else if (strcmp(test, "harvest") == 0)
+        TestHarvest();
+    else if (strcmp(test, "brownout") == 0)
+        TestBrownout();
+    else if (strcmp(test, "nofield") == 0)
+        TestNoField();
+    else if (strcmp(test, "stuck") == 0)
+        TestStuck();
+    else
+    {
+        fprintf(stderr, "usage: %s steady|harvest|brownout|nofield|stuck\n", argv[0]);
+        return 2;
+    }
+
+    printf("%s: %d failures\n", test, Failures);
+    return Failures != 0;
+}